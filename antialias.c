@@ -0,0 +1,237 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "gl-util.h"
+#include "gpu-resources.h"
+#include "antialias.h"
+#include "gl-capture.h"
+
+static const char *const MODE_NAMES[ANTIALIAS_MODE_COUNT] = { "off", "fxaa", "msaa" };
+
+/* one triangle that covers the viewport, clipped to it */
+static const GLfloat QUAD_POSITIONS[] = {
+    -1.0f, -1.0f,
+     3.0f, -1.0f,
+    -1.0f,  3.0f
+};
+
+const char *antialias_mode_name(enum antialias_mode mode)
+{
+    return MODE_NAMES[mode];
+}
+
+enum antialias_mode parse_antialias_mode(const char *name)
+{
+    int mode;
+
+    for (mode = 0; mode < ANTIALIAS_MODE_COUNT; ++mode)
+        if (strcmp(name, MODE_NAMES[mode]) == 0)
+            break;
+    return (enum antialias_mode)mode;
+}
+
+int msaa_supported(void)
+{
+    return GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+}
+
+void init_antialias(struct antialias *out_antialias, enum antialias_mode mode)
+{
+    memset(out_antialias, 0, sizeof(struct antialias));
+    out_antialias->mode = mode;
+}
+
+static void delete_msaa_target(struct antialias *antialias)
+{
+    untrack_gpu_resource(GPU_FRAMEBUFFER, antialias->msaa.framebuffer);
+    untrack_gpu_resource(GPU_RENDERBUFFER, antialias->msaa.color_renderbuffer);
+    untrack_gpu_resource(GPU_RENDERBUFFER, antialias->msaa.depth_renderbuffer);
+    glDeleteFramebuffers(1, &antialias->msaa.framebuffer);
+    glDeleteRenderbuffers(1, &antialias->msaa.color_renderbuffer);
+    glDeleteRenderbuffers(1, &antialias->msaa.depth_renderbuffer);
+    antialias->msaa.framebuffer = 0;
+    antialias->msaa.color_renderbuffer = antialias->msaa.depth_renderbuffer = 0;
+    antialias->msaa.size[0] = antialias->msaa.size[1] = 0;
+}
+
+void delete_antialias(struct antialias *antialias)
+{
+    if (antialias->msaa.framebuffer)
+        delete_msaa_target(antialias);
+    if (antialias->fxaa_ready) {
+        untrack_gpu_resource(GPU_PROGRAM, antialias->fxaa.program);
+        untrack_gpu_resource(GPU_SHADER, antialias->fxaa.vertex_shader);
+        untrack_gpu_resource(GPU_SHADER, antialias->fxaa.fragment_shader);
+        untrack_gpu_resource(GPU_BUFFER, antialias->quad_buffer);
+        glDeleteProgram(antialias->fxaa.program);
+        glDeleteShader(antialias->fxaa.vertex_shader);
+        glDeleteShader(antialias->fxaa.fragment_shader);
+        glDeleteBuffers(1, &antialias->quad_buffer);
+    }
+    init_antialias(antialias, ANTIALIAS_OFF);
+}
+
+static int make_fxaa(struct antialias *antialias)
+{
+    antialias->fxaa.vertex_shader = make_shader(GL_VERTEX_SHADER, "fxaa.v.glsl");
+    if (antialias->fxaa.vertex_shader == 0)
+        return 0;
+    antialias->fxaa.fragment_shader = make_shader(GL_FRAGMENT_SHADER, "fxaa.f.glsl");
+    if (antialias->fxaa.fragment_shader == 0)
+        return 0;
+
+    antialias->fxaa.program
+        = make_program(antialias->fxaa.vertex_shader, antialias->fxaa.fragment_shader);
+    if (antialias->fxaa.program == 0)
+        return 0;
+
+    antialias->fxaa.texture = glGetUniformLocation(antialias->fxaa.program, "texture");
+    antialias->fxaa.texel = glGetUniformLocation(antialias->fxaa.program, "texel");
+    antialias->fxaa.position = glGetAttribLocation(antialias->fxaa.program, "position");
+
+    glGenBuffers(1, &antialias->quad_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, antialias->quad_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(QUAD_POSITIONS), QUAD_POSITIONS, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    track_gpu_resource(GPU_BUFFER, antialias->quad_buffer, sizeof(QUAD_POSITIONS), "fxaa");
+
+    antialias->fxaa_ready = 1;
+    return 1;
+}
+
+int set_antialias_mode(struct antialias *antialias, enum antialias_mode mode, int samples)
+{
+    if (mode == ANTIALIAS_FXAA && !antialias->fxaa_ready && !make_fxaa(antialias)) {
+        fprintf(stderr, "FXAA shaders failed to build, keeping anti-aliasing %s\n",
+            MODE_NAMES[antialias->mode]);
+        return 0;
+    }
+    if (mode == ANTIALIAS_MSAA) {
+        GLint max_samples;
+
+        if (!msaa_supported()) {
+            fprintf(stderr, "Multisampled framebuffers not available, keeping anti-aliasing %s\n",
+                MODE_NAMES[antialias->mode]);
+            return 0;
+        }
+        glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+        if (samples > max_samples)
+            samples = max_samples;
+        if (samples != antialias->msaa.samples && antialias->msaa.framebuffer)
+            delete_msaa_target(antialias);
+        antialias->msaa.samples = samples;
+    }
+    antialias->mode = mode;
+    return 1;
+}
+
+static int make_msaa_target(struct antialias *antialias, GLsizei width, GLsizei height)
+{
+    size_t bytes = (size_t)width * height * 4 * antialias->msaa.samples;
+    GLenum status;
+
+    /* color and depth, four bytes a sample each */
+    if (!reserve_gpu_memory(2*bytes, "msaa target"))
+        return 0;
+
+    glGenRenderbuffers(1, &antialias->msaa.color_renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, antialias->msaa.color_renderbuffer);
+    glRenderbufferStorageMultisample(
+        GL_RENDERBUFFER, antialias->msaa.samples, GL_RGBA8, width, height
+    );
+    track_gpu_resource(GPU_RENDERBUFFER, antialias->msaa.color_renderbuffer, bytes, "msaa target");
+
+    glGenRenderbuffers(1, &antialias->msaa.depth_renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, antialias->msaa.depth_renderbuffer);
+    glRenderbufferStorageMultisample(
+        GL_RENDERBUFFER, antialias->msaa.samples, GL_DEPTH_COMPONENT24, width, height
+    );
+    track_gpu_resource(GPU_RENDERBUFFER, antialias->msaa.depth_renderbuffer, bytes, "msaa target");
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &antialias->msaa.framebuffer);
+    track_gpu_resource(GPU_FRAMEBUFFER, antialias->msaa.framebuffer, 0, "msaa target");
+    glBindFramebuffer(GL_FRAMEBUFFER, antialias->msaa.framebuffer);
+    glFramebufferRenderbuffer(
+        GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_RENDERBUFFER, antialias->msaa.color_renderbuffer
+    );
+    glFramebufferRenderbuffer(
+        GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_RENDERBUFFER, antialias->msaa.depth_renderbuffer
+    );
+
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "%dx MSAA target %dx%d incomplete: 0x%04x\n",
+            antialias->msaa.samples, width, height, status);
+        delete_msaa_target(antialias);
+        return 0;
+    }
+
+    antialias->msaa.size[0] = width;
+    antialias->msaa.size[1] = height;
+    return 1;
+}
+
+/* Like the scene target, only ever grown, so that scale changes are cheap. */
+int bind_msaa_target(struct antialias *antialias, GLsizei width, GLsizei height)
+{
+    if (width > antialias->msaa.size[0] || height > antialias->msaa.size[1]) {
+        GLsizei
+            alloc_w = width > antialias->msaa.size[0] ? width : antialias->msaa.size[0],
+            alloc_h = height > antialias->msaa.size[1] ? height : antialias->msaa.size[1];
+
+        if (antialias->msaa.framebuffer)
+            delete_msaa_target(antialias);
+        if (!make_msaa_target(antialias, alloc_w, alloc_h))
+            return 0;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, antialias->msaa.framebuffer);
+    return 1;
+}
+
+void resolve_msaa_target(
+    struct antialias const *antialias, GLsizei width, GLsizei height, GLuint framebuffer
+) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, antialias->msaa.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    glBlitFramebuffer(
+        0, 0, width, height,
+        0, 0, width, height,
+        GL_COLOR_BUFFER_BIT, GL_NEAREST
+    );
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void draw_fxaa(
+    struct antialias const *antialias,
+    struct render_target const *target, GLsizei const *size
+) {
+    GLfloat
+        texel_w = 1.0f/(GLfloat)target->size[0],
+        texel_h = 1.0f/(GLfloat)target->size[1];
+
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(antialias->fxaa.program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, target->color_texture);
+    glUniform1i(antialias->fxaa.texture, 0);
+    glUniform4f(
+        antialias->fxaa.texel,
+        texel_w, texel_h, (GLfloat)size[0]*texel_w, (GLfloat)size[1]*texel_h
+    );
+
+    glBindBuffer(GL_ARRAY_BUFFER, antialias->quad_buffer);
+    glVertexAttribPointer(antialias->fxaa.position, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(antialias->fxaa.position);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDisableVertexAttribArray(antialias->fxaa.position);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glUseProgram(0);
+    glEnable(GL_DEPTH_TEST);
+}
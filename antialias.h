@@ -0,0 +1,72 @@
+enum antialias_mode {
+    ANTIALIAS_OFF,
+    ANTIALIAS_FXAA,
+    ANTIALIAS_MSAA,
+    ANTIALIAS_MODE_COUNT
+};
+
+#define DEFAULT_MSAA_SAMPLES 4
+
+/*
+ * Edge smoothing for the scene target. FXAA draws the target to the
+ * window through a filter in place of the usual blit, at the cost of one
+ * full-screen pass however much geometry there is. MSAA renders into a
+ * multisampled framebuffer that is resolved into the target, which
+ * multiplies the cost of every fragment on a GL without dedicated
+ * hardware for it.
+ */
+struct antialias {
+    enum antialias_mode mode;
+    int fxaa_ready;
+
+    GLuint quad_buffer;
+    struct {
+        GLuint vertex_shader, fragment_shader, program;
+        GLint texture, texel, position;
+    } fxaa;
+
+    struct {
+        GLuint framebuffer, color_renderbuffer, depth_renderbuffer;
+        GLsizei size[2];
+        int samples;
+    } msaa;
+};
+
+const char *antialias_mode_name(enum antialias_mode mode);
+
+/* Returns ANTIALIAS_MODE_COUNT for an unknown name. */
+enum antialias_mode parse_antialias_mode(const char *name);
+
+int msaa_supported(void);
+
+/* Neither mode's GL objects are made until it is first used. */
+void init_antialias(struct antialias *out_antialias, enum antialias_mode mode);
+void delete_antialias(struct antialias *antialias);
+
+/*
+ * Switches modes, making what the new one needs. Returns 0 with a
+ * message, leaving the mode as it was, if that fails.
+ */
+int set_antialias_mode(struct antialias *antialias, enum antialias_mode mode, int samples);
+
+/*
+ * Binds the multisampled framebuffer at least width by height, growing
+ * it if need be. Returns 0 if it could not be made, after which the
+ * caller must rebind its own framebuffer.
+ */
+int bind_msaa_target(struct antialias *antialias, GLsizei width, GLsizei height);
+
+/* Resolves the lower-left width by height into the framebuffer. */
+void resolve_msaa_target(
+    struct antialias const *antialias, GLsizei width, GLsizei height, GLuint framebuffer
+);
+
+/*
+ * Filters the lower-left size of the render target's color texture into
+ * the viewport of the bound framebuffer, scaling it to fit. Expects
+ * depth testing on, and leaves it on with no program bound.
+ */
+void draw_fxaa(
+    struct antialias const *antialias,
+    struct render_target const *target, GLsizei const *size
+);
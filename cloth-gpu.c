@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "thread-util.h"
+#include "job-pool.h"
+#include "memory.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+#include "wind-field.h"
+#include "cloth.h"
+#include "gl-util.h"
+#include "gpu-resources.h"
+#include "cloth-gpu.h"
+#include "gl-capture.h"
+
+#define COMPUTE_GROUP_SIZE 64
+
+static int compute_supported(void)
+{
+    return GLEW_VERSION_4_3
+        || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object);
+}
+
+/* transform feedback, texelFetch and gl_VertexID all come with GL 3.0 */
+int cloth_gpu_supported(void)
+{
+    return compute_supported() || GLEW_VERSION_3_0;
+}
+
+static GLuint make_feedback_program(GLuint shader)
+{
+    static const GLchar *const VARYINGS[] = { "deformed_position", "deformed_normal" };
+    GLuint program = glCreateProgram();
+
+    track_gpu_resource(GPU_PROGRAM, program, 0, gpu_resource_owner(GPU_SHADER, shader));
+    glAttachShader(program, shader);
+    glTransformFeedbackVaryings(program, 2, VARYINGS, GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(program);
+    return finish_program(program);
+}
+
+static GLuint make_compute_program(GLuint shader)
+{
+    GLuint program = glCreateProgram();
+
+    track_gpu_resource(GPU_PROGRAM, program, 0, gpu_resource_owner(GPU_SHADER, shader));
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    return finish_program(program);
+}
+
+int make_cloth_gpu(struct cloth_gpu *out_gpu, struct cloth const *cloth)
+{
+    out_gpu->x_res = cloth->x_res;
+    out_gpu->y_res = cloth->y_res;
+    out_gpu->use_compute = compute_supported();
+
+    out_gpu->shader = out_gpu->use_compute
+        ? make_shader(GL_COMPUTE_SHADER, "cloth.c.glsl")
+        : make_shader(GL_VERTEX_SHADER, "cloth.v.glsl");
+    if (out_gpu->shader == 0)
+        return 0;
+    out_gpu->program = out_gpu->use_compute
+        ? make_compute_program(out_gpu->shader)
+        : make_feedback_program(out_gpu->shader);
+    if (out_gpu->program == 0) {
+        glDeleteShader(out_gpu->shader);
+        untrack_gpu_resource(GPU_SHADER, out_gpu->shader);
+        return 0;
+    }
+
+    out_gpu->uniforms.state = glGetUniformLocation(out_gpu->program, "state");
+    out_gpu->uniforms.resolution = glGetUniformLocation(out_gpu->program, "resolution");
+    out_gpu->uniforms.alpha = glGetUniformLocation(out_gpu->program, "alpha");
+
+    glGenTextures(1, &out_gpu->state_texture);
+    glBindTexture(GL_TEXTURE_2D, out_gpu->state_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_R32F,
+        cloth->x_res, 6 * cloth->y_res, 0,
+        GL_RED, GL_FLOAT, NULL
+    );
+    track_gpu_resource(
+        GPU_TEXTURE, out_gpu->state_texture,
+        (size_t)cloth->particle_count * 6 * sizeof(GLfloat), "cloth state"
+    );
+
+    glGenBuffers(1, &out_gpu->vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, out_gpu->vertex_buffer);
+    glBufferData(
+        GL_ARRAY_BUFFER,
+        cloth->particle_count * sizeof(struct deformed_vertex),
+        NULL,
+        GL_STREAM_COPY
+    );
+    track_gpu_resource(
+        GPU_BUFFER, out_gpu->vertex_buffer,
+        cloth->particle_count * sizeof(struct deformed_vertex), "cloth vertices"
+    );
+    return 1;
+}
+
+void delete_cloth_gpu(struct cloth_gpu *gpu)
+{
+    glDeleteBuffers(1, &gpu->vertex_buffer);
+    glDeleteTextures(1, &gpu->state_texture);
+    glDetachShader(gpu->program, gpu->shader);
+    glDeleteProgram(gpu->program);
+    glDeleteShader(gpu->shader);
+    untrack_gpu_resource(GPU_BUFFER, gpu->vertex_buffer);
+    untrack_gpu_resource(GPU_TEXTURE, gpu->state_texture);
+    untrack_gpu_resource(GPU_PROGRAM, gpu->program);
+    untrack_gpu_resource(GPU_SHADER, gpu->shader);
+    gpu->vertex_buffer = gpu->state_texture = 0;
+}
+
+static void upload_rows(struct cloth_gpu const *gpu, int block, GLfloat const *data)
+{
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0,
+        0, block * gpu->y_res, gpu->x_res, gpu->y_res,
+        GL_RED, GL_FLOAT, data
+    );
+}
+
+/*
+ * Leaves texture unit 0 active with the state texture bound; the scene
+ * binds its own textures before drawing.
+ */
+void update_cloth_gpu(struct cloth_gpu *gpu, struct cloth const *cloth, double time)
+{
+    GLsizei count = gpu->x_res * gpu->y_res;
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gpu->state_texture);
+    upload_rows(gpu, 0, cloth->prev_x);
+    upload_rows(gpu, 1, cloth->prev_y);
+    upload_rows(gpu, 2, cloth->prev_z);
+    upload_rows(gpu, 3, cloth->x);
+    upload_rows(gpu, 4, cloth->y);
+    upload_rows(gpu, 5, cloth->z);
+
+    glUseProgram(gpu->program);
+    glUniform1i(gpu->uniforms.state, 0);
+    glUniform2i(gpu->uniforms.resolution, gpu->x_res, gpu->y_res);
+    glUniform1f(gpu->uniforms.alpha, cloth_alpha(cloth, time));
+
+    if (gpu->use_compute) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpu->vertex_buffer);
+        glDispatchCompute((count + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    } else {
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, gpu->vertex_buffer);
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, count);
+        glEndTransformFeedback();
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    }
+    glUseProgram(0);
+}
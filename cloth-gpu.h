@@ -0,0 +1,25 @@
+/*
+ * Writes the cloth's positions and normals on the GPU once per frame,
+ * into a buffer of struct deformed_vertex that every pass drawing the
+ * flag reads as ordinary vertex attributes. The CPU only uploads the
+ * cloth's last two steps, as a float texture of x_res by 6*y_res texels,
+ * straight from the solver's arrays. The GPU work is a compute shader on
+ * GL 4.3, or a transform feedback pass on GL 3.0.
+ */
+struct cloth_gpu {
+    GLuint state_texture, vertex_buffer;
+    GLuint shader, program;
+
+    struct {
+        GLint state, resolution, alpha;
+    } uniforms;
+
+    int x_res, y_res, use_compute;
+};
+
+int cloth_gpu_supported(void);
+int make_cloth_gpu(struct cloth_gpu *out_gpu, struct cloth const *cloth);
+void delete_cloth_gpu(struct cloth_gpu *gpu);
+
+/* time is as for cloth_vertices. */
+void update_cloth_gpu(struct cloth_gpu *gpu, struct cloth const *cloth, double time);
@@ -0,0 +1,635 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "thread-util.h"
+#include "job-pool.h"
+#include "memory.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+#include "wind-field.h"
+#include "cloth.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  include <xmmintrin.h>
+#  define CLOTH_SSE
+#endif
+
+#define CLOTH_GRAVITY       4.0f
+#define CLOTH_DRAG          3.0f
+#define CLOTH_FRICTION      0.5f
+#define CLOTH_DAMPING       0.002f
+#define CLOTH_MIN_LENGTH    1.0e-6f
+
+/*
+ * Below these sizes a pass runs on the calling thread, since waking the
+ * other workers would cost more than the work itself.
+ */
+#define PARTICLES_PER_JOB   4096
+#define CONSTRAINTS_PER_JOB 2048
+
+#define CLOTH_ARRAYS        17
+
+#define ROUND_UP(n, align)  (((n) + (align) - 1) / (align) * (align))
+
+/*
+ * Stretch links to the neighbors along each axis, shear links along the
+ * diagonals, and bending links to the particles two along each axis.
+ */
+static const struct {
+    int ds, dt;
+    GLfloat stiffness;
+} CLOTH_LINKS[] = {
+    {  1, 0, 1.0f  }, { 0, 1, 1.0f  },
+    {  1, 1, 0.5f  }, { -1, 1, 0.5f },
+    {  2, 0, 0.15f }, { 0, 2, 0.15f }
+};
+
+#define CLOTH_LINK_COUNT ((int)(sizeof(CLOTH_LINKS)/sizeof(CLOTH_LINKS[0])))
+
+/*
+ * Greedily gives each constraint the lowest color not yet used by either
+ * of its particles, then sorts the constraints by color. Links of one
+ * kind are colored together, which gives each kind two colors on a grid.
+ */
+static int make_constraints(
+    struct cloth_constraints *out_constraints,
+    struct cloth const *cloth, GLfloat width, GLfloat height
+) {
+    struct arena *arena = scratch_arena();
+    struct arena_mark mark = get_arena_mark(arena);
+    int max_count = CLOTH_LINK_COUNT * cloth->particle_count;
+    int *a = (int*) arena_alloc(arena, max_count * sizeof(int));
+    int *b = (int*) arena_alloc(arena, max_count * sizeof(int));
+    int *link = (int*) arena_alloc(arena, max_count * sizeof(int));
+    unsigned char *color = (unsigned char*) arena_alloc(arena, max_count);
+    unsigned *used = (unsigned*) arena_alloc(arena, cloth->particle_count * sizeof(unsigned));
+    GLfloat
+        s_step = width / (GLfloat)(cloth->x_res - 1),
+        t_step = height / (GLfloat)(cloth->y_res - 1);
+    int count = 0, i, l, s, t;
+    char *block;
+
+    if (!a || !b || !link || !color || !used) {
+        release_arena(arena, mark);
+        return 0;
+    }
+    memset(used, 0, cloth->particle_count * sizeof(unsigned));
+    memset(out_constraints->color_start, 0, sizeof(out_constraints->color_start));
+    out_constraints->color_count = 0;
+
+    for (l = 0; l < CLOTH_LINK_COUNT; ++l)
+        for (t = 0; t + CLOTH_LINKS[l].dt < cloth->y_res; ++t)
+            for (s = 0; s < cloth->x_res; ++s) {
+                int s2 = s + CLOTH_LINKS[l].ds, t2 = t + CLOTH_LINKS[l].dt;
+                int pa = t*cloth->x_res + s, pb = t2*cloth->x_res + s2;
+                unsigned free_colors;
+                int c;
+
+                if (s2 < 0 || s2 >= cloth->x_res)
+                    continue;
+                if (cloth->inv_mass[pa] == 0.0f && cloth->inv_mass[pb] == 0.0f)
+                    continue;
+
+                free_colors = ~(used[pa] | used[pb]);
+                if (free_colors == 0) {
+                    fprintf(stderr, "Cloth needs more than %d constraint colors\n", CLOTH_MAX_COLORS);
+                    release_arena(arena, mark);
+                    return 0;
+                }
+                for (c = 0; !(free_colors & (1u << c)); ++c)
+                    ;
+                used[pa] |= 1u << c;
+                used[pb] |= 1u << c;
+
+                a[count] = pa;
+                b[count] = pb;
+                link[count] = l;
+                color[count] = (unsigned char)c;
+                ++out_constraints->color_start[c + 1];
+                if (c + 1 > out_constraints->color_count)
+                    out_constraints->color_count = c + 1;
+                ++count;
+            }
+
+    block = (char*) memory_alloc(count * (2*sizeof(int) + 2*sizeof(GLfloat)), MEMORY_CLOTH);
+    if (!block) {
+        release_arena(arena, mark);
+        return 0;
+    }
+    out_constraints->a = (int*)block;
+    out_constraints->b = out_constraints->a + count;
+    out_constraints->rest = (GLfloat*)(out_constraints->b + count);
+    out_constraints->stiffness = out_constraints->rest + count;
+    out_constraints->count = count;
+
+    for (i = 0; i < out_constraints->color_count; ++i)
+        out_constraints->color_start[i + 1] += out_constraints->color_start[i];
+
+    /* color_start[c] is used as the insertion point for color c, then restored */
+    for (i = 0; i < count; ++i) {
+        int j = out_constraints->color_start[color[i]]++;
+        GLfloat
+            ds = (GLfloat)CLOTH_LINKS[link[i]].ds * s_step,
+            dt = (GLfloat)CLOTH_LINKS[link[i]].dt * t_step;
+
+        out_constraints->a[j] = a[i];
+        out_constraints->b[j] = b[i];
+        out_constraints->rest[j] = sqrtf(ds*ds + dt*dt);
+        out_constraints->stiffness[j] = CLOTH_LINKS[link[i]].stiffness;
+    }
+    for (i = out_constraints->color_count; i > 0; --i)
+        out_constraints->color_start[i] = out_constraints->color_start[i - 1];
+    out_constraints->color_start[0] = 0;
+
+    release_arena(arena, mark);
+    return 1;
+}
+
+/*
+ * Central differences along the grid, one-sided at the edges, with the
+ * same winding as the flag mesh.
+ */
+static void update_normals(struct cloth *cloth, int first, int end)
+{
+    GLfloat const *x = cloth->x, *y = cloth->y, *z = cloth->z;
+    int i;
+
+    for (i = first; i < end; ++i) {
+        int s = i % cloth->x_res, t = i / cloth->x_res;
+        int
+            s0 = s > 0 ? i - 1 : i, s1 = s < cloth->x_res - 1 ? i + 1 : i,
+            t0 = t > 0 ? i - cloth->x_res : i, t1 = t < cloth->y_res - 1 ? i + cloth->x_res : i;
+        GLfloat
+            sx = x[s1] - x[s0], sy = y[s1] - y[s0], sz = z[s1] - z[s0],
+            tx = x[t1] - x[t0], ty = y[t1] - y[t0], tz = z[t1] - z[t0],
+            nx = ty*sz - tz*sy,
+            ny = tz*sx - tx*sz,
+            nz = tx*sy - ty*sx,
+            length = sqrtf(nx*nx + ny*ny + nz*nz),
+            scale = length > CLOTH_MIN_LENGTH ? 1.0f/length : 0.0f;
+
+        cloth->normal_x[i] = nx * scale;
+        cloth->normal_y[i] = ny * scale;
+        cloth->normal_z[i] = nz * scale;
+    }
+}
+
+int make_cloth(struct cloth *out_cloth, int x_res, int y_res, GLfloat width, GLfloat height)
+{
+    int s, t, i, stride;
+    GLfloat *block;
+
+    out_cloth->x_res = x_res;
+    out_cloth->y_res = y_res;
+    out_cloth->particle_count = x_res * y_res;
+    out_cloth->padded_count = ROUND_UP(out_cloth->particle_count, 4);
+    out_cloth->time = 0.0;
+    out_cloth->max_steps = CLOTH_MAX_STEPS;
+
+    /* keep every array MEMORY_ALIGNMENT-aligned for aligned SIMD loads */
+    stride = ROUND_UP(out_cloth->padded_count, MEMORY_ALIGNMENT / (int)sizeof(GLfloat));
+    block = (GLfloat*) memory_alloc(CLOTH_ARRAYS * stride * sizeof(GLfloat), MEMORY_CLOTH);
+    if (!block)
+        return 0;
+    memset(block, 0, CLOTH_ARRAYS * stride * sizeof(GLfloat));
+    out_cloth->x        = block;
+    out_cloth->y        = block + stride;
+    out_cloth->z        = block + 2*stride;
+    out_cloth->prev_x   = block + 3*stride;
+    out_cloth->prev_y   = block + 4*stride;
+    out_cloth->prev_z   = block + 5*stride;
+    out_cloth->normal_x = block + 6*stride;
+    out_cloth->normal_y = block + 7*stride;
+    out_cloth->normal_z = block + 8*stride;
+    out_cloth->inv_mass = block + 9*stride;
+    out_cloth->tether_x = block + 10*stride;
+    out_cloth->tether_y = block + 11*stride;
+    out_cloth->tether_z = block + 12*stride;
+    out_cloth->tether_length = block + 13*stride;
+    out_cloth->gust_x   = block + 14*stride;
+    out_cloth->gust_y   = block + 15*stride;
+    out_cloth->gust_z   = block + 16*stride;
+
+    for (t = 0, i = 0; t < y_res; ++t)
+        for (s = 0; s < x_res; ++s, ++i) {
+            out_cloth->x[i] = out_cloth->prev_x[i] = width * (GLfloat)s / (GLfloat)(x_res - 1);
+            out_cloth->y[i] = out_cloth->prev_y[i]
+                = height * ((GLfloat)t / (GLfloat)(y_res - 1) - 0.5f);
+            out_cloth->inv_mass[i] = s == 0 ? 0.0f : 1.0f;
+            out_cloth->tether_x[i] = 0.0f;
+            out_cloth->tether_y[i] = out_cloth->y[i];
+            out_cloth->tether_length[i] = out_cloth->x[i];
+        }
+    update_normals(out_cloth, 0, out_cloth->particle_count);
+
+    if (!make_constraints(&out_cloth->constraints, out_cloth, width, height)) {
+        memory_free(block);
+        return 0;
+    }
+    return 1;
+}
+
+void delete_cloth(struct cloth *cloth)
+{
+    memory_free(cloth->x);
+    memory_free(cloth->constraints.a);
+    cloth->x = NULL;
+    cloth->constraints.a = NULL;
+}
+
+/*
+ * Each particle's gust is the wind field's at its position, scaled by the
+ * steady wind's speed, or nothing without a field. The field is sampled
+ * a particle at a time, so that integrate_particles can then add the
+ * gusts four at a time.
+ */
+static void sample_gusts(
+    struct cloth *cloth, int first, int end, GLfloat const *wind,
+    struct wind_field const *field, GLfloat const *field_offset
+) {
+    GLfloat position[3], gust[3], scale;
+    int i;
+
+    if (!field) {
+        for (i = first; i < end; ++i)
+            cloth->gust_x[i] = cloth->gust_y[i] = cloth->gust_z[i] = 0.0f;
+        return;
+    }
+
+    scale = field->strength * sqrtf(wind[0]*wind[0] + wind[1]*wind[1] + wind[2]*wind[2]);
+    for (i = first; i < end; ++i) {
+        position[0] = cloth->x[i];
+        position[1] = cloth->y[i];
+        position[2] = cloth->z[i];
+        sample_wind_field(field, field_offset, position, gust);
+        cloth->gust_x[i] = gust[0] * scale;
+        cloth->gust_y[i] = gust[1] * scale;
+        cloth->gust_z[i] = gust[2] * scale;
+    }
+}
+
+/*
+ * Verlet integration under gravity and a wind force proportional to the
+ * wind's speed relative to the cloth: mostly along the normal, with a
+ * little drag along the surface so that the cloth streams out even when
+ * the wind runs parallel to it. The wind is the steady wind plus each
+ * particle's gust. Pinned particles have no inverse mass and are masked
+ * out. first and end are multiples of four within padded_count.
+ */
+static void integrate_particles(struct cloth *cloth, int first, int end, GLfloat const *wind)
+{
+    GLfloat
+        dt = (GLfloat)CLOTH_STEP, dt2 = dt*dt, inv_dt = 1.0f/dt,
+        retain = 1.0f - CLOTH_DAMPING;
+    int i = first;
+
+#ifdef CLOTH_SSE
+    __m128
+        v_retain = _mm_set1_ps(retain), v_inv_dt = _mm_set1_ps(inv_dt),
+        v_dt2 = _mm_set1_ps(dt2), v_drag = _mm_set1_ps(CLOTH_DRAG),
+        v_friction = _mm_set1_ps(CLOTH_FRICTION),
+        v_gravity = _mm_set1_ps(CLOTH_GRAVITY), v_zero = _mm_setzero_ps(),
+        wind_x = _mm_set1_ps(wind[0]), wind_y = _mm_set1_ps(wind[1]), wind_z = _mm_set1_ps(wind[2]);
+
+    for (; i < end; i += 4) {
+        __m128
+            x = _mm_load_ps(cloth->x + i), y = _mm_load_ps(cloth->y + i), z = _mm_load_ps(cloth->z + i),
+            vx = _mm_mul_ps(_mm_sub_ps(x, _mm_load_ps(cloth->prev_x + i)), v_retain),
+            vy = _mm_mul_ps(_mm_sub_ps(y, _mm_load_ps(cloth->prev_y + i)), v_retain),
+            vz = _mm_mul_ps(_mm_sub_ps(z, _mm_load_ps(cloth->prev_z + i)), v_retain),
+            nx = _mm_load_ps(cloth->normal_x + i),
+            ny = _mm_load_ps(cloth->normal_y + i),
+            nz = _mm_load_ps(cloth->normal_z + i),
+            moving = _mm_cmpgt_ps(_mm_load_ps(cloth->inv_mass + i), v_zero),
+            rx = _mm_sub_ps(
+                _mm_add_ps(wind_x, _mm_load_ps(cloth->gust_x + i)), _mm_mul_ps(vx, v_inv_dt)
+            ),
+            ry = _mm_sub_ps(
+                _mm_add_ps(wind_y, _mm_load_ps(cloth->gust_y + i)), _mm_mul_ps(vy, v_inv_dt)
+            ),
+            rz = _mm_sub_ps(
+                _mm_add_ps(wind_z, _mm_load_ps(cloth->gust_z + i)), _mm_mul_ps(vz, v_inv_dt)
+            ),
+            lift = _mm_mul_ps(v_drag, _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(nx, rx), _mm_mul_ps(ny, ry)), _mm_mul_ps(nz, rz)
+            )),
+            ax = _mm_add_ps(_mm_mul_ps(lift, nx), _mm_mul_ps(v_friction, rx)),
+            ay = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(lift, ny), _mm_mul_ps(v_friction, ry)), v_gravity),
+            az = _mm_add_ps(_mm_mul_ps(lift, nz), _mm_mul_ps(v_friction, rz)),
+            dx = _mm_add_ps(vx, _mm_mul_ps(ax, v_dt2)),
+            dy = _mm_add_ps(vy, _mm_mul_ps(ay, v_dt2)),
+            dz = _mm_add_ps(vz, _mm_mul_ps(az, v_dt2));
+
+        _mm_store_ps(cloth->prev_x + i, x);
+        _mm_store_ps(cloth->prev_y + i, y);
+        _mm_store_ps(cloth->prev_z + i, z);
+        _mm_store_ps(cloth->x + i, _mm_add_ps(x, _mm_and_ps(dx, moving)));
+        _mm_store_ps(cloth->y + i, _mm_add_ps(y, _mm_and_ps(dy, moving)));
+        _mm_store_ps(cloth->z + i, _mm_add_ps(z, _mm_and_ps(dz, moving)));
+    }
+#endif
+
+    for (; i < end; ++i) {
+        GLfloat
+            vx = (cloth->x[i] - cloth->prev_x[i]) * retain,
+            vy = (cloth->y[i] - cloth->prev_y[i]) * retain,
+            vz = (cloth->z[i] - cloth->prev_z[i]) * retain,
+            rx = wind[0] + cloth->gust_x[i] - vx*inv_dt,
+            ry = wind[1] + cloth->gust_y[i] - vy*inv_dt,
+            rz = wind[2] + cloth->gust_z[i] - vz*inv_dt,
+            lift = CLOTH_DRAG * (
+                cloth->normal_x[i]*rx + cloth->normal_y[i]*ry + cloth->normal_z[i]*rz
+            );
+
+        cloth->prev_x[i] = cloth->x[i];
+        cloth->prev_y[i] = cloth->y[i];
+        cloth->prev_z[i] = cloth->z[i];
+        if (cloth->inv_mass[i] > 0.0f) {
+            cloth->x[i] += vx + (lift*cloth->normal_x[i] + CLOTH_FRICTION*rx)*dt2;
+            cloth->y[i] += vy + (lift*cloth->normal_y[i] + CLOTH_FRICTION*ry - CLOTH_GRAVITY)*dt2;
+            cloth->z[i] += vz + (lift*cloth->normal_z[i] + CLOTH_FRICTION*rz)*dt2;
+        }
+    }
+}
+
+/*
+ * Moves each pair of particles along the line between them, in inverse
+ * proportion to their mass, toward their rest distance. first and end
+ * must lie within one color.
+ */
+static void project_constraints(struct cloth *cloth, int first, int end)
+{
+    struct cloth_constraints const *constraints = &cloth->constraints;
+    GLfloat *x = cloth->x, *y = cloth->y, *z = cloth->z;
+    GLfloat const *inv_mass = cloth->inv_mass;
+    int i = first;
+
+#ifdef CLOTH_SSE
+    __m128 min_length = _mm_set1_ps(CLOTH_MIN_LENGTH);
+
+    for (; i + 4 <= end; i += 4) {
+        int const *a = constraints->a + i, *b = constraints->b + i;
+        GLfloat out[6][4];
+        int j;
+        __m128
+            ax = _mm_set_ps(x[a[3]], x[a[2]], x[a[1]], x[a[0]]),
+            ay = _mm_set_ps(y[a[3]], y[a[2]], y[a[1]], y[a[0]]),
+            az = _mm_set_ps(z[a[3]], z[a[2]], z[a[1]], z[a[0]]),
+            bx = _mm_set_ps(x[b[3]], x[b[2]], x[b[1]], x[b[0]]),
+            by = _mm_set_ps(y[b[3]], y[b[2]], y[b[1]], y[b[0]]),
+            bz = _mm_set_ps(z[b[3]], z[b[2]], z[b[1]], z[b[0]]),
+            wa = _mm_set_ps(inv_mass[a[3]], inv_mass[a[2]], inv_mass[a[1]], inv_mass[a[0]]),
+            wb = _mm_set_ps(inv_mass[b[3]], inv_mass[b[2]], inv_mass[b[1]], inv_mass[b[0]]),
+            dx = _mm_sub_ps(bx, ax), dy = _mm_sub_ps(by, ay), dz = _mm_sub_ps(bz, az),
+            length = _mm_max_ps(min_length, _mm_sqrt_ps(_mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)
+            ))),
+            scale = _mm_div_ps(
+                _mm_mul_ps(
+                    _mm_loadu_ps(constraints->stiffness + i),
+                    _mm_sub_ps(length, _mm_loadu_ps(constraints->rest + i))
+                ),
+                _mm_mul_ps(_mm_add_ps(wa, wb), length)
+            );
+
+        dx = _mm_mul_ps(dx, scale);
+        dy = _mm_mul_ps(dy, scale);
+        dz = _mm_mul_ps(dz, scale);
+        _mm_storeu_ps(out[0], _mm_add_ps(ax, _mm_mul_ps(wa, dx)));
+        _mm_storeu_ps(out[1], _mm_add_ps(ay, _mm_mul_ps(wa, dy)));
+        _mm_storeu_ps(out[2], _mm_add_ps(az, _mm_mul_ps(wa, dz)));
+        _mm_storeu_ps(out[3], _mm_sub_ps(bx, _mm_mul_ps(wb, dx)));
+        _mm_storeu_ps(out[4], _mm_sub_ps(by, _mm_mul_ps(wb, dy)));
+        _mm_storeu_ps(out[5], _mm_sub_ps(bz, _mm_mul_ps(wb, dz)));
+
+        for (j = 0; j < 4; ++j) {
+            x[a[j]] = out[0][j];
+            y[a[j]] = out[1][j];
+            z[a[j]] = out[2][j];
+            x[b[j]] = out[3][j];
+            y[b[j]] = out[4][j];
+            z[b[j]] = out[5][j];
+        }
+    }
+#endif
+
+    for (; i < end; ++i) {
+        int a = constraints->a[i], b = constraints->b[i];
+        GLfloat
+            dx = x[b] - x[a], dy = y[b] - y[a], dz = z[b] - z[a],
+            length = sqrtf(dx*dx + dy*dy + dz*dz),
+            scale;
+
+        if (length < CLOTH_MIN_LENGTH)
+            length = CLOTH_MIN_LENGTH;
+        scale = constraints->stiffness[i] * (length - constraints->rest[i])
+            / ((inv_mass[a] + inv_mass[b]) * length);
+        x[a] += inv_mass[a] * dx * scale;
+        y[a] += inv_mass[a] * dy * scale;
+        z[a] += inv_mass[a] * dz * scale;
+        x[b] -= inv_mass[b] * dx * scale;
+        y[b] -= inv_mass[b] * dy * scale;
+        z[b] -= inv_mass[b] * dz * scale;
+    }
+}
+
+/*
+ * Pulls particles that have strayed too far from their tether back onto
+ * its length. The pinned ends never move, so particles are independent
+ * of each other here. first and end are multiples of four within
+ * padded_count.
+ */
+static void apply_tethers(struct cloth *cloth, int first, int end)
+{
+    int i = first;
+
+#ifdef CLOTH_SSE
+    __m128 min_length = _mm_set1_ps(CLOTH_MIN_LENGTH), one = _mm_set1_ps(1.0f);
+
+    for (; i < end; i += 4) {
+        __m128
+            x = _mm_load_ps(cloth->x + i), y = _mm_load_ps(cloth->y + i), z = _mm_load_ps(cloth->z + i),
+            dx = _mm_sub_ps(x, _mm_load_ps(cloth->tether_x + i)),
+            dy = _mm_sub_ps(y, _mm_load_ps(cloth->tether_y + i)),
+            dz = _mm_sub_ps(z, _mm_load_ps(cloth->tether_z + i)),
+            length = _mm_max_ps(min_length, _mm_sqrt_ps(_mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)
+            ))),
+            pull = _mm_sub_ps(one, _mm_div_ps(_mm_load_ps(cloth->tether_length + i), length)),
+            taut = _mm_cmpgt_ps(pull, _mm_setzero_ps());
+
+        pull = _mm_and_ps(pull, taut);
+        _mm_store_ps(cloth->x + i, _mm_sub_ps(x, _mm_mul_ps(dx, pull)));
+        _mm_store_ps(cloth->y + i, _mm_sub_ps(y, _mm_mul_ps(dy, pull)));
+        _mm_store_ps(cloth->z + i, _mm_sub_ps(z, _mm_mul_ps(dz, pull)));
+    }
+#endif
+
+    for (; i < end; ++i) {
+        GLfloat
+            dx = cloth->x[i] - cloth->tether_x[i],
+            dy = cloth->y[i] - cloth->tether_y[i],
+            dz = cloth->z[i] - cloth->tether_z[i],
+            length = sqrtf(dx*dx + dy*dy + dz*dz),
+            pull;
+
+        if (length <= cloth->tether_length[i])
+            continue;
+        pull = 1.0f - cloth->tether_length[i] / length;
+        cloth->x[i] -= dx * pull;
+        cloth->y[i] -= dy * pull;
+        cloth->z[i] -= dz * pull;
+    }
+}
+
+/*
+ * A range of particles or constraints split into per_job pieces, each a
+ * multiple of four so that SIMD loads stay aligned.
+ */
+struct cloth_pass {
+    struct cloth *cloth;
+    GLfloat const *wind;
+    struct wind_field const *field;
+    GLfloat field_offset[3];
+    int first, end, per_job;
+};
+
+static void pass_range(struct cloth_pass const *pass, int job, int *out_first, int *out_end)
+{
+    *out_first = pass->first + job * pass->per_job;
+    *out_end = *out_first + pass->per_job < pass->end ? *out_first + pass->per_job : pass->end;
+}
+
+static void integrate_job(int job, int worker, void *data)
+{
+    struct cloth_pass const *pass = (struct cloth_pass const*)data;
+    int first, end;
+    pass_range(pass, job, &first, &end);
+    sample_gusts(pass->cloth, first, end, pass->wind, pass->field, pass->field_offset);
+    integrate_particles(pass->cloth, first, end, pass->wind);
+}
+
+static void project_job(int job, int worker, void *data)
+{
+    struct cloth_pass const *pass = (struct cloth_pass const*)data;
+    int first, end;
+    pass_range(pass, job, &first, &end);
+    project_constraints(pass->cloth, first, end);
+}
+
+static void tether_job(int job, int worker, void *data)
+{
+    struct cloth_pass const *pass = (struct cloth_pass const*)data;
+    int first, end;
+    pass_range(pass, job, &first, &end);
+    apply_tethers(pass->cloth, first, end);
+}
+
+static void normals_job(int job, int worker, void *data)
+{
+    struct cloth_pass const *pass = (struct cloth_pass const*)data;
+    int first, end;
+    pass_range(pass, job, &first, &end);
+    update_normals(pass->cloth, first, end);
+}
+
+static void run_pass(
+    struct job_pool *pool, struct cloth_pass *pass,
+    int first, int end, int per_job, job_func func
+) {
+    int count = end - first, jobs = count / per_job;
+
+    if (jobs > pool->worker_count)
+        jobs = pool->worker_count;
+    if (jobs < 1)
+        jobs = 1;
+    pass->first = first;
+    pass->end = end;
+    pass->per_job = ROUND_UP((count + jobs - 1) / jobs, 4);
+    run_jobs(pool, jobs, func, pass);
+}
+
+/*
+ * Each color is a barrier: the colors run one after another, and the
+ * constraints within a color are spread across the pool.
+ */
+static void step_cloth(
+    struct cloth *cloth, struct job_pool *pool,
+    GLfloat const *wind, struct wind_field const *field
+) {
+    struct cloth_constraints const *constraints = &cloth->constraints;
+    struct cloth_pass pass;
+    int iteration, color;
+
+    pass.cloth = cloth;
+    pass.wind = wind;
+    pass.field = field;
+    if (field)
+        wind_field_offset(field, cloth->time, pass.field_offset);
+
+    run_pass(pool, &pass, 0, cloth->padded_count, PARTICLES_PER_JOB, &integrate_job);
+    for (iteration = 0; iteration < CLOTH_ITERATIONS; ++iteration)
+        for (color = 0; color < constraints->color_count; ++color)
+            run_pass(
+                pool, &pass,
+                constraints->color_start[color], constraints->color_start[color + 1],
+                CONSTRAINTS_PER_JOB, &project_job
+            );
+    run_pass(pool, &pass, 0, cloth->padded_count, PARTICLES_PER_JOB, &tether_job);
+    run_pass(pool, &pass, 0, cloth->particle_count, PARTICLES_PER_JOB, &normals_job);
+    cloth->time += CLOTH_STEP;
+}
+
+int advance_cloth(
+    struct cloth *cloth, struct job_pool *pool, double time,
+    wind_func wind, struct wind_field const *field
+) {
+    GLfloat step_wind[3];
+    int steps = 0;
+
+    if (cloth->max_steps > 0 && time - cloth->time > cloth->max_steps * CLOTH_STEP)
+        cloth->time = time - cloth->max_steps * CLOTH_STEP;
+    while (cloth->time + CLOTH_STEP <= time) {
+        wind((GLfloat)cloth->time, step_wind);
+        step_cloth(cloth, pool, step_wind, field);
+        ++steps;
+    }
+    return steps;
+}
+
+/*
+ * Positions are interpolated between the last two steps, which puts the
+ * flag up to one step behind time but keeps its motion smooth whatever
+ * the frame rate.
+ */
+GLfloat cloth_alpha(struct cloth const *cloth, double time)
+{
+    GLfloat alpha = (GLfloat)((time - cloth->time) / CLOTH_STEP);
+
+    if (alpha < 0.0f)
+        return 0.0f;
+    if (alpha > 1.0f)
+        return 1.0f;
+    return alpha;
+}
+
+/* Normals are from the last step. */
+void cloth_vertices(struct cloth const *cloth, double time, struct flag_vertex *out_vertices)
+{
+    GLfloat alpha = cloth_alpha(cloth, time);
+    int i;
+
+    for (i = 0; i < cloth->particle_count; ++i) {
+        struct flag_vertex *v = &out_vertices[i];
+
+        v->position[0] = cloth->prev_x[i] + (cloth->x[i] - cloth->prev_x[i]) * alpha;
+        v->position[1] = cloth->prev_y[i] + (cloth->y[i] - cloth->prev_y[i]) * alpha;
+        v->position[2] = cloth->prev_z[i] + (cloth->z[i] - cloth->prev_z[i]) * alpha;
+        v->normal[0] = cloth->normal_x[i];
+        v->normal[1] = cloth->normal_y[i];
+        v->normal[2] = cloth->normal_z[i];
+    }
+}
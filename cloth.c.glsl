@@ -0,0 +1,51 @@
+#version 430
+
+/*
+ * Interpolates the cloth between its last two steps and derives each
+ * normal from the neighboring particles, once per frame, into the buffer
+ * that every pass drawing the flag reads. Must match cloth.v.glsl.
+ */
+
+layout(local_size_x = 64) in;
+
+uniform sampler2D state;
+uniform ivec2 resolution;
+uniform float alpha;
+
+struct deformed_vertex {
+    vec4 position, normal;
+};
+
+layout(std430, binding = 0) writeonly buffer deformed_vertices {
+    deformed_vertex vertices[];
+};
+
+/* rows 0-2 of each particle are the previous x, y and z; rows 3-5 the current */
+float component(ivec2 st, int row)
+{
+    return texelFetch(state, ivec2(st.x, st.y + row*resolution.y), 0).r;
+}
+
+vec3 particle(ivec2 st)
+{
+    st = clamp(st, ivec2(0), resolution - ivec2(1));
+    return mix(
+        vec3(component(st, 0), component(st, 1), component(st, 2)),
+        vec3(component(st, 3), component(st, 4), component(st, 5)),
+        alpha
+    );
+}
+
+void main()
+{
+    int i = int(gl_GlobalInvocationID.x);
+    if (i >= resolution.x * resolution.y)
+        return;
+
+    ivec2 st = ivec2(i % resolution.x, i / resolution.x);
+    vec3 s = particle(st + ivec2(1, 0)) - particle(st - ivec2(1, 0));
+    vec3 t = particle(st + ivec2(0, 1)) - particle(st - ivec2(0, 1));
+
+    vertices[i].position = vec4(particle(st), 0.0);
+    vertices[i].normal = vec4(normalize(cross(t, s)), 0.0);
+}
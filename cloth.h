@@ -0,0 +1,77 @@
+#define CLOTH_STEP          (1.0/240.0)
+#define CLOTH_ITERATIONS    2
+#define CLOTH_MAX_STEPS     8
+#define CLOTH_MAX_COLORS    32
+
+/*
+ * Constraints between pairs of particles, sorted by color. No two
+ * constraints of one color share a particle, so a color can be split
+ * across threads, or projected four at a time, and still give the same
+ * result as projecting it serially.
+ */
+struct cloth_constraints {
+    int *a, *b;
+    GLfloat *rest, *stiffness;
+    int count, color_count;
+    int color_start[CLOTH_MAX_COLORS + 1];
+};
+
+/*
+ * Position-based dynamics cloth on a grid of x_res by y_res particles,
+ * with one array per component so that the solver can work on four
+ * particles at once. x, y and z hold the state at time; prev_x, prev_y
+ * and prev_z hold the state one CLOTH_STEP earlier, which gives the
+ * velocity, and which rendering interpolates from. gust_x, gust_y and
+ * gust_z hold what the wind field adds to each particle's wind in the
+ * step being taken.
+ *
+ * Each free particle is also tethered to the pinned particle at the
+ * start of its row, and kept no further from it than it is across the
+ * flat cloth. This stops the cloth stretching under load far more
+ * cheaply than more solver iterations would.
+ */
+struct cloth {
+    int x_res, y_res, particle_count, padded_count;
+    GLfloat *x, *y, *z;
+    GLfloat *prev_x, *prev_y, *prev_z;
+    GLfloat *normal_x, *normal_y, *normal_z;
+    GLfloat *inv_mass;
+    GLfloat *tether_x, *tether_y, *tether_z, *tether_length;
+    GLfloat *gust_x, *gust_y, *gust_z;
+    struct cloth_constraints constraints;
+
+    double time;
+    int max_steps;
+};
+
+/*
+ * The cloth starts flat in the z = 0 plane, from x = 0 to width and
+ * centered on y = 0, with the x = 0 column pinned in place.
+ */
+int make_cloth(struct cloth *out_cloth, int x_res, int y_res, GLfloat width, GLfloat height);
+void delete_cloth(struct cloth *cloth);
+
+/* Writes the velocity of a uniform wind at the given time. */
+typedef void (*wind_func)(GLfloat seconds, GLfloat *out_wind);
+
+/*
+ * Runs fixed CLOTH_STEPs until the cloth is within a step of time, each
+ * in the wind at the start of that step, so the result depends only on
+ * time and not on how often this is called. With max_steps nonzero, a
+ * cloth that has fallen further behind than that skips ahead instead of
+ * catching up. The field, if not NULL, adds its gusts to the uniform
+ * wind. Returns the number of steps taken.
+ */
+int advance_cloth(
+    struct cloth *cloth, struct job_pool *pool, double time,
+    wind_func wind, struct wind_field const *field
+);
+
+/*
+ * How far time, which should be the time last passed to advance_cloth,
+ * lies between the previous and current steps, from 0 to 1.
+ */
+GLfloat cloth_alpha(struct cloth const *cloth, double time);
+
+/* Writes positions and normals for time into a grid of flag vertices. */
+void cloth_vertices(struct cloth const *cloth, double time, struct flag_vertex *out_vertices);
@@ -0,0 +1,40 @@
+#version 130
+
+/*
+ * Transform feedback version of cloth.c.glsl, for contexts without
+ * compute shaders: drawn as one point per vertex with rasterization
+ * off. Must match cloth.c.glsl.
+ */
+
+uniform sampler2D state;
+uniform ivec2 resolution;
+uniform float alpha;
+
+out vec4 deformed_position, deformed_normal;
+
+/* rows 0-2 of each particle are the previous x, y and z; rows 3-5 the current */
+float component(ivec2 st, int row)
+{
+    return texelFetch(state, ivec2(st.x, st.y + row*resolution.y), 0).r;
+}
+
+vec3 particle(ivec2 st)
+{
+    st = clamp(st, ivec2(0), resolution - ivec2(1));
+    return mix(
+        vec3(component(st, 0), component(st, 1), component(st, 2)),
+        vec3(component(st, 3), component(st, 4), component(st, 5)),
+        alpha
+    );
+}
+
+void main()
+{
+    ivec2 st = ivec2(gl_VertexID % resolution.x, gl_VertexID / resolution.x);
+    vec3 s = particle(st + ivec2(1, 0)) - particle(st - ivec2(1, 0));
+    vec3 t = particle(st + ivec2(0, 1)) - particle(st - ivec2(0, 1));
+
+    deformed_position = vec4(particle(st), 0.0);
+    deformed_normal = vec4(normalize(cross(t, s)), 0.0);
+    gl_Position = vec4(0.0);
+}
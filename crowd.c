@@ -0,0 +1,534 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "thread-util.h"
+#include "job-pool.h"
+#include "memory.h"
+#include "gl-util.h"
+#include "gpu-resources.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+#include "wind-field.h"
+#include "cloth.h"
+#include "crowd.h"
+#include "gl-capture.h"
+
+/*
+ * The stands are rows of seats on an arc around the field's center,
+ * facing back toward the main flag and rising away from it.
+ */
+#define CROWD_CENTER_X      0.5f
+#define CROWD_CENTER_Z      0.0f
+#define CROWD_FIRST_ROW     4.0f
+#define CROWD_ROW_DEPTH     0.8f
+#define CROWD_ROW_RISE      0.4f
+#define CROWD_FLOOR         (-1.0f)
+#define CROWD_FLAG_RAISE    1.25f
+#define CROWD_SEAT_WIDTH    0.6f
+#define CROWD_ARC           2.0f
+#define CROWD_FLAG_SCALE    0.4f
+
+/*
+ * Gusts cross the stands at CROWD_GUST_SPEED; each flag reads the wind
+ * from the history at the delay for its distance from the center.
+ */
+#define CROWD_GUST_SPEED    12.0f
+#define CROWD_WIND_INTERVAL 0.25f
+#define CROWD_WIND_SPEED    5.0f
+
+/* the texture unit after the lights' and the shadow map's */
+#define CROWD_WIND_UNIT     5
+
+/* matches the period of the wave in crowd.v.glsl */
+#define CROWD_WAVE_PERIOD   4.0
+
+#define CROWD_FLAGS_PER_JOB 1024
+#define CROWD_ARRAYS        10
+#define CROWD_INSTANCE_FLOATS 8
+
+#define ROUND_UP(n, align)  (((n) + (align) - 1) / (align) * (align))
+
+/* Grid sizes of the levels of detail, and the distances they end at. */
+static const struct {
+    int x_res, y_res;
+    GLfloat distance;
+} CROWD_LOD_MESHES[CROWD_LODS] = {
+    { 16, 12,  6.0f },
+    {  8,  6, 16.0f },
+    {  4,  3, HUGE_VALF }
+};
+
+int crowd_supported(void)
+{
+    return GLEW_VERSION_3_3;
+}
+
+static GLfloat hash_unit(unsigned n)
+{
+    n ^= n >> 16;
+    n *= 0x7feb352dU;
+    n ^= n >> 15;
+    n *= 0x846ca68bU;
+    n ^= n >> 16;
+    return (GLfloat)(n >> 8) * (1.0f/16777216.0f);
+}
+
+static void lay_out_crowd(struct crowd *crowd)
+{
+    int row, seat, seats, i = 0;
+
+    for (row = 0; i < crowd->count; ++row) {
+        GLfloat distance = CROWD_FIRST_ROW + CROWD_ROW_DEPTH*(GLfloat)row;
+
+        seats = (int)(CROWD_ARC * distance / CROWD_SEAT_WIDTH);
+        for (seat = 0; seat < seats && i < crowd->count; ++seat, ++i) {
+            GLfloat angle = CROWD_ARC * (((GLfloat)seat + 0.5f)/(GLfloat)seats - 0.5f);
+            unsigned seed = 4u * (unsigned)i;
+
+            crowd->x[i] = CROWD_CENTER_X + distance*sinf(angle);
+            crowd->y[i] = CROWD_FLOOR + CROWD_ROW_RISE*(GLfloat)row + CROWD_FLAG_RAISE;
+            crowd->z[i] = CROWD_CENTER_Z + distance*cosf(angle);
+            crowd->scale[i] = CROWD_FLAG_SCALE * (0.8f + 0.4f*hash_unit(seed));
+            crowd->phase_offset[i] = (GLfloat)CROWD_WAVE_PERIOD * hash_unit(seed + 1);
+            crowd->frequency[i] = 0.8f + 0.45f*hash_unit(seed + 2);
+        }
+    }
+}
+
+static int make_lod_meshes(struct crowd *crowd)
+{
+    GLsizei vertex_count = 0, element_count = 0;
+    GLfloat *vertices;
+    GLushort *elements;
+    struct arena *arena = scratch_arena();
+    struct arena_mark mark = get_arena_mark(arena);
+    int lod, s, t, v = 0, e = 0;
+
+    for (lod = 0; lod < CROWD_LODS; ++lod) {
+        int x_res = CROWD_LOD_MESHES[lod].x_res, y_res = CROWD_LOD_MESHES[lod].y_res;
+        crowd->lod_first_elements[lod] = element_count;
+        crowd->lod_element_counts[lod] = 6 * (x_res - 1) * (y_res - 1);
+        vertex_count += x_res * y_res;
+        element_count += crowd->lod_element_counts[lod];
+    }
+    vertices = (GLfloat*) arena_alloc(arena, 2 * vertex_count * sizeof(GLfloat));
+    elements = (GLushort*) arena_alloc(arena, element_count * sizeof(GLushort));
+    if (!vertices || !elements) {
+        release_arena(arena, mark);
+        return 0;
+    }
+
+    for (lod = 0; lod < CROWD_LODS; ++lod) {
+        int x_res = CROWD_LOD_MESHES[lod].x_res, y_res = CROWD_LOD_MESHES[lod].y_res;
+        GLushort first = (GLushort)(v / 2), index;
+
+        for (t = 0; t < y_res; ++t)
+            for (s = 0; s < x_res; ++s) {
+                vertices[v++] = (GLfloat)s / (GLfloat)(x_res - 1);
+                vertices[v++] = (GLfloat)t / (GLfloat)(y_res - 1);
+            }
+        for (t = 0; t < y_res - 1; ++t)
+            for (s = 0; s < x_res - 1; ++s) {
+                index = first + (GLushort)(t*x_res + s);
+                elements[e++] = index;
+                elements[e++] = index + 1;
+                elements[e++] = index + x_res;
+                elements[e++] = index + 1;
+                elements[e++] = index + x_res + 1;
+                elements[e++] = index + x_res;
+            }
+    }
+
+    glGenBuffers(1, &crowd->vertex_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, crowd->vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, 2 * vertex_count * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+    track_gpu_resource(
+        GPU_BUFFER, crowd->vertex_buffer, 2 * vertex_count * sizeof(GLfloat), "crowd meshes"
+    );
+    glGenBuffers(1, &crowd->element_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, crowd->element_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, element_count * sizeof(GLushort), elements, GL_STATIC_DRAW);
+    track_gpu_resource(
+        GPU_BUFFER, crowd->element_buffer, element_count * sizeof(GLushort), "crowd meshes"
+    );
+
+    release_arena(arena, mark);
+    return 1;
+}
+
+static int make_crowd_program(struct crowd *crowd)
+{
+    crowd->program.vertex_shader = make_shader(GL_VERTEX_SHADER, "crowd.v.glsl");
+    if (crowd->program.vertex_shader == 0)
+        return 0;
+    crowd->program.fragment_shader = make_shader(GL_FRAGMENT_SHADER, "crowd.f.glsl");
+    if (crowd->program.fragment_shader == 0)
+        return 0;
+
+    crowd->program.program
+        = make_program(crowd->program.vertex_shader, crowd->program.fragment_shader);
+    if (crowd->program.program == 0)
+        return 0;
+
+    crowd->program.p_matrix = glGetUniformLocation(crowd->program.program, "p_matrix");
+    crowd->program.mv_matrix = glGetUniformLocation(crowd->program.program, "mv_matrix");
+    crowd->program.texture = glGetUniformLocation(crowd->program.program, "texture");
+    crowd->program.wind_field = glGetUniformLocation(crowd->program.program, "wind_field");
+    crowd->program.wind = glGetUniformLocation(crowd->program.program, "wind");
+    crowd->program.texcoord = glGetAttribLocation(crowd->program.program, "texcoord");
+    crowd->program.pose = glGetAttribLocation(crowd->program.program, "pose");
+    crowd->program.wave = glGetAttribLocation(crowd->program.program, "wave");
+    return 1;
+}
+
+/*
+ * The vertex array keeps the per-instance divisors out of the default
+ * vertex array state that the rest of the scene draws with. The instance
+ * attributes are pointed at each level's instances as it is drawn.
+ */
+static void make_vertex_array(struct crowd *crowd)
+{
+    glGenVertexArrays(1, &crowd->vertex_array);
+    track_gpu_resource(GPU_VERTEX_ARRAY, crowd->vertex_array, 0, "crowd");
+    glBindVertexArray(crowd->vertex_array);
+
+    glBindBuffer(GL_ARRAY_BUFFER, crowd->vertex_buffer);
+    glVertexAttribPointer(crowd->program.texcoord, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    glEnableVertexAttribArray(crowd->program.texcoord);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, crowd->element_buffer);
+
+    glGenBuffers(1, &crowd->instance_buffer);
+    track_gpu_resource(GPU_BUFFER, crowd->instance_buffer, 0, "crowd instances");
+    glEnableVertexAttribArray(crowd->program.pose);
+    glEnableVertexAttribArray(crowd->program.wave);
+    glVertexAttribDivisor(crowd->program.pose, 1);
+    glVertexAttribDivisor(crowd->program.wave, 1);
+
+    glBindVertexArray(0);
+}
+
+int make_crowd(struct crowd *out_crowd, int count)
+{
+    int stride, batch_count = (count + CROWD_FLAGS_PER_JOB - 1) / CROWD_FLAGS_PER_JOB;
+    size_t
+        float_size, instance_size, lod_size, batch_size;
+    char *block;
+
+    if (!make_crowd_program(out_crowd))
+        return 0;
+
+    stride = ROUND_UP(count, MEMORY_ALIGNMENT / (int)sizeof(GLfloat));
+    float_size = CROWD_ARRAYS * stride * sizeof(GLfloat);
+    instance_size = CROWD_INSTANCE_FLOATS * (size_t)count * sizeof(GLfloat);
+    lod_size = ROUND_UP((size_t)count, MEMORY_ALIGNMENT);
+    batch_size = CROWD_LODS * (size_t)batch_count * sizeof(int);
+
+    block = (char*) memory_alloc(float_size + instance_size + lod_size + batch_size, MEMORY_CROWD);
+    if (!block)
+        return 0;
+    memset(block, 0, float_size + instance_size + lod_size + batch_size);
+
+    out_crowd->count = count;
+    out_crowd->batch_count = batch_count;
+    out_crowd->x            = (GLfloat*)block;
+    out_crowd->y            = out_crowd->x + stride;
+    out_crowd->z            = out_crowd->x + 2*stride;
+    out_crowd->yaw          = out_crowd->x + 3*stride;
+    out_crowd->scale        = out_crowd->x + 4*stride;
+    out_crowd->phase_offset = out_crowd->x + 5*stride;
+    out_crowd->frequency    = out_crowd->x + 6*stride;
+    out_crowd->phase        = out_crowd->x + 7*stride;
+    out_crowd->wind         = out_crowd->x + 8*stride;
+    out_crowd->amplitude    = out_crowd->x + 9*stride;
+    out_crowd->instances    = (GLfloat*)(block + float_size);
+    out_crowd->lod          = (unsigned char*)(block + float_size + instance_size);
+    out_crowd->batch_offsets = (int*)(block + float_size + instance_size + lod_size);
+    out_crowd->time = 0.0;
+    out_crowd->upload_bytes = 0;
+    memset(out_crowd->lod_counts, 0, sizeof(out_crowd->lod_counts));
+
+    lay_out_crowd(out_crowd);
+    if (!make_lod_meshes(out_crowd)) {
+        memory_free(block);
+        return 0;
+    }
+    make_vertex_array(out_crowd);
+    return 1;
+}
+
+void delete_crowd(struct crowd *crowd)
+{
+    glDeleteVertexArrays(1, &crowd->vertex_array);
+    glDeleteBuffers(1, &crowd->instance_buffer);
+    glDeleteBuffers(1, &crowd->element_buffer);
+    glDeleteBuffers(1, &crowd->vertex_buffer);
+    glDetachShader(crowd->program.program, crowd->program.vertex_shader);
+    glDetachShader(crowd->program.program, crowd->program.fragment_shader);
+    glDeleteProgram(crowd->program.program);
+    glDeleteShader(crowd->program.vertex_shader);
+    glDeleteShader(crowd->program.fragment_shader);
+    untrack_gpu_resource(GPU_VERTEX_ARRAY, crowd->vertex_array);
+    untrack_gpu_resource(GPU_BUFFER, crowd->instance_buffer);
+    untrack_gpu_resource(GPU_BUFFER, crowd->element_buffer);
+    untrack_gpu_resource(GPU_BUFFER, crowd->vertex_buffer);
+    untrack_gpu_resource(GPU_PROGRAM, crowd->program.program);
+    untrack_gpu_resource(GPU_SHADER, crowd->program.vertex_shader);
+    untrack_gpu_resource(GPU_SHADER, crowd->program.fragment_shader);
+    memory_free(crowd->x);
+    crowd->x = NULL;
+}
+
+/*
+ * Planes of the view frustum in world space, from the rows of the
+ * combined matrix, normalized so that a plane's equation gives the
+ * distance from it.
+ */
+static void update_frustum(struct crowd *crowd, GLfloat const *p_matrix, GLfloat const *mv_matrix)
+{
+    GLfloat m[16], length;
+    int row, col, k, plane;
+
+    for (col = 0; col < 4; ++col)
+        for (row = 0; row < 4; ++row) {
+            m[col*4 + row] = 0.0f;
+            for (k = 0; k < 4; ++k)
+                m[col*4 + row] += p_matrix[k*4 + row] * mv_matrix[col*4 + k];
+        }
+
+    for (plane = 0; plane < 6; ++plane) {
+        GLfloat sign = plane & 1 ? -1.0f : 1.0f;
+        row = plane / 2;
+        for (col = 0; col < 4; ++col)
+            crowd->planes[plane][col] = m[col*4 + 3] + sign*m[col*4 + row];
+        length = sqrtf(
+            crowd->planes[plane][0]*crowd->planes[plane][0]
+            + crowd->planes[plane][1]*crowd->planes[plane][1]
+            + crowd->planes[plane][2]*crowd->planes[plane][2]
+        );
+        for (col = 0; col < 4; ++col)
+            crowd->planes[plane][col] /= length;
+    }
+
+    /* the modelview matrix is rigid, so its inverse rotation is its transpose */
+    for (k = 0; k < 3; ++k)
+        crowd->eye[k] = -(mv_matrix[k*4]*mv_matrix[12]
+            + mv_matrix[k*4 + 1]*mv_matrix[13]
+            + mv_matrix[k*4 + 2]*mv_matrix[14]);
+}
+
+static void update_wind_history(struct crowd *crowd, double time, wind_func wind)
+{
+    GLfloat velocity[3];
+    int k;
+
+    for (k = 0; k < CROWD_WIND_SAMPLES; ++k) {
+        wind((GLfloat)(time - CROWD_WIND_INTERVAL*(double)k), velocity);
+        crowd->wind_speeds[k] = sqrtf(velocity[0]*velocity[0] + velocity[2]*velocity[2]);
+        crowd->wind_angles[k] = atan2f(velocity[2], velocity[0]);
+    }
+}
+
+static void batch_range(struct crowd const *crowd, int job, int *out_first, int *out_end)
+{
+    *out_first = job * CROWD_FLAGS_PER_JOB;
+    *out_end = *out_first + CROWD_FLAGS_PER_JOB < crowd->count
+        ? *out_first + CROWD_FLAGS_PER_JOB : crowd->count;
+}
+
+static unsigned char flag_lod(struct crowd const *crowd, int i)
+{
+    GLfloat
+        scale = crowd->scale[i],
+        center[3] = {
+            crowd->x[i] + 0.5f*scale*cosf(crowd->yaw[i]),
+            crowd->y[i],
+            crowd->z[i] + 0.5f*scale*sinf(crowd->yaw[i])
+        },
+        radius = 0.75f*scale,
+        dx = center[0] - crowd->eye[0],
+        dy = center[1] - crowd->eye[1],
+        dz = center[2] - crowd->eye[2],
+        distance;
+    int plane;
+    unsigned char lod;
+
+    for (plane = 0; plane < 6; ++plane) {
+        GLfloat const *p = crowd->planes[plane];
+        if (p[0]*center[0] + p[1]*center[1] + p[2]*center[2] + p[3] < -radius)
+            return CROWD_CULLED;
+    }
+
+    distance = sqrtf(dx*dx + dy*dy + dz*dz);
+    for (lod = 0; lod < CROWD_LODS - 1; ++lod)
+        if (distance < CROWD_LOD_MESHES[lod].distance)
+            break;
+    return lod;
+}
+
+/*
+ * Everything here is a function of time alone, so an export split across
+ * processes animates the crowd the same as one that renders every frame.
+ */
+static void update_job(int job, int worker, void *data)
+{
+    struct crowd *crowd = (struct crowd*)data;
+    int first, end, i, *counts = &crowd->batch_offsets[job * CROWD_LODS];
+    GLfloat delay_scale = 1.0f/(CROWD_GUST_SPEED*CROWD_WIND_INTERVAL);
+
+    batch_range(crowd, job, &first, &end);
+    memset(counts, 0, CROWD_LODS * sizeof(int));
+
+    for (i = first; i < end; ++i) {
+        GLfloat
+            dx = crowd->x[i] - CROWD_CENTER_X,
+            dz = crowd->z[i] - CROWD_CENTER_Z,
+            delay = sqrtf(dx*dx + dz*dz) * delay_scale,
+            f;
+        int k = (int)delay;
+
+        if (k > CROWD_WIND_SAMPLES - 2)
+            k = CROWD_WIND_SAMPLES - 2;
+        f = fminf(delay - (GLfloat)k, 1.0f);
+
+        crowd->wind[i] = crowd->wind_speeds[k] + f*(crowd->wind_speeds[k + 1] - crowd->wind_speeds[k]);
+        crowd->yaw[i] = crowd->wind_angles[k] + f*(crowd->wind_angles[k + 1] - crowd->wind_angles[k]);
+        crowd->amplitude[i] = fminf(fmaxf(crowd->wind[i] * (1.0f/CROWD_WIND_SPEED), 0.25f), 1.5f);
+        crowd->phase[i] = (GLfloat)fmod(
+            crowd->time * (double)crowd->frequency[i] + (double)crowd->phase_offset[i],
+            CROWD_WAVE_PERIOD
+        );
+        crowd->lod[i] = flag_lod(crowd, i);
+        if (crowd->lod[i] != CROWD_CULLED)
+            ++counts[crowd->lod[i]];
+    }
+}
+
+static void write_job(int job, int worker, void *data)
+{
+    struct crowd *crowd = (struct crowd*)data;
+    int first, end, i, *offsets = &crowd->batch_offsets[job * CROWD_LODS];
+
+    batch_range(crowd, job, &first, &end);
+    for (i = first; i < end; ++i) {
+        GLfloat *instance;
+
+        if (crowd->lod[i] == CROWD_CULLED)
+            continue;
+        instance = &crowd->instances[CROWD_INSTANCE_FLOATS * offsets[crowd->lod[i]]++];
+        instance[0] = crowd->x[i];
+        instance[1] = crowd->y[i];
+        instance[2] = crowd->z[i];
+        instance[3] = crowd->scale[i];
+        instance[4] = crowd->phase[i];
+        instance[5] = crowd->amplitude[i];
+        instance[6] = cosf(crowd->yaw[i]);
+        instance[7] = sinf(crowd->yaw[i]);
+    }
+}
+
+/*
+ * Each batch counts its visible flags per level, and a prefix sum over
+ * the counts gives every batch its own place to write in each level's
+ * run of instances, so the second pass needs no locking and packs the
+ * instances in the same order whatever the number of threads.
+ */
+static int pack_instances(struct crowd *crowd)
+{
+    int lod, batch, offset = 0;
+
+    for (lod = 0; lod < CROWD_LODS; ++lod) {
+        crowd->lod_first[lod] = offset;
+        for (batch = 0; batch < crowd->batch_count; ++batch) {
+            int *slot = &crowd->batch_offsets[batch * CROWD_LODS + lod], count = *slot;
+            *slot = offset;
+            offset += count;
+        }
+        crowd->lod_counts[lod] = offset - crowd->lod_first[lod];
+    }
+    return offset;
+}
+
+void update_crowd(
+    struct crowd *crowd, struct job_pool *pool, double time, wind_func wind,
+    GLfloat const *p_matrix, GLfloat const *mv_matrix
+) {
+    int visible;
+
+    crowd->time = time;
+    update_wind_history(crowd, time, wind);
+    update_frustum(crowd, p_matrix, mv_matrix);
+
+    run_jobs(pool, crowd->batch_count, &update_job, crowd);
+    visible = pack_instances(crowd);
+    crowd->upload_bytes = (GLsizeiptr)CROWD_INSTANCE_FLOATS * visible * sizeof(GLfloat);
+    if (visible == 0)
+        return;
+    run_jobs(pool, crowd->batch_count, &write_job, crowd);
+
+    glBindBuffer(GL_ARRAY_BUFFER, crowd->instance_buffer);
+    glBufferData(
+        GL_ARRAY_BUFFER,
+        CROWD_INSTANCE_FLOATS * visible * sizeof(GLfloat),
+        crowd->instances,
+        GL_STREAM_DRAW
+    );
+    resize_gpu_resource(GPU_BUFFER, crowd->instance_buffer, (size_t)crowd->upload_bytes);
+}
+
+/*
+ * Culling is off, since both sides of a crowd flag can face the camera.
+ */
+int draw_crowd(
+    struct crowd const *crowd, struct wind_field const *field,
+    GLfloat const *p_matrix, GLfloat const *mv_matrix, GLuint texture
+) {
+    GLsizei stride = CROWD_INSTANCE_FLOATS * sizeof(GLfloat);
+    GLfloat offset[3] = { 0.0f, 0.0f, 0.0f };
+    int lod, draws = 0;
+
+    glUseProgram(crowd->program.program);
+    glUniformMatrix4fv(crowd->program.p_matrix, 1, GL_FALSE, p_matrix);
+    glUniformMatrix4fv(crowd->program.mv_matrix, 1, GL_FALSE, mv_matrix);
+    glUniform1i(crowd->program.texture, 0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    /* without a field the sampler reads an unbound unit, which zero strength ignores */
+    if (field)
+        wind_field_offset(field, crowd->time, offset);
+    glUniform1i(crowd->program.wind_field, CROWD_WIND_UNIT);
+    glUniform4f(
+        crowd->program.wind, offset[0], offset[1], offset[2], field ? field->strength : 0.0f
+    );
+    glActiveTexture(GL_TEXTURE0 + CROWD_WIND_UNIT);
+    glBindTexture(GL_TEXTURE_3D, field ? field->texture : 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    glDisable(GL_CULL_FACE);
+    glBindVertexArray(crowd->vertex_array);
+    glBindBuffer(GL_ARRAY_BUFFER, crowd->instance_buffer);
+    for (lod = 0; lod < CROWD_LODS; ++lod) {
+        GLsizeiptr first = (GLsizeiptr)crowd->lod_first[lod] * stride;
+
+        if (crowd->lod_counts[lod] == 0)
+            continue;
+        glVertexAttribPointer(
+            crowd->program.pose, 4, GL_FLOAT, GL_FALSE, stride, (void*)first
+        );
+        glVertexAttribPointer(
+            crowd->program.wave, 4, GL_FLOAT, GL_FALSE, stride,
+            (void*)(first + 4*sizeof(GLfloat))
+        );
+        glDrawElementsInstanced(
+            GL_TRIANGLES, crowd->lod_element_counts[lod], GL_UNSIGNED_SHORT,
+            (void*)(crowd->lod_first_elements[lod] * sizeof(GLushort)),
+            crowd->lod_counts[lod]
+        );
+        ++draws;
+    }
+    glBindVertexArray(0);
+    glEnable(GL_CULL_FACE);
+    return draws;
+}
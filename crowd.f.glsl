@@ -0,0 +1,27 @@
+#version 110
+
+uniform mat4 mv_matrix;
+uniform sampler2D texture;
+
+varying vec3 frag_normal;
+varying vec2 frag_texcoord;
+
+/* must match flag.f.glsl */
+const vec3 light_direction = vec3(0.408248, -0.816497, 0.408248);
+const vec4 light_diffuse = vec4(0.8, 0.8, 0.8, 0.0);
+const vec4 light_ambient = vec4(0.2, 0.2, 0.2, 1.0);
+
+/*
+ * Crowd flags are too small on screen for specular highlights, point
+ * lights or shadows to show, so they only take the sun. Both sides are
+ * lit, since culling is off for them.
+ */
+void main()
+{
+    vec3 mv_light_direction = (mv_matrix * vec4(light_direction, 0.0)).xyz,
+         normal = normalize(gl_FrontFacing ? frag_normal : -frag_normal);
+
+    vec4 diffuse_factor = max(-dot(normal, mv_light_direction), 0.0) * light_diffuse;
+
+    gl_FragColor = (diffuse_factor + light_ambient) * texture2D(texture, frag_texcoord);
+}
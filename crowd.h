@@ -0,0 +1,75 @@
+#define CROWD_LODS          3
+#define CROWD_CULLED        CROWD_LODS
+#define CROWD_WIND_SAMPLES  64
+
+/*
+ * A stadium's worth of small flags, far too many to simulate as cloth.
+ * Each is drawn as a closed-form wave by crowd.v.glsl, driven by state
+ * kept in one array per field, so that an update is a linear sweep over
+ * contiguous arrays split across the job pool, with nothing allocated
+ * or pointed to per flag.
+ *
+ * x, y, z, scale, phase_offset and frequency are fixed when the crowd
+ * is laid out. yaw, wind, amplitude, phase and lod are recomputed by
+ * every update; lod is CROWD_CULLED for a flag outside the view. The
+ * visible flags are then packed into instances grouped by level of
+ * detail, and each level is drawn with one instanced draw call.
+ */
+struct crowd {
+    int count, batch_count;
+
+    GLfloat *x, *y, *z, *yaw, *scale;
+    GLfloat *phase_offset, *frequency;
+    GLfloat *phase, *wind, *amplitude;
+    unsigned char *lod;
+
+    /* CROWD_LODS per batch: each batch's counts, then where it writes */
+    int *batch_offsets;
+    GLfloat *instances;
+    int lod_counts[CROWD_LODS], lod_first[CROWD_LODS];
+
+    /* the wind at the stands' center, going back in time */
+    GLfloat wind_speeds[CROWD_WIND_SAMPLES], wind_angles[CROWD_WIND_SAMPLES];
+    GLfloat planes[6][4];
+    GLfloat eye[3];
+    double time;
+
+    GLuint vertex_array, vertex_buffer, element_buffer, instance_buffer;
+    GLsizeiptr upload_bytes;    /* by the last update */
+    GLsizei lod_element_counts[CROWD_LODS], lod_first_elements[CROWD_LODS];
+
+    struct {
+        GLuint vertex_shader, fragment_shader, program;
+        GLint p_matrix, mv_matrix, texture;
+        GLint wind_field, wind;
+        GLint texcoord, pose, wave;
+    } program;
+};
+
+int crowd_supported(void);
+
+/* Lays count flags out on tiered stands facing the main flag. */
+int make_crowd(struct crowd *out_crowd, int count);
+void delete_crowd(struct crowd *crowd);
+
+/*
+ * Animates the crowd for time and uploads the visible flags' instances.
+ * Flags are culled against, and their detail chosen for, the whole view
+ * given by p_matrix and mv_matrix. Gusts reach each flag later the
+ * further it sits from the field, so the wind is sampled over the past
+ * few seconds rather than at time alone.
+ */
+void update_crowd(
+    struct crowd *crowd, struct job_pool *pool, double time, wind_func wind,
+    GLfloat const *p_matrix, GLfloat const *mv_matrix
+);
+
+/*
+ * Leaves the crowd's program bound. The field, if not NULL, must have
+ * its texture; its gusts are read at the time of the last update.
+ * Returns the number of draw calls.
+ */
+int draw_crowd(
+    struct crowd const *crowd, struct wind_field const *field,
+    GLfloat const *p_matrix, GLfloat const *mv_matrix, GLuint texture
+);
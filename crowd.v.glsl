@@ -0,0 +1,65 @@
+#version 110
+
+uniform mat4 p_matrix, mv_matrix;
+uniform sampler3D wind_field;
+uniform vec4 wind;      /* the field's offset, and the strength of its gusts */
+
+attribute vec2 texcoord;
+
+/* per instance: position and scale; phase, amplitude, cosine and sine of yaw */
+attribute vec4 pose, wave;
+
+varying vec3 frag_normal;
+varying vec2 frag_texcoord;
+
+const float PI = 3.14159265;
+
+/* matches WIND_FIELD_PERIOD in wind-field.h */
+const float WIND_FIELD_PERIOD = 8.0;
+
+/*
+ * A flag hanging from its pole at s = 0, sagging away from the wind and
+ * rippling along its length, with the normal from the surface's partial
+ * derivatives. The wave repeats every 4 units of phase.
+ *
+ * Each vertex reads the wind field where it would hang flat: a gust
+ * along the flag strengthens its wave there, and one across it shifts
+ * the ripple. The field changes little across a flag, so the normal
+ * leaves its variation out.
+ */
+void main()
+{
+    mat3 yaw = mat3(
+         wave.z, 0.0, wave.w,
+         0.0,    1.0, 0.0,
+        -wave.w, 0.0, wave.z
+    );
+    float s = texcoord.x, t = texcoord.y;
+    vec3 rest = pose.xyz + pose.w*(yaw*vec3(s, 0.75*t - 0.375, 0.0));
+    vec3 gust = wind.w * (
+        2.0*texture3DLod(wind_field, (rest + wind.xyz)/WIND_FIELD_PERIOD, 0.0).xyz - 1.0
+    );
+
+    float along = dot(gust, yaw[0]), across = dot(gust, yaw[2]),
+          amplitude = wave.y * max(1.0 + along, 0.0),
+          sag = amplitude * (0.0625 + 0.03125*sin(PI*wave.x)),
+          ripple = 1.5*PI*(wave.x + s) + PI*across;
+
+    vec3 position = vec3(
+        s - sag*(1.0 - 0.5*s)*t*(t - 1.0),
+        0.75*t - 0.375,
+        0.125*amplitude*s*sin(ripple)
+    );
+    vec3 ds = vec3(
+        1.0 + 0.5*sag*t*(t - 1.0),
+        0.0,
+        0.125*amplitude*(sin(ripple) + 1.5*PI*s*cos(ripple))
+    );
+    vec3 dt = vec3(-sag*(1.0 - 0.5*s)*(2.0*t - 1.0), 0.75, 0.0);
+
+    vec4 eye_position = mv_matrix * vec4(pose.xyz + pose.w*(yaw*position), 1.0);
+
+    gl_Position = p_matrix * eye_position;
+    frag_normal = (mv_matrix * vec4(yaw*cross(dt, ds), 0.0)).xyz;
+    frag_texcoord = texcoord;
+}
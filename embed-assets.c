@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "memory.h"
+#include "file-util.h"
+#include "embedded-assets.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+
+/*
+ * Build-time tool that writes a C source file embedding the given assets,
+ * for the flag-embedded target:
+ *
+ *   embed-assets <output.c> [--background-mesh] <file>...
+ *
+ * Files ending in .tga are stored decoded, as read_tga returns them, so
+ * that loading them is only a texture upload. --background-mesh bakes
+ * the output of generate_background_mesh.
+ */
+
+#define BYTES_PER_LINE 16
+
+static int ends_with(const char *s, const char *suffix)
+{
+    size_t length = strlen(s), suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(s + length - suffix_length, suffix) == 0;
+}
+
+/*
+ * Each asset is wrapped in a union with a double so that baked vertex
+ * data is aligned for the floats it holds.
+ */
+static void write_asset_data(FILE *out, int index, void const *data, size_t size, int terminate)
+{
+    unsigned char const *bytes = (unsigned char const*)data;
+    size_t i, total = size + (terminate ? 1 : 0);
+
+    fprintf(out,
+        "static const union { unsigned char bytes[%lu]; double align; } asset_%d = {{",
+        (unsigned long)(total > 0 ? total : 1), index
+    );
+    for (i = 0; i < total; ++i)
+        fprintf(out, "%s0x%02x,",
+            i % BYTES_PER_LINE == 0 ? "\n    " : " ",
+            i < size ? bytes[i] : 0
+        );
+    if (total == 0)
+        fprintf(out, "0");
+    fprintf(out, "\n}};\n\n");
+}
+
+struct asset_entry {
+    const char *name;
+    size_t size;
+    int width, height;
+};
+
+static int embed_file(
+    FILE *out, struct arena *arena, int index,
+    const char *filename, struct asset_entry *out_entry
+) {
+    void *data;
+
+    out_entry->name = filename;
+    out_entry->width = out_entry->height = 0;
+
+    if (ends_with(filename, ".tga")) {
+        data = read_tga(arena, filename, &out_entry->width, &out_entry->height);
+        if (!data)
+            return 0;
+        /* upload_texture only takes 24-bit BGR pixels */
+        out_entry->size = (size_t)out_entry->width * out_entry->height * 3;
+        write_asset_data(out, index, data, out_entry->size, 0);
+    } else {
+        GLint length;
+        data = file_contents(arena, filename, &length);
+        if (!data)
+            return 0;
+        out_entry->size = (size_t)length;
+        write_asset_data(out, index, data, out_entry->size, 1);
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct asset_entry *entries;
+    struct mesh_data background;
+    struct arena arena;
+    FILE *out;
+    int i, count = 0, ok = 1, has_background = 0;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <output.c> [--background-mesh] <file>...\n", argv[0]);
+        return 1;
+    }
+
+    init_memory(0);
+    init_arena(&arena, 1024*1024, MEMORY_SCRATCH);
+
+    /* one entry an argument, but the one --background-mesh adds two */
+    entries = (struct asset_entry*) malloc((argc + 1) * sizeof(struct asset_entry));
+    out = fopen(argv[1], "w");
+    if (!entries || !out) {
+        fprintf(stderr, "Unable to open %s for writing\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(out,
+        "/* generated by embed-assets; do not edit */\n"
+        "#include <stddef.h>\n"
+        "#include \"embedded-assets.h\"\n\n"
+    );
+
+    for (i = 2; i < argc && ok; ++i) {
+        struct arena_mark mark = get_arena_mark(&arena);
+
+        if (strcmp(argv[i], "--background-mesh") == 0) {
+            if (has_background) {
+                fprintf(stderr, "--background-mesh given more than once\n");
+                ok = 0;
+                break;
+            }
+            has_background = 1;
+            if (!generate_background_mesh(&background, &arena)) {
+                ok = 0;
+                break;
+            }
+            entries[count].name = BACKGROUND_VERTICES_ASSET;
+            entries[count].size = background.vertex_count * sizeof(struct flag_vertex);
+            entries[count].width = entries[count].height = 0;
+            write_asset_data(out, count, background.vertices, entries[count].size, 0);
+            ++count;
+
+            entries[count].name = BACKGROUND_ELEMENTS_ASSET;
+            entries[count].size = background.element_count * sizeof(GLushort);
+            entries[count].width = entries[count].height = 0;
+            write_asset_data(out, count, background.elements, entries[count].size, 0);
+            ++count;
+        } else {
+            if (!embed_file(out, &arena, count, argv[i], &entries[count]))
+                ok = 0;
+            else
+                ++count;
+        }
+        release_arena(&arena, mark);
+    }
+
+    fprintf(out, "static const struct embedded_asset assets[] = {\n");
+    for (i = 0; i < count; ++i)
+        fprintf(out, "    { \"%s\", asset_%d.bytes, %lu, %d, %d },\n",
+            entries[i].name, i, (unsigned long)entries[i].size,
+            entries[i].width, entries[i].height
+        );
+    if (count == 0)
+        fprintf(out, "    { \"\", NULL, 0, 0, 0 },\n");
+    fprintf(out,
+        "};\n\n"
+        "const struct embedded_asset *const embedded_assets = assets;\n"
+        "const int embedded_asset_count = %d;\n",
+        count
+    );
+
+    if (fclose(out) != 0)
+        ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Failed to embed assets into %s\n", argv[1]);
+        remove(argv[1]);
+    }
+    delete_arena(&arena);
+    free(entries);
+    return !ok;
+}
@@ -0,0 +1,31 @@
+/*
+ * Assets compiled into the executable by the embed-assets tool. The
+ * flag-embedded target links the generated embedded-assets.c; the
+ * ordinary build links no-embedded-assets.c, whose table is empty, so
+ * everything is loaded from files as before.
+ *
+ * Text assets are followed by a nul that size does not count. Textures
+ * hold their pixels as read_tga returns them, with width and height set;
+ * both are 0 for everything else.
+ */
+struct embedded_asset {
+    const char *name;
+    const void *data;
+    size_t size;
+    int width, height;
+};
+
+/* baked output of generate_background_mesh */
+#define BACKGROUND_VERTICES_ASSET "background-mesh.vertices"
+#define BACKGROUND_ELEMENTS_ASSET "background-mesh.elements"
+
+extern const struct embedded_asset *const embedded_assets;
+extern const int embedded_asset_count;
+
+struct embedded_asset const *find_embedded_asset(const char *name);
+
+/*
+ * Load from files even where an embedded copy exists, for hot reloading
+ * while developing against an embedded build.
+ */
+void prefer_asset_files(int prefer);
@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <sys/types.h>
+#  include <sys/wait.h>
+#endif
+#include "memory.h"
+#include "file-util.h"
+#include "options.h"
+#include "export.h"
+
+static int is_y4m_path(const char *path)
+{
+    size_t length = strlen(path);
+    return strcmp(path, "-") == 0
+        || (length >= 4 && strcmp(path + length - 4, ".y4m") == 0);
+}
+
+/*
+ * An image path is used as the format string for each frame's file name,
+ * so it must take exactly one integer conversion, such as %04d, with any
+ * other '%' written as %%.
+ */
+static int is_frame_pattern(const char *path)
+{
+    int conversions = 0;
+
+    for (; *path; ++path) {
+        if (*path != '%')
+            continue;
+        if (*++path == '%')
+            continue;
+        while (*path && strchr("-+ #0", *path))
+            ++path;
+        while (*path >= '0' && *path <= '9')
+            ++path;
+        if (*path == '.')
+            for (++path; *path >= '0' && *path <= '9'; ++path)
+                ;
+        if (*path != 'd' && *path != 'i')
+            return 0;
+        ++conversions;
+    }
+    return conversions == 1;
+}
+
+static void part_path(char *out_path, size_t size, const char *path, int worker)
+{
+    snprintf(out_path, size, "%s.part%d", path, worker);
+}
+
+static void write_y4m_header(FILE *stream, struct flag_options const *options)
+{
+    int fps_milli = (int)(options->export_fps * 1000.0f + 0.5f);
+
+    if (fps_milli % 1000 == 0)
+        fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+            options->export_size[0], options->export_size[1], fps_milli/1000);
+    else
+        fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C420jpeg\n",
+            options->export_size[0], options->export_size[1], fps_milli);
+}
+
+static int append_file(FILE *stream, const char *path)
+{
+    char buffer[65536];
+    size_t read;
+    FILE *f = fopen(path, "rb");
+    int ok = 1;
+
+    if (!f) {
+        fprintf(stderr, "Unable to open %s for reading\n", path);
+        return 0;
+    }
+    while (ok && (read = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        ok = fwrite(buffer, 1, read, stream) == read;
+    fclose(f);
+    return ok;
+}
+
+/*
+ * The y4m parts written by the workers contain only frames; the parent
+ * writes the stream header and joins them in order.
+ */
+static int join_y4m_parts(struct flag_options const *options, int workers)
+{
+    FILE *stream = strcmp(options->export_path, "-") == 0
+        ? stdout : fopen(options->export_path, "wb");
+    char path[1024];
+    int i, ok = 1;
+
+    if (!stream) {
+        fprintf(stderr, "Unable to open %s for writing\n", options->export_path);
+        return 0;
+    }
+    write_y4m_header(stream, options);
+    for (i = 0; i < workers; ++i) {
+        part_path(path, sizeof(path), options->export_path, i);
+        ok = ok && append_file(stream, path);
+        remove(path);
+    }
+    if (stream != stdout)
+        ok = fclose(stream) == 0 && ok;
+    else
+        ok = fflush(stream) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "Unable to write %s\n", options->export_path);
+    return ok;
+}
+
+/*
+ * The cloth simulation is deterministic, so the frame range can be split
+ * into contiguous chunks rendered by independent processes, each with its
+ * own GL context, that each simulate from time 0 up to their first frame.
+ * This must run before glutInit, since a display connection cannot be
+ * shared across fork().
+ *
+ * Returns 1 in a process that should render out_job, 0 in the parent once
+ * all workers have finished successfully, or -1 on failure.
+ */
+int start_export_workers(struct flag_options const *options, struct export_job *out_job)
+{
+    int frames = options->export_frames;
+    int workers = options->export_jobs;
+
+    /* the cloth settles from flat and the wind never repeats, so no length loops */
+    if (frames < 1) {
+        fprintf(stderr, "--export requires --export-frames\n");
+        return -1;
+    }
+    if (is_y4m_path(options->export_path)) {
+        if (options->export_size[0] % 2 != 0 || options->export_size[1] % 2 != 0) {
+            fprintf(stderr, "y4m export requires an even frame size\n");
+            return -1;
+        }
+    } else if (!is_frame_pattern(options->export_path)) {
+        fprintf(stderr,
+            "--export needs a .y4m path or a pattern with one integer conversion "
+            "such as frame%%04d.tga\n");
+        return -1;
+    }
+    if (workers > frames)
+        workers = frames;
+
+#ifdef _WIN32
+    if (workers > 1)
+        fprintf(stderr, "Worker processes not supported on this platform, exporting serially\n");
+    workers = 1;
+#endif
+
+    if (workers <= 1) {
+        out_job->worker = -1;
+        out_job->first_frame = 0;
+        out_job->frame_count = frames;
+        return 1;
+    }
+
+#ifndef _WIN32
+    {
+        pid_t pids[64];
+        int i, ok = 1;
+
+        if (workers > (int)(sizeof(pids)/sizeof(pids[0])))
+            workers = (int)(sizeof(pids)/sizeof(pids[0]));
+
+        fflush(stdout);
+        fflush(stderr);
+        for (i = 0; i < workers; ++i) {
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                out_job->worker = i;
+                out_job->first_frame = frames*i/workers;
+                out_job->frame_count = frames*(i + 1)/workers - out_job->first_frame;
+                return 1;
+            }
+            if (pids[i] < 0) {
+                perror("fork");
+                workers = i;
+                ok = 0;
+                break;
+            }
+        }
+
+        for (i = 0; i < workers; ++i) {
+            int status;
+            if (waitpid(pids[i], &status, 0) < 0
+                || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "Export worker %d failed\n", i);
+                ok = 0;
+            }
+        }
+
+        if (ok && is_y4m_path(options->export_path))
+            ok = join_y4m_parts(options, workers);
+        return ok ? 0 : -1;
+    }
+#else
+    return -1;
+#endif
+}
+
+/*
+ * A worker of a split y4m export writes its frames to a part file for
+ * the parent to join; otherwise the stream gets its header right away.
+ */
+int open_frame_writer(
+    struct frame_writer *out_writer,
+    struct flag_options const *options,
+    struct export_job const *job
+) {
+    out_writer->pattern = options->export_path;
+    out_writer->stream = NULL;
+    out_writer->yuv = NULL;
+    out_writer->failed = 0;
+
+    if (!is_y4m_path(options->export_path))
+        return 1;
+
+    if (job->worker >= 0) {
+        char path[1024];
+        part_path(path, sizeof(path), options->export_path, job->worker);
+        out_writer->stream = fopen(path, "wb");
+    } else if (strcmp(options->export_path, "-") == 0)
+        out_writer->stream = stdout;
+    else
+        out_writer->stream = fopen(options->export_path, "wb");
+
+    if (!out_writer->stream) {
+        fprintf(stderr, "Unable to open %s for writing\n", options->export_path);
+        return 0;
+    }
+    if (job->worker < 0)
+        write_y4m_header(out_writer->stream, options);
+
+    out_writer->yuv = malloc(options->export_size[0] * options->export_size[1] * 3/2);
+    return 1;
+}
+
+#define Y_OF(r, g, b)  (( 66*(r) + 129*(g) +  25*(b) + 128)/256 +  16)
+#define CB_OF(r, g, b) ((-38*(r) -  74*(g) + 112*(b) + 128)/256 + 128)
+#define CR_OF(r, g, b) ((112*(r) -  94*(g) -  18*(b) + 128)/256 + 128)
+
+/*
+ * Convert bottom-up BGRA to top-down planar BT.601 4:2:0, averaging each
+ * 2x2 block for the chroma planes.
+ */
+static void bgra_to_yuv420(
+    unsigned char *out_yuv,
+    unsigned char const *pixels,
+    GLsizei width, GLsizei height
+) {
+    unsigned char
+        *y_plane = out_yuv,
+        *cb_plane = out_yuv + width*height,
+        *cr_plane = cb_plane + (width/2)*(height/2);
+    GLsizei x, y;
+
+    for (y = 0; y < height; ++y) {
+        unsigned char const *row = pixels + (height - 1 - y)*width*4;
+        for (x = 0; x < width; ++x)
+            y_plane[y*width + x] = (unsigned char)Y_OF(row[x*4+2], row[x*4+1], row[x*4+0]);
+    }
+
+    for (y = 0; y < height/2; ++y) {
+        unsigned char const
+            *row0 = pixels + (height - 1 - 2*y)*width*4,
+            *row1 = row0 - width*4;
+        for (x = 0; x < width/2; ++x) {
+            int
+                b = row0[x*8+0] + row0[x*8+4] + row1[x*8+0] + row1[x*8+4],
+                g = row0[x*8+1] + row0[x*8+5] + row1[x*8+1] + row1[x*8+5],
+                r = row0[x*8+2] + row0[x*8+6] + row1[x*8+2] + row1[x*8+6];
+            r = (r + 2)/4; g = (g + 2)/4; b = (b + 2)/4;
+            cb_plane[y*(width/2) + x] = (unsigned char)CB_OF(r, g, b);
+            cr_plane[y*(width/2) + x] = (unsigned char)CR_OF(r, g, b);
+        }
+    }
+}
+
+#undef Y_OF
+#undef CB_OF
+#undef CR_OF
+
+void write_frame(void const *pixels, GLsizei width, GLsizei height, int frame, void *data)
+{
+    struct frame_writer *writer = (struct frame_writer*)data;
+
+    if (writer->failed)
+        return;
+
+    if (writer->stream) {
+        size_t bytes = (size_t)width*height*3/2;
+        bgra_to_yuv420(writer->yuv, (unsigned char const*)pixels, width, height);
+        if (fputs("FRAME\n", writer->stream) == EOF
+            || fwrite(writer->yuv, 1, bytes, writer->stream) != bytes) {
+            fprintf(stderr, "Unable to write frame %d\n", frame);
+            writer->failed = 1;
+        }
+    } else {
+        char path[1024];
+        snprintf(path, sizeof(path), writer->pattern, frame);
+        if (!write_tga(path, width, height, pixels))
+            writer->failed = 1;
+    }
+}
+
+int close_frame_writer(struct frame_writer *writer)
+{
+    if (writer->stream) {
+        if (writer->stream == stdout) {
+            if (fflush(stdout) != 0)
+                writer->failed = 1;
+        } else if (fclose(writer->stream) != 0)
+            writer->failed = 1;
+    }
+    free(writer->yuv);
+    return !writer->failed;
+}
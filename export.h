@@ -0,0 +1,20 @@
+struct export_job {
+    int worker, first_frame, frame_count;
+};
+
+struct frame_writer {
+    const char *pattern;
+    FILE *stream;
+    unsigned char *yuv;
+    int failed;
+};
+
+int start_export_workers(struct flag_options const *options, struct export_job *out_job);
+
+int open_frame_writer(
+    struct frame_writer *out_writer,
+    struct flag_options const *options,
+    struct export_job const *job
+);
+void write_frame(void const *pixels, GLsizei width, GLsizei height, int frame, void *writer);
+int close_frame_writer(struct frame_writer *writer);
@@ -2,12 +2,61 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+#include "memory.h"
+#include "file-util.h"
+#include "embedded-assets.h"
 
-void *file_contents(const char *filename, GLint *length)
+static int asset_files_preferred = 0;
+
+struct embedded_asset const *find_embedded_asset(const char *name)
+{
+    int i;
+
+    for (i = 0; i < embedded_asset_count; ++i)
+        if (strcmp(embedded_assets[i].name, name) == 0)
+            return &embedded_assets[i];
+    return NULL;
+}
+
+void prefer_asset_files(int prefer)
+{
+    asset_files_preferred = prefer;
+}
+
+/*
+ * file_contents and read_tga allocate their result from the given arena,
+ * so the caller takes a mark beforehand and releases back to it once it
+ * is done. Neither touches GL, so they may run on any thread that owns
+ * the arena.
+ *
+ * Assets embedded in the executable are returned in place, without
+ * touching the file system, unless prefer_asset_files has been called.
+ * The result must be treated as read-only either way.
+ */
+
+void *file_contents(struct arena *arena, const char *filename, GLint *length)
 {
-    FILE *f = fopen(filename, "r");
+    struct embedded_asset const *asset
+        = asset_files_preferred ? NULL : find_embedded_asset(filename);
+    FILE *f;
     void *buffer;
 
+    if (asset) {
+        *length = (GLint)asset->size;
+        return (void*)asset->data;
+    }
+
+    f = fopen(filename, "r");
     if (!f) {
         fprintf(stderr, "Unable to open %s for reading\n", filename);
         return NULL;
@@ -17,7 +66,11 @@ void *file_contents(const char *filename, GLint *length)
     *length = ftell(f);
     fseek(f, 0, SEEK_SET);
 
-    buffer = malloc(*length+1);
+    buffer = arena_alloc(arena, *length+1);
+    if (!buffer) {
+        fclose(f);
+        return NULL;
+    }
     *length = fread(buffer, 1, *length, f);
     fclose(f);
     ((char*)buffer)[*length] = '\0';
@@ -25,12 +78,12 @@ void *file_contents(const char *filename, GLint *length)
     return buffer;
 }
 
-static short le_short(unsigned char *bytes)
+static unsigned le_short(unsigned char *bytes)
 {
-    return bytes[0] | ((char)bytes[1] << 8);
+    return bytes[0] | ((unsigned)bytes[1] << 8);
 }
 
-void *read_tga(const char *filename, int *width, int *height)
+void *read_tga(struct arena *arena, const char *filename, int *width, int *height)
 {
     struct tga_header {
        char  id_length;
@@ -46,11 +99,19 @@ void *read_tga(const char *filename, int *width, int *height)
        char  bits_per_pixel;
        char  image_descriptor;
     } header;
-    int i, color_map_size, pixels_size;
+    struct embedded_asset const *asset
+        = asset_files_preferred ? NULL : find_embedded_asset(filename);
+    int i, color_map_size;
     FILE *f;
-    size_t read;
+    size_t read, pixels_size;
     void *pixels;
 
+    if (asset) {
+        *width = asset->width;
+        *height = asset->height;
+        return (void*)asset->data;
+    }
+
     f = fopen(filename, "rb");
 
     if (!f) {
@@ -83,7 +144,7 @@ void *read_tga(const char *filename, int *width, int *height)
             return NULL;
         }
 
-    color_map_size = le_short(header.color_map_length) * (header.color_map_depth/8);
+    color_map_size = (int)le_short(header.color_map_length) * (header.color_map_depth/8);
     for (i = 0; i < color_map_size; ++i)
         if (getc(f) == EOF) {
             fprintf(stderr, "%s has incomplete color map\n", filename);
@@ -91,19 +152,153 @@ void *read_tga(const char *filename, int *width, int *height)
             return NULL;
         }
 
-    *width = le_short(header.width); *height = le_short(header.height);
-    pixels_size = *width * *height * (header.bits_per_pixel/8);
-    pixels = malloc(pixels_size);
+    *width = (int)le_short(header.width); *height = (int)le_short(header.height);
+    pixels_size = (size_t)*width * (size_t)*height * (header.bits_per_pixel/8);
+    pixels = arena_alloc(arena, pixels_size);
+    if (!pixels) {
+        fprintf(stderr, "Unable to allocate %dx%d image for %s\n", *width, *height, filename);
+        fclose(f);
+        return NULL;
+    }
 
     read = fread(pixels, 1, pixels_size, f);
 
     if (read != pixels_size) {
         fprintf(stderr, "%s has incomplete image\n", filename);
         fclose(f);
-        free(pixels);
         return NULL;
     }
 
+    fclose(f);
     return pixels;
 }
 
+/*
+ * Writes 32-bit BGRA pixels, bottom row first, as a 24-bit uncompressed
+ * tga, which read_tga can load back. The alpha channel is dropped.
+ */
+int write_tga(const char *filename, int width, int height, void const *bgra_pixels)
+{
+    unsigned char header[18] = { 0 };
+    unsigned char const *pixels = (unsigned char const*)bgra_pixels;
+    unsigned char *row;
+    FILE *f;
+    int x, y, ok = 1;
+
+    header[2] = 2;                              /* uncompressed RGB */
+    header[12] = width & 0xff;  header[13] = (width >> 8) & 0xff;
+    header[14] = height & 0xff; header[15] = (height >> 8) & 0xff;
+    header[16] = 24;                            /* bits per pixel */
+
+    f = fopen(filename, "wb");
+    if (!f) {
+        fprintf(stderr, "Unable to open %s for writing\n", filename);
+        return 0;
+    }
+
+    row = malloc(width * 3);
+    ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+    for (y = 0; ok && y < height; ++y) {
+        for (x = 0; x < width; ++x) {
+            row[x*3 + 0] = pixels[(y*width + x)*4 + 0];
+            row[x*3 + 1] = pixels[(y*width + x)*4 + 1];
+            row[x*3 + 2] = pixels[(y*width + x)*4 + 2];
+        }
+        ok = fwrite(row, 1, width * 3, f) == (size_t)(width * 3);
+    }
+    free(row);
+
+    if (fclose(f) != 0 || !ok) {
+        fprintf(stderr, "Unable to write %s\n", filename);
+        return 0;
+    }
+    return 1;
+}
+
+#ifdef _WIN32
+
+int map_file(struct mapped_file *out_file, const char *filename)
+{
+    LARGE_INTEGER size;
+    HANDLE file, mapping;
+    void const *data;
+
+    file = CreateFileA(
+        filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Unable to open %s for reading\n", filename);
+        return 0;
+    }
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        fprintf(stderr, "%s is empty\n", filename);
+        CloseHandle(file);
+        return 0;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!data) {
+        fprintf(stderr, "Unable to map %s\n", filename);
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return 0;
+    }
+
+    out_file->data = data;
+    out_file->size = (size_t)size.QuadPart;
+    out_file->file_handle = file;
+    out_file->mapping_handle = mapping;
+    return 1;
+}
+
+void unmap_file(struct mapped_file *file)
+{
+    UnmapViewOfFile(file->data);
+    CloseHandle((HANDLE)file->mapping_handle);
+    CloseHandle((HANDLE)file->file_handle);
+    file->data = NULL;
+    file->size = 0;
+}
+
+#else
+
+int map_file(struct mapped_file *out_file, const char *filename)
+{
+    struct stat st;
+    void *data;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Unable to open %s for reading\n", filename);
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "%s is empty\n", filename);
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %s\n", filename);
+        return 0;
+    }
+
+    out_file->data = data;
+    out_file->size = (size_t)st.st_size;
+    out_file->file_handle = out_file->mapping_handle = NULL;
+    return 1;
+}
+
+void unmap_file(struct mapped_file *file)
+{
+    munmap((void*)file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
+
+#endif
@@ -1,3 +1,17 @@
-void *file_contents(const char *filename, GLint *length);
-void *read_tga(const char *filename, int *width, int *height);
+void *file_contents(struct arena *arena, const char *filename, GLint *length);
+void *read_tga(struct arena *arena, const char *filename, int *width, int *height);
+int write_tga(const char *filename, int width, int height, void const *bgra_pixels);
+
+/*
+ * A whole file mapped read-only into memory. The handles are only used
+ * on Windows, which needs both the file and the mapping object kept.
+ */
+struct mapped_file {
+    void const *data;
+    size_t size;
+    void *file_handle, *mapping_handle;
+};
+
+int map_file(struct mapped_file *out_file, const char *filename);
+void unmap_file(struct mapped_file *file);
 
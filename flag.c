@@ -4,24 +4,135 @@
 #  include <GLUT/glut.h>
 #else
 #  include <GL/glut.h>
+#  ifdef FREEGLUT
+#    include <GL/freeglut_ext.h>
+#  endif
 #endif
 #include <stddef.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include "memory.h"
 #include "file-util.h"
+#include "embedded-assets.h"
 #include "gl-util.h"
+#include "gpu-resources.h"
+#include "antialias.h"
 #include "vec-util.h"
+#include "geometry-heap.h"
 #include "meshes.h"
+#include "options.h"
+#include "frame-clock.h"
+#include "readback.h"
+#include "export.h"
+#include "stream-server.h"
+#include "metrics.h"
+#include "thread-util.h"
+#include "job-pool.h"
+#include "wind-field.h"
+#include "cloth.h"
+#include "cloth-gpu.h"
+#include "crowd.h"
+#include "render-queue.h"
+#include "lights.h"
+#include "shadows.h"
+#include "scene-file.h"
+#include "tile-file.h"
+#include "virtual-texture.h"
+#include "soft-raster.h"
+#include "gl-capture.h"
+
+static struct flag_options g_options;
+
+#define MAX_OUTPUTS 16
+
+/*
+ * A window is a GLUT window. With --wall, each window shows one output,
+ * or with --wall-viewports, one window shows every output side by side.
+ * All windows share a single GL context, so meshes, textures and the
+ * program exist once no matter how many outputs are drawn.
+ */
+struct window {
+    int id;
+    GLsizei size[2];
+    int visible, pending;
+};
+
+/*
+ * An output is one tile of the wall: a viewport of a window with its own
+ * sub-frustum of the whole view, and its own offscreen target for
+ * dynamic resolution.
+ */
+struct output {
+    int window;
+    GLint viewport[4];
+    GLfloat region[4];
+    GLfloat p_matrix[16];
+    struct render_target scene_target;
+
+    /* how the last frame was drawn, for presenting it after the scene */
+    GLsizei render_size[2];
+    int offscreen;
+};
+
+/*
+ * Something the render queue draws. The center is only used to order
+ * draws by depth.
+ */
+struct scene_item {
+    struct flag_mesh const *mesh;
+    GLfloat center[3];
+    int translucent;
+};
 
 static struct {
+    struct geometry_heap geometry_heap;
+    int use_geometry_heap;
+
     struct flag_mesh flag, background;
     struct flag_vertex *flag_vertex_array;
+    struct cloth cloth;
+    struct cloth_gpu cloth_gpu;
+    int use_cloth_gpu;
+
+    /* gusts on top of flag_wind for the cloth and the crowd, unless --turbulence 0 */
+    struct wind_field wind_field;
+    int use_wind_field;
+
+    /* with --crowd, stands of flags replace the background */
+    struct crowd crowd;
+    int use_crowd, use_background;
+
+    /* with --scene, these replace the background */
+    struct scene_file scene;
+    struct flag_mesh *scene_meshes;
+    GLuint *scene_textures;
+    int use_scene;
+
+    /*
+     * with --virtual-texture, the flag is drawn from a cache of the tiles
+     * in view; its texture is one level of the tiles, for the crowd,
+     * shadows and the software rasterizer
+     */
+    struct virtual_texture virtual_texture;
+    int use_virtual_texture;
+
+    struct scene_item *scene_items;
+    int scene_item_count;
+    struct render_queue render_queue;
+    int render_queue_dirty;
+    struct job_pool jobs;
     
     struct {
         GLuint vertex_shader, fragment_shader, program;
 
         struct {
             GLint texture, p_matrix, mv_matrix;
+            GLint light_texture, cluster_texture, light_index_texture;
+            GLint cluster_viewport, clustered_lighting;
+            GLint shadow_map, shadow_matrix, shadow_texel, shadowing;
+            GLint virtual_texturing;
+            struct vt_uniforms vt;
         } uniforms;
 
         struct {
@@ -29,9 +140,66 @@ static struct {
         } attributes;
     } flag_program;
 
-    GLfloat p_matrix[16], mv_matrix[16];
+    GLfloat mv_matrix[16];
     GLfloat eye_offset[2];
-    GLsizei window_size[2];
+    GLfloat view_p_matrix[16];  /* the whole wall's frustum */
+
+    struct light lights[MAX_LIGHTS];
+    struct light_clusters light_clusters;
+    int light_count, clustered_lighting;
+
+    struct shadow_map shadow_map;
+    int shadows, shadows_dirty;
+
+    /* with --software, the rasterizer and its copies of the flag and background */
+    struct {
+        struct soft_raster raster;
+        struct soft_texture textures[2];
+        struct soft_mesh meshes[2];
+        int mesh_count;
+    } software;
+    int use_software;
+
+    struct window windows[MAX_OUTPUTS];
+    struct output outputs[MAX_OUTPUTS];
+    int window_count, output_count;
+
+    GLfloat resolution_scale;
+    struct antialias antialias;
+
+    /* only kept while serving metrics */
+    struct gpu_timer gpu_timer;
+    int use_gpu_timer;
+
+    struct {
+        struct readback_ring ring;
+        int frame;
+    } stream;
+
+    struct {
+        double start, next_frame, frame_start, period;
+        double swap_time;   /* spent in glutSwapBuffers since frame_start */
+        int pending_windows, vsync;
+    } scheduler;
+
+    struct {
+        double launch;
+        int presented;
+    } startup;
+
+    struct {
+        double last_adjust, last_report, busy_time, cloth_time, crowd_time;
+        int adjust_frames, cloth_updates;
+        struct frame_pacing pacing;
+
+        /* since launch, by anti-aliasing mode, so that the modes can be compared */
+        double antialias_time[ANTIALIAS_MODE_COUNT];
+        int antialias_frames[ANTIALIAS_MODE_COUNT];
+
+        /* since the last frame was presented */
+        double update_time, upload_bytes;
+        int draw_calls;
+    } stats;
 } g_resources;
 
 static void init_gl_state(void)
@@ -45,23 +213,57 @@ static void init_gl_state(void)
 #define PROJECTION_NEAR_PLANE 0.0625f
 #define PROJECTION_FAR_PLANE 256.0f
 
-static void update_p_matrix(GLfloat *matrix, int w, int h)
+/*
+ * w and h are the size of the whole view; region selects the part of it,
+ * as { x_lo, y_lo, x_hi, y_hi } fractions from the lower left, that this
+ * matrix projects onto the viewport. The full region gives the ordinary
+ * symmetric frustum.
+ */
+static void update_p_matrix(GLfloat *matrix, int w, int h, GLfloat const *region)
 {
     GLfloat wf = (GLfloat)w, hf = (GLfloat)h;
     GLfloat
         r_xy_factor = fminf(wf, hf) * 1.0f/PROJECTION_FOV_RATIO,
-        r_x = r_xy_factor/wf,
-        r_y = r_xy_factor/hf,
+        s_x = 1.0f/(region[2] - region[0]),
+        s_y = 1.0f/(region[3] - region[1]),
+        r_x = s_x*r_xy_factor/wf,
+        r_y = s_y*r_xy_factor/hf,
+        o_x = s_x*(1.0f - region[0] - region[2]),
+        o_y = s_y*(1.0f - region[1] - region[3]),
         r_zw_factor = 1.0f/(PROJECTION_FAR_PLANE - PROJECTION_NEAR_PLANE),
         r_z = (PROJECTION_NEAR_PLANE + PROJECTION_FAR_PLANE)*r_zw_factor,
         r_w = -2.0f*PROJECTION_NEAR_PLANE*PROJECTION_FAR_PLANE*r_zw_factor;
 
     matrix[ 0] = r_x;  matrix[ 1] = 0.0f; matrix[ 2] = 0.0f; matrix[ 3] = 0.0f;
     matrix[ 4] = 0.0f; matrix[ 5] = r_y;  matrix[ 6] = 0.0f; matrix[ 7] = 0.0f;
-    matrix[ 8] = 0.0f; matrix[ 9] = 0.0f; matrix[10] = r_z;  matrix[11] = 1.0f;
+    matrix[ 8] = o_x;  matrix[ 9] = o_y;  matrix[10] = r_z;  matrix[11] = 1.0f;
     matrix[12] = 0.0f; matrix[13] = 0.0f; matrix[14] = r_w;  matrix[15] = 0.0f;
 }
 
+static const GLfloat FULL_REGION[4] = { 0.0f, 0.0f, 1.0f, 1.0f };
+
+static void update_output_p_matrix(struct output *output)
+{
+    int
+        wall_w = output->viewport[2] * g_options.wall_size[0],
+        wall_h = output->viewport[3] * g_options.wall_size[1];
+
+    update_p_matrix(output->p_matrix, wall_w, wall_h, output->region);
+}
+
+/* Every output's frustum is a region of this one. */
+static void update_view_p_matrix(void)
+{
+    struct output const *output = &g_resources.outputs[0];
+
+    update_p_matrix(
+        g_resources.view_p_matrix,
+        output->viewport[2] * g_options.wall_size[0],
+        output->viewport[3] * g_options.wall_size[1],
+        FULL_REGION
+    );
+}
+
 static void update_mv_matrix(GLfloat *matrix, GLfloat *eye_offset)
 {
     static const GLfloat BASE_EYE_POSITION[3]  = { 0.5f, -0.25f, -1.25f  };
@@ -75,21 +277,34 @@ static void update_mv_matrix(GLfloat *matrix, GLfloat *eye_offset)
     matrix[15] = 1.0f;
 }
 
-static void render_mesh(struct flag_mesh const *mesh)
+static void bind_mesh(struct flag_mesh const *mesh, void *data)
 {
-    glBindTexture(GL_TEXTURE_2D, mesh->texture);
-
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
-    glVertexAttribPointer(
-        g_resources.flag_program.attributes.position,
-        3, GL_FLOAT, GL_FALSE, sizeof(struct flag_vertex),
-        (void*)offsetof(struct flag_vertex, position)
-    );
-    glVertexAttribPointer(
-        g_resources.flag_program.attributes.normal,
-        3, GL_FLOAT, GL_FALSE, sizeof(struct flag_vertex),
-        (void*)offsetof(struct flag_vertex, normal)
-    );
+    if (mesh->deformed_buffer) {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->deformed_buffer);
+        glVertexAttribPointer(
+            g_resources.flag_program.attributes.position,
+            3, GL_FLOAT, GL_FALSE, sizeof(struct deformed_vertex),
+            (void*)offsetof(struct deformed_vertex, position)
+        );
+        glVertexAttribPointer(
+            g_resources.flag_program.attributes.normal,
+            3, GL_FLOAT, GL_FALSE, sizeof(struct deformed_vertex),
+            (void*)offsetof(struct deformed_vertex, normal)
+        );
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
+        glVertexAttribPointer(
+            g_resources.flag_program.attributes.position,
+            3, GL_FLOAT, GL_FALSE, sizeof(struct flag_vertex),
+            (void*)offsetof(struct flag_vertex, position)
+        );
+        glVertexAttribPointer(
+            g_resources.flag_program.attributes.normal,
+            3, GL_FLOAT, GL_FALSE, sizeof(struct flag_vertex),
+            (void*)offsetof(struct flag_vertex, normal)
+        );
+    }
     glVertexAttribPointer(
         g_resources.flag_program.attributes.texcoord,
         2, GL_FLOAT, GL_FALSE, sizeof(struct flag_vertex),
@@ -107,17 +322,104 @@ static void render_mesh(struct flag_mesh const *mesh)
     );
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->element_buffer);
-    glDrawElements(
-        GL_TRIANGLES,
-        mesh->element_count,
-        GL_UNSIGNED_SHORT,
-        (void*)0
-    );
+
+    if (g_resources.use_virtual_texture)
+        glUniform1f(
+            g_resources.flag_program.uniforms.virtual_texturing,
+            mesh == &g_resources.flag ? 1.0f : 0.0f
+        );
 }
 
 #define INITIAL_WINDOW_WIDTH  640
 #define INITIAL_WINDOW_HEIGHT 480
 
+#define MIN_RESOLUTION_SCALE    0.25f
+#define MAX_RESOLUTION_SCALE    2.0f
+#define RESOLUTION_SCALE_STEP   0.125f
+
+static void set_resolution_scale(GLfloat scale)
+{
+    if (!render_targets_supported())
+        scale = 1.0f;
+    g_resources.resolution_scale
+        = fminf(fmaxf(scale, MIN_RESOLUTION_SCALE), MAX_RESOLUTION_SCALE);
+}
+
+/*
+ * Returns nonzero and binds the offscreen scene target if the current
+ * resolution scale, anti-aliasing or the software rasterizer requires
+ * one. The target is only reallocated when it needs to grow, so the scale
+ * can change every frame without churning GL objects; smaller scales
+ * render into the lower-left corner of it.
+ */
+static int bind_scene_target(struct output *output, GLsizei *out_size)
+{
+    GLsizei
+        w = output->viewport[2],
+        h = output->viewport[3];
+
+    if (g_resources.resolution_scale == 1.0f && !g_resources.use_software
+        && g_resources.antialias.mode == ANTIALIAS_OFF) {
+        out_size[0] = w;
+        out_size[1] = h;
+        return 0;
+    }
+
+    out_size[0] = (GLsizei)((GLfloat)w * g_resources.resolution_scale + 0.5f);
+    out_size[1] = (GLsizei)((GLfloat)h * g_resources.resolution_scale + 0.5f);
+    if (out_size[0] < 1) out_size[0] = 1;
+    if (out_size[1] < 1) out_size[1] = 1;
+
+    if (out_size[0] > output->scene_target.size[0]
+        || out_size[1] > output->scene_target.size[1]) {
+        GLsizei
+            alloc_w = out_size[0] > w ? out_size[0] : w,
+            alloc_h = out_size[1] > h ? out_size[1] : h;
+
+        if (output->scene_target.framebuffer)
+            delete_render_target(&output->scene_target);
+        /* color and depth, four bytes a pixel each */
+        if (!reserve_gpu_memory((size_t)alloc_w * alloc_h * 8, "render target")
+            || !make_render_target(&output->scene_target, alloc_w, alloc_h)) {
+            fprintf(stderr, "Falling back to full resolution rendering%s\n",
+                g_resources.antialias.mode != ANTIALIAS_OFF ? " without anti-aliasing" : "");
+            g_resources.resolution_scale = 1.0f;
+            set_antialias_mode(&g_resources.antialias, ANTIALIAS_OFF, 0);
+            /* an earlier output's target may still be bound */
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            out_size[0] = w;
+            out_size[1] = h;
+            return 0;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, output->scene_target.framebuffer);
+    return 1;
+}
+
+/* FXAA filters the target on its way to the window in place of the blit. */
+static void present_scene_target(struct output const *output, GLsizei const *size)
+{
+    GLint const *viewport = output->viewport;
+
+    if (g_resources.antialias.mode == ANTIALIAS_FXAA) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        draw_fxaa(&g_resources.antialias, &output->scene_target, size);
+        return;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, output->scene_target.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(
+        0, 0, size[0], size[1],
+        viewport[0], viewport[1],
+        viewport[0] + viewport[2], viewport[1] + viewport[3],
+        GL_COLOR_BUFFER_BIT, GL_LINEAR
+    );
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
 static void enact_flag_program(
     GLuint vertex_shader,
     GLuint fragment_shader,
@@ -134,6 +436,27 @@ static void enact_flag_program(
         = glGetUniformLocation(program, "p_matrix");
     g_resources.flag_program.uniforms.mv_matrix
         = glGetUniformLocation(program, "mv_matrix");
+    g_resources.flag_program.uniforms.light_texture
+        = glGetUniformLocation(program, "light_texture");
+    g_resources.flag_program.uniforms.cluster_texture
+        = glGetUniformLocation(program, "cluster_texture");
+    g_resources.flag_program.uniforms.light_index_texture
+        = glGetUniformLocation(program, "light_index_texture");
+    g_resources.flag_program.uniforms.cluster_viewport
+        = glGetUniformLocation(program, "cluster_viewport");
+    g_resources.flag_program.uniforms.clustered_lighting
+        = glGetUniformLocation(program, "clustered_lighting");
+    g_resources.flag_program.uniforms.shadow_map
+        = glGetUniformLocation(program, "shadow_map");
+    g_resources.flag_program.uniforms.shadow_matrix
+        = glGetUniformLocation(program, "shadow_matrix");
+    g_resources.flag_program.uniforms.shadow_texel
+        = glGetUniformLocation(program, "shadow_texel");
+    g_resources.flag_program.uniforms.shadowing
+        = glGetUniformLocation(program, "shadowing");
+    g_resources.flag_program.uniforms.virtual_texturing
+        = glGetUniformLocation(program, "virtual_texturing");
+    get_vt_uniforms(program, &g_resources.flag_program.uniforms.vt);
 
     g_resources.flag_program.attributes.position
         = glGetAttribLocation(program, "position");
@@ -156,12 +479,20 @@ static int make_flag_program(
     if (*vertex_shader == 0)
         return 0;
     *fragment_shader = make_shader(GL_FRAGMENT_SHADER, "flag.f.glsl");
-    if (*fragment_shader == 0)
+    if (*fragment_shader == 0) {
+        glDeleteShader(*vertex_shader);
+        untrack_gpu_resource(GPU_SHADER, *vertex_shader);
         return 0;
+    }
 
     *program = make_program(*vertex_shader, *fragment_shader);
-    if (*program == 0)
+    if (*program == 0) {
+        glDeleteShader(*vertex_shader);
+        glDeleteShader(*fragment_shader);
+        untrack_gpu_resource(GPU_SHADER, *vertex_shader);
+        untrack_gpu_resource(GPU_SHADER, *fragment_shader);
         return 0;
+    }
 
     return 1;
 }
@@ -179,68 +510,921 @@ static void delete_flag_program(void)
     glDeleteProgram(g_resources.flag_program.program);
     glDeleteShader(g_resources.flag_program.vertex_shader);
     glDeleteShader(g_resources.flag_program.fragment_shader);
+    untrack_gpu_resource(GPU_PROGRAM, g_resources.flag_program.program);
+    untrack_gpu_resource(GPU_SHADER, g_resources.flag_program.vertex_shader);
+    untrack_gpu_resource(GPU_SHADER, g_resources.flag_program.fragment_shader);
 }
 
+/*
+ * Whether or not the new shaders build, a reload should leave as many GL
+ * objects alive as it found.
+ */
 static void update_flag_program(void)
 {
     printf("reloading program\n");
     GLuint vertex_shader, fragment_shader, program;
+    struct gpu_resource_mark mark = get_gpu_resource_mark();
 
+    prefer_asset_files(1);
     if (make_flag_program(&vertex_shader, &fragment_shader, &program)) {
         delete_flag_program();
         enact_flag_program(vertex_shader, fragment_shader, program);
+        g_resources.render_queue_dirty = 1;
+        record_shader_reload();
     }
+    check_gpu_resource_leaks(mark, "Shader reload");
 }
 
-static int make_resources(void)
+/* must match light_direction in flag.f.glsl */
+static const GLfloat LIGHT_DIRECTION[3] = { 0.408248f, -0.816497f, 0.408248f };
+
+/*
+ * Meshes that never move, drawn once into the cached static shadow map.
+ */
+static struct flag_mesh const *static_meshes(int *out_count)
 {
-    GLuint vertex_shader, fragment_shader, program;
+    if (g_resources.use_scene) {
+        *out_count = (int)g_resources.scene.header->mesh_count;
+        return g_resources.scene_meshes;
+    }
+    *out_count = g_resources.use_background ? 1 : 0;
+    return &g_resources.background;
+}
 
-    g_resources.flag_vertex_array = init_flag_mesh(&g_resources.flag);
-    init_background_mesh(&g_resources.background);
+/*
+ * A box around everywhere the cloth can reach: its tethers keep every
+ * particle within the flag's width of the pole.
+ */
+static const GLfloat FLAG_BOUNDS_LO[3] = { -0.125f, -1.375f, -1.0f };
+static const GLfloat FLAG_BOUNDS_HI[3] = {  1.125f,  1.375f, 1.0f };
 
-    g_resources.flag.texture = make_texture("flag.tga");
-    g_resources.background.texture = make_texture("background.tga");
+/*
+ * The background encloses the flag, but a scene file need not, so its
+ * bounds are widened to take the flag in. Crowd flags neither cast nor
+ * receive shadows, so with only the crowd the box is just the flag's.
+ */
+static void scene_bounds(GLfloat *out_lo, GLfloat *out_hi)
+{
+    int i;
 
-    if (g_resources.flag.texture == 0 || g_resources.background.texture == 0)
+    if (g_resources.use_background) {
+        background_mesh_bounds(out_lo, out_hi);
+        return;
+    }
+    if (!g_resources.use_scene) {
+        for (i = 0; i < 3; ++i) {
+            out_lo[i] = FLAG_BOUNDS_LO[i];
+            out_hi[i] = FLAG_BOUNDS_HI[i];
+        }
+        return;
+    }
+    for (i = 0; i < 3; ++i) {
+        GLfloat
+            lo = g_resources.scene.header->bounds_lo[i],
+            hi = g_resources.scene.header->bounds_hi[i];
+        out_lo[i] = lo < FLAG_BOUNDS_LO[i] ? lo : FLAG_BOUNDS_LO[i];
+        out_hi[i] = hi > FLAG_BOUNDS_HI[i] ? hi : FLAG_BOUNDS_HI[i];
+    }
+}
+
+#define MIN_SHADOW_SIZE 128
+
+/*
+ * The static and dynamic maps are each a 24-bit depth texture, which
+ * takes four bytes a texel. Over the GPU memory budget, the maps are
+ * made smaller until they fit.
+ */
+static void make_shadows(void)
+{
+    GLfloat bounds_lo[3], bounds_hi[3];
+    GLsizei size = g_options.shadow_size;
+
+    g_resources.shadows = 0;
+    if (size == 0 || g_resources.use_software)
+        return;
+    if (!shadow_maps_supported()) {
+        fprintf(stderr, "Framebuffer objects not available, disabling shadows\n");
+        return;
+    }
+
+    while (!reserve_gpu_memory(2 * (size_t)size * size * 4, "shadow map")) {
+        size /= 2;
+        if (size < MIN_SHADOW_SIZE) {
+            fprintf(stderr, "No room for a shadow map, disabling shadows\n");
+            return;
+        }
+    }
+    if (size != g_options.shadow_size)
+        printf("shadow map reduced to %d to stay within the GPU memory budget\n", size);
+
+    scene_bounds(bounds_lo, bounds_hi);
+    if (!make_shadow_map(
+            &g_resources.shadow_map, size,
+            LIGHT_DIRECTION, bounds_lo, bounds_hi
+        )) {
+        fprintf(stderr, "Unable to create shadow map, disabling shadows\n");
+        return;
+    }
+    g_resources.shadows = g_resources.shadows_dirty = 1;
+}
+
+static void add_scene_item(struct flag_mesh const *mesh, GLfloat const *center, int translucent)
+{
+    struct scene_item *item = &g_resources.scene_items[g_resources.scene_item_count++];
+
+    item->mesh = mesh;
+    item->center[0] = center[0];
+    item->center[1] = center[1];
+    item->center[2] = center[2];
+    item->translucent = translucent;
+}
+
+/* The flag, and either the scene file's instances or the background. */
+static int make_scene(void)
+{
+    static const GLfloat FLAG_CENTER[3] = { 0.5f, 0.0f, 0.0f };
+    GLfloat bounds_lo[3], bounds_hi[3], background_center[3];
+    size_t item_count = 2;
+
+    if (g_resources.use_scene)
+        item_count += g_resources.scene.header->instance_count;
+    g_resources.scene_items = (struct scene_item*) memory_alloc(
+        item_count * sizeof(struct scene_item), MEMORY_OTHER
+    );
+    if (!g_resources.scene_items)
         return 0;
 
-    if (!make_flag_program(&vertex_shader, &fragment_shader, &program))
+    background_mesh_bounds(bounds_lo, bounds_hi);
+    background_center[0] = 0.5f*(bounds_lo[0] + bounds_hi[0]);
+    background_center[1] = 0.5f*(bounds_lo[1] + bounds_hi[1]);
+    background_center[2] = 0.5f*(bounds_lo[2] + bounds_hi[2]);
+
+    g_resources.scene_item_count = 0;
+    add_scene_item(&g_resources.flag, FLAG_CENTER, 0);
+    if (g_resources.use_scene) {
+        struct scene_file const *scene = &g_resources.scene;
+        GLuint i;
+
+        for (i = 0; i < scene->header->instance_count; ++i) {
+            struct scene_file_instance const *instance = &scene->instances[i];
+            add_scene_item(
+                &g_resources.scene_meshes[instance->mesh],
+                instance->center,
+                (instance->flags & SCENE_INSTANCE_TRANSLUCENT) != 0
+            );
+        }
+    } else if (g_resources.use_background)
+        add_scene_item(&g_resources.background, background_center, 0);
+
+    init_render_queue(&g_resources.render_queue);
+    g_resources.render_queue_dirty = 1;
+    return 1;
+}
+
+#define STARTUP_ARENA_CHUNK_SIZE (256*1024)
+
+/*
+ * CPU-side loading runs as jobs on the pool while the GL thread compiles
+ * shaders and uploads each result as soon as its task finishes.
+ */
+enum startup_task_id {
+    LOAD_FLAG_TEXTURE,
+    LOAD_BACKGROUND_TEXTURE,
+    GENERATE_FLAG_MESH,
+    GENERATE_BACKGROUND_MESH,
+    STARTUP_TASK_COUNT
+};
+
+static const char *const STARTUP_TASK_NAMES[STARTUP_TASK_COUNT] = {
+    "decode flag.tga",
+    "decode background.tga",
+    "generate flag mesh",
+    "generate background mesh"
+};
+
+struct startup_task {
+    struct arena arena;
+    int done, uploaded, ok;
+    double seconds;
+
+    void *pixels;
+    int width, height;
+    struct mesh_data mesh;
+};
+
+struct startup {
+    struct startup_task tasks[STARTUP_TASK_COUNT];
+    struct mutex mutex;
+    struct condition completed;
+};
+
+/* a scene file or a crowd replaces the background */
+static int startup_task_skipped(int id)
+{
+    return !g_resources.use_background
+        && (id == LOAD_BACKGROUND_TEXTURE || id == GENERATE_BACKGROUND_MESH);
+}
+
+#define FLAG_TEXTURE_MAX_SIZE 1024
+
+/* The finest level of a tile file that is small enough for a plain texture. */
+static int fallback_tile_level(struct tile_file const *tiles)
+{
+    int level = 0;
+
+    while (level < (int)tiles->header->level_count - 1
+        && (tiles->header->levels[level].width > FLAG_TEXTURE_MAX_SIZE
+            || tiles->header->levels[level].height > FLAG_TEXTURE_MAX_SIZE))
+        ++level;
+    return level;
+}
+
+static void run_startup_task(int job, int worker, void *data)
+{
+    struct startup *startup = (struct startup*)data;
+    struct startup_task *task = &startup->tasks[job];
+    double start = clock_seconds();
+    int ok = 0;
+
+    if (startup_task_skipped(job)) {
+        ok = 1;
+    } else {
+        switch (job) {
+        case LOAD_FLAG_TEXTURE:
+            if (g_resources.virtual_texture.tiles.header)
+                task->pixels = read_tile_level(
+                    &g_resources.virtual_texture.tiles, &task->arena,
+                    fallback_tile_level(&g_resources.virtual_texture.tiles),
+                    &task->width, &task->height
+                );
+            else
+                task->pixels = read_tga(&task->arena, "flag.tga", &task->width, &task->height);
+            ok = task->pixels != NULL;
+            break;
+        case LOAD_BACKGROUND_TEXTURE:
+            task->pixels = read_tga(&task->arena, "background.tga", &task->width, &task->height);
+            ok = task->pixels != NULL;
+            break;
+        case GENERATE_FLAG_MESH:
+            ok = generate_flag_mesh(&task->mesh, &task->arena);
+            break;
+        case GENERATE_BACKGROUND_MESH:
+            ok = load_background_mesh(&task->mesh, &task->arena);
+            break;
+        }
+    }
+
+    lock_mutex(&startup->mutex);
+    task->seconds = clock_seconds() - start;
+    task->ok = ok;
+    task->done = 1;
+    signal_condition(&startup->completed);
+    unlock_mutex(&startup->mutex);
+}
+
+/*
+ * Returns a finished task that has not been uploaded yet, or -1 once
+ * every task has been. Runs a pending task on this thread rather than
+ * sitting idle, which is also how a pool without other workers gets
+ * through them.
+ */
+static int next_startup_task(struct startup *startup, double *wait_seconds)
+{
+    for (;;) {
+        int i, pending = 0;
+        double start;
+
+        lock_mutex(&startup->mutex);
+        for (i = 0; i < STARTUP_TASK_COUNT; ++i) {
+            if (startup->tasks[i].uploaded)
+                continue;
+            if (startup->tasks[i].done) {
+                unlock_mutex(&startup->mutex);
+                return i;
+            }
+            pending = 1;
+        }
+        unlock_mutex(&startup->mutex);
+        if (!pending)
+            return -1;
+
+        if (help_jobs(&g_resources.jobs))
+            continue;
+
+        start = clock_seconds();
+        lock_mutex(&startup->mutex);
+        for (;;) {
+            for (i = 0; i < STARTUP_TASK_COUNT; ++i)
+                if (startup->tasks[i].done && !startup->tasks[i].uploaded)
+                    break;
+            if (i < STARTUP_TASK_COUNT)
+                break;
+            wait_condition(&startup->completed, &startup->mutex);
+        }
+        unlock_mutex(&startup->mutex);
+        *wait_seconds += clock_seconds() - start;
+    }
+}
+
+/*
+ * The software rasterizer draws from memory rather than from GL buffers,
+ * so it keeps copies of what the startup tasks made before their arenas
+ * go. The flag's vertices are not copied, since they are the array the
+ * cloth rewrites every step.
+ */
+static int copy_soft_mesh(
+    struct soft_mesh *out_mesh, struct mesh_data const *data,
+    struct flag_vertex const *vertices, struct soft_texture const *texture
+) {
+    struct flag_vertex *vertex_copy;
+    GLushort *element_copy = (GLushort*) memory_alloc(
+        (size_t)data->element_count * sizeof(GLushort), MEMORY_MESH
+    );
+
+    if (!element_copy)
+        return 0;
+    memcpy(element_copy, data->elements, (size_t)data->element_count * sizeof(GLushort));
+    if (!vertices) {
+        vertex_copy = (struct flag_vertex*) memory_alloc(
+            (size_t)data->vertex_count * sizeof(struct flag_vertex), MEMORY_MESH
+        );
+        if (!vertex_copy) {
+            memory_free(element_copy);
+            return 0;
+        }
+        memcpy(vertex_copy, data->vertices, (size_t)data->vertex_count * sizeof(struct flag_vertex));
+        vertices = vertex_copy;
+    }
+
+    out_mesh->vertices = vertices;
+    out_mesh->elements = element_copy;
+    out_mesh->vertex_count = data->vertex_count;
+    out_mesh->element_count = data->element_count;
+    out_mesh->texture = texture;
+    return 1;
+}
+
+static void upload_startup_task(int id, struct startup_task *task, struct geometry_heap *heap)
+{
+    struct soft_texture *soft_textures = g_resources.software.textures;
+    struct soft_mesh *soft_meshes = g_resources.software.meshes;
+    int software = g_resources.use_software;
+
+    if (startup_task_skipped(id))
+        return;
+    switch (id) {
+    case LOAD_FLAG_TEXTURE:
+        g_resources.flag.texture = upload_texture(
+            task->pixels, task->width, task->height,
+            g_resources.virtual_texture.tiles.header ? "flag tiles" : "flag.tga"
+        );
+        if (!g_resources.flag.texture)
+            task->ok = 0;
+        else if (software && !make_soft_texture(
+                &soft_textures[0], task->pixels, task->width, task->height))
+            task->ok = 0;
+        break;
+    case LOAD_BACKGROUND_TEXTURE:
+        g_resources.background.texture
+            = upload_texture(task->pixels, task->width, task->height, "background.tga");
+        if (!g_resources.background.texture)
+            task->ok = 0;
+        else if (software && !make_soft_texture(
+                &soft_textures[1], task->pixels, task->width, task->height))
+            task->ok = 0;
+        break;
+    case GENERATE_FLAG_MESH:
+        /*
+         * deformed vertices are indexed from 0, and the render queue only
+         * calls bind_mesh, which switches virtual texturing on and off, when
+         * the buffers change, so either needs the mesh to have its own
+         */
+        g_resources.flag_vertex_array = init_flag_mesh(
+            &g_resources.flag,
+            g_resources.use_cloth_gpu || g_resources.use_virtual_texture ? NULL : heap,
+            &task->mesh
+        );
+        if (!g_resources.flag_vertex_array)
+            task->ok = 0;
+        else if (software && !copy_soft_mesh(
+                &soft_meshes[0], &task->mesh, g_resources.flag_vertex_array, &soft_textures[0]))
+            task->ok = 0;
+        break;
+    case GENERATE_BACKGROUND_MESH:
+        init_background_mesh(&g_resources.background, heap, &task->mesh);
+        if (software && !copy_soft_mesh(&soft_meshes[1], &task->mesh, NULL, &soft_textures[1]))
+            task->ok = 0;
+        break;
+    }
+}
+
+/*
+ * Links the flag program once both shaders have compiled. With block
+ * set, waits for the compiler; otherwise only polls, and returns 0
+ * without doing anything while the shaders are still compiling.
+ */
+static int advance_flag_program(
+    GLuint *vertex_shader, GLuint *fragment_shader, GLuint *program, int block
+) {
+    if (*program != 0)
+        return 1;
+    if (!block && !(shader_ready(*vertex_shader) && shader_ready(*fragment_shader)))
+        return 0;
+
+    *vertex_shader = finish_shader(*vertex_shader, "flag.v.glsl");
+    *fragment_shader = finish_shader(*fragment_shader, "flag.f.glsl");
+    if (*vertex_shader == 0 || *fragment_shader == 0)
+        return -1;
+    *program = start_program(*vertex_shader, *fragment_shader);
+    return 1;
+}
+
+static int load_startup_assets(struct geometry_heap *heap)
+{
+    struct startup startup;
+    GLuint vertex_shader, fragment_shader, program = 0;
+    double
+        start = clock_seconds(), shader_start,
+        wait_seconds = 0.0, upload_seconds = 0.0,
+        submit_seconds, shader_seconds;
+    int i, ok = 1, linking = 0;
+
+    init_mutex(&startup.mutex);
+    init_condition(&startup.completed);
+    for (i = 0; i < STARTUP_TASK_COUNT; ++i) {
+        init_arena(&startup.tasks[i].arena, STARTUP_ARENA_CHUNK_SIZE, MEMORY_SCRATCH);
+        startup.tasks[i].done = startup.tasks[i].uploaded = startup.tasks[i].ok = 0;
+    }
+    start_jobs(&g_resources.jobs, STARTUP_TASK_COUNT, &run_startup_task, &startup);
+
+    shader_start = clock_seconds();
+    vertex_shader = start_shader(GL_VERTEX_SHADER, "flag.v.glsl");
+    fragment_shader = start_shader(GL_FRAGMENT_SHADER, "flag.f.glsl");
+    if (vertex_shader == 0 || fragment_shader == 0)
+        ok = 0;
+    submit_seconds = clock_seconds() - shader_start;
+
+    while ((i = next_startup_task(&startup, &wait_seconds)) >= 0) {
+        struct startup_task *task = &startup.tasks[i];
+        double upload_start = clock_seconds();
+
+        if (task->ok)
+            upload_startup_task(i, task, heap);
+        if (!task->ok) {
+            fprintf(stderr, "Startup task failed: %s\n", STARTUP_TASK_NAMES[i]);
+            ok = 0;
+        }
+        delete_arena(&task->arena);
+        task->uploaded = 1;
+        upload_seconds += clock_seconds() - upload_start;
+
+        if (ok && !linking)
+            linking = advance_flag_program(&vertex_shader, &fragment_shader, &program, 0);
+    }
+    finish_jobs(&g_resources.jobs);
+    destroy_condition(&startup.completed);
+    destroy_mutex(&startup.mutex);
+
+    shader_start = clock_seconds();
+    if (ok && advance_flag_program(&vertex_shader, &fragment_shader, &program, 1) < 0)
+        ok = 0;
+    if (ok && finish_program(program) == 0)
+        ok = 0;
+    shader_seconds = clock_seconds() - shader_start;
+    if (!ok)
         return 0;
 
     enact_flag_program(vertex_shader, fragment_shader, program);
 
+    /* task times overlap each other; the rest are spent on the GL thread */
+    printf("startup assets loaded in %.1f ms with %d worker%s\n",
+        (clock_seconds() - start) * 1000.0,
+        g_resources.jobs.worker_count, g_resources.jobs.worker_count == 1 ? "" : "s");
+    for (i = 0; i < STARTUP_TASK_COUNT; ++i)
+        printf("  %-26s %7.1f ms\n", STARTUP_TASK_NAMES[i], startup.tasks[i].seconds * 1000.0);
+    printf("  %-26s %7.1f ms\n", "shader submission", submit_seconds * 1000.0);
+    printf("  %-26s %7.1f ms\n", "gl uploads", upload_seconds * 1000.0);
+    printf("  %-26s %7.1f ms\n", "waiting on workers", wait_seconds * 1000.0);
+    printf("  %-26s %7.1f ms%s\n", "waiting on shaders", shader_seconds * 1000.0,
+        parallel_shader_compile_supported() ? " (parallel compile)" : "");
+    return 1;
+}
+
+/*
+ * The scene file's vertex and element data is already in the layout GL
+ * takes, so each mesh is uploaded straight out of the mapping; the
+ * mapping stays open for the instance table and bounds.
+ */
+static int load_scene(struct geometry_heap *heap)
+{
+    struct scene_file *scene = &g_resources.scene;
+    double start = clock_seconds();
+    GLuint i, mesh_count, texture_count;
+
+    if (!open_scene_file(scene, g_options.scene_path))
+        return 0;
+    mesh_count = scene->header->mesh_count;
+    texture_count = scene->header->texture_count;
+
+    g_resources.scene_meshes = (struct flag_mesh*) memory_alloc(
+        (mesh_count + 1) * sizeof(struct flag_mesh), MEMORY_MESH
+    );
+    g_resources.scene_textures = (GLuint*) memory_alloc(
+        (texture_count + 1) * sizeof(GLuint), MEMORY_OTHER
+    );
+    if (!g_resources.scene_meshes || !g_resources.scene_textures)
+        return 0;
+
+    for (i = 0; i < texture_count; ++i) {
+        g_resources.scene_textures[i] = make_texture(scene->textures[i].path);
+        if (g_resources.scene_textures[i] == 0)
+            return 0;
+    }
+    for (i = 0; i < mesh_count; ++i) {
+        struct scene_file_mesh const *mesh = &scene->meshes[i];
+
+        init_mesh(
+            &g_resources.scene_meshes[i], heap,
+            scene_mesh_vertices(scene, mesh), mesh->vertex_count,
+            scene_mesh_elements(scene, mesh), mesh->element_count,
+            GL_STATIC_DRAW
+        );
+        g_resources.scene_meshes[i].texture = g_resources.scene_textures[mesh->texture];
+    }
+
+    printf("loaded %s: %u meshes, %u instances, %u textures in %.1f ms\n",
+        g_options.scene_path, mesh_count, scene->header->instance_count, texture_count,
+        (clock_seconds() - start) * 1000.0);
+    return 1;
+}
+
+/*
+ * The field drifts with the steady wind, and a little across it, so
+ * that no flag sees the volume repeat.
+ */
+static int make_wind_field_resources(void)
+{
+    static const GLfloat drift[3] = { 4.0f, 0.35f, 0.6f };
+
+    g_resources.use_wind_field = g_options.turbulence > 0.0f;
+    if (!g_resources.use_wind_field)
+        return 1;
+    if (!make_wind_field(&g_resources.wind_field, &g_resources.jobs, drift, g_options.turbulence))
+        return 0;
+    if (g_resources.use_crowd)
+        make_wind_texture(&g_resources.wind_field);
+    return 1;
+}
+
+/*
+ * Either mode draws the scene through its target, so needs framebuffer
+ * objects, and the software rasterizer has no samples to resolve.
+ */
+static int set_antialias(enum antialias_mode mode)
+{
+    if (mode != ANTIALIAS_OFF && !render_targets_supported()) {
+        fprintf(stderr, "Framebuffer objects not available, ignoring anti-aliasing %s\n",
+            antialias_mode_name(mode));
+        return 0;
+    }
+    if (mode == ANTIALIAS_MSAA && g_resources.use_software) {
+        fprintf(stderr, "Software rasterizing, ignoring anti-aliasing msaa\n");
+        return 0;
+    }
+    return set_antialias_mode(&g_resources.antialias, mode, g_options.msaa_samples);
+}
+
+static int make_resources(void)
+{
+    struct geometry_heap *heap = NULL;
+
+    make_job_pool(&g_resources.jobs, g_options.worker_threads);
+
+    g_resources.use_geometry_heap = base_vertex_supported()
+        && make_geometry_heap(&g_resources.geometry_heap, sizeof(struct flag_vertex));
+    if (g_resources.use_geometry_heap)
+        heap = &g_resources.geometry_heap;
+
+    /* the software rasterizer only draws the flag and background, and only into a target */
+    g_resources.use_software = g_options.software && render_targets_supported();
+    if (g_options.software && !g_resources.use_software)
+        fprintf(stderr, "Framebuffer objects not available, ignoring --software\n");
+    if (g_resources.use_software
+        && (g_options.scene_path || g_options.crowd_size > 0 || g_options.light_count > 0))
+        fprintf(stderr, "Software rasterizing, ignoring --scene, --crowd and --lights\n");
+
+    g_resources.use_scene = g_options.scene_path != NULL && !g_resources.use_software;
+    g_resources.use_cloth_gpu = !g_options.cpu_vertices && !g_resources.use_software
+        && cloth_gpu_supported();
+    g_resources.use_crowd = g_options.crowd_size > 0 && !g_resources.use_software;
+    if (g_resources.use_crowd && !crowd_supported()) {
+        fprintf(stderr, "Instanced drawing not available, ignoring --crowd\n");
+        g_resources.use_crowd = 0;
+    }
+    g_resources.use_background = !g_resources.use_scene && !g_resources.use_crowd;
+
+    if (g_options.virtual_texture_path) {
+        if (!open_virtual_texture(&g_resources.virtual_texture, g_options.virtual_texture_path))
+            return 0;
+        g_resources.use_virtual_texture = !g_resources.use_software && virtual_texture_supported();
+        if (!g_resources.use_software && !g_resources.use_virtual_texture)
+            fprintf(stderr,
+                "Framebuffer objects not available, drawing the flag from one level of its tiles\n");
+    }
+    if (!load_startup_assets(heap))
+        return 0;
+    if (!make_wind_field_resources())
+        return 0;
+    if (g_resources.use_software) {
+        g_resources.software.mesh_count = g_resources.use_background ? 2 : 1;
+        if (!make_soft_raster(&g_resources.software.raster, g_resources.jobs.worker_count))
+            return 0;
+    }
+    if (!make_cloth(&g_resources.cloth, FLAG_X_RES, FLAG_Y_RES, FLAG_WIDTH, FLAG_HEIGHT))
+        return 0;
+    if (g_resources.use_cloth_gpu) {
+        g_resources.use_cloth_gpu = make_cloth_gpu(&g_resources.cloth_gpu, &g_resources.cloth);
+        if (g_resources.use_cloth_gpu)
+            g_resources.flag.deformed_buffer = g_resources.cloth_gpu.vertex_buffer;
+        else
+            fprintf(stderr, "Writing flag vertices on the CPU\n");
+    }
+    if (g_resources.use_scene && !load_scene(heap))
+        return 0;
+    if (g_resources.use_crowd && !make_crowd(&g_resources.crowd, g_options.crowd_size))
+        return 0;
+
+    if (!make_scene())
+        return 0;
+
     g_resources.eye_offset[0] = 0.0f;
     g_resources.eye_offset[1] = 0.0f;
-    g_resources.window_size[0] = INITIAL_WINDOW_WIDTH;
-    g_resources.window_size[1] = INITIAL_WINDOW_HEIGHT;
+    update_mv_matrix(g_resources.mv_matrix, g_resources.eye_offset);
 
-    update_p_matrix(
-        g_resources.p_matrix,
-        INITIAL_WINDOW_WIDTH,
-        INITIAL_WINDOW_HEIGHT
+    g_resources.clustered_lighting = !g_resources.use_software
+        && light_clusters_supported()
+        && make_light_clusters(&g_resources.light_clusters);
+    if (g_options.light_count > 0 && !g_resources.clustered_lighting && !g_resources.use_software)
+        fprintf(stderr, "Float textures not available, ignoring --lights\n");
+    g_resources.light_count = g_options.light_count < MAX_LIGHTS
+        ? g_options.light_count : MAX_LIGHTS;
+
+    make_shadows();
+
+    if (g_options.resolution_scale != 1.0f && !render_targets_supported())
+        fprintf(stderr, "Framebuffer objects not available, ignoring --scale\n");
+    set_resolution_scale(g_options.resolution_scale);
+
+    init_antialias(&g_resources.antialias, ANTIALIAS_OFF);
+    set_antialias((enum antialias_mode)g_options.antialias);
+
+    /* sized for the first frame; update_virtual_texture grows it with the view */
+    if (g_resources.use_virtual_texture && !make_virtual_texture(
+            &g_resources.virtual_texture,
+            g_options.export_path
+                ? g_options.export_size[0] : INITIAL_WINDOW_WIDTH * g_options.wall_size[0],
+            g_options.export_path
+                ? g_options.export_size[1] : INITIAL_WINDOW_HEIGHT * g_options.wall_size[1]
+        ))
+        return 0;
+
+    return 1;
+}
+
+#define WIND_SPEED      5.0f
+#define WIND_GUST       1.5f
+#define WIND_FLUTTER    0.75f
+#define WIND_SWING      0.3f
+
+/*
+ * A steady wind away from the pole, with slow gusts and a slow swing
+ * from side to side.
+ */
+static void flag_wind(GLfloat seconds, GLfloat *out_wind)
+{
+    GLfloat
+        speed = WIND_SPEED
+            + WIND_GUST*sinf(0.7f*seconds)
+            + WIND_FLUTTER*sinf(2.3f*seconds + 1.0f),
+        angle = WIND_SWING*sinf(0.31f*seconds);
+
+    out_wind[0] = speed*cosf(angle);
+    out_wind[1] = 0.0f;
+    out_wind[2] = speed*sinf(angle);
+}
+
+static void update(GLfloat seconds)
+{
+    double start = clock_seconds(), update_start = start;
+
+    advance_cloth(
+        &g_resources.cloth, &g_resources.jobs, seconds, &flag_wind,
+        g_resources.use_wind_field ? &g_resources.wind_field : NULL
     );
-    update_mv_matrix(g_resources.mv_matrix, g_resources.eye_offset);
+    if (g_resources.use_cloth_gpu) {
+        update_cloth_gpu(&g_resources.cloth_gpu, &g_resources.cloth, seconds);
+        g_resources.stats.upload_bytes
+            += (double)(6 * g_resources.cloth.particle_count * sizeof(GLfloat));
+    } else {
+        cloth_vertices(&g_resources.cloth, seconds, g_resources.flag_vertex_array);
+        if (!g_resources.use_software) {
+            update_flag_mesh(&g_resources.flag, g_resources.flag_vertex_array);
+            g_resources.stats.upload_bytes
+                += (double)(g_resources.cloth.particle_count * sizeof(struct flag_vertex));
+        }
+    }
+    g_resources.stats.cloth_time += clock_seconds() - start;
+    ++g_resources.stats.cloth_updates;
 
+    if (g_resources.use_crowd) {
+        start = clock_seconds();
+        update_crowd(
+            &g_resources.crowd, &g_resources.jobs, seconds, &flag_wind,
+            g_resources.view_p_matrix, g_resources.mv_matrix
+        );
+        g_resources.stats.crowd_time += clock_seconds() - start;
+        g_resources.stats.upload_bytes += (double)g_resources.crowd.upload_bytes;
+    }
+    g_resources.stats.update_time += clock_seconds() - update_start;
+
+    animate_demo_lights(g_resources.lights, g_resources.light_count, seconds);
+    g_resources.shadows_dirty = 1;
+    g_resources.render_queue_dirty = 1;
+}
+
+/*
+ * Redraw the flag into the shadow map once per animation frame, however
+ * many windows and outputs go on to sample it. Returns nonzero if it
+ * drew, leaving the shadow framebuffer bound.
+ */
+static int update_shadows(void)
+{
+    struct flag_mesh const *meshes;
+    int mesh_count;
+
+    if (!g_resources.shadows || !g_resources.shadows_dirty)
+        return 0;
+    meshes = static_meshes(&mesh_count);
+    update_shadow_map(&g_resources.shadow_map, meshes, mesh_count, &g_resources.flag);
+    g_resources.shadows_dirty = 0;
     return 1;
 }
 
-static void update(void)
+static void toggle_shadows(void)
+{
+    if (g_resources.shadow_map.size == 0) {
+        printf("shadows unavailable\n");
+        return;
+    }
+    g_resources.shadows = !g_resources.shadows;
+    g_resources.shadows_dirty = 1;
+    printf("shadows %s\n", g_resources.shadows ? "on" : "off");
+}
+
+static int lights_active(void)
+{
+    return g_resources.clustered_lighting && g_resources.light_count > 0;
+}
+
+static void cycle_light_count(void)
+{
+    static const int LIGHT_COUNTS[] = { 0, 16, 64, 256, MAX_LIGHTS };
+    int i, n = sizeof(LIGHT_COUNTS)/sizeof(LIGHT_COUNTS[0]);
+
+    for (i = 0; i < n - 1 && LIGHT_COUNTS[i] <= g_resources.light_count; ++i)
+        ;
+    g_resources.light_count = LIGHT_COUNTS[i] > g_resources.light_count ? LIGHT_COUNTS[i] : 0;
+    printf("%d lights\n", g_resources.light_count);
+}
+
+static struct window *current_window(void)
+{
+    int id = glutGetWindow(), i;
+    for (i = 0; i < g_resources.window_count; ++i)
+        if (g_resources.windows[i].id == id)
+            return &g_resources.windows[i];
+    return &g_resources.windows[0];
+}
+
+#define DEFAULT_FPS_CAP 60.0f
+
+/*
+ * Only the first window waits for vsync. If every window did, a wall of N
+ * windows sharing one thread would run at 1/N of the refresh rate. The
+ * first window is configured last, since some swap control extensions
+ * set the interval for the whole context rather than one drawable.
+ */
+static void configure_scheduler(void)
 {
-    int milliseconds = glutGet(GLUT_ELAPSED_TIME);
-    GLfloat seconds = (GLfloat)milliseconds * (1.0f/1000.0f);
+    GLfloat fps = g_options.fps_cap;
+    int current = glutGetWindow(), i;
+
+    for (i = g_resources.window_count - 1; i >= 0; --i) {
+        glutSetWindow(g_resources.windows[i].id);
+        g_resources.scheduler.vsync
+            = set_swap_interval(g_options.vsync && i == 0 ? 1 : 0) && g_options.vsync;
+    }
+    glutSetWindow(current);
+    if (g_options.vsync && !g_resources.scheduler.vsync)
+        fprintf(stderr, "Unable to enable vsync\n");
 
-    update_flag_mesh(&g_resources.flag, g_resources.flag_vertex_array, seconds);
-    glutPostRedisplay();
+    if (fps < 0.0f)
+        fps = g_resources.scheduler.vsync ? 0.0f : DEFAULT_FPS_CAP;
+    g_resources.scheduler.period = fps > 0.0f ? 1.0/(double)fps : 0.0;
+    g_resources.scheduler.next_frame = clock_seconds();
+}
+
+static int any_window_visible(void)
+{
+    int i;
+    for (i = 0; i < g_resources.window_count; ++i)
+        if (g_resources.windows[i].visible)
+            return 1;
+    return 0;
+}
+
+/*
+ * Runs once per frame: sleep until the frame's deadline if we are capped,
+ * advance the animation once for every output, then stop idling until
+ * render() has presented the frame in every visible window, so that we
+ * never compute frames that will not be shown.
+ */
+static void idle(void)
+{
+    double now, period = g_resources.scheduler.period;
+    int i;
+
+    if (period > 0.0) {
+        sleep_until(g_resources.scheduler.next_frame);
+        now = clock_seconds();
+        g_resources.scheduler.next_frame += period;
+        if (g_resources.scheduler.next_frame < now)
+            g_resources.scheduler.next_frame = now + period;
+    } else
+        now = clock_seconds();
+
+    g_resources.scheduler.frame_start = now;
+    g_resources.scheduler.swap_time = 0.0;
+    update((GLfloat)(now - g_resources.scheduler.start));
+
+    glutIdleFunc(NULL);
+    for (i = 0; i < g_resources.window_count; ++i) {
+        struct window *window = &g_resources.windows[i];
+        if (window->visible) {
+            window->pending = 1;
+            ++g_resources.scheduler.pending_windows;
+            glutPostWindowRedisplay(window->id);
+        }
+    }
+}
+
+static void update_stats(void);
+
+static void window_presented(struct window *window)
+{
+    if (!window->pending)
+        return;
+    window->pending = 0;
+    if (--g_resources.scheduler.pending_windows > 0)
+        return;
+
+    if (!g_resources.startup.presented) {
+        g_resources.startup.presented = 1;
+        printf("first frame presented %.1f ms after launch\n",
+            (clock_seconds() - g_resources.startup.launch) * 1000.0);
+    }
+    end_capture_frame();
+    update_stats();
+    if (any_window_visible())
+        glutIdleFunc(&idle);
+}
+
+static void visibility(int state)
+{
+    struct window *window = current_window();
+    int was_visible = any_window_visible();
+
+    window->visible = state == GLUT_VISIBLE;
+    if (!window->visible)
+        window_presented(window);
+
+    if (!any_window_visible())
+        glutIdleFunc(NULL);
+    else if (!was_visible) {
+        g_resources.scheduler.next_frame = clock_seconds();
+        glutIdleFunc(&idle);
+    }
 }
 
 static void drag(int x, int y)
 {
-    float w = (float)g_resources.window_size[0];
-    float h = (float)g_resources.window_size[1];
+    struct window *window = current_window();
+    float w = (float)window->size[0];
+    float h = (float)window->size[1];
     g_resources.eye_offset[0] = (float)x/w - 0.5f;
     g_resources.eye_offset[1] = -(float)y/h + 0.5f;
     update_mv_matrix(g_resources.mv_matrix, g_resources.eye_offset);
+    g_resources.render_queue_dirty = 1;
 }
 
 static void mouse(int button, int state, int x, int y)
@@ -249,38 +1433,381 @@ static void mouse(int button, int state, int x, int y)
         g_resources.eye_offset[0] = 0.0f;
         g_resources.eye_offset[1] = 0.0f;
         update_mv_matrix(g_resources.mv_matrix, g_resources.eye_offset);
+        g_resources.render_queue_dirty = 1;
     }
 }
 
+/* Off always succeeds, so this stops at the next mode that can be used. */
+static void cycle_antialias(void)
+{
+    enum antialias_mode mode = g_resources.antialias.mode;
+
+    do
+        mode = (enum antialias_mode)((mode + 1) % ANTIALIAS_MODE_COUNT);
+    while (!set_antialias(mode));
+
+    if (mode == ANTIALIAS_MSAA)
+        printf("anti-aliasing msaa %dx\n", g_resources.antialias.msaa.samples);
+    else
+        printf("anti-aliasing %s\n", antialias_mode_name(mode));
+}
+
 static void keyboard(unsigned char key, int x, int y)
 {
     if (key == 'r' || key == 'R') {
         update_flag_program();
+    } else if (key == '+' || key == '=') {
+        g_options.auto_resolution = 0;
+        set_resolution_scale(g_resources.resolution_scale + RESOLUTION_SCALE_STEP);
+    } else if (key == '-') {
+        g_options.auto_resolution = 0;
+        set_resolution_scale(g_resources.resolution_scale - RESOLUTION_SCALE_STEP);
+    } else if (key == 'a' || key == 'A') {
+        g_options.auto_resolution = !g_options.auto_resolution;
+        printf("automatic resolution scale %s\n", g_options.auto_resolution ? "on" : "off");
+    } else if (key == 'l' || key == 'L') {
+        cycle_light_count();
+    } else if (key == 's' || key == 'S') {
+        toggle_shadows();
+    } else if (key == 'm' || key == 'M') {
+        report_memory();
+        report_gpu_resources();
+    } else if (key == 'f' || key == 'F') {
+        cycle_antialias();
+    } else if (key == 'v' || key == 'V') {
+        g_options.vsync = !g_options.vsync;
+        configure_scheduler();
+        printf("vsync %s\n", g_resources.scheduler.vsync ? "on" : "off");
     }
 }
 
+/*
+ * Lay the window's outputs out in a grid. A window that owns a single
+ * output gives it the whole window.
+ */
 static void reshape(int w, int h)
 {
-    g_resources.window_size[0] = w;
-    g_resources.window_size[1] = h;
-    update_p_matrix(g_resources.p_matrix, w, h);
-    glViewport(0, 0, w, h);
+    struct window *window = current_window();
+    int window_index = (int)(window - g_resources.windows), i;
+
+    window->size[0] = w;
+    window->size[1] = h;
+
+    for (i = 0; i < g_resources.output_count; ++i) {
+        struct output *output = &g_resources.outputs[i];
+        if (output->window != window_index)
+            continue;
+
+        if (g_resources.window_count == 1 && g_resources.output_count > 1) {
+            int
+                cols = g_options.wall_size[0],
+                rows = g_options.wall_size[1],
+                col = i % cols,
+                row = i / cols;
+            output->viewport[0] = w*col/cols;
+            output->viewport[1] = h*(rows - row - 1)/rows;
+            output->viewport[2] = w*(col + 1)/cols - output->viewport[0];
+            output->viewport[3] = h*(rows - row)/rows - output->viewport[1];
+        } else {
+            output->viewport[0] = output->viewport[1] = 0;
+            output->viewport[2] = w;
+            output->viewport[3] = h;
+        }
+        update_output_p_matrix(output);
+        if (output->scene_target.framebuffer)
+            delete_render_target(&output->scene_target);
+    }
+    update_view_p_matrix();
 }
 
-static void render(void)
+#define RESOLUTION_ADJUST_SECONDS 0.25
+#define STATS_REPORT_SECONDS      1.0
+
+/*
+ * Fragment cost is proportional to the number of pixels, that is, to the
+ * square of the scale, so correct the scale by the square root of the
+ * ratio between the target and measured frame times. The dead band keeps
+ * the scale from oscillating around the target.
+ */
+static void adjust_resolution_scale(GLfloat frame_ms)
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    GLfloat ratio = g_options.target_frame_ms / frame_ms;
+
+    if (ratio > 0.9f && ratio < 1.1f)
+        return;
+    set_resolution_scale(fminf(
+        g_resources.resolution_scale * sqrtf(fminf(fmaxf(ratio, 0.5f), 1.25f)),
+        1.0f
+    ));
+}
+
+/*
+ * Hands this frame's measurements to the metrics server, along with any
+ * GPU timings that have come back since the last frame.
+ */
+static void update_metrics(double now)
+{
+    struct frame_metrics frame;
+    double gpu_seconds;
+
+    if (g_resources.use_gpu_timer)
+        while (poll_gpu_timer(&g_resources.gpu_timer, &gpu_seconds))
+            record_gpu_seconds(gpu_seconds);
+
+    record_gpu_memory(
+        (double)gpu_kind_bytes(GPU_TEXTURE),
+        (double)gpu_memory_bytes(),
+        gpu_resource_count()
+    );
+
+    frame.frame_seconds = now - g_resources.scheduler.frame_start;
+    frame.update_seconds = g_resources.stats.update_time;
+    frame.upload_bytes = g_resources.stats.upload_bytes
+        + (double)g_resources.light_clusters.upload_bytes;
+    frame.draw_calls = g_resources.stats.draw_calls;
+    record_frame_metrics(&frame);
+
+    g_resources.stats.update_time = 0.0;
+    g_resources.stats.upload_bytes = 0.0;
+    g_resources.stats.draw_calls = 0;
+    g_resources.light_clusters.upload_bytes = 0;
+}
+
+/*
+ * Once anti-aliasing has been turned on, the mean time to produce a frame
+ * in each mode that has been used.
+ */
+static void report_antialias_times(void)
+{
+    char line[128];
+    int mode, length;
+
+    if (g_resources.stats.antialias_frames[ANTIALIAS_FXAA] == 0
+        && g_resources.stats.antialias_frames[ANTIALIAS_MSAA] == 0)
+        return;
+
+    length = snprintf(line, sizeof(line), "anti-aliasing %s, ms/frame by mode:",
+        antialias_mode_name(g_resources.antialias.mode));
+    for (mode = 0; mode < ANTIALIAS_MODE_COUNT && length < (int)sizeof(line); ++mode)
+        if (g_resources.stats.antialias_frames[mode] > 0)
+            length += snprintf(line + length, sizeof(line) - length, " %s %.2f",
+                antialias_mode_name((enum antialias_mode)mode),
+                1000.0 * g_resources.stats.antialias_time[mode]
+                    / (double)g_resources.stats.antialias_frames[mode]);
+    printf("%s\n", line);
+}
+
+/*
+ * The resolution scale is driven by the time spent producing each frame
+ * rather than the interval between frames, which the frame cap and vsync
+ * would otherwise pin at the refresh period. For the same reason, time
+ * blocked in glutSwapBuffers does not count as busy.
+ */
+static void update_stats(void)
+{
+    double now = clock_seconds();
+    double budget = g_resources.scheduler.period > 0.0
+        ? g_resources.scheduler.period : 1.0/DEFAULT_FPS_CAP;
+
+    record_frame(&g_resources.stats.pacing, now, budget);
+    g_resources.stats.busy_time
+        += now - g_resources.scheduler.frame_start - g_resources.scheduler.swap_time;
+    ++g_resources.stats.adjust_frames;
+    g_resources.stats.antialias_time[g_resources.antialias.mode]
+        += now - g_resources.scheduler.frame_start;
+    ++g_resources.stats.antialias_frames[g_resources.antialias.mode];
+
+    if (metrics_server_running())
+        update_metrics(now);
+
+    if (now - g_resources.stats.last_adjust >= RESOLUTION_ADJUST_SECONDS) {
+        if (g_options.auto_resolution)
+            adjust_resolution_scale((GLfloat)(
+                1000.0 * g_resources.stats.busy_time
+                    / (double)g_resources.stats.adjust_frames
+            ));
+        g_resources.stats.last_adjust = now;
+        g_resources.stats.busy_time = 0.0;
+        g_resources.stats.adjust_frames = 0;
+    }
+
+    if (now - g_resources.stats.last_report >= STATS_REPORT_SECONDS) {
+        double mean, jitter;
+        GLint const *viewport = g_resources.outputs[0].viewport;
+
+        report_frame_pacing(&g_resources.stats.pacing, &mean, &jitter);
+        if (mean > 0.0)
+            printf(
+                "%.1f fps, %.2f ms/frame (min %.2f, max %.2f, jitter %.2f, %d late), "
+                "resolution scale %.3f (%dx%d x %d)%s\n",
+                1.0/mean, 1000.0*mean,
+                1000.0*g_resources.stats.pacing.min,
+                1000.0*g_resources.stats.pacing.max,
+                1000.0*jitter, g_resources.stats.pacing.late_frames,
+                g_resources.resolution_scale,
+                (int)((GLfloat)viewport[2] * g_resources.resolution_scale + 0.5f),
+                (int)((GLfloat)viewport[3] * g_resources.resolution_scale + 0.5f),
+                g_resources.output_count,
+                g_options.auto_resolution ? " auto" : ""
+            );
+        if (g_resources.stats.cloth_updates > 0)
+            printf(
+                "cloth %.2f ms/frame (%d particles, %d constraints in %d colors, %d thread%s), "
+                "vertices by %s\n",
+                1000.0 * g_resources.stats.cloth_time / (double)g_resources.stats.cloth_updates,
+                g_resources.cloth.particle_count,
+                g_resources.cloth.constraints.count,
+                g_resources.cloth.constraints.color_count,
+                g_resources.jobs.worker_count, g_resources.jobs.worker_count == 1 ? "" : "s",
+                !g_resources.use_cloth_gpu ? "CPU"
+                    : g_resources.cloth_gpu.use_compute ? "compute shader" : "transform feedback"
+            );
+        if (g_resources.use_software && g_resources.software.raster.stats.frames > 0) {
+            struct soft_raster *raster = &g_resources.software.raster;
+            double frames = (double)raster->stats.frames;
+
+            printf(
+                "software raster %.2f ms transform, %.2f ms setup, %.2f ms raster per frame "
+                "(%.0f triangles, %.0f binned)\n",
+                1000.0 * raster->stats.transform_seconds / frames,
+                1000.0 * raster->stats.setup_seconds / frames,
+                1000.0 * raster->stats.raster_seconds / frames,
+                (double)raster->stats.triangles / frames,
+                (double)raster->stats.binned / frames
+            );
+            memset(&raster->stats, 0, sizeof(raster->stats));
+        }
+        if (g_resources.use_crowd && g_resources.stats.cloth_updates > 0)
+            printf(
+                "crowd %.2f ms/frame (%d flags, %d + %d + %d drawn by level of detail)\n",
+                1000.0 * g_resources.stats.crowd_time / (double)g_resources.stats.cloth_updates,
+                g_resources.crowd.count,
+                g_resources.crowd.lod_counts[0],
+                g_resources.crowd.lod_counts[1],
+                g_resources.crowd.lod_counts[2]
+            );
+        if (g_resources.use_virtual_texture) {
+            struct virtual_texture *vt = &g_resources.virtual_texture;
+
+            printf(
+                "virtual texture %d of %d tiles resident, %d requested, %d loaded, "
+                "%d evicted, %d dropped (%.1f MiB)\n",
+                virtual_texture_resident(vt), vt->slot_count,
+                vt->stats.requested, vt->stats.uploaded,
+                vt->stats.evicted, vt->stats.dropped,
+                (double)virtual_texture_bytes(vt) / (1024.0*1024.0)
+            );
+            memset(&vt->stats, 0, sizeof(vt->stats));
+        }
+        report_antialias_times();
+        g_resources.stats.cloth_time = 0.0;
+        g_resources.stats.crowd_time = 0.0;
+        g_resources.stats.cloth_updates = 0;
+        reset_frame_pacing(&g_resources.stats.pacing);
+        g_resources.stats.last_report = now;
+    }
+}
+
+/*
+ * Runs on the job pool's workers: everything here must be read-only
+ * with respect to g_resources, apart from the list it is given.
+ */
+static void record_scene(struct command_list *list, int first, int count, void *data)
+{
+    GLfloat const *mv = g_resources.mv_matrix;
+    GLuint program = g_resources.flag_program.program;
+    int i;
+
+    for (i = first; i < first + count; ++i) {
+        struct scene_item const *item = &g_resources.scene_items[i];
+        GLfloat depth = mv[2]*item->center[0] + mv[6]*item->center[1]
+            + mv[10]*item->center[2] + mv[14];
+
+        push_draw_item(
+            list,
+            draw_item_key(
+                item->translucent, program, item->mesh->texture,
+                item->mesh->vertex_buffer, depth, PROJECTION_FAR_PLANE
+            ),
+            item->mesh, program, item->mesh->texture
+        );
+    }
+}
+
+/*
+ * The queue is view-dependent but shared by every output, so it is only
+ * rebuilt when the scene or the camera changes.
+ */
+static void update_render_queue(void)
+{
+    if (!g_resources.render_queue_dirty)
+        return;
+    record_render_queue(
+        &g_resources.render_queue, &g_resources.jobs,
+        g_resources.scene_item_count, &record_scene, NULL
+    );
+    g_resources.render_queue_dirty = 0;
+}
+
+/*
+ * Light data textures live on units 1-3, the shadow map on unit 4 and
+ * the virtual texture's cache and indirection table on 5 and 6.
+ * Unit 0 is left active, so the per-output cluster uploads and the mesh
+ * textures never disturb them. The shadow sampler is pointed at its own
+ * unit even with shadows off, since samplers of different types may not
+ * share a unit.
+ */
+static void begin_scene(void)
+{
+    update_render_queue();
 
     glUseProgram(g_resources.flag_program.program);
 
     glActiveTexture(GL_TEXTURE0);
     glUniform1i(g_resources.flag_program.uniforms.texture, 0);
 
-    glUniformMatrix4fv(
-        g_resources.flag_program.uniforms.p_matrix,
-        1, GL_FALSE,
-        g_resources.p_matrix
-    );
+    glUniform1f(g_resources.flag_program.uniforms.clustered_lighting, lights_active() ? 1.0f : 0.0f);
+    if (lights_active()) {
+        upload_lights(
+            &g_resources.light_clusters,
+            g_resources.lights, g_resources.light_count,
+            g_resources.mv_matrix
+        );
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, g_resources.light_clusters.light_texture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, g_resources.light_clusters.cluster_texture);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, g_resources.light_clusters.index_texture);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(g_resources.flag_program.uniforms.light_texture, 1);
+        glUniform1i(g_resources.flag_program.uniforms.cluster_texture, 2);
+        glUniform1i(g_resources.flag_program.uniforms.light_index_texture, 3);
+    }
+
+    glUniform1i(g_resources.flag_program.uniforms.shadow_map, 4);
+    glUniform1f(g_resources.flag_program.uniforms.shadowing, g_resources.shadows ? 1.0f : 0.0f);
+    if (g_resources.shadows) {
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, g_resources.shadow_map.depth);
+        glActiveTexture(GL_TEXTURE0);
+        glUniformMatrix4fv(
+            g_resources.flag_program.uniforms.shadow_matrix,
+            1, GL_FALSE,
+            g_resources.shadow_map.matrix
+        );
+        glUniform1f(
+            g_resources.flag_program.uniforms.shadow_texel,
+            1.0f/(GLfloat)g_resources.shadow_map.size
+        );
+    }
+
+    /* bind_mesh switches it on for the flag */
+    glUniform1f(g_resources.flag_program.uniforms.virtual_texturing, 0.0f);
+    if (g_resources.use_virtual_texture)
+        bind_virtual_texture(
+            &g_resources.virtual_texture, &g_resources.flag_program.uniforms.vt, 0.0f
+        );
 
     glUniformMatrix4fv(
         g_resources.flag_program.uniforms.mv_matrix,
@@ -293,36 +1820,448 @@ static void render(void)
     glEnableVertexAttribArray(g_resources.flag_program.attributes.texcoord);
     glEnableVertexAttribArray(g_resources.flag_program.attributes.shininess);
     glEnableVertexAttribArray(g_resources.flag_program.attributes.specular);
+}
+
+static void draw_scene(GLfloat const *p_matrix, GLint const *viewport)
+{
+    glUniformMatrix4fv(
+        g_resources.flag_program.uniforms.p_matrix,
+        1, GL_FALSE,
+        p_matrix
+    );
+
+    if (lights_active()) {
+        update_light_clusters(&g_resources.light_clusters, p_matrix);
+        glUniform4f(
+            g_resources.flag_program.uniforms.cluster_viewport,
+            (GLfloat)viewport[0], (GLfloat)viewport[1],
+            (GLfloat)CLUSTER_X/(GLfloat)viewport[2],
+            (GLfloat)CLUSTER_Y/(GLfloat)viewport[3]
+        );
+    }
 
-    render_mesh(&g_resources.flag);
-    render_mesh(&g_resources.background);
+    replay_render_queue(&g_resources.render_queue, &bind_mesh, NULL);
+    g_resources.stats.draw_calls += g_resources.render_queue.stats.draw_calls;
 
+    if (g_resources.use_crowd) {
+        g_resources.stats.draw_calls += draw_crowd(
+            &g_resources.crowd,
+            g_resources.wind_field.texture ? &g_resources.wind_field : NULL,
+            p_matrix, g_resources.mv_matrix, g_resources.flag.texture
+        );
+        glUseProgram(g_resources.flag_program.program);
+    }
+}
+
+static void end_scene(void)
+{
     glDisableVertexAttribArray(g_resources.flag_program.attributes.position);
     glDisableVertexAttribArray(g_resources.flag_program.attributes.normal);
     glDisableVertexAttribArray(g_resources.flag_program.attributes.texcoord);
     glDisableVertexAttribArray(g_resources.flag_program.attributes.shininess);
     glDisableVertexAttribArray(g_resources.flag_program.attributes.specular);
+}
+
+/*
+ * Offscreen outputs are left in their scene targets; render() presents
+ * them once the scene is finished with.
+ */
+static void render_output(struct output *output)
+{
+    GLsizei *render_size = output->render_size;
+    GLint viewport[4];
+    int
+        offscreen = bind_scene_target(output, render_size),
+        msaa = offscreen && g_resources.antialias.mode == ANTIALIAS_MSAA;
+
+    if (msaa && !bind_msaa_target(&g_resources.antialias, render_size[0], render_size[1])) {
+        fprintf(stderr, "Falling back to anti-aliasing off\n");
+        set_antialias(ANTIALIAS_OFF);
+        msaa = 0;
+        glBindFramebuffer(GL_FRAMEBUFFER, output->scene_target.framebuffer);
+    }
+
+    if (offscreen) {
+        viewport[0] = viewport[1] = 0;
+        viewport[2] = render_size[0];
+        viewport[3] = render_size[1];
+    } else {
+        viewport[0] = output->viewport[0];
+        viewport[1] = output->viewport[1];
+        viewport[2] = output->viewport[2];
+        viewport[3] = output->viewport[3];
+    }
+
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (offscreen)
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    draw_scene(output->p_matrix, viewport);
+
+    if (msaa)
+        resolve_msaa_target(
+            &g_resources.antialias, render_size[0], render_size[1],
+            output->scene_target.framebuffer
+        );
+    output->offscreen = offscreen;
+}
+
+static int draw_soft_output(GLsizei width, GLsizei height, GLfloat const *p_matrix, GLuint texture)
+{
+    if (!draw_soft_frame(
+            &g_resources.software.raster, &g_resources.jobs,
+            width, height,
+            g_resources.software.meshes, g_resources.software.mesh_count,
+            p_matrix, g_resources.mv_matrix, LIGHT_DIRECTION
+        ))
+        return 0;
+    upload_soft_frame(&g_resources.software.raster, texture);
+    g_resources.stats.upload_bytes += (double)width * (double)height * 4.0;
+    return 1;
+}
+
+/*
+ * The rasterizer's image replaces the lower-left corner of the scene
+ * target's color texture, which is then presented as a scaled render
+ * would be.
+ */
+static void render_soft_output(struct output *output)
+{
+    GLsizei render_size[2];
+
+    if (!bind_scene_target(output, render_size))
+        return;
+    if (draw_soft_output(
+            render_size[0], render_size[1],
+            output->p_matrix, output->scene_target.color_texture
+        ))
+        present_scene_target(output, render_size);
+    else
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+#define STREAM_READBACK_DEPTH 2
+
+/*
+ * Queue the first window's back buffer for the stream server. The ring
+ * is sized to the window, so it is rebuilt whenever the window resizes.
+ */
+static void stream_window(struct window const *window)
+{
+    struct readback_ring *ring = &g_resources.stream.ring;
+
+    if (!stream_server_wants_frames())
+        return;
+
+    if (ring->size[0] != window->size[0] || ring->size[1] != window->size[1]) {
+        if (ring->depth > 0)
+            delete_readback_ring(ring);
+        if (!make_readback_ring(ring, STREAM_READBACK_DEPTH, window->size[0], window->size[1]))
+            return;
+    }
+    readback_push(ring, g_resources.stream.frame++, &stream_frame, NULL);
+}
+
+/*
+ * Once a frame, for the whole wall at the size it is being drawn, since
+ * that decides which levels the flag program samples.
+ */
+static void update_flag_virtual_texture(void)
+{
+    struct output const *output = &g_resources.outputs[0];
+    GLfloat scale = g_resources.resolution_scale;
+
+    update_virtual_texture(
+        &g_resources.virtual_texture, &g_resources.flag,
+        g_resources.view_p_matrix, g_resources.mv_matrix,
+        (GLsizei)((GLfloat)(output->viewport[2] * g_options.wall_size[0]) * scale + 0.5f),
+        (GLsizei)((GLfloat)(output->viewport[3] * g_options.wall_size[1]) * scale + 0.5f),
+        0
+    );
+}
+
+static void render(void)
+{
+    struct window *window = current_window();
+    int window_index = (int)(window - g_resources.windows), i;
+    double swap_start;
+
+    if (g_resources.use_gpu_timer)
+        begin_gpu_timer(&g_resources.gpu_timer);
+
+    if (update_shadows())
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (window_index == 0 && g_resources.use_virtual_texture) {
+        update_flag_virtual_texture();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    if (g_resources.use_software) {
+        for (i = 0; i < g_resources.output_count; ++i)
+            if (g_resources.outputs[i].window == window_index)
+                render_soft_output(&g_resources.outputs[i]);
+    } else {
+        begin_scene();
+        for (i = 0; i < g_resources.output_count; ++i)
+            if (g_resources.outputs[i].window == window_index)
+                render_output(&g_resources.outputs[i]);
+        end_scene();
+
+        for (i = 0; i < g_resources.output_count; ++i) {
+            struct output const *output = &g_resources.outputs[i];
+            if (output->window == window_index && output->offscreen)
+                present_scene_target(output, output->render_size);
+        }
+    }
+
+    if (window_index == 0)
+        stream_window(window);
+
+    if (g_resources.use_gpu_timer)
+        end_gpu_timer(&g_resources.gpu_timer);
+    swap_start = clock_seconds();
     glutSwapBuffers();
+    g_resources.scheduler.swap_time += clock_seconds() - swap_start;
+    window_presented(window);
 }
 
-int main(int argc, char* argv[])
+static void create_window(const char *title, int x, int y)
 {
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
-    glutInitWindowSize(INITIAL_WINDOW_WIDTH, INITIAL_WINDOW_HEIGHT);
-    glutCreateWindow("Flag");
-    glutIdleFunc(&update);
+    struct window *window = &g_resources.windows[g_resources.window_count++];
+
+    glutInitWindowPosition(x, y);
+    window->id = glutCreateWindow(title);
+    window->size[0] = INITIAL_WINDOW_WIDTH;
+    window->size[1] = INITIAL_WINDOW_HEIGHT;
+    window->visible = 1;
+    window->pending = 0;
+
     glutDisplayFunc(&render);
+    glutVisibilityFunc(&visibility);
     glutReshapeFunc(&reshape);
     glutMotionFunc(&drag);
     glutMouseFunc(&mouse);
     glutKeyboardFunc(&keyboard);
+}
+
+/*
+ * Each output covers one cell of the wall grid, counted left to right
+ * and top to bottom. The remaining windows are created with the first
+ * window's context current so that freeglut reuses it for them.
+ */
+static int create_outputs(void)
+{
+    int
+        cols = g_options.wall_size[0],
+        rows = g_options.wall_size[1],
+        separate_windows = cols*rows > 1 && !g_options.wall_viewports,
+        i;
+
+    if (cols*rows > MAX_OUTPUTS) {
+        fprintf(stderr, "At most %d outputs are supported\n", MAX_OUTPUTS);
+        return 0;
+    }
+
+    glutInitWindowSize(INITIAL_WINDOW_WIDTH, INITIAL_WINDOW_HEIGHT);
+    create_window("Flag", 0, 0);
+
+#ifdef GLUT_USE_CURRENT_CONTEXT
+    if (separate_windows) {
+        char title[32];
+        glutSetOption(GLUT_RENDERING_CONTEXT, GLUT_USE_CURRENT_CONTEXT);
+        for (i = 1; i < cols*rows; ++i) {
+            snprintf(title, sizeof(title), "Flag %d", i);
+            create_window(
+                title,
+                INITIAL_WINDOW_WIDTH*(i % cols),
+                INITIAL_WINDOW_HEIGHT*(i / cols)
+            );
+        }
+        glutSetWindow(g_resources.windows[0].id);
+    }
+#else
+    if (separate_windows)
+        fprintf(stderr, "Shared contexts not available, drawing the wall in one window\n");
+#endif
+
+    g_resources.output_count = cols*rows;
+    for (i = 0; i < g_resources.output_count; ++i) {
+        struct output *output = &g_resources.outputs[i];
+        int col = i % cols, row = i / cols;
+
+        output->window = g_resources.window_count > 1 ? i : 0;
+        output->region[0] = (GLfloat)col/(GLfloat)cols;
+        output->region[1] = (GLfloat)(rows - row - 1)/(GLfloat)rows;
+        output->region[2] = (GLfloat)(col + 1)/(GLfloat)cols;
+        output->region[3] = (GLfloat)(rows - row)/(GLfloat)rows;
+    }
+    return 1;
+}
+
+/*
+ * With --capture, GL calls are recorded from before the first one that
+ * loads anything, so that the capture can be replayed on its own.
+ */
+static int start_capture(GLsizei width, GLsizei height)
+{
+    if (!g_options.capture_path)
+        return 1;
+    if (!start_gl_capture(g_options.capture_path, g_options.capture_frames, width, height))
+        return 0;
+    atexit(&stop_gl_capture);
+    return 1;
+}
+
+#define EXPORT_READBACK_DEPTH 3
+
+/*
+ * Render the export job's frames into an offscreen target in a hidden
+ * window, at fixed time steps rather than wall-clock time. Frames are read
+ * back through a ring of pixel buffers, so writing out one frame overlaps
+ * with drawing the next ones. With FXAA, frames are drawn into a second
+ * target that is filtered into the first.
+ */
+static int run_export(int *argc, char **argv)
+{
+    GLint viewport[4];
+    struct export_job job;
+    struct frame_writer writer;
+    struct readback_ring ring;
+    struct render_target target, fxaa_source;
+    struct render_target *scene_target = &target;
+    GLfloat *p_matrix = g_resources.view_p_matrix;
+    GLsizei
+        w = g_options.export_size[0],
+        h = g_options.export_size[1];
+    double start;
+    int status = start_export_workers(&g_options, &job), i, ok, msaa;
+
+    if (status <= 0)
+        return status < 0;
+
+    glutInit(argc, argv);
+    glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
+    glutInitWindowSize(w, h);
+    glutCreateWindow("Flag export");
+    glutHideWindow();
+
+    glewInit();
+    if (!GLEW_VERSION_2_0 || !render_targets_supported()) {
+        fprintf(stderr, "OpenGL 2.0 with framebuffer objects required for export\n");
+        return 1;
+    }
+    /* only one worker's frames, so that workers don't share a file */
+    if (job.worker <= 0 && !start_capture(w, h))
+        return 1;
+
+    init_gl_state();
+    if (!make_resources()) {
+        fprintf(stderr, "Failed to load resources\n");
+        return 1;
+    }
+    /* simulate every step up to each frame, however long that takes */
+    g_resources.cloth.max_steps = 0;
+    if (!make_render_target(&target, w, h)
+        || !make_readback_ring(&ring, EXPORT_READBACK_DEPTH, w, h)
+        || !open_frame_writer(&writer, &g_options, &job))
+        return 1;
+    if (g_resources.antialias.mode == ANTIALIAS_FXAA) {
+        if (!make_render_target(&fxaa_source, w, h))
+            return 1;
+        scene_target = &fxaa_source;
+    }
+    msaa = g_resources.antialias.mode == ANTIALIAS_MSAA;
+
+    update_p_matrix(p_matrix, w, h, FULL_REGION);
+    viewport[0] = viewport[1] = 0;
+    viewport[2] = w;
+    viewport[3] = h;
+
+    start = clock_seconds();
+    for (i = 0; i < job.frame_count && !writer.failed; ++i) {
+        int frame = job.first_frame + i;
+
+        update(g_options.export_start + (GLfloat)frame / g_options.export_fps);
+        if (g_resources.use_software) {
+            if (!draw_soft_output(w, h, p_matrix, scene_target->color_texture))
+                return 1;
+        } else {
+            update_shadows();
+            /* every tile the frame needs is loaded before it is drawn */
+            if (g_resources.use_virtual_texture)
+                update_virtual_texture(
+                    &g_resources.virtual_texture, &g_resources.flag,
+                    p_matrix, g_resources.mv_matrix, w, h, 1
+                );
+            if (!msaa)
+                glBindFramebuffer(GL_FRAMEBUFFER, scene_target->framebuffer);
+            else if (!bind_msaa_target(&g_resources.antialias, w, h))
+                return 1;
+            glViewport(0, 0, w, h);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            begin_scene();
+            draw_scene(p_matrix, viewport);
+            end_scene();
+            if (msaa)
+                resolve_msaa_target(&g_resources.antialias, w, h, target.framebuffer);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+        if (scene_target != &target) {
+            glViewport(0, 0, w, h);
+            draw_fxaa(&g_resources.antialias, scene_target, target.size);
+        }
+        readback_push(&ring, frame, &write_frame, &writer);
+        end_capture_frame();
+    }
+    readback_flush(&ring, &write_frame, &writer);
+    if (i > 0)
+        fprintf(stderr, "%d frames in %.2f ms/frame with anti-aliasing %s\n",
+            i, 1000.0 * (clock_seconds() - start) / (double)i,
+            antialias_mode_name(g_resources.antialias.mode));
+    if (g_resources.use_virtual_texture)
+        fprintf(stderr, "virtual texture %d tiles loaded, %d evicted, %d dropped\n",
+            g_resources.virtual_texture.stats.uploaded,
+            g_resources.virtual_texture.stats.evicted,
+            g_resources.virtual_texture.stats.dropped);
+
+    ok = close_frame_writer(&writer);
+    delete_readback_ring(&ring);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    delete_render_target(&target);
+    if (scene_target != &target)
+        delete_render_target(&fxaa_source);
+    return !ok;
+}
+
+int main(int argc, char* argv[])
+{
+    int i;
+
+    g_resources.startup.launch = clock_seconds();
+    default_options(&g_options);
+    if (!parse_options(&argc, argv, &g_options))
+        return 1;
+
+    init_memory(g_options.memory_budget);
+    init_gpu_resources(g_options.gpu_budget);
+
+    if (g_options.export_path)
+        return run_export(&argc, argv);
+
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
+    if (!create_outputs())
+        return 1;
 
     glewInit();
     if (!GLEW_VERSION_2_0) {
         fprintf(stderr, "OpenGL 2.0 not available\n");
         return 1;
     }
+    if (!start_capture(INITIAL_WINDOW_WIDTH, INITIAL_WINDOW_HEIGHT))
+        return 1;
 
     init_gl_state();
     if (!make_resources()) {
@@ -330,6 +2269,32 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    if (g_options.stream_address) {
+        if (!start_stream_server(g_options.stream_address))
+            return 1;
+        atexit(&stop_stream_server);
+    }
+
+    if (g_options.metrics_address) {
+        if (!start_metrics_server(g_options.metrics_address))
+            return 1;
+        atexit(&stop_metrics_server);
+        g_resources.use_gpu_timer = gpu_timers_supported();
+        if (g_resources.use_gpu_timer)
+            make_gpu_timer(&g_resources.gpu_timer);
+    }
+
+    for (i = 0; i < g_resources.window_count; ++i) {
+        glutSetWindow(g_resources.windows[i].id);
+        reshape(INITIAL_WINDOW_WIDTH, INITIAL_WINDOW_HEIGHT);
+    }
+    glutSetWindow(g_resources.windows[0].id);
+
+    configure_scheduler();
+    reset_frame_pacing(&g_resources.stats.pacing);
+    g_resources.scheduler.start = clock_seconds();
+    glutIdleFunc(&idle);
+
     glutMainLoop();
     return 0;
 }
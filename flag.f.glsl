@@ -3,16 +3,152 @@
 uniform mat4 p_matrix, mv_matrix;
 uniform sampler2D texture;
 
+uniform sampler2D light_texture, cluster_texture, light_index_texture;
+uniform vec4 cluster_viewport;
+uniform float clustered_lighting;
+
+uniform sampler2DShadow shadow_map;
+uniform float shadowing, shadow_texel;
+
+uniform float virtual_texturing;
+uniform sampler2D vt_cache, vt_indirection;
+/* see vt-feedback.f.glsl; vt_scale is 1/the indirection and cache sizes */
+uniform vec4 vt_size, vt_scale, vt_levels[16];
+
 varying vec3 frag_position, frag_normal;
 varying vec2 frag_texcoord;
 varying float frag_shininess;
 varying vec4 frag_specular;
+varying vec3 frag_shadow_position;
 
 const vec3 light_direction = vec3(0.408248, -0.816497, 0.408248);
 const vec4 light_diffuse = vec4(0.8, 0.8, 0.8, 0.0);
 const vec4 light_ambient = vec4(0.2, 0.2, 0.2, 1.0);
 const vec4 light_specular = vec4(1.0, 1.0, 1.0, 1.0);
 
+/* must match lights.h */
+const float MAX_LIGHTS = 1024.0;
+const float LIGHT_TEXELS = 3.0;
+const float CLUSTER_X = 16.0, CLUSTER_Y = 9.0, CLUSTER_Z = 24.0;
+const float CLUSTER_NEAR = 0.0625, CLUSTER_FAR = 16.0;
+const float LIGHT_INDEX_WIDTH = 1024.0, LIGHT_INDEX_HEIGHT = 64.0;
+const int MAX_LIGHTS_PER_CLUSTER = 256;
+
+/* must match tile-file.h */
+const float TILE_SIZE = 128.0, TILE_BORDER = 1.0, TILE_TEXELS = 130.0;
+
+vec4 light_texel(float light, float texel)
+{
+    return texture2D(
+        light_texture,
+        vec2((texel + 0.5)/LIGHT_TEXELS, (light + 0.5)/MAX_LIGHTS)
+    );
+}
+
+/*
+ * Sum the point and spot lights listed for this fragment's cluster; see
+ * update_light_clusters in lights.c for how the lists are built.
+ */
+void clustered_lights(
+    vec3 normal, vec3 eye,
+    inout vec4 diffuse_factor, inout vec4 specular_factor
+) {
+    vec2 tile = floor((gl_FragCoord.xy - cluster_viewport.xy) * cluster_viewport.zw);
+    float slice = clamp(
+        floor(log(max(frag_position.z, CLUSTER_NEAR)/CLUSTER_NEAR)
+            * (CLUSTER_Z/log(CLUSTER_FAR/CLUSTER_NEAR))),
+        0.0, CLUSTER_Z - 1.0
+    );
+    vec4 cluster = texture2D(
+        cluster_texture,
+        vec2(
+            (tile.y*CLUSTER_X + tile.x + 0.5)/(CLUSTER_X*CLUSTER_Y),
+            (slice + 0.5)/CLUSTER_Z
+        )
+    );
+
+    for (int i = 0; i < MAX_LIGHTS_PER_CLUSTER; ++i) {
+        if (float(i) >= cluster.y)
+            break;
+
+        float index = cluster.x + float(i);
+        float light = texture2D(
+            light_index_texture,
+            vec2(
+                (mod(index, LIGHT_INDEX_WIDTH) + 0.5)/LIGHT_INDEX_WIDTH,
+                (floor(index/LIGHT_INDEX_WIDTH) + 0.5)/LIGHT_INDEX_HEIGHT
+            )
+        ).r;
+
+        vec4 position_radius = light_texel(light, 0.0),
+             color_cutoff = light_texel(light, 1.0),
+             direction_inner = light_texel(light, 2.0);
+
+        vec3 to_light = position_radius.xyz - frag_position;
+        float distance_squared = dot(to_light, to_light);
+        float falloff = max(1.0 - distance_squared/(position_radius.w*position_radius.w), 0.0);
+        vec3 l = to_light * inversesqrt(max(distance_squared, 1e-8));
+
+        float attenuation = falloff*falloff;
+        if (color_cutoff.w >= -1.0)
+            attenuation *= smoothstep(
+                color_cutoff.w, direction_inner.w, dot(-l, direction_inner.xyz)
+            );
+
+        vec4 color = vec4(color_cutoff.rgb * attenuation, 0.0);
+        diffuse_factor += max(dot(normal, l), 0.0) * color;
+        specular_factor
+            += max(pow(max(-dot(reflect(-l, normal), eye), 0.0), frag_shininess), 0.0) * color;
+    }
+}
+
+/*
+ * Pick a level as vt-feedback.f.glsl does, then sample whichever tile the
+ * indirection table has in the cache for it: its own, or a coarser one
+ * while its own is loading. Filtering is bilinear within that level.
+ */
+vec4 virtual_texel(vec2 texcoord)
+{
+    vec2 uv = clamp(texcoord, 0.0, 1.0),
+         dx = dFdx(texcoord * vt_size.xy), dy = dFdy(texcoord * vt_size.xy);
+    float level = clamp(
+        floor(0.5*log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + vt_size.w + 0.5),
+        0.0, vt_size.z - 1.0
+    );
+    vec4 wanted = vt_levels[int(level)];
+    vec2 tile = min(floor(uv * wanted.xy / TILE_SIZE), ceil(wanted.xy / TILE_SIZE) - 1.0);
+    vec4 entry = texture2D(
+        vt_indirection,
+        vec2(tile.x + 0.5, wanted.z + tile.y + 0.5) * vt_scale.xy
+    );
+
+    vec2 resident = vt_levels[int(entry.b*255.0 + 0.5)].xy,
+         texels = uv * resident,
+         resident_tile = min(floor(texels / TILE_SIZE), ceil(resident / TILE_SIZE) - 1.0),
+         slot = floor(entry.rg*255.0 + 0.5);
+
+    return texture2D(
+        vt_cache,
+        (slot*TILE_TEXELS + TILE_BORDER + texels - resident_tile*TILE_SIZE) * vt_scale.zw
+    );
+}
+
+/*
+ * 3x3 percentage-closer filter. Each tap is itself a bilinear 2x2
+ * comparison, since the shadow map uses linear filtering.
+ */
+float shadow_factor()
+{
+    float sum = 0.0;
+    for (float y = -1.0; y <= 1.0; y += 1.0)
+        for (float x = -1.0; x <= 1.0; x += 1.0)
+            sum += shadow2D(
+                shadow_map,
+                frag_shadow_position + vec3(x*shadow_texel, y*shadow_texel, 0.0)
+            ).r;
+    return sum * (1.0/9.0);
+}
+
 void main()
 {
     vec3 mv_light_direction = (mv_matrix * vec4(light_direction, 0.0)).xyz,
@@ -20,13 +156,21 @@ void main()
          eye = normalize(frag_position),
          reflection = reflect(mv_light_direction, normal);
 
-    vec4 frag_diffuse = texture2D(texture, frag_texcoord);
+    float shadow = shadowing > 0.5 ? shadow_factor() : 1.0;
+
+    vec4 frag_diffuse = virtual_texturing > 0.5
+        ? virtual_texel(frag_texcoord)
+        : texture2D(texture, frag_texcoord);
     vec4 diffuse_factor
-        = max(-dot(normal, mv_light_direction), 0.0) * light_diffuse;
+        = shadow * max(-dot(normal, mv_light_direction), 0.0) * light_diffuse;
+    vec4 specular_factor
+        = shadow * max(pow(-dot(reflection, eye), frag_shininess), 0.0) * light_specular;
+
+    if (clustered_lighting > 0.5)
+        clustered_lights(normal, eye, diffuse_factor, specular_factor);
+
     vec4 ambient_diffuse_factor
         = diffuse_factor + light_ambient;
-    vec4 specular_factor
-        = max(pow(-dot(reflection, eye), frag_shininess), 0.0) * light_specular;
     
     gl_FragColor = specular_factor * frag_specular
         + ambient_diffuse_factor * frag_diffuse;
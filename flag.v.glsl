@@ -1,6 +1,6 @@
 #version 110
 
-uniform mat4 p_matrix, mv_matrix;
+uniform mat4 p_matrix, mv_matrix, shadow_matrix;
 uniform sampler2D texture;
 
 attribute vec3 position, normal;
@@ -12,6 +12,7 @@ varying vec3 frag_position, frag_normal;
 varying vec2 frag_texcoord;
 varying float frag_shininess;
 varying vec4 frag_specular;
+varying vec3 frag_shadow_position;
 
 void main()
 {
@@ -22,4 +23,5 @@ void main()
     frag_texcoord = texcoord;
     frag_shininess = shininess;
     frag_specular = specular;
+    frag_shadow_position = (shadow_matrix * vec4(position, 1.0)).xyz;
 }
@@ -0,0 +1,113 @@
+#include <math.h>
+#include <float.h>
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <time.h>
+#  include <errno.h>
+#  include <sched.h>
+#endif
+#include "frame-clock.h"
+
+/*
+ * Portion of a sleep left to a yield loop instead of the OS timer, which
+ * may oversleep by about a scheduler tick.
+ */
+#define SPIN_SECONDS 0.002
+
+#ifdef _WIN32
+
+double clock_seconds(void)
+{
+    static double period = 0.0;
+    LARGE_INTEGER counter;
+
+    if (period == 0.0) {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        period = 1.0/(double)frequency.QuadPart;
+        timeBeginPeriod(1);
+    }
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * period;
+}
+
+void sleep_until(double deadline)
+{
+    double remaining = deadline - clock_seconds();
+
+    if (remaining > SPIN_SECONDS)
+        Sleep((DWORD)((remaining - SPIN_SECONDS) * 1000.0));
+    while (clock_seconds() < deadline)
+        SwitchToThread();
+}
+
+#else
+
+double clock_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+void sleep_until(double deadline)
+{
+    double remaining = deadline - clock_seconds();
+
+    if (remaining > SPIN_SECONDS) {
+        struct timespec duration;
+        remaining -= SPIN_SECONDS;
+        duration.tv_sec = (time_t)remaining;
+        duration.tv_nsec = (long)((remaining - (double)duration.tv_sec) * 1e9);
+        while (nanosleep(&duration, &duration) == -1 && errno == EINTR)
+            ;
+    }
+    while (clock_seconds() < deadline)
+        sched_yield();
+}
+
+#endif
+
+void reset_frame_pacing(struct frame_pacing *pacing)
+{
+    pacing->sum = pacing->sum_squares = 0.0;
+    pacing->min = DBL_MAX;
+    pacing->max = 0.0;
+    pacing->frames = pacing->late_frames = 0;
+}
+
+/*
+ * Record the interval since the previous frame. Frames that take more
+ * than one and a half times the budget have visibly missed their slot.
+ */
+void record_frame(struct frame_pacing *pacing, double now, double budget)
+{
+    double interval = now - pacing->last_frame;
+
+    pacing->last_frame = now;
+    if (interval <= 0.0 || interval > 1.0)
+        return;
+
+    pacing->sum += interval;
+    pacing->sum_squares += interval*interval;
+    if (interval < pacing->min) pacing->min = interval;
+    if (interval > pacing->max) pacing->max = interval;
+    if (budget > 0.0 && interval > 1.5*budget)
+        ++pacing->late_frames;
+    ++pacing->frames;
+}
+
+void report_frame_pacing(struct frame_pacing const *pacing, double *out_mean, double *out_jitter)
+{
+    double mean, variance;
+
+    if (pacing->frames == 0) {
+        *out_mean = *out_jitter = 0.0;
+        return;
+    }
+    mean = pacing->sum / (double)pacing->frames;
+    variance = pacing->sum_squares / (double)pacing->frames - mean*mean;
+    *out_mean = mean;
+    *out_jitter = variance > 0.0 ? sqrt(variance) : 0.0;
+}
@@ -0,0 +1,12 @@
+double clock_seconds(void);
+void sleep_until(double deadline);
+
+struct frame_pacing {
+    double last_frame;
+    double sum, sum_squares, min, max;
+    int frames, late_frames;
+};
+
+void reset_frame_pacing(struct frame_pacing *pacing);
+void record_frame(struct frame_pacing *pacing, double now, double budget);
+void report_frame_pacing(struct frame_pacing const *pacing, double *out_mean, double *out_jitter);
@@ -0,0 +1,62 @@
+#version 110
+
+uniform sampler2D texture;
+
+/* xy: the size of a texel; zw: the far corner of the rendered region */
+uniform vec4 texel;
+
+varying vec2 frag_texcoord;
+
+const float REDUCE_MIN = 1.0/128.0;
+const float REDUCE_MUL = 1.0/8.0;
+const float SPAN_MAX = 8.0;
+
+const vec3 LUMA = vec3(0.299, 0.587, 0.114);
+
+vec3 sample_clamped(vec2 texcoord)
+{
+    return texture2D(texture, clamp(texcoord, 0.5*texel.xy, texel.zw - 0.5*texel.xy)).rgb;
+}
+
+/*
+ * FXAA in one pass, after Lottes: the luma of the four diagonal
+ * neighbours gives the direction across an edge, and the pixel is
+ * replaced by a blend of samples taken along the edge, over a span that
+ * grows with its contrast. If the wider blend strays outside the
+ * neighbourhood's luma range it has crossed another edge, and the
+ * narrower one is used instead. Flat areas come through unchanged.
+ */
+void main()
+{
+    vec3 rgb_nw = sample_clamped(frag_texcoord + vec2(-1.0, -1.0)*texel.xy),
+         rgb_ne = sample_clamped(frag_texcoord + vec2( 1.0, -1.0)*texel.xy),
+         rgb_sw = sample_clamped(frag_texcoord + vec2(-1.0,  1.0)*texel.xy),
+         rgb_se = sample_clamped(frag_texcoord + vec2( 1.0,  1.0)*texel.xy),
+         rgb_m  = sample_clamped(frag_texcoord);
+
+    float luma_nw = dot(rgb_nw, LUMA), luma_ne = dot(rgb_ne, LUMA),
+          luma_sw = dot(rgb_sw, LUMA), luma_se = dot(rgb_se, LUMA),
+          luma_m = dot(rgb_m, LUMA),
+          luma_min = min(luma_m, min(min(luma_nw, luma_ne), min(luma_sw, luma_se))),
+          luma_max = max(luma_m, max(max(luma_nw, luma_ne), max(luma_sw, luma_se)));
+
+    vec2 direction = vec2(
+        (luma_sw + luma_se) - (luma_nw + luma_ne),
+        (luma_nw + luma_sw) - (luma_ne + luma_se)
+    );
+    float reduce = max((luma_nw + luma_ne + luma_sw + luma_se)*0.25*REDUCE_MUL, REDUCE_MIN),
+          scale = 1.0/(min(abs(direction.x), abs(direction.y)) + reduce);
+    direction = clamp(direction*scale, -SPAN_MAX, SPAN_MAX) * texel.xy;
+
+    vec3 rgb_a = 0.5*(
+            sample_clamped(frag_texcoord + direction*(1.0/3.0 - 0.5))
+            + sample_clamped(frag_texcoord + direction*(2.0/3.0 - 0.5))
+         ),
+         rgb_b = 0.5*rgb_a + 0.25*(
+            sample_clamped(frag_texcoord - 0.5*direction)
+            + sample_clamped(frag_texcoord + 0.5*direction)
+         );
+    float luma_b = dot(rgb_b, LUMA);
+
+    gl_FragColor = vec4(luma_b < luma_min || luma_b > luma_max ? rgb_a : rgb_b, 1.0);
+}
@@ -0,0 +1,18 @@
+#version 110
+
+/* xy: the size of a texel; zw: the far corner of the rendered region */
+uniform vec4 texel;
+
+attribute vec2 position;
+
+varying vec2 frag_texcoord;
+
+/*
+ * One triangle covering the viewport, with texture coordinates spanning
+ * the part of the scene target that was rendered.
+ */
+void main()
+{
+    gl_Position = vec4(position, 0.0, 1.0);
+    frag_texcoord = (0.5*position + 0.5) * texel.zw;
+}
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <string.h>
+#include <stdio.h>
+#include "geometry-heap.h"
+#include "gpu-resources.h"
+#include "gl-capture.h"
+
+#define STATIC_VERTEX_CAPACITY  65536
+#define DYNAMIC_VERTEX_CAPACITY 65536
+#define ELEMENT_CAPACITY        (1024*1024)
+#define INITIAL_FREE_RANGES     16
+
+int base_vertex_supported(void)
+{
+    return GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex;
+}
+
+int multi_draw_indirect_supported(void)
+{
+    return GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+}
+
+int make_geometry_arena(
+    struct geometry_arena *out_arena,
+    GLenum target, GLsizei stride, GLsizei capacity, GLenum hint
+) {
+    out_arena->target = target;
+    out_arena->stride = stride;
+    out_arena->capacity = capacity;
+    out_arena->used = 0;
+
+    out_arena->free_ranges
+        = (struct heap_range*) malloc(INITIAL_FREE_RANGES * sizeof(struct heap_range));
+    if (!out_arena->free_ranges) {
+        fprintf(stderr, "Unable to allocate geometry arena free list\n");
+        return 0;
+    }
+    out_arena->free_capacity = INITIAL_FREE_RANGES;
+    out_arena->free_count = 1;
+    out_arena->free_ranges[0].offset = 0;
+    out_arena->free_ranges[0].size = capacity;
+
+    glGenBuffers(1, &out_arena->buffer);
+    glBindBuffer(target, out_arena->buffer);
+    glBufferData(target, (GLsizeiptr)capacity * stride, NULL, hint);
+    track_gpu_resource(GPU_BUFFER, out_arena->buffer, (size_t)capacity * stride, "geometry heap");
+    return 1;
+}
+
+void delete_geometry_arena(struct geometry_arena *arena)
+{
+    glDeleteBuffers(1, &arena->buffer);
+    untrack_gpu_resource(GPU_BUFFER, arena->buffer);
+    free(arena->free_ranges);
+    arena->buffer = 0;
+    arena->free_ranges = NULL;
+    arena->free_count = arena->free_capacity = 0;
+    arena->capacity = arena->used = 0;
+}
+
+/*
+ * First fit over the free ranges, which are kept sorted by offset.
+ * Returns GEOMETRY_ALLOC_FAILED if no free range is large enough.
+ */
+GLsizei geometry_alloc(struct geometry_arena *arena, GLsizei size)
+{
+    int i;
+
+    for (i = 0; i < arena->free_count; ++i) {
+        struct heap_range *range = &arena->free_ranges[i];
+        if (range->size >= size) {
+            GLsizei offset = range->offset;
+
+            range->offset += size;
+            range->size -= size;
+            if (range->size == 0) {
+                memmove(
+                    range, range + 1,
+                    (arena->free_count - i - 1) * sizeof(struct heap_range)
+                );
+                --arena->free_count;
+            }
+            arena->used += size;
+            return offset;
+        }
+    }
+    return GEOMETRY_ALLOC_FAILED;
+}
+
+/*
+ * Returns the range to the free list, merging it with free neighbors so
+ * that fragmentation does not accumulate as meshes come and go.
+ */
+void geometry_free(struct geometry_arena *arena, GLsizei offset, GLsizei size)
+{
+    struct heap_range *ranges;
+    int i;
+
+    for (i = 0; i < arena->free_count && arena->free_ranges[i].offset < offset; ++i)
+        ;
+    ranges = arena->free_ranges;
+    arena->used -= size;
+
+    if (i > 0 && ranges[i-1].offset + ranges[i-1].size == offset) {
+        ranges[i-1].size += size;
+        if (i < arena->free_count && offset + size == ranges[i].offset) {
+            ranges[i-1].size += ranges[i].size;
+            memmove(
+                &ranges[i], &ranges[i+1],
+                (arena->free_count - i - 1) * sizeof(struct heap_range)
+            );
+            --arena->free_count;
+        }
+        return;
+    }
+    if (i < arena->free_count && offset + size == ranges[i].offset) {
+        ranges[i].offset = offset;
+        ranges[i].size += size;
+        return;
+    }
+
+    if (arena->free_count == arena->free_capacity) {
+        int capacity = arena->free_capacity * 2;
+        ranges = (struct heap_range*) realloc(ranges, capacity * sizeof(struct heap_range));
+        if (!ranges) {
+            fprintf(stderr, "Unable to grow geometry arena free list, leaking %d\n", (int)size);
+            return;
+        }
+        arena->free_ranges = ranges;
+        arena->free_capacity = capacity;
+    }
+    memmove(&ranges[i+1], &ranges[i], (arena->free_count - i) * sizeof(struct heap_range));
+    ranges[i].offset = offset;
+    ranges[i].size = size;
+    ++arena->free_count;
+}
+
+int make_geometry_heap(struct geometry_heap *out_heap, GLsizei vertex_stride)
+{
+    if (!make_geometry_arena(
+            &out_heap->static_vertices, GL_ARRAY_BUFFER,
+            vertex_stride, STATIC_VERTEX_CAPACITY, GL_STATIC_DRAW
+        ))
+        return 0;
+    if (!make_geometry_arena(
+            &out_heap->dynamic_vertices, GL_ARRAY_BUFFER,
+            vertex_stride, DYNAMIC_VERTEX_CAPACITY, GL_STREAM_DRAW
+        )) {
+        delete_geometry_arena(&out_heap->static_vertices);
+        return 0;
+    }
+    if (!make_geometry_arena(
+            &out_heap->elements, GL_ELEMENT_ARRAY_BUFFER,
+            sizeof(GLushort), ELEMENT_CAPACITY, GL_STATIC_DRAW
+        )) {
+        delete_geometry_arena(&out_heap->static_vertices);
+        delete_geometry_arena(&out_heap->dynamic_vertices);
+        return 0;
+    }
+    return 1;
+}
+
+void delete_geometry_heap(struct geometry_heap *heap)
+{
+    delete_geometry_arena(&heap->static_vertices);
+    delete_geometry_arena(&heap->dynamic_vertices);
+    delete_geometry_arena(&heap->elements);
+}
@@ -0,0 +1,42 @@
+/*
+ * One large buffer object carved up between many meshes. Offsets and
+ * sizes are counted in elements of the arena's stride, so a vertex
+ * offset can be used directly as a base vertex.
+ */
+struct heap_range {
+    GLsizei offset, size;
+};
+
+struct geometry_arena {
+    GLuint buffer;
+    GLenum target;
+    GLsizei stride, capacity, used;
+
+    struct heap_range *free_ranges;
+    int free_count, free_capacity;
+};
+
+/*
+ * Vertices that never change after upload live apart from vertices that
+ * are rewritten every frame, so each buffer can carry an accurate usage
+ * hint. All meshes share one element buffer.
+ */
+struct geometry_heap {
+    struct geometry_arena static_vertices, dynamic_vertices, elements;
+};
+
+#define GEOMETRY_ALLOC_FAILED ((GLsizei)-1)
+
+int base_vertex_supported(void);
+int multi_draw_indirect_supported(void);
+
+int make_geometry_arena(
+    struct geometry_arena *out_arena,
+    GLenum target, GLsizei stride, GLsizei capacity, GLenum hint
+);
+void delete_geometry_arena(struct geometry_arena *arena);
+GLsizei geometry_alloc(struct geometry_arena *arena, GLsizei size);
+void geometry_free(struct geometry_arena *arena, GLsizei offset, GLsizei size);
+
+int make_geometry_heap(struct geometry_heap *out_heap, GLsizei vertex_stride);
+void delete_geometry_heap(struct geometry_heap *heap);
@@ -0,0 +1,1085 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#define GL_CAPTURE_DIRECT
+#include "gl-capture.h"
+
+#define CAPTURE_STREAM_BUFFER (1 << 20)
+
+/*
+ * Only the GL thread calls into here. The pack and unpack state is
+ * tracked so that a pixel pointer is recorded as what it is: an offset
+ * into a bound buffer, or client memory whose contents go in the file.
+ */
+static struct {
+    FILE *stream;
+    const char *path;
+    int frame_count, frames;
+    GLuint pack_buffer, unpack_buffer;
+    GLint pack_alignment, unpack_alignment;
+} g_capture = { NULL, NULL, 0, 0, 0, 0, 4, 4 };
+
+static void put_word(GLuint word)
+{
+    fwrite(&word, sizeof(word), 1, g_capture.stream);
+}
+
+static void put_int(GLint value)
+{
+    fwrite(&value, sizeof(value), 1, g_capture.stream);
+}
+
+static void put_float(GLfloat value)
+{
+    fwrite(&value, sizeof(value), 1, g_capture.stream);
+}
+
+static void put_size(GLsizeiptr value)
+{
+    GLint64 wide = (GLint64)value;
+    fwrite(&wide, sizeof(wide), 1, g_capture.stream);
+}
+
+static void put_pointer(void const *pointer)
+{
+    put_size((GLsizeiptr)(GLintptr)pointer);
+}
+
+static void put_blob(void const *data, size_t size)
+{
+    static const char padding[sizeof(GLuint)];
+    size_t pad = (sizeof(GLuint) - size % sizeof(GLuint)) % sizeof(GLuint);
+
+    put_word((GLuint)size);
+    fwrite(data, 1, size, g_capture.stream);
+    fwrite(padding, 1, pad, g_capture.stream);
+}
+
+static void put_op(enum gl_capture_op op)
+{
+    put_word((GLuint)op);
+}
+
+static void put_names(enum gl_capture_op op, GLsizei n, GLuint const *names)
+{
+    put_op(op);
+    put_blob(names, (size_t)n * sizeof(GLuint));
+}
+
+static int pixel_size(GLenum format, GLenum type)
+{
+    int components, bytes;
+
+    switch (type) {
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+    case GL_UNSIGNED_INT_24_8:
+        return 4;
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+        return 2;
+    case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT:
+        bytes = 2;
+        break;
+    case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT:
+        bytes = 4;
+        break;
+    default:
+        bytes = 1;
+        break;
+    }
+    switch (format) {
+    case GL_RG: case GL_LUMINANCE_ALPHA:
+        components = 2;
+        break;
+    case GL_RGB: case GL_BGR:
+        components = 3;
+        break;
+    case GL_RGBA: case GL_BGRA:
+        components = 4;
+        break;
+    default:
+        components = 1;
+        break;
+    }
+    return components * bytes;
+}
+
+static size_t image_size(
+    GLsizei width, GLsizei height, GLenum format, GLenum type, GLint alignment
+) {
+    size_t row = (size_t)width * pixel_size(format, type);
+    size_t stride = (row + alignment - 1) / alignment * alignment;
+
+    return width > 0 && height > 0 ? stride * (height - 1) + row : 0;
+}
+
+/*
+ * Pixels are a null pointer, an offset into the bound buffer, or the
+ * client memory's contents, flagged by a leading word of 0, 1 or 2.
+ */
+static void put_pixels(
+    GLuint buffer, void const *pixels,
+    GLsizei width, GLsizei height, GLenum format, GLenum type
+) {
+    if (buffer) {
+        put_word(1);
+        put_pointer(pixels);
+    } else if (pixels) {
+        put_word(2);
+        put_blob(pixels, image_size(width, height, format, type, g_capture.unpack_alignment));
+    } else
+        put_word(0);
+}
+
+int start_gl_capture(const char *path, int frame_count, GLsizei width, GLsizei height)
+{
+    struct gl_capture_header header;
+
+    g_capture.stream = fopen(path, "wb");
+    if (!g_capture.stream) {
+        fprintf(stderr, "Unable to open %s for writing\n", path);
+        return 0;
+    }
+    setvbuf(g_capture.stream, NULL, _IOFBF, CAPTURE_STREAM_BUFFER);
+    g_capture.path = path;
+    g_capture.frame_count = frame_count;
+    g_capture.frames = 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GL_CAPTURE_MAGIC, sizeof(GL_CAPTURE_MAGIC));
+    header.version = GL_CAPTURE_VERSION;
+    header.width = width;
+    header.height = height;
+    fwrite(&header, sizeof(header), 1, g_capture.stream);
+    printf("capturing %d frames of GL calls to %s\n", frame_count, path);
+    return 1;
+}
+
+void stop_gl_capture(void)
+{
+    GLuint frames = (GLuint)g_capture.frames;
+    int ok;
+
+    if (!g_capture.stream)
+        return;
+    ok = fseek(g_capture.stream, offsetof(struct gl_capture_header, frame_count), SEEK_SET) == 0
+        && fwrite(&frames, sizeof(frames), 1, g_capture.stream) == 1;
+    ok = !ferror(g_capture.stream) && ok;
+    ok = fclose(g_capture.stream) == 0 && ok;
+    g_capture.stream = NULL;
+
+    if (ok)
+        printf("captured %d frames to %s\n", g_capture.frames, g_capture.path);
+    else
+        fprintf(stderr, "Unable to write %s\n", g_capture.path);
+}
+
+void end_capture_frame(void)
+{
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_END_FRAME);
+    if (++g_capture.frames >= g_capture.frame_count || ferror(g_capture.stream))
+        stop_gl_capture();
+}
+
+void capture_glEnable(GLenum cap)
+{
+    glEnable(cap);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_ENABLE);
+    put_word(cap);
+}
+
+void capture_glDisable(GLenum cap)
+{
+    glDisable(cap);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DISABLE);
+    put_word(cap);
+}
+
+void capture_glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    glViewport(x, y, width, height);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_VIEWPORT);
+    put_int(x);
+    put_int(y);
+    put_int(width);
+    put_int(height);
+}
+
+void capture_glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+    glClearColor(red, green, blue, alpha);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_CLEAR_COLOR);
+    put_float(red);
+    put_float(green);
+    put_float(blue);
+    put_float(alpha);
+}
+
+void capture_glClear(GLbitfield mask)
+{
+    glClear(mask);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_CLEAR);
+    put_word(mask);
+}
+
+void capture_glPolygonOffset(GLfloat factor, GLfloat units)
+{
+    glPolygonOffset(factor, units);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_POLYGON_OFFSET);
+    put_float(factor);
+    put_float(units);
+}
+
+void capture_glPixelStorei(GLenum pname, GLint param)
+{
+    glPixelStorei(pname, param);
+    if (pname == GL_PACK_ALIGNMENT)
+        g_capture.pack_alignment = param;
+    else if (pname == GL_UNPACK_ALIGNMENT)
+        g_capture.unpack_alignment = param;
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_PIXEL_STOREI);
+    put_word(pname);
+    put_int(param);
+}
+
+void capture_glMemoryBarrier(GLbitfield barriers)
+{
+    glMemoryBarrier(barriers);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_MEMORY_BARRIER);
+    put_word(barriers);
+}
+
+void capture_glGenBuffers(GLsizei n, GLuint *buffers)
+{
+    glGenBuffers(n, buffers);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_GEN_BUFFERS, n, buffers);
+}
+
+void capture_glDeleteBuffers(GLsizei n, const GLuint *buffers)
+{
+    glDeleteBuffers(n, buffers);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_DELETE_BUFFERS, n, buffers);
+}
+
+void capture_glBindBuffer(GLenum target, GLuint buffer)
+{
+    glBindBuffer(target, buffer);
+    if (target == GL_PIXEL_PACK_BUFFER)
+        g_capture.pack_buffer = buffer;
+    else if (target == GL_PIXEL_UNPACK_BUFFER)
+        g_capture.unpack_buffer = buffer;
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BIND_BUFFER);
+    put_word(target);
+    put_word(buffer);
+}
+
+void capture_glBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    glBindBufferBase(target, index, buffer);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BIND_BUFFER_BASE);
+    put_word(target);
+    put_word(index);
+    put_word(buffer);
+}
+
+void capture_glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+    glBufferData(target, size, data, usage);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BUFFER_DATA);
+    put_word(target);
+    put_size(size);
+    put_word(usage);
+    put_word(data != NULL);
+    if (data)
+        put_blob(data, (size_t)size);
+}
+
+void capture_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+    glBufferSubData(target, offset, size, data);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BUFFER_SUB_DATA);
+    put_word(target);
+    put_size(offset);
+    put_blob(data, (size_t)size);
+}
+
+/*
+ * Only the mapping itself is recorded, not what is read or written
+ * through it, which covers reading pixels back.
+ */
+void *capture_glMapBuffer(GLenum target, GLenum access)
+{
+    void *pointer = glMapBuffer(target, access);
+    if (g_capture.stream) {
+        put_op(CAPTURE_MAP_BUFFER);
+        put_word(target);
+        put_word(access);
+    }
+    return pointer;
+}
+
+GLboolean capture_glUnmapBuffer(GLenum target)
+{
+    GLboolean ok = glUnmapBuffer(target);
+    if (g_capture.stream) {
+        put_op(CAPTURE_UNMAP_BUFFER);
+        put_word(target);
+    }
+    return ok;
+}
+
+void capture_glGenTextures(GLsizei n, GLuint *textures)
+{
+    glGenTextures(n, textures);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_GEN_TEXTURES, n, textures);
+}
+
+void capture_glDeleteTextures(GLsizei n, const GLuint *textures)
+{
+    glDeleteTextures(n, textures);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_DELETE_TEXTURES, n, textures);
+}
+
+void capture_glActiveTexture(GLenum texture)
+{
+    glActiveTexture(texture);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_ACTIVE_TEXTURE);
+    put_word(texture);
+}
+
+void capture_glBindTexture(GLenum target, GLuint texture)
+{
+    glBindTexture(target, texture);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BIND_TEXTURE);
+    put_word(target);
+    put_word(texture);
+}
+
+void capture_glTexParameteri(GLenum target, GLenum pname, GLint param)
+{
+    glTexParameteri(target, pname, param);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_TEX_PARAMETERI);
+    put_word(target);
+    put_word(pname);
+    put_int(param);
+}
+
+void capture_glTexImage2D(
+    GLenum target, GLint level, GLint internal_format,
+    GLsizei width, GLsizei height, GLint border,
+    GLenum format, GLenum type, const void *pixels
+) {
+    glTexImage2D(target, level, internal_format, width, height, border, format, type, pixels);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_TEX_IMAGE_2D);
+    put_word(target);
+    put_int(level);
+    put_int(internal_format);
+    put_int(width);
+    put_int(height);
+    put_int(border);
+    put_word(format);
+    put_word(type);
+    put_pixels(g_capture.unpack_buffer, pixels, width, height, format, type);
+}
+
+void capture_glTexSubImage2D(
+    GLenum target, GLint level, GLint x, GLint y,
+    GLsizei width, GLsizei height,
+    GLenum format, GLenum type, const void *pixels
+) {
+    glTexSubImage2D(target, level, x, y, width, height, format, type, pixels);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_TEX_SUB_IMAGE_2D);
+    put_word(target);
+    put_int(level);
+    put_int(x);
+    put_int(y);
+    put_int(width);
+    put_int(height);
+    put_word(format);
+    put_word(type);
+    put_pixels(g_capture.unpack_buffer, pixels, width, height, format, type);
+}
+
+/* The slices are recorded as one image depth times as tall. */
+void capture_glTexImage3D(
+    GLenum target, GLint level, GLint internal_format,
+    GLsizei width, GLsizei height, GLsizei depth, GLint border,
+    GLenum format, GLenum type, const void *pixels
+) {
+    glTexImage3D(target, level, internal_format, width, height, depth, border, format, type, pixels);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_TEX_IMAGE_3D);
+    put_word(target);
+    put_int(level);
+    put_int(internal_format);
+    put_int(width);
+    put_int(height);
+    put_int(depth);
+    put_int(border);
+    put_word(format);
+    put_word(type);
+    put_pixels(g_capture.unpack_buffer, pixels, width, height*depth, format, type);
+}
+
+void capture_glGenVertexArrays(GLsizei n, GLuint *arrays)
+{
+    glGenVertexArrays(n, arrays);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_GEN_VERTEX_ARRAYS, n, arrays);
+}
+
+void capture_glDeleteVertexArrays(GLsizei n, const GLuint *arrays)
+{
+    glDeleteVertexArrays(n, arrays);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_DELETE_VERTEX_ARRAYS, n, arrays);
+}
+
+void capture_glBindVertexArray(GLuint array)
+{
+    glBindVertexArray(array);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BIND_VERTEX_ARRAY);
+    put_word(array);
+}
+
+/* Every attribute comes from a buffer, so pointer is an offset. */
+void capture_glVertexAttribPointer(
+    GLuint index, GLint size, GLenum type, GLboolean normalized,
+    GLsizei stride, const void *pointer
+) {
+    glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_VERTEX_ATTRIB_POINTER);
+    put_word(index);
+    put_int(size);
+    put_word(type);
+    put_word(normalized);
+    put_int(stride);
+    put_pointer(pointer);
+}
+
+void capture_glEnableVertexAttribArray(GLuint index)
+{
+    glEnableVertexAttribArray(index);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY);
+    put_word(index);
+}
+
+void capture_glDisableVertexAttribArray(GLuint index)
+{
+    glDisableVertexAttribArray(index);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DISABLE_VERTEX_ATTRIB_ARRAY);
+    put_word(index);
+}
+
+void capture_glVertexAttribDivisor(GLuint index, GLuint divisor)
+{
+    glVertexAttribDivisor(index, divisor);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_VERTEX_ATTRIB_DIVISOR);
+    put_word(index);
+    put_word(divisor);
+}
+
+GLuint capture_glCreateShader(GLenum type)
+{
+    GLuint shader = glCreateShader(type);
+    if (g_capture.stream) {
+        put_op(CAPTURE_CREATE_SHADER);
+        put_word(type);
+        put_word(shader);
+    }
+    return shader;
+}
+
+void capture_glShaderSource(
+    GLuint shader, GLsizei count, const GLchar *const *strings, const GLint *lengths
+) {
+    GLsizei i;
+
+    glShaderSource(shader, count, strings, lengths);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_SHADER_SOURCE);
+    put_word(shader);
+    put_int(count);
+    for (i = 0; i < count; ++i)
+        put_blob(
+            strings[i],
+            lengths && lengths[i] >= 0 ? (size_t)lengths[i] : strlen(strings[i])
+        );
+}
+
+void capture_glCompileShader(GLuint shader)
+{
+    glCompileShader(shader);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_COMPILE_SHADER);
+    put_word(shader);
+}
+
+void capture_glDeleteShader(GLuint shader)
+{
+    glDeleteShader(shader);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DELETE_SHADER);
+    put_word(shader);
+}
+
+GLuint capture_glCreateProgram(void)
+{
+    GLuint program = glCreateProgram();
+    if (g_capture.stream) {
+        put_op(CAPTURE_CREATE_PROGRAM);
+        put_word(program);
+    }
+    return program;
+}
+
+void capture_glAttachShader(GLuint program, GLuint shader)
+{
+    glAttachShader(program, shader);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_ATTACH_SHADER);
+    put_word(program);
+    put_word(shader);
+}
+
+void capture_glDetachShader(GLuint program, GLuint shader)
+{
+    glDetachShader(program, shader);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DETACH_SHADER);
+    put_word(program);
+    put_word(shader);
+}
+
+void capture_glTransformFeedbackVaryings(
+    GLuint program, GLsizei count, const GLchar *const *varyings, GLenum buffer_mode
+) {
+    GLsizei i;
+
+    glTransformFeedbackVaryings(program, count, varyings, buffer_mode);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_TRANSFORM_FEEDBACK_VARYINGS);
+    put_word(program);
+    put_int(count);
+    for (i = 0; i < count; ++i)
+        put_blob(varyings[i], strlen(varyings[i]) + 1);
+    put_word(buffer_mode);
+}
+
+void capture_glLinkProgram(GLuint program)
+{
+    glLinkProgram(program);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_LINK_PROGRAM);
+    put_word(program);
+}
+
+void capture_glDeleteProgram(GLuint program)
+{
+    glDeleteProgram(program);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DELETE_PROGRAM);
+    put_word(program);
+}
+
+void capture_glUseProgram(GLuint program)
+{
+    glUseProgram(program);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_USE_PROGRAM);
+    put_word(program);
+}
+
+GLint capture_glGetAttribLocation(GLuint program, const GLchar *name)
+{
+    GLint location = glGetAttribLocation(program, name);
+    if (g_capture.stream) {
+        put_op(CAPTURE_GET_ATTRIB_LOCATION);
+        put_word(program);
+        put_blob(name, strlen(name) + 1);
+        put_int(location);
+    }
+    return location;
+}
+
+GLint capture_glGetUniformLocation(GLuint program, const GLchar *name)
+{
+    GLint location = glGetUniformLocation(program, name);
+    if (g_capture.stream) {
+        put_op(CAPTURE_GET_UNIFORM_LOCATION);
+        put_word(program);
+        put_blob(name, strlen(name) + 1);
+        put_int(location);
+    }
+    return location;
+}
+
+void capture_glUniform1i(GLint location, GLint x)
+{
+    glUniform1i(location, x);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_UNIFORM_1I);
+    put_int(location);
+    put_int(x);
+}
+
+void capture_glUniform1f(GLint location, GLfloat x)
+{
+    glUniform1f(location, x);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_UNIFORM_1F);
+    put_int(location);
+    put_float(x);
+}
+
+void capture_glUniform2i(GLint location, GLint x, GLint y)
+{
+    glUniform2i(location, x, y);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_UNIFORM_2I);
+    put_int(location);
+    put_int(x);
+    put_int(y);
+}
+
+void capture_glUniform4f(GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+{
+    glUniform4f(location, x, y, z, w);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_UNIFORM_4F);
+    put_int(location);
+    put_float(x);
+    put_float(y);
+    put_float(z);
+    put_float(w);
+}
+
+void capture_glUniformMatrix4fv(
+    GLint location, GLsizei count, GLboolean transpose, const GLfloat *value
+) {
+    glUniformMatrix4fv(location, count, transpose, value);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_UNIFORM_MATRIX_4FV);
+    put_int(location);
+    put_word(transpose);
+    put_blob(value, (size_t)count * 16 * sizeof(GLfloat));
+}
+
+void capture_glGenFramebuffers(GLsizei n, GLuint *framebuffers)
+{
+    glGenFramebuffers(n, framebuffers);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_GEN_FRAMEBUFFERS, n, framebuffers);
+}
+
+void capture_glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers)
+{
+    glDeleteFramebuffers(n, framebuffers);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_DELETE_FRAMEBUFFERS, n, framebuffers);
+}
+
+void capture_glBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    glBindFramebuffer(target, framebuffer);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BIND_FRAMEBUFFER);
+    put_word(target);
+    put_word(framebuffer);
+}
+
+void capture_glFramebufferTexture2D(
+    GLenum target, GLenum attachment, GLenum texture_target, GLuint texture, GLint level
+) {
+    glFramebufferTexture2D(target, attachment, texture_target, texture, level);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_FRAMEBUFFER_TEXTURE_2D);
+    put_word(target);
+    put_word(attachment);
+    put_word(texture_target);
+    put_word(texture);
+    put_int(level);
+}
+
+void capture_glGenRenderbuffers(GLsizei n, GLuint *renderbuffers)
+{
+    glGenRenderbuffers(n, renderbuffers);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_GEN_RENDERBUFFERS, n, renderbuffers);
+}
+
+void capture_glDeleteRenderbuffers(GLsizei n, const GLuint *renderbuffers)
+{
+    glDeleteRenderbuffers(n, renderbuffers);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_DELETE_RENDERBUFFERS, n, renderbuffers);
+}
+
+void capture_glBindRenderbuffer(GLenum target, GLuint renderbuffer)
+{
+    glBindRenderbuffer(target, renderbuffer);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BIND_RENDERBUFFER);
+    put_word(target);
+    put_word(renderbuffer);
+}
+
+void capture_glRenderbufferStorage(
+    GLenum target, GLenum internal_format, GLsizei width, GLsizei height
+) {
+    glRenderbufferStorage(target, internal_format, width, height);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_RENDERBUFFER_STORAGE);
+    put_word(target);
+    put_word(internal_format);
+    put_int(width);
+    put_int(height);
+}
+
+void capture_glRenderbufferStorageMultisample(
+    GLenum target, GLsizei samples, GLenum internal_format, GLsizei width, GLsizei height
+) {
+    glRenderbufferStorageMultisample(target, samples, internal_format, width, height);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_RENDERBUFFER_STORAGE_MULTISAMPLE);
+    put_word(target);
+    put_int(samples);
+    put_word(internal_format);
+    put_int(width);
+    put_int(height);
+}
+
+void capture_glFramebufferRenderbuffer(
+    GLenum target, GLenum attachment, GLenum renderbuffer_target, GLuint renderbuffer
+) {
+    glFramebufferRenderbuffer(target, attachment, renderbuffer_target, renderbuffer);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_FRAMEBUFFER_RENDERBUFFER);
+    put_word(target);
+    put_word(attachment);
+    put_word(renderbuffer_target);
+    put_word(renderbuffer);
+}
+
+void capture_glDrawBuffer(GLenum buffer)
+{
+    glDrawBuffer(buffer);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DRAW_BUFFER);
+    put_word(buffer);
+}
+
+void capture_glReadBuffer(GLenum buffer)
+{
+    glReadBuffer(buffer);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_READ_BUFFER);
+    put_word(buffer);
+}
+
+void capture_glBlitFramebuffer(
+    GLint src_x0, GLint src_y0, GLint src_x1, GLint src_y1,
+    GLint dst_x0, GLint dst_y0, GLint dst_x1, GLint dst_y1,
+    GLbitfield mask, GLenum filter
+) {
+    glBlitFramebuffer(
+        src_x0, src_y0, src_x1, src_y1,
+        dst_x0, dst_y0, dst_x1, dst_y1,
+        mask, filter
+    );
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BLIT_FRAMEBUFFER);
+    put_int(src_x0);
+    put_int(src_y0);
+    put_int(src_x1);
+    put_int(src_y1);
+    put_int(dst_x0);
+    put_int(dst_y0);
+    put_int(dst_x1);
+    put_int(dst_y1);
+    put_word(mask);
+    put_word(filter);
+}
+
+/*
+ * Reading into client memory records only how many bytes were read, for
+ * the replayer to read into memory of its own.
+ */
+void capture_glReadPixels(
+    GLint x, GLint y, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, void *pixels
+) {
+    glReadPixels(x, y, width, height, format, type, pixels);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_READ_PIXELS);
+    put_int(x);
+    put_int(y);
+    put_int(width);
+    put_int(height);
+    put_word(format);
+    put_word(type);
+    put_word(g_capture.pack_buffer != 0);
+    if (g_capture.pack_buffer)
+        put_pointer(pixels);
+    else
+        put_size(
+            (GLsizeiptr)image_size(width, height, format, type, g_capture.pack_alignment)
+        );
+}
+
+void capture_glGenQueries(GLsizei n, GLuint *queries)
+{
+    glGenQueries(n, queries);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_GEN_QUERIES, n, queries);
+}
+
+void capture_glDeleteQueries(GLsizei n, const GLuint *queries)
+{
+    glDeleteQueries(n, queries);
+    if (!g_capture.stream)
+        return;
+    put_names(CAPTURE_DELETE_QUERIES, n, queries);
+}
+
+void capture_glBeginQuery(GLenum target, GLuint query)
+{
+    glBeginQuery(target, query);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BEGIN_QUERY);
+    put_word(target);
+    put_word(query);
+}
+
+void capture_glEndQuery(GLenum target)
+{
+    glEndQuery(target);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_END_QUERY);
+    put_word(target);
+}
+
+void capture_glDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    glDrawArrays(mode, first, count);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DRAW_ARRAYS);
+    put_word(mode);
+    put_int(first);
+    put_int(count);
+}
+
+/* Elements always come from a buffer, so indices is an offset. */
+void capture_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices)
+{
+    glDrawElements(mode, count, type, indices);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DRAW_ELEMENTS);
+    put_word(mode);
+    put_int(count);
+    put_word(type);
+    put_pointer(indices);
+}
+
+void capture_glDrawElementsBaseVertex(
+    GLenum mode, GLsizei count, GLenum type, const void *indices, GLint base_vertex
+) {
+    glDrawElementsBaseVertex(mode, count, type, indices, base_vertex);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DRAW_ELEMENTS_BASE_VERTEX);
+    put_word(mode);
+    put_int(count);
+    put_word(type);
+    put_pointer(indices);
+    put_int(base_vertex);
+}
+
+void capture_glDrawElementsInstanced(
+    GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instance_count
+) {
+    glDrawElementsInstanced(mode, count, type, indices, instance_count);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DRAW_ELEMENTS_INSTANCED);
+    put_word(mode);
+    put_int(count);
+    put_word(type);
+    put_pointer(indices);
+    put_int(instance_count);
+}
+
+static void put_offsets(const void *const *indices, GLsizei draw_count)
+{
+    GLsizei i;
+
+    put_word((GLuint)draw_count * sizeof(GLint64));
+    for (i = 0; i < draw_count; ++i)
+        put_pointer(indices[i]);
+}
+
+void capture_glMultiDrawElements(
+    GLenum mode, const GLsizei *counts, GLenum type,
+    const void *const *indices, GLsizei draw_count
+) {
+    glMultiDrawElements(mode, counts, type, indices, draw_count);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_MULTI_DRAW_ELEMENTS);
+    put_word(mode);
+    put_word(type);
+    put_blob(counts, (size_t)draw_count * sizeof(GLsizei));
+    put_offsets(indices, draw_count);
+}
+
+void capture_glMultiDrawElementsBaseVertex(
+    GLenum mode, const GLsizei *counts, GLenum type,
+    const void *const *indices, GLsizei draw_count, const GLint *base_vertices
+) {
+    glMultiDrawElementsBaseVertex(mode, counts, type, indices, draw_count, base_vertices);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_MULTI_DRAW_ELEMENTS_BASE_VERTEX);
+    put_word(mode);
+    put_word(type);
+    put_blob(counts, (size_t)draw_count * sizeof(GLsizei));
+    put_offsets(indices, draw_count);
+    put_blob(base_vertices, (size_t)draw_count * sizeof(GLint));
+}
+
+/* The commands always come from a bound GL_DRAW_INDIRECT_BUFFER. */
+void capture_glMultiDrawElementsIndirect(
+    GLenum mode, GLenum type, const void *indirect, GLsizei draw_count, GLsizei stride
+) {
+    glMultiDrawElementsIndirect(mode, type, indirect, draw_count, stride);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT);
+    put_word(mode);
+    put_word(type);
+    put_pointer(indirect);
+    put_int(draw_count);
+    put_int(stride);
+}
+
+void capture_glBeginTransformFeedback(GLenum mode)
+{
+    glBeginTransformFeedback(mode);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_BEGIN_TRANSFORM_FEEDBACK);
+    put_word(mode);
+}
+
+void capture_glEndTransformFeedback(void)
+{
+    glEndTransformFeedback();
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_END_TRANSFORM_FEEDBACK);
+}
+
+void capture_glDispatchCompute(GLuint x, GLuint y, GLuint z)
+{
+    glDispatchCompute(x, y, z);
+    if (!g_capture.stream)
+        return;
+    put_op(CAPTURE_DISPATCH_COMPUTE);
+    put_word(x);
+    put_word(y);
+    put_word(z);
+}
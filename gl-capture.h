@@ -0,0 +1,423 @@
+#define GL_CAPTURE_MAGIC    "FLAGGLC"
+#define GL_CAPTURE_VERSION  3
+
+/*
+ * A recording of the GL command stream, for replay-capture. Layout, in
+ * native byte order:
+ *
+ *   header
+ *   records, each a GLuint op followed by its arguments
+ *
+ * Arguments are 32-bit words in the order of the call's parameters,
+ * except that sizes and offsets take two words as a 64-bit value, and
+ * data the call reads from client memory is a blob: a word giving its
+ * size in bytes, then the bytes, padded to a whole word. GL names and
+ * locations are those the driver handed out while recording; the
+ * replayer maps them to its own. Commands that only query GL are not
+ * recorded, apart from the locations the program looks up.
+ *
+ * frame_count is filled in when the capture ends; a capture cut short
+ * leaves it 0, and its frames are counted by replaying.
+ */
+struct gl_capture_header {
+    char magic[8];
+    GLuint version, frame_count;
+    GLsizei width, height;
+};
+
+enum gl_capture_op {
+    CAPTURE_END_FRAME,
+
+    CAPTURE_ENABLE,
+    CAPTURE_DISABLE,
+    CAPTURE_VIEWPORT,
+    CAPTURE_CLEAR_COLOR,
+    CAPTURE_CLEAR,
+    CAPTURE_POLYGON_OFFSET,
+    CAPTURE_PIXEL_STOREI,
+    CAPTURE_MEMORY_BARRIER,
+
+    CAPTURE_GEN_BUFFERS,
+    CAPTURE_DELETE_BUFFERS,
+    CAPTURE_BIND_BUFFER,
+    CAPTURE_BIND_BUFFER_BASE,
+    CAPTURE_BUFFER_DATA,
+    CAPTURE_BUFFER_SUB_DATA,
+    CAPTURE_MAP_BUFFER,
+    CAPTURE_UNMAP_BUFFER,
+
+    CAPTURE_GEN_TEXTURES,
+    CAPTURE_DELETE_TEXTURES,
+    CAPTURE_ACTIVE_TEXTURE,
+    CAPTURE_BIND_TEXTURE,
+    CAPTURE_TEX_PARAMETERI,
+    CAPTURE_TEX_IMAGE_2D,
+    CAPTURE_TEX_SUB_IMAGE_2D,
+    CAPTURE_TEX_IMAGE_3D,
+
+    CAPTURE_GEN_VERTEX_ARRAYS,
+    CAPTURE_DELETE_VERTEX_ARRAYS,
+    CAPTURE_BIND_VERTEX_ARRAY,
+    CAPTURE_VERTEX_ATTRIB_POINTER,
+    CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY,
+    CAPTURE_DISABLE_VERTEX_ATTRIB_ARRAY,
+    CAPTURE_VERTEX_ATTRIB_DIVISOR,
+
+    CAPTURE_CREATE_SHADER,
+    CAPTURE_SHADER_SOURCE,
+    CAPTURE_COMPILE_SHADER,
+    CAPTURE_DELETE_SHADER,
+    CAPTURE_CREATE_PROGRAM,
+    CAPTURE_ATTACH_SHADER,
+    CAPTURE_DETACH_SHADER,
+    CAPTURE_TRANSFORM_FEEDBACK_VARYINGS,
+    CAPTURE_LINK_PROGRAM,
+    CAPTURE_DELETE_PROGRAM,
+    CAPTURE_USE_PROGRAM,
+    CAPTURE_GET_ATTRIB_LOCATION,
+    CAPTURE_GET_UNIFORM_LOCATION,
+    CAPTURE_UNIFORM_1I,
+    CAPTURE_UNIFORM_1F,
+    CAPTURE_UNIFORM_2I,
+    CAPTURE_UNIFORM_4F,
+    CAPTURE_UNIFORM_MATRIX_4FV,
+
+    CAPTURE_GEN_FRAMEBUFFERS,
+    CAPTURE_DELETE_FRAMEBUFFERS,
+    CAPTURE_BIND_FRAMEBUFFER,
+    CAPTURE_FRAMEBUFFER_TEXTURE_2D,
+    CAPTURE_GEN_RENDERBUFFERS,
+    CAPTURE_DELETE_RENDERBUFFERS,
+    CAPTURE_BIND_RENDERBUFFER,
+    CAPTURE_RENDERBUFFER_STORAGE,
+    CAPTURE_RENDERBUFFER_STORAGE_MULTISAMPLE,
+    CAPTURE_FRAMEBUFFER_RENDERBUFFER,
+    CAPTURE_DRAW_BUFFER,
+    CAPTURE_READ_BUFFER,
+    CAPTURE_BLIT_FRAMEBUFFER,
+    CAPTURE_READ_PIXELS,
+
+    CAPTURE_GEN_QUERIES,
+    CAPTURE_DELETE_QUERIES,
+    CAPTURE_BEGIN_QUERY,
+    CAPTURE_END_QUERY,
+
+    CAPTURE_DRAW_ARRAYS,
+    CAPTURE_DRAW_ELEMENTS,
+    CAPTURE_DRAW_ELEMENTS_BASE_VERTEX,
+    CAPTURE_DRAW_ELEMENTS_INSTANCED,
+    CAPTURE_MULTI_DRAW_ELEMENTS,
+    CAPTURE_MULTI_DRAW_ELEMENTS_BASE_VERTEX,
+    CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT,
+    CAPTURE_BEGIN_TRANSFORM_FEEDBACK,
+    CAPTURE_END_TRANSFORM_FEEDBACK,
+    CAPTURE_DISPATCH_COMPUTE,
+
+    CAPTURE_OP_COUNT
+};
+
+/*
+ * Records every GL call made through the functions below to path until
+ * frame_count frames have ended, then closes the file. width and height
+ * are the size of the default framebuffer, for the replayer's window.
+ * Start before the first GL call, so that the replayer creates every
+ * object the captured frames use.
+ */
+int start_gl_capture(const char *path, int frame_count, GLsizei width, GLsizei height);
+void end_capture_frame(void);
+void stop_gl_capture(void);
+
+void capture_glEnable(GLenum cap);
+void capture_glDisable(GLenum cap);
+void capture_glViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void capture_glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void capture_glClear(GLbitfield mask);
+void capture_glPolygonOffset(GLfloat factor, GLfloat units);
+void capture_glPixelStorei(GLenum pname, GLint param);
+void capture_glMemoryBarrier(GLbitfield barriers);
+
+void capture_glGenBuffers(GLsizei n, GLuint *buffers);
+void capture_glDeleteBuffers(GLsizei n, const GLuint *buffers);
+void capture_glBindBuffer(GLenum target, GLuint buffer);
+void capture_glBindBufferBase(GLenum target, GLuint index, GLuint buffer);
+void capture_glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+void capture_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data);
+void *capture_glMapBuffer(GLenum target, GLenum access);
+GLboolean capture_glUnmapBuffer(GLenum target);
+
+void capture_glGenTextures(GLsizei n, GLuint *textures);
+void capture_glDeleteTextures(GLsizei n, const GLuint *textures);
+void capture_glActiveTexture(GLenum texture);
+void capture_glBindTexture(GLenum target, GLuint texture);
+void capture_glTexParameteri(GLenum target, GLenum pname, GLint param);
+void capture_glTexImage2D(
+    GLenum target, GLint level, GLint internal_format,
+    GLsizei width, GLsizei height, GLint border,
+    GLenum format, GLenum type, const void *pixels
+);
+void capture_glTexSubImage2D(
+    GLenum target, GLint level, GLint x, GLint y,
+    GLsizei width, GLsizei height,
+    GLenum format, GLenum type, const void *pixels
+);
+void capture_glTexImage3D(
+    GLenum target, GLint level, GLint internal_format,
+    GLsizei width, GLsizei height, GLsizei depth, GLint border,
+    GLenum format, GLenum type, const void *pixels
+);
+
+void capture_glGenVertexArrays(GLsizei n, GLuint *arrays);
+void capture_glDeleteVertexArrays(GLsizei n, const GLuint *arrays);
+void capture_glBindVertexArray(GLuint array);
+void capture_glVertexAttribPointer(
+    GLuint index, GLint size, GLenum type, GLboolean normalized,
+    GLsizei stride, const void *pointer
+);
+void capture_glEnableVertexAttribArray(GLuint index);
+void capture_glDisableVertexAttribArray(GLuint index);
+void capture_glVertexAttribDivisor(GLuint index, GLuint divisor);
+
+GLuint capture_glCreateShader(GLenum type);
+void capture_glShaderSource(
+    GLuint shader, GLsizei count, const GLchar *const *strings, const GLint *lengths
+);
+void capture_glCompileShader(GLuint shader);
+void capture_glDeleteShader(GLuint shader);
+GLuint capture_glCreateProgram(void);
+void capture_glAttachShader(GLuint program, GLuint shader);
+void capture_glDetachShader(GLuint program, GLuint shader);
+void capture_glTransformFeedbackVaryings(
+    GLuint program, GLsizei count, const GLchar *const *varyings, GLenum buffer_mode
+);
+void capture_glLinkProgram(GLuint program);
+void capture_glDeleteProgram(GLuint program);
+void capture_glUseProgram(GLuint program);
+GLint capture_glGetAttribLocation(GLuint program, const GLchar *name);
+GLint capture_glGetUniformLocation(GLuint program, const GLchar *name);
+void capture_glUniform1i(GLint location, GLint x);
+void capture_glUniform1f(GLint location, GLfloat x);
+void capture_glUniform2i(GLint location, GLint x, GLint y);
+void capture_glUniform4f(GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w);
+void capture_glUniformMatrix4fv(
+    GLint location, GLsizei count, GLboolean transpose, const GLfloat *value
+);
+
+void capture_glGenFramebuffers(GLsizei n, GLuint *framebuffers);
+void capture_glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers);
+void capture_glBindFramebuffer(GLenum target, GLuint framebuffer);
+void capture_glFramebufferTexture2D(
+    GLenum target, GLenum attachment, GLenum texture_target, GLuint texture, GLint level
+);
+void capture_glGenRenderbuffers(GLsizei n, GLuint *renderbuffers);
+void capture_glDeleteRenderbuffers(GLsizei n, const GLuint *renderbuffers);
+void capture_glBindRenderbuffer(GLenum target, GLuint renderbuffer);
+void capture_glRenderbufferStorage(
+    GLenum target, GLenum internal_format, GLsizei width, GLsizei height
+);
+void capture_glRenderbufferStorageMultisample(
+    GLenum target, GLsizei samples, GLenum internal_format, GLsizei width, GLsizei height
+);
+void capture_glFramebufferRenderbuffer(
+    GLenum target, GLenum attachment, GLenum renderbuffer_target, GLuint renderbuffer
+);
+void capture_glDrawBuffer(GLenum buffer);
+void capture_glReadBuffer(GLenum buffer);
+void capture_glBlitFramebuffer(
+    GLint src_x0, GLint src_y0, GLint src_x1, GLint src_y1,
+    GLint dst_x0, GLint dst_y0, GLint dst_x1, GLint dst_y1,
+    GLbitfield mask, GLenum filter
+);
+void capture_glReadPixels(
+    GLint x, GLint y, GLsizei width, GLsizei height,
+    GLenum format, GLenum type, void *pixels
+);
+
+void capture_glGenQueries(GLsizei n, GLuint *queries);
+void capture_glDeleteQueries(GLsizei n, const GLuint *queries);
+void capture_glBeginQuery(GLenum target, GLuint query);
+void capture_glEndQuery(GLenum target);
+
+void capture_glDrawArrays(GLenum mode, GLint first, GLsizei count);
+void capture_glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices);
+void capture_glDrawElementsBaseVertex(
+    GLenum mode, GLsizei count, GLenum type, const void *indices, GLint base_vertex
+);
+void capture_glDrawElementsInstanced(
+    GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instance_count
+);
+void capture_glMultiDrawElements(
+    GLenum mode, const GLsizei *counts, GLenum type,
+    const void *const *indices, GLsizei draw_count
+);
+void capture_glMultiDrawElementsBaseVertex(
+    GLenum mode, const GLsizei *counts, GLenum type,
+    const void *const *indices, GLsizei draw_count, const GLint *base_vertices
+);
+void capture_glMultiDrawElementsIndirect(
+    GLenum mode, GLenum type, const void *indirect, GLsizei draw_count, GLsizei stride
+);
+void capture_glBeginTransformFeedback(GLenum mode);
+void capture_glEndTransformFeedback(void);
+void capture_glDispatchCompute(GLuint x, GLuint y, GLuint z);
+
+/*
+ * Included last, after the GL headers, by every file that calls GL, so
+ * that its calls go through the functions above. gl-capture.c and the
+ * replayer define GL_CAPTURE_DIRECT to reach GL itself.
+ */
+#ifndef GL_CAPTURE_DIRECT
+#  undef glEnable
+#  define glEnable capture_glEnable
+#  undef glDisable
+#  define glDisable capture_glDisable
+#  undef glViewport
+#  define glViewport capture_glViewport
+#  undef glClearColor
+#  define glClearColor capture_glClearColor
+#  undef glClear
+#  define glClear capture_glClear
+#  undef glPolygonOffset
+#  define glPolygonOffset capture_glPolygonOffset
+#  undef glPixelStorei
+#  define glPixelStorei capture_glPixelStorei
+#  undef glMemoryBarrier
+#  define glMemoryBarrier capture_glMemoryBarrier
+#  undef glGenBuffers
+#  define glGenBuffers capture_glGenBuffers
+#  undef glDeleteBuffers
+#  define glDeleteBuffers capture_glDeleteBuffers
+#  undef glBindBuffer
+#  define glBindBuffer capture_glBindBuffer
+#  undef glBindBufferBase
+#  define glBindBufferBase capture_glBindBufferBase
+#  undef glBufferData
+#  define glBufferData capture_glBufferData
+#  undef glBufferSubData
+#  define glBufferSubData capture_glBufferSubData
+#  undef glMapBuffer
+#  define glMapBuffer capture_glMapBuffer
+#  undef glUnmapBuffer
+#  define glUnmapBuffer capture_glUnmapBuffer
+#  undef glGenTextures
+#  define glGenTextures capture_glGenTextures
+#  undef glDeleteTextures
+#  define glDeleteTextures capture_glDeleteTextures
+#  undef glActiveTexture
+#  define glActiveTexture capture_glActiveTexture
+#  undef glBindTexture
+#  define glBindTexture capture_glBindTexture
+#  undef glTexParameteri
+#  define glTexParameteri capture_glTexParameteri
+#  undef glTexImage2D
+#  define glTexImage2D capture_glTexImage2D
+#  undef glTexSubImage2D
+#  define glTexSubImage2D capture_glTexSubImage2D
+#  undef glTexImage3D
+#  define glTexImage3D capture_glTexImage3D
+#  undef glGenVertexArrays
+#  define glGenVertexArrays capture_glGenVertexArrays
+#  undef glDeleteVertexArrays
+#  define glDeleteVertexArrays capture_glDeleteVertexArrays
+#  undef glBindVertexArray
+#  define glBindVertexArray capture_glBindVertexArray
+#  undef glVertexAttribPointer
+#  define glVertexAttribPointer capture_glVertexAttribPointer
+#  undef glEnableVertexAttribArray
+#  define glEnableVertexAttribArray capture_glEnableVertexAttribArray
+#  undef glDisableVertexAttribArray
+#  define glDisableVertexAttribArray capture_glDisableVertexAttribArray
+#  undef glVertexAttribDivisor
+#  define glVertexAttribDivisor capture_glVertexAttribDivisor
+#  undef glCreateShader
+#  define glCreateShader capture_glCreateShader
+#  undef glShaderSource
+#  define glShaderSource capture_glShaderSource
+#  undef glCompileShader
+#  define glCompileShader capture_glCompileShader
+#  undef glDeleteShader
+#  define glDeleteShader capture_glDeleteShader
+#  undef glCreateProgram
+#  define glCreateProgram capture_glCreateProgram
+#  undef glAttachShader
+#  define glAttachShader capture_glAttachShader
+#  undef glDetachShader
+#  define glDetachShader capture_glDetachShader
+#  undef glTransformFeedbackVaryings
+#  define glTransformFeedbackVaryings capture_glTransformFeedbackVaryings
+#  undef glLinkProgram
+#  define glLinkProgram capture_glLinkProgram
+#  undef glDeleteProgram
+#  define glDeleteProgram capture_glDeleteProgram
+#  undef glUseProgram
+#  define glUseProgram capture_glUseProgram
+#  undef glGetAttribLocation
+#  define glGetAttribLocation capture_glGetAttribLocation
+#  undef glGetUniformLocation
+#  define glGetUniformLocation capture_glGetUniformLocation
+#  undef glUniform1i
+#  define glUniform1i capture_glUniform1i
+#  undef glUniform1f
+#  define glUniform1f capture_glUniform1f
+#  undef glUniform2i
+#  define glUniform2i capture_glUniform2i
+#  undef glUniform4f
+#  define glUniform4f capture_glUniform4f
+#  undef glUniformMatrix4fv
+#  define glUniformMatrix4fv capture_glUniformMatrix4fv
+#  undef glGenFramebuffers
+#  define glGenFramebuffers capture_glGenFramebuffers
+#  undef glDeleteFramebuffers
+#  define glDeleteFramebuffers capture_glDeleteFramebuffers
+#  undef glBindFramebuffer
+#  define glBindFramebuffer capture_glBindFramebuffer
+#  undef glFramebufferTexture2D
+#  define glFramebufferTexture2D capture_glFramebufferTexture2D
+#  undef glGenRenderbuffers
+#  define glGenRenderbuffers capture_glGenRenderbuffers
+#  undef glDeleteRenderbuffers
+#  define glDeleteRenderbuffers capture_glDeleteRenderbuffers
+#  undef glBindRenderbuffer
+#  define glBindRenderbuffer capture_glBindRenderbuffer
+#  undef glRenderbufferStorage
+#  define glRenderbufferStorage capture_glRenderbufferStorage
+#  undef glRenderbufferStorageMultisample
+#  define glRenderbufferStorageMultisample capture_glRenderbufferStorageMultisample
+#  undef glFramebufferRenderbuffer
+#  define glFramebufferRenderbuffer capture_glFramebufferRenderbuffer
+#  undef glDrawBuffer
+#  define glDrawBuffer capture_glDrawBuffer
+#  undef glReadBuffer
+#  define glReadBuffer capture_glReadBuffer
+#  undef glBlitFramebuffer
+#  define glBlitFramebuffer capture_glBlitFramebuffer
+#  undef glReadPixels
+#  define glReadPixels capture_glReadPixels
+#  undef glGenQueries
+#  define glGenQueries capture_glGenQueries
+#  undef glDeleteQueries
+#  define glDeleteQueries capture_glDeleteQueries
+#  undef glBeginQuery
+#  define glBeginQuery capture_glBeginQuery
+#  undef glEndQuery
+#  define glEndQuery capture_glEndQuery
+#  undef glDrawArrays
+#  define glDrawArrays capture_glDrawArrays
+#  undef glDrawElements
+#  define glDrawElements capture_glDrawElements
+#  undef glDrawElementsBaseVertex
+#  define glDrawElementsBaseVertex capture_glDrawElementsBaseVertex
+#  undef glDrawElementsInstanced
+#  define glDrawElementsInstanced capture_glDrawElementsInstanced
+#  undef glMultiDrawElements
+#  define glMultiDrawElements capture_glMultiDrawElements
+#  undef glMultiDrawElementsBaseVertex
+#  define glMultiDrawElementsBaseVertex capture_glMultiDrawElementsBaseVertex
+#  undef glMultiDrawElementsIndirect
+#  define glMultiDrawElementsIndirect capture_glMultiDrawElementsIndirect
+#  undef glBeginTransformFeedback
+#  define glBeginTransformFeedback capture_glBeginTransformFeedback
+#  undef glEndTransformFeedback
+#  define glEndTransformFeedback capture_glEndTransformFeedback
+#  undef glDispatchCompute
+#  define glDispatchCompute capture_glDispatchCompute
+#endif
@@ -2,22 +2,45 @@
 #include <GL/glew.h>
 #ifdef __APPLE__
 #  include <GLUT/glut.h>
+#  include <OpenGL/OpenGL.h>
 #else
 #  include <GL/glut.h>
+#  ifdef _WIN32
+#    include <GL/wglew.h>
+#  else
+#    include <GL/glxew.h>
+#  endif
 #endif
 #include <stddef.h>
 #include <math.h>
 #include <stdio.h>
+#include "memory.h"
 #include "file-util.h"
+#include "gpu-resources.h"
+#include "gl-util.h"
+#include "gl-capture.h"
 
 GLuint make_texture(const char *filename)
 {
     int width, height;
-    void *pixels = read_tga(filename, &width, &height);
-    GLuint texture;
+    struct arena_mark mark = get_arena_mark(scratch_arena());
+    void *pixels = read_tga(scratch_arena(), filename, &width, &height);
+    GLuint texture = 0;
 
-    if (!pixels)
-        return 0;
+    if (pixels)
+        texture = upload_texture(pixels, width, height, filename);
+    release_arena(scratch_arena(), mark);
+    return texture;
+}
+
+/*
+ * Takes pixels as read_tga returns them. The texture may be reduced to
+ * stay within the GPU memory budget, this one first if it is the largest.
+ * Returns 0 with a message if the driver runs out of memory.
+ */
+GLuint upload_texture(void const *pixels, int width, int height, const char *owner)
+{
+    GLuint texture;
 
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
@@ -25,6 +48,8 @@ GLuint make_texture(const char *filename)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+    /* BGR rows are tightly packed, so need not be a multiple of 4 bytes */
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glTexImage2D(
         GL_TEXTURE_2D, 0,           /* target, level */
         GL_RGB8,                    /* internal format */
@@ -32,7 +57,14 @@ GLuint make_texture(const char *filename)
         GL_BGR, GL_UNSIGNED_BYTE,   /* external format, type */
         pixels                      /* pixels */
     );
-    free(pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        fprintf(stderr, "Out of GPU memory uploading %s\n", owner);
+        glDeleteTextures(1, &texture);
+        return 0;
+    }
+    track_reducible_texture(texture, width, height, owner);
+    reserve_gpu_memory(0, owner);
     return texture;
 }
 
@@ -43,35 +75,87 @@ void show_info_log(
 )
 {
     GLint log_length;
+    struct arena_mark mark = get_arena_mark(scratch_arena());
     char *log;
 
     glGet__iv(object, GL_INFO_LOG_LENGTH, &log_length);
-    log = malloc(log_length);
-    glGet__InfoLog(object, log_length, NULL, log);
-    fprintf(stderr, "%s", log);
-    free(log);
+    log = arena_alloc(scratch_arena(), log_length);
+    if (log) {
+        glGet__InfoLog(object, log_length, NULL, log);
+        fprintf(stderr, "%s", log);
+    }
+    release_arena(scratch_arena(), mark);
+}
+
+/*
+ * With KHR_parallel_shader_compile, the driver compiles and links on
+ * threads of its own, and the completion status can be polled without
+ * blocking. Without it, everything reports ready and the status queries
+ * in finish_shader and finish_program wait for the result as usual.
+ */
+int parallel_shader_compile_supported(void)
+{
+    return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+}
+
+int shader_ready(GLuint shader)
+{
+    GLint ready = GL_TRUE;
+
+    if (parallel_shader_compile_supported())
+        glGetShaderiv(shader, GL_COMPLETION_STATUS_KHR, &ready);
+    return ready;
+}
+
+int program_ready(GLuint program)
+{
+    GLint ready = GL_TRUE;
+
+    if (parallel_shader_compile_supported())
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &ready);
+    return ready;
 }
 
 GLuint make_shader(GLenum type, const char *filename)
+{
+    return finish_shader(start_shader(type, filename), filename);
+}
+
+/* Submits the shader for compilation without waiting for the result. */
+GLuint start_shader(GLenum type, const char *filename)
 {
     GLint length;
-    GLchar *source = file_contents(filename, &length);
+    struct arena_mark mark = get_arena_mark(scratch_arena());
+    GLchar *source = file_contents(scratch_arena(), filename, &length);
     GLuint shader;
-    GLint shader_ok;
 
-    if (!source)
+    if (!source) {
+        release_arena(scratch_arena(), mark);
         return 0;
+    }
 
     shader = glCreateShader(type);
+    track_gpu_resource(GPU_SHADER, shader, 0, filename);
     glShaderSource(shader, 1, (const GLchar**)&source, &length);
-    free(source);
+    release_arena(scratch_arena(), mark);
     glCompileShader(shader);
+    return shader;
+}
+
+/* Returns 0 and deletes the shader if it failed to compile. */
+GLuint finish_shader(GLuint shader, const char *filename)
+{
+    GLint shader_ok;
+
+    if (shader == 0)
+        return 0;
 
     glGetShaderiv(shader, GL_COMPILE_STATUS, &shader_ok);
     if (!shader_ok) {
         fprintf(stderr, "Failed to compile %s:\n", filename);
         show_info_log(shader, glGetShaderiv, glGetShaderInfoLog);
         glDeleteShader(shader);
+        untrack_gpu_resource(GPU_SHADER, shader);
         return 0;
     }
     return shader;
@@ -79,21 +163,199 @@ GLuint make_shader(GLenum type, const char *filename)
 
 GLuint make_program(GLuint vertex_shader, GLuint fragment_shader)
 {
-    GLint program_ok;
+    return finish_program(start_program(vertex_shader, fragment_shader));
+}
 
+/* The program is charged to whatever owns the vertex shader. */
+GLuint start_program(GLuint vertex_shader, GLuint fragment_shader)
+{
     GLuint program = glCreateProgram();
 
+    track_gpu_resource(
+        GPU_PROGRAM, program, 0, gpu_resource_owner(GPU_SHADER, vertex_shader)
+    );
+
     glAttachShader(program, vertex_shader);
     glAttachShader(program, fragment_shader);
     glLinkProgram(program);
+    return program;
+}
+
+GLuint finish_program(GLuint program)
+{
+    GLint program_ok;
 
     glGetProgramiv(program, GL_LINK_STATUS, &program_ok);
     if (!program_ok) {
         fprintf(stderr, "Failed to link shader program:\n");
         show_info_log(program, glGetProgramiv, glGetProgramInfoLog);
         glDeleteProgram(program);
+        untrack_gpu_resource(GPU_PROGRAM, program);
         return 0;
     }
     return program;
 }
 
+
+int render_targets_supported(void)
+{
+    return GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+}
+
+int make_render_target(struct render_target *out_target, GLsizei width, GLsizei height)
+{
+    GLenum status;
+
+    glGenTextures(1, &out_target->color_texture);
+    glBindTexture(GL_TEXTURE_2D, out_target->color_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0,           /* target, level */
+        GL_RGBA8,                   /* internal format */
+        width, height, 0,           /* width, height, border */
+        GL_RGBA, GL_UNSIGNED_BYTE,  /* external format, type */
+        NULL                        /* pixels */
+    );
+    track_gpu_resource(
+        GPU_TEXTURE, out_target->color_texture,
+        (size_t)width * height * 4, "render target"
+    );
+
+    glGenRenderbuffers(1, &out_target->depth_renderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, out_target->depth_renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    track_gpu_resource(
+        GPU_RENDERBUFFER, out_target->depth_renderbuffer,
+        (size_t)width * height * 4, "render target"
+    );
+
+    glGenFramebuffers(1, &out_target->framebuffer);
+    track_gpu_resource(GPU_FRAMEBUFFER, out_target->framebuffer, 0, "render target");
+    glBindFramebuffer(GL_FRAMEBUFFER, out_target->framebuffer);
+    glFramebufferTexture2D(
+        GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_TEXTURE_2D, out_target->color_texture, 0
+    );
+    glFramebufferRenderbuffer(
+        GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_RENDERBUFFER, out_target->depth_renderbuffer
+    );
+
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Render target %dx%d incomplete: 0x%04x\n", width, height, status);
+        delete_render_target(out_target);
+        return 0;
+    }
+
+    out_target->size[0] = width;
+    out_target->size[1] = height;
+    return 1;
+}
+
+void delete_render_target(struct render_target *target)
+{
+    glDeleteFramebuffers(1, &target->framebuffer);
+    glDeleteRenderbuffers(1, &target->depth_renderbuffer);
+    glDeleteTextures(1, &target->color_texture);
+    untrack_gpu_resource(GPU_FRAMEBUFFER, target->framebuffer);
+    untrack_gpu_resource(GPU_RENDERBUFFER, target->depth_renderbuffer);
+    untrack_gpu_resource(GPU_TEXTURE, target->color_texture);
+    target->framebuffer = target->depth_renderbuffer = target->color_texture = 0;
+    target->size[0] = target->size[1] = 0;
+}
+
+/*
+ * Set the swap interval of the current window's context. Returns zero if
+ * the platform does not let us control vsync.
+ */
+int set_swap_interval(int interval)
+{
+#if defined(__APPLE__)
+    GLint value = interval;
+    return CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &value)
+        == kCGLNoError;
+#elif defined(_WIN32)
+    if (WGLEW_EXT_swap_control)
+        return wglSwapIntervalEXT(interval);
+    return 0;
+#else
+    if (GLXEW_EXT_swap_control) {
+        glXSwapIntervalEXT(glXGetCurrentDisplay(), glXGetCurrentDrawable(), interval);
+        return 1;
+    }
+    if (GLXEW_MESA_swap_control)
+        return glXSwapIntervalMESA((unsigned)interval) == 0;
+    if (GLXEW_SGI_swap_control && interval > 0)
+        return glXSwapIntervalSGI(interval) == 0;
+    return 0;
+#endif
+}
+
+int gpu_timers_supported(void)
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+void make_gpu_timer(struct gpu_timer *out_timer)
+{
+    int i;
+
+    glGenQueries(GPU_TIMER_QUERIES, out_timer->queries);
+    for (i = 0; i < GPU_TIMER_QUERIES; ++i)
+        track_gpu_resource(GPU_QUERY, out_timer->queries[i], 0, "gpu timer");
+    out_timer->first = out_timer->count = out_timer->timing = 0;
+}
+
+void delete_gpu_timer(struct gpu_timer *timer)
+{
+    int i;
+
+    glDeleteQueries(GPU_TIMER_QUERIES, timer->queries);
+    for (i = 0; i < GPU_TIMER_QUERIES; ++i)
+        untrack_gpu_resource(GPU_QUERY, timer->queries[i]);
+    timer->first = timer->count = timer->timing = 0;
+}
+
+void begin_gpu_timer(struct gpu_timer *timer)
+{
+    if (timer->count == GPU_TIMER_QUERIES)
+        return;
+    glBeginQuery(
+        GL_TIME_ELAPSED,
+        timer->queries[(timer->first + timer->count) % GPU_TIMER_QUERIES]
+    );
+    timer->timing = 1;
+}
+
+void end_gpu_timer(struct gpu_timer *timer)
+{
+    if (!timer->timing)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    ++timer->count;
+    timer->timing = 0;
+}
+
+int poll_gpu_timer(struct gpu_timer *timer, double *out_seconds)
+{
+    GLuint query = timer->queries[timer->first];
+    GLint available;
+    GLuint64 nanoseconds;
+
+    if (timer->count == 0)
+        return 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    timer->first = (timer->first + 1) % GPU_TIMER_QUERIES;
+    --timer->count;
+    *out_seconds = (double)nanoseconds * 1.0e-9;
+    return 1;
+}
@@ -1,4 +1,5 @@
 GLuint make_texture(const char *filename);
+GLuint upload_texture(void const *pixels, int width, int height, const char *owner);
 
 void show_info_log(
     GLuint object,
@@ -8,3 +9,44 @@ void show_info_log(
 
 GLuint make_shader(GLenum type, const char *filename);
 GLuint make_program(GLuint vertex_shader, GLuint fragment_shader);
+
+int parallel_shader_compile_supported(void);
+int shader_ready(GLuint shader);
+int program_ready(GLuint program);
+GLuint start_shader(GLenum type, const char *filename);
+GLuint finish_shader(GLuint shader, const char *filename);
+GLuint start_program(GLuint vertex_shader, GLuint fragment_shader);
+GLuint finish_program(GLuint program);
+
+int set_swap_interval(int interval);
+
+struct render_target {
+    GLuint framebuffer, color_texture, depth_renderbuffer;
+    GLsizei size[2];
+};
+
+int render_targets_supported(void);
+int make_render_target(struct render_target *out_target, GLsizei width, GLsizei height);
+void delete_render_target(struct render_target *target);
+
+#define GPU_TIMER_QUERIES 8
+
+/*
+ * A ring of GL_TIME_ELAPSED queries whose results are read a few frames
+ * late, so that timing the GPU never makes the CPU wait for it.
+ */
+struct gpu_timer {
+    GLuint queries[GPU_TIMER_QUERIES];
+    int first, count, timing;
+};
+
+int gpu_timers_supported(void);
+void make_gpu_timer(struct gpu_timer *out_timer);
+void delete_gpu_timer(struct gpu_timer *timer);
+
+/* Skips the measurement if every query is still waiting on the GPU. */
+void begin_gpu_timer(struct gpu_timer *timer);
+void end_gpu_timer(struct gpu_timer *timer);
+
+/* Returns 1 with the oldest result if it is ready, or 0 without waiting. */
+int poll_gpu_timer(struct gpu_timer *timer, double *out_seconds);
@@ -0,0 +1,359 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "memory.h"
+#include "gpu-resources.h"
+#include "gl-capture.h"
+
+#define MAX_GPU_RESOURCES   4096
+#define OWNER_LENGTH        32
+#define MIN_REDUCED_SIZE    16
+
+static const char *const KIND_NAMES[GPU_RESOURCE_KIND_COUNT] = {
+    "buffer", "texture", "renderbuffer", "framebuffer",
+    "vertex array", "shader", "program", "query"
+};
+
+struct gpu_resource {
+    enum gpu_resource_kind kind;
+    GLuint name;
+    int reducible;
+    GLsizei width, height;  /* of reducible textures */
+    size_t bytes;
+    unsigned long serial;
+    char owner[OWNER_LENGTH];
+};
+
+/*
+ * Live objects are kept packed at the front of the table; untracking
+ * moves the last one into the hole. There are few enough that a linear
+ * search is no bother.
+ */
+static struct {
+    size_t budget, total, peak_total;
+    size_t current[GPU_RESOURCE_KIND_COUNT], peak[GPU_RESOURCE_KIND_COUNT];
+    int counts[GPU_RESOURCE_KIND_COUNT];
+    unsigned long next_serial;
+    int count, overflowed;
+    struct gpu_resource resources[MAX_GPU_RESOURCES];
+} g_gpu;
+
+void init_gpu_resources(size_t budget)
+{
+    g_gpu.budget = budget;
+}
+
+static struct gpu_resource *find_resource(enum gpu_resource_kind kind, GLuint name)
+{
+    int i;
+
+    for (i = 0; i < g_gpu.count; ++i)
+        if (g_gpu.resources[i].name == name && g_gpu.resources[i].kind == kind)
+            return &g_gpu.resources[i];
+    return NULL;
+}
+
+static void charge(enum gpu_resource_kind kind, size_t old_bytes, size_t new_bytes)
+{
+    g_gpu.total = g_gpu.total - old_bytes + new_bytes;
+    g_gpu.current[kind] = g_gpu.current[kind] - old_bytes + new_bytes;
+    if (g_gpu.total > g_gpu.peak_total)
+        g_gpu.peak_total = g_gpu.total;
+    if (g_gpu.current[kind] > g_gpu.peak[kind])
+        g_gpu.peak[kind] = g_gpu.current[kind];
+}
+
+static struct gpu_resource *add_resource(
+    enum gpu_resource_kind kind, GLuint name,
+    size_t bytes, const char *owner
+) {
+    struct gpu_resource *resource;
+
+    if (name == 0)
+        return NULL;
+    if (g_gpu.count == MAX_GPU_RESOURCES) {
+        if (!g_gpu.overflowed)
+            fprintf(stderr, "More than %d GL objects, not tracking the rest\n", MAX_GPU_RESOURCES);
+        g_gpu.overflowed = 1;
+        return NULL;
+    }
+
+    resource = &g_gpu.resources[g_gpu.count++];
+    resource->kind = kind;
+    resource->name = name;
+    resource->reducible = 0;
+    resource->width = resource->height = 0;
+    resource->bytes = bytes;
+    resource->serial = g_gpu.next_serial++;
+    strncpy(resource->owner, owner, OWNER_LENGTH - 1);
+    resource->owner[OWNER_LENGTH - 1] = '\0';
+    ++g_gpu.counts[kind];
+    charge(kind, 0, bytes);
+    return resource;
+}
+
+void track_gpu_resource(
+    enum gpu_resource_kind kind, GLuint name,
+    size_t bytes, const char *owner
+) {
+    add_resource(kind, name, bytes, owner);
+}
+
+void track_reducible_texture(GLuint texture, GLsizei width, GLsizei height, const char *owner)
+{
+    struct gpu_resource *resource
+        = add_resource(GPU_TEXTURE, texture, (size_t)width * height * 4, owner);
+
+    if (!resource)
+        return;
+    resource->reducible = 1;
+    resource->width = width;
+    resource->height = height;
+}
+
+void resize_gpu_resource(enum gpu_resource_kind kind, GLuint name, size_t bytes)
+{
+    struct gpu_resource *resource = find_resource(kind, name);
+
+    if (!resource)
+        return;
+    charge(kind, resource->bytes, bytes);
+    resource->bytes = bytes;
+}
+
+void untrack_gpu_resource(enum gpu_resource_kind kind, GLuint name)
+{
+    struct gpu_resource *resource = find_resource(kind, name);
+
+    if (!resource)
+        return;
+    charge(kind, resource->bytes, 0);
+    --g_gpu.counts[kind];
+    *resource = g_gpu.resources[--g_gpu.count];
+}
+
+const char *gpu_resource_owner(enum gpu_resource_kind kind, GLuint name)
+{
+    struct gpu_resource *resource = find_resource(kind, name);
+    return resource ? resource->owner : "unknown";
+}
+
+static int can_halve(GLsizei width, GLsizei height)
+{
+    return width >= 2*MIN_REDUCED_SIZE && height >= 2*MIN_REDUCED_SIZE;
+}
+
+/* what halving a texture as far as it goes would free */
+static size_t reducible_bytes(struct gpu_resource const *resource)
+{
+    GLsizei width = resource->width, height = resource->height;
+
+    while (can_halve(width, height)) {
+        width /= 2;
+        height /= 2;
+    }
+    return resource->bytes - (size_t)width * height * 4;
+}
+
+/*
+ * Reads the image back, averages each 2x2 block of it, and respecifies
+ * the texture at the smaller size. Texture coordinates are normalized,
+ * so nothing that samples it has to change. This can run mid-frame, from
+ * any reserve_gpu_memory, so the active unit's binding is put back.
+ * Returns 0 if the scratch memory is not there.
+ */
+static int halve_texture(struct gpu_resource *resource)
+{
+    struct arena_mark mark = get_arena_mark(scratch_arena());
+    GLsizei
+        width = resource->width, height = resource->height,
+        half_width = width / 2, half_height = height / 2,
+        x, y, c;
+    GLint bound;
+    unsigned char *pixels, *half;
+
+    /* RGBA rows are always 4-byte aligned, so the pixel store defaults do */
+    pixels = (unsigned char*) arena_alloc(scratch_arena(), (size_t)width * height * 4);
+    half = (unsigned char*) arena_alloc(scratch_arena(), (size_t)half_width * half_height * 4);
+    if (!pixels || !half) {
+        release_arena(scratch_arena(), mark);
+        return 0;
+    }
+
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+    glBindTexture(GL_TEXTURE_2D, resource->name);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    for (y = 0; y < half_height; ++y)
+        for (x = 0; x < half_width; ++x)
+            for (c = 0; c < 4; ++c) {
+                unsigned char const *p = &pixels[((2*y)*width + 2*x)*4 + c];
+                half[(y*half_width + x)*4 + c] = (unsigned char)(
+                    (p[0] + p[4] + p[width*4] + p[width*4 + 4] + 2) / 4
+                );
+            }
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_RGB8,
+        half_width, half_height, 0,
+        GL_RGBA, GL_UNSIGNED_BYTE, half
+    );
+    glBindTexture(GL_TEXTURE_2D, (GLuint)bound);
+    release_arena(scratch_arena(), mark);
+
+    printf("reduced %s to %dx%d to stay within the GPU memory budget\n",
+        resource->owner, half_width, half_height);
+    resource->width = half_width;
+    resource->height = half_height;
+    resize_gpu_resource(GPU_TEXTURE, resource->name, (size_t)half_width * half_height * 4);
+    return 1;
+}
+
+/* largest first, so that each halving frees as much as it can */
+static struct gpu_resource *largest_reducible(void)
+{
+    struct gpu_resource *largest = NULL;
+    int i;
+
+    for (i = 0; i < g_gpu.count; ++i) {
+        struct gpu_resource *resource = &g_gpu.resources[i];
+        if (resource->reducible && can_halve(resource->width, resource->height)
+            && (!largest || resource->bytes > largest->bytes))
+            largest = resource;
+    }
+    return largest;
+}
+
+int reserve_gpu_memory(size_t bytes, const char *owner)
+{
+    size_t reclaimable = 0;
+    int i;
+
+    if (g_gpu.budget == 0 || g_gpu.total + bytes <= g_gpu.budget)
+        return 1;
+
+    for (i = 0; i < g_gpu.count; ++i)
+        if (g_gpu.resources[i].reducible)
+            reclaimable += reducible_bytes(&g_gpu.resources[i]);
+    if (g_gpu.total + bytes - reclaimable > g_gpu.budget) {
+        fprintf(
+            stderr, "GPU memory budget exceeded by %lu bytes making room for %s\n",
+            (unsigned long)(g_gpu.total + bytes - g_gpu.budget), owner
+        );
+        return 0;
+    }
+
+    while (g_gpu.total + bytes > g_gpu.budget)
+        if (!halve_texture(largest_reducible()))
+            return 0;
+    return 1;
+}
+
+size_t gpu_memory_bytes(void)
+{
+    return g_gpu.total;
+}
+
+size_t gpu_kind_bytes(enum gpu_resource_kind kind)
+{
+    return g_gpu.current[kind];
+}
+
+int gpu_resource_count(void)
+{
+    return g_gpu.count;
+}
+
+struct owner_total {
+    const char *owner;
+    size_t bytes;
+    int count;
+};
+
+static int compare_owner_totals(const void *a, const void *b)
+{
+    size_t
+        a_bytes = ((struct owner_total const*)a)->bytes,
+        b_bytes = ((struct owner_total const*)b)->bytes;
+    return a_bytes < b_bytes ? 1 : a_bytes > b_bytes ? -1 : 0;
+}
+
+void report_gpu_resources(void)
+{
+    struct arena_mark mark = get_arena_mark(scratch_arena());
+    struct owner_total *owners;
+    int i, j, owner_count = 0;
+
+    for (i = 0; i < GPU_RESOURCE_KIND_COUNT; ++i)
+        printf(
+            "gpu %-12s %5d live %8.1f KiB current, %8.1f KiB peak\n",
+            KIND_NAMES[i], g_gpu.counts[i],
+            (double)g_gpu.current[i] / 1024.0,
+            (double)g_gpu.peak[i] / 1024.0
+        );
+    if (g_gpu.budget)
+        printf(
+            "gpu total        %5d live %8.1f KiB of %.1f KiB budget, %.1f KiB peak\n",
+            g_gpu.count, (double)g_gpu.total / 1024.0,
+            (double)g_gpu.budget / 1024.0, (double)g_gpu.peak_total / 1024.0
+        );
+    else
+        printf(
+            "gpu total        %5d live %8.1f KiB current, %8.1f KiB peak\n",
+            g_gpu.count, (double)g_gpu.total / 1024.0, (double)g_gpu.peak_total / 1024.0
+        );
+
+    owners = (struct owner_total*) arena_alloc(
+        scratch_arena(), (size_t)(g_gpu.count + 1) * sizeof(struct owner_total)
+    );
+    if (!owners) {
+        release_arena(scratch_arena(), mark);
+        return;
+    }
+    for (i = 0; i < g_gpu.count; ++i) {
+        struct gpu_resource const *resource = &g_gpu.resources[i];
+        for (j = 0; j < owner_count; ++j)
+            if (strcmp(owners[j].owner, resource->owner) == 0)
+                break;
+        if (j == owner_count) {
+            owners[j].owner = resource->owner;
+            owners[j].bytes = 0;
+            owners[j].count = 0;
+            ++owner_count;
+        }
+        owners[j].bytes += resource->bytes;
+        ++owners[j].count;
+    }
+    qsort(owners, owner_count, sizeof(struct owner_total), &compare_owner_totals);
+    for (i = 0; i < owner_count; ++i)
+        printf("  %-31s %5d objects %8.1f KiB\n",
+            owners[i].owner, owners[i].count, (double)owners[i].bytes / 1024.0);
+    release_arena(scratch_arena(), mark);
+}
+
+struct gpu_resource_mark get_gpu_resource_mark(void)
+{
+    struct gpu_resource_mark mark;
+
+    mark.serial = g_gpu.next_serial;
+    mark.count = g_gpu.count;
+    return mark;
+}
+
+int check_gpu_resource_leaks(struct gpu_resource_mark mark, const char *operation)
+{
+    int i, leaked = g_gpu.count - mark.count;
+
+    if (leaked <= 0)
+        return 0;
+    fprintf(stderr, "%s left %d more GL object%s alive; created since and still alive:\n",
+        operation, leaked, leaked == 1 ? "" : "s");
+    for (i = 0; i < g_gpu.count; ++i) {
+        struct gpu_resource const *resource = &g_gpu.resources[i];
+        if (resource->serial >= mark.serial)
+            fprintf(stderr, "  %s %u (%s, %lu bytes)\n",
+                KIND_NAMES[resource->kind], resource->name,
+                resource->owner, (unsigned long)resource->bytes);
+    }
+    return leaked;
+}
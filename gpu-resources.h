@@ -0,0 +1,72 @@
+/*
+ * Every GL object the program creates is registered here with its kind,
+ * an estimate of the memory it holds and the name of what owns it, so
+ * that totals can be reported, leaks spotted, and memory held to a
+ * budget. Only for use from the GL thread.
+ */
+enum gpu_resource_kind {
+    GPU_BUFFER,
+    GPU_TEXTURE,
+    GPU_RENDERBUFFER,
+    GPU_FRAMEBUFFER,
+    GPU_VERTEX_ARRAY,
+    GPU_SHADER,
+    GPU_PROGRAM,
+    GPU_QUERY,
+    GPU_RESOURCE_KIND_COUNT
+};
+
+/*
+ * A budget of 0 means no limit. Only optional allocations are held to
+ * it: see reserve_gpu_memory.
+ */
+void init_gpu_resources(size_t budget);
+
+/*
+ * The owner is copied, truncated if need be. Tracking name 0 does
+ * nothing, as does untracking a name that is not tracked, so these can
+ * follow glGen and glDelete calls without checks.
+ */
+void track_gpu_resource(
+    enum gpu_resource_kind kind, GLuint name,
+    size_t bytes, const char *owner
+);
+void resize_gpu_resource(enum gpu_resource_kind kind, GLuint name, size_t bytes);
+void untrack_gpu_resource(enum gpu_resource_kind kind, GLuint name);
+const char *gpu_resource_owner(enum gpu_resource_kind kind, GLuint name);
+
+/*
+ * An RGB8 image texture without mipmaps, which reserve_gpu_memory may
+ * replace with one of half the width and height to make room. Charged
+ * four bytes a texel, which is how drivers store RGB8.
+ */
+void track_reducible_texture(GLuint texture, GLsizei width, GLsizei height, const char *owner);
+
+/*
+ * Returns 1 if bytes more fit within the budget, first halving the
+ * largest reducible textures as many times as it takes. Returns 0 with
+ * a message, and without reducing anything, if even that would not make
+ * room; the caller does without or asks for less. Allocations the
+ * program cannot run without are tracked but never checked, so they can
+ * push the total over.
+ */
+int reserve_gpu_memory(size_t bytes, const char *owner);
+
+size_t gpu_memory_bytes(void);
+size_t gpu_kind_bytes(enum gpu_resource_kind kind);
+int gpu_resource_count(void);
+void report_gpu_resources(void);
+
+/*
+ * For checking that an operation, such as reloading a shader, leaves as
+ * many objects alive as it found. Objects created since the mark that
+ * are still alive are listed if the count grew, and their number is
+ * returned.
+ */
+struct gpu_resource_mark {
+    unsigned long serial;
+    int count;
+};
+
+struct gpu_resource_mark get_gpu_resource_mark(void);
+int check_gpu_resource_leaks(struct gpu_resource_mark mark, const char *operation);
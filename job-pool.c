@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "thread-util.h"
+#include "job-pool.h"
+
+/*
+ * Called and returns with the mutex held. Jobs are claimed one at a
+ * time under the lock; they are meant to be coarse enough that this is
+ * never the bottleneck.
+ */
+static void work_locked(struct job_pool *pool, int worker)
+{
+    while (pool->next_job < pool->job_count) {
+        int job = pool->next_job++;
+        job_func func = pool->func;
+        void *data = pool->data;
+
+        unlock_mutex(&pool->mutex);
+        func(job, worker, data);
+        lock_mutex(&pool->mutex);
+
+        if (--pool->remaining == 0)
+            signal_condition(&pool->done);
+    }
+}
+
+static void worker_main(void *data)
+{
+    struct job_worker *worker = (struct job_worker*)data;
+    struct job_pool *pool = worker->pool;
+    int seen;
+
+    lock_mutex(&pool->mutex);
+    seen = pool->generation;
+    for (;;) {
+        while (!pool->quit && pool->generation == seen)
+            wait_condition(&pool->start, &pool->mutex);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        work_locked(pool, worker->index);
+    }
+    unlock_mutex(&pool->mutex);
+}
+
+/*
+ * A worker_count of 0 or less means one worker per processor. If some
+ * threads fail to start, the pool makes do with the ones that did.
+ */
+int make_job_pool(struct job_pool *out_pool, int worker_count)
+{
+    int i;
+
+    if (worker_count <= 0)
+        worker_count = processor_count();
+    if (worker_count > MAX_WORKERS)
+        worker_count = MAX_WORKERS;
+
+    init_mutex(&out_pool->mutex);
+    init_condition(&out_pool->start);
+    init_condition(&out_pool->done);
+    out_pool->func = NULL;
+    out_pool->data = NULL;
+    out_pool->job_count = out_pool->next_job = out_pool->remaining = 0;
+    out_pool->generation = out_pool->quit = 0;
+
+    out_pool->worker_count = 1;
+    for (i = 1; i < worker_count; ++i) {
+        struct job_worker *worker = &out_pool->workers[i];
+        worker->pool = out_pool;
+        worker->index = i;
+        if (!start_thread(&worker->thread, &worker_main, worker))
+            break;
+        out_pool->worker_count = i + 1;
+    }
+    return 1;
+}
+
+void delete_job_pool(struct job_pool *pool)
+{
+    int i;
+
+    lock_mutex(&pool->mutex);
+    pool->quit = 1;
+    broadcast_condition(&pool->start);
+    unlock_mutex(&pool->mutex);
+
+    for (i = 1; i < pool->worker_count; ++i)
+        join_thread(&pool->workers[i].thread);
+
+    destroy_condition(&pool->start);
+    destroy_condition(&pool->done);
+    destroy_mutex(&pool->mutex);
+    pool->worker_count = 0;
+}
+
+void run_jobs(struct job_pool *pool, int job_count, job_func func, void *data)
+{
+    int i;
+
+    if (job_count <= 0)
+        return;
+    if (pool->worker_count <= 1 || job_count == 1) {
+        for (i = 0; i < job_count; ++i)
+            func(i, 0, data);
+        return;
+    }
+
+    start_jobs(pool, job_count, func, data);
+    finish_jobs(pool);
+}
+
+void start_jobs(struct job_pool *pool, int job_count, job_func func, void *data)
+{
+    lock_mutex(&pool->mutex);
+    pool->func = func;
+    pool->data = data;
+    pool->job_count = job_count > 0 ? job_count : 0;
+    pool->next_job = 0;
+    pool->remaining = pool->job_count;
+    ++pool->generation;
+    broadcast_condition(&pool->start);
+    unlock_mutex(&pool->mutex);
+}
+
+int help_jobs(struct job_pool *pool)
+{
+    job_func func;
+    void *data;
+    int job;
+
+    lock_mutex(&pool->mutex);
+    if (pool->next_job >= pool->job_count) {
+        unlock_mutex(&pool->mutex);
+        return 0;
+    }
+    job = pool->next_job++;
+    func = pool->func;
+    data = pool->data;
+    unlock_mutex(&pool->mutex);
+
+    func(job, 0, data);
+
+    lock_mutex(&pool->mutex);
+    if (--pool->remaining == 0)
+        signal_condition(&pool->done);
+    unlock_mutex(&pool->mutex);
+    return 1;
+}
+
+void finish_jobs(struct job_pool *pool)
+{
+    lock_mutex(&pool->mutex);
+    work_locked(pool, 0);
+    while (pool->remaining > 0)
+        wait_condition(&pool->done, &pool->mutex);
+    unlock_mutex(&pool->mutex);
+}
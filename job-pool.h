@@ -0,0 +1,47 @@
+#define MAX_WORKERS 32
+
+/*
+ * A job is called with its index and the index of the worker running it,
+ * from 0 to worker_count - 1, so it can use per-worker scratch space
+ * without locking.
+ */
+typedef void (*job_func)(int job, int worker, void *data);
+
+struct job_worker {
+    struct job_pool *pool;
+    int index;
+    struct thread thread;
+};
+
+/*
+ * Persistent worker threads for fork-join parallelism. The thread that
+ * calls run_jobs counts as worker 0 and works alongside the others until
+ * every job has finished.
+ */
+struct job_pool {
+    struct job_worker workers[MAX_WORKERS];
+    int worker_count;
+
+    struct mutex mutex;
+    struct condition start, done;
+
+    job_func func;
+    void *data;
+    int job_count, next_job, remaining, generation, quit;
+};
+
+int make_job_pool(struct job_pool *out_pool, int worker_count);
+void delete_job_pool(struct job_pool *pool);
+void run_jobs(struct job_pool *pool, int job_count, job_func func, void *data);
+
+/*
+ * Split form of run_jobs for callers with work of their own to overlap.
+ * start_jobs returns as soon as the jobs are handed to the other workers;
+ * help_jobs runs one unclaimed job on the calling thread, returning 0 if
+ * there were none left; finish_jobs helps until every job has finished
+ * and must be called before starting another batch. A pool with no other
+ * workers only makes progress through help_jobs and finish_jobs.
+ */
+void start_jobs(struct job_pool *pool, int job_count, job_func func, void *data);
+int help_jobs(struct job_pool *pool);
+void finish_jobs(struct job_pool *pool);
@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include "lights.h"
+#include "memory.h"
+#include "gpu-resources.h"
+#include "gl-capture.h"
+
+/* must match MAX_LIGHTS_PER_CLUSTER in flag.f.glsl */
+#define MAX_LIGHTS_PER_CLUSTER 256
+
+int light_clusters_supported(void)
+{
+    return GLEW_VERSION_3_0 || GLEW_ARB_texture_float;
+}
+
+static GLuint make_data_texture(
+    GLenum internal_format, GLenum format, GLsizei width, GLsizei height, int components
+) {
+    GLuint texture;
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0,
+        internal_format,
+        width, height, 0,
+        format, GL_FLOAT,
+        NULL
+    );
+    track_gpu_resource(
+        GPU_TEXTURE, texture,
+        (size_t)width * height * components * sizeof(GLfloat), "light clusters"
+    );
+    return texture;
+}
+
+static void *light_alloc(size_t size)
+{
+    void *pointer = memory_alloc(size, MEMORY_LIGHTS);
+    if (pointer)
+        memset(pointer, 0, size);
+    return pointer;
+}
+
+int make_light_clusters(struct light_clusters *out_clusters)
+{
+    out_clusters->light_data
+        = (GLfloat*) light_alloc(MAX_LIGHTS * LIGHT_TEXELS * 4 * sizeof(GLfloat));
+    out_clusters->cluster_data
+        = (GLfloat*) light_alloc(CLUSTER_COUNT * 4 * sizeof(GLfloat));
+    out_clusters->index_data
+        = (GLfloat*) light_alloc(MAX_LIGHT_INDICES * sizeof(GLfloat));
+    out_clusters->cluster_counts
+        = (unsigned short*) light_alloc(CLUSTER_COUNT * sizeof(unsigned short));
+    out_clusters->light_count = 0;
+    out_clusters->overflowed = 0;
+    out_clusters->upload_bytes = 0;
+
+    if (!out_clusters->light_data || !out_clusters->cluster_data
+        || !out_clusters->index_data || !out_clusters->cluster_counts) {
+        fprintf(stderr, "Unable to allocate light clusters\n");
+        return 0;
+    }
+
+    out_clusters->light_texture = make_data_texture(
+        GL_RGBA32F_ARB, GL_RGBA, LIGHT_TEXELS, MAX_LIGHTS, 4
+    );
+    out_clusters->cluster_texture = make_data_texture(
+        GL_RGBA32F_ARB, GL_RGBA, CLUSTER_X * CLUSTER_Y, CLUSTER_Z, 4
+    );
+    out_clusters->index_texture = make_data_texture(
+        GL_LUMINANCE32F_ARB, GL_LUMINANCE, LIGHT_INDEX_WIDTH, LIGHT_INDEX_HEIGHT, 1
+    );
+    return 1;
+}
+
+void delete_light_clusters(struct light_clusters *clusters)
+{
+    glDeleteTextures(1, &clusters->light_texture);
+    glDeleteTextures(1, &clusters->cluster_texture);
+    glDeleteTextures(1, &clusters->index_texture);
+    untrack_gpu_resource(GPU_TEXTURE, clusters->light_texture);
+    untrack_gpu_resource(GPU_TEXTURE, clusters->cluster_texture);
+    untrack_gpu_resource(GPU_TEXTURE, clusters->index_texture);
+    memory_free(clusters->light_data);
+    memory_free(clusters->cluster_data);
+    memory_free(clusters->index_data);
+    memory_free(clusters->cluster_counts);
+}
+
+static void transform_point(GLfloat *out, GLfloat const *m, GLfloat const *p, GLfloat w)
+{
+    out[0] = m[0]*p[0] + m[4]*p[1] + m[ 8]*p[2] + m[12]*w;
+    out[1] = m[1]*p[0] + m[5]*p[1] + m[ 9]*p[2] + m[13]*w;
+    out[2] = m[2]*p[0] + m[6]*p[1] + m[10]*p[2] + m[14]*w;
+}
+
+/*
+ * Move the lights into view space and upload them. Binning then works
+ * from the same view-space copy.
+ */
+void upload_lights(
+    struct light_clusters *clusters,
+    struct light const *lights, int count,
+    GLfloat const *mv_matrix
+) {
+    int i;
+
+    if (count > MAX_LIGHTS)
+        count = MAX_LIGHTS;
+
+    for (i = 0; i < count; ++i) {
+        GLfloat *texels = clusters->light_data + i * LIGHT_TEXELS * 4;
+
+        transform_point(texels, mv_matrix, lights[i].position, 1.0f);
+        texels[3] = lights[i].radius;
+        texels[4] = lights[i].color[0];
+        texels[5] = lights[i].color[1];
+        texels[6] = lights[i].color[2];
+        texels[7] = lights[i].spot_cos;
+        transform_point(texels + 8, mv_matrix, lights[i].direction, 0.0f);
+        texels[11] = lights[i].spot_inner_cos;
+    }
+    clusters->light_count = count;
+
+    if (count > 0) {
+        glBindTexture(GL_TEXTURE_2D, clusters->light_texture);
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0,
+            0, 0, LIGHT_TEXELS, count,
+            GL_RGBA, GL_FLOAT,
+            clusters->light_data
+        );
+        clusters->upload_bytes += (GLsizeiptr)LIGHT_TEXELS * count * 4 * sizeof(GLfloat);
+    }
+}
+
+static int depth_slice(GLfloat depth)
+{
+    int slice;
+
+    if (depth <= CLUSTER_NEAR)
+        return 0;
+    slice = (int)(logf(depth/CLUSTER_NEAR)
+        * ((GLfloat)CLUSTER_Z / logf(CLUSTER_FAR/CLUSTER_NEAR)));
+    return slice < CLUSTER_Z ? slice : CLUSTER_Z - 1;
+}
+
+static int tile_of(GLfloat ndc, int tiles)
+{
+    int tile = (int)floorf((ndc + 1.0f) * 0.5f * (GLfloat)tiles);
+    return tile < 0 ? 0 : tile >= tiles ? tiles - 1 : tile;
+}
+
+/*
+ * Conservative cluster range of a view-space sphere. Eye depth is +z in
+ * this projection, and x/z over the sphere's bounding box is extreme at
+ * its corners, so projecting the corners bounds the sphere on screen.
+ * Returns zero if the sphere is entirely behind the eye.
+ */
+static int light_cluster_range(
+    GLfloat const *texels, GLfloat const *p_matrix, int *out_lo, int *out_hi
+) {
+    GLfloat
+        x = texels[0], y = texels[1], z = texels[2], r = texels[3],
+        z_lo = fmaxf(z - r, CLUSTER_NEAR), z_hi = z + r,
+        x_lo = fminf((x - r)/z_lo, (x - r)/z_hi),
+        x_hi = fmaxf((x + r)/z_lo, (x + r)/z_hi),
+        y_lo = fminf((y - r)/z_lo, (y - r)/z_hi),
+        y_hi = fmaxf((y + r)/z_lo, (y + r)/z_hi);
+
+    if (z_hi < CLUSTER_NEAR)
+        return 0;
+
+    out_lo[0] = tile_of(p_matrix[0]*x_lo + p_matrix[8], CLUSTER_X);
+    out_hi[0] = tile_of(p_matrix[0]*x_hi + p_matrix[8], CLUSTER_X);
+    out_lo[1] = tile_of(p_matrix[5]*y_lo + p_matrix[9], CLUSTER_Y);
+    out_hi[1] = tile_of(p_matrix[5]*y_hi + p_matrix[9], CLUSTER_Y);
+    out_lo[2] = depth_slice(z_lo);
+    out_hi[2] = depth_slice(z_hi);
+    return 1;
+}
+
+#define FOR_EACH_CLUSTER(lo, hi, c) \
+    for (cz = lo[2]; cz <= hi[2]; ++cz) \
+        for (cy = lo[1]; cy <= hi[1]; ++cy) \
+            for (cx = lo[0], c = (cz*CLUSTER_Y + cy)*CLUSTER_X + cx; cx <= hi[0]; ++cx, ++c)
+
+/*
+ * Bin the uploaded lights into clusters for the given projection. A
+ * counting pass sizes each cluster's list, a prefix sum lays the lists
+ * out back to back in the index texture, and a second pass fills them.
+ */
+void update_light_clusters(struct light_clusters *clusters, GLfloat const *p_matrix)
+{
+    unsigned short *counts = clusters->cluster_counts;
+    GLfloat *cluster_data = clusters->cluster_data;
+    int i, c, cx, cy, cz, lo[3], hi[3], total;
+
+    memset(counts, 0, CLUSTER_COUNT * sizeof(unsigned short));
+
+    for (i = 0; i < clusters->light_count; ++i) {
+        if (!light_cluster_range(clusters->light_data + i*LIGHT_TEXELS*4, p_matrix, lo, hi))
+            continue;
+        FOR_EACH_CLUSTER(lo, hi, c)
+            if (counts[c] < MAX_LIGHTS_PER_CLUSTER)
+                ++counts[c];
+    }
+
+    for (c = 0, total = 0; c < CLUSTER_COUNT; ++c) {
+        int count = counts[c];
+        if (total + count > MAX_LIGHT_INDICES) {
+            count = MAX_LIGHT_INDICES - total;
+            if (!clusters->overflowed) {
+                fprintf(stderr, "Too many lights per cluster, some will be dropped\n");
+                clusters->overflowed = 1;
+            }
+        }
+        cluster_data[c*4 + 0] = (GLfloat)total;
+        cluster_data[c*4 + 1] = (GLfloat)count;
+        total += count;
+        counts[c] = 0;
+    }
+
+    for (i = 0; i < clusters->light_count; ++i) {
+        if (!light_cluster_range(clusters->light_data + i*LIGHT_TEXELS*4, p_matrix, lo, hi))
+            continue;
+        FOR_EACH_CLUSTER(lo, hi, c)
+            if (counts[c] < (unsigned short)cluster_data[c*4 + 1])
+                clusters->index_data[(int)cluster_data[c*4 + 0] + counts[c]++] = (GLfloat)i;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, clusters->cluster_texture);
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0,
+        0, 0, CLUSTER_X * CLUSTER_Y, CLUSTER_Z,
+        GL_RGBA, GL_FLOAT,
+        cluster_data
+    );
+    clusters->upload_bytes += (GLsizeiptr)CLUSTER_COUNT * 4 * sizeof(GLfloat);
+
+    if (total > 0) {
+        glBindTexture(GL_TEXTURE_2D, clusters->index_texture);
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0,
+            0, 0, LIGHT_INDEX_WIDTH, (total + LIGHT_INDEX_WIDTH - 1)/LIGHT_INDEX_WIDTH,
+            GL_LUMINANCE, GL_FLOAT,
+            clusters->index_data
+        );
+        clusters->upload_bytes += (GLsizeiptr)LIGHT_INDEX_WIDTH
+            * ((total + LIGHT_INDEX_WIDTH - 1)/LIGHT_INDEX_WIDTH) * sizeof(GLfloat);
+    }
+}
+
+#undef FOR_EACH_CLUSTER
+
+/*
+ * Colored lights wandering between the camera and the wall. Every fourth
+ * one is a spot light aimed down at the ground like a floodlight.
+ */
+void animate_demo_lights(struct light *lights, int count, GLfloat time)
+{
+    int i;
+    GLfloat brightness = 1.5f/sqrtf((GLfloat)(count > 4 ? count : 4));
+
+    for (i = 0; i < count; ++i) {
+        struct light *light = &lights[i];
+        GLfloat
+            phase = (GLfloat)i * 2.399963f,
+            speed = 0.15f + 0.05f*(GLfloat)(i % 7),
+            hue = (GLfloat)i * 0.618034f;
+
+        hue -= floorf(hue);
+
+        light->position[0] = 0.5f + 1.2f*sinf(speed*time + phase);
+        light->position[1] = -0.3f + 0.6f*sinf(0.7f*speed*time + 1.3f*phase);
+        light->position[2] = -0.45f + 0.5f*cosf(1.3f*speed*time + phase);
+        light->radius = 0.5f;
+
+        light->color[0] = brightness*(0.5f + 0.5f*cosf(6.283185f*(hue)));
+        light->color[1] = brightness*(0.5f + 0.5f*cosf(6.283185f*(hue - 0.333333f)));
+        light->color[2] = brightness*(0.5f + 0.5f*cosf(6.283185f*(hue - 0.666667f)));
+
+        if (i % 4 == 3) {
+            light->position[1] = 0.6f;
+            light->radius = 2.0f;
+            light->direction[0] = 0.287f*sinf(time + phase);
+            light->direction[1] = -0.958f;
+            light->direction[2] = 0.287f*cosf(time + phase);
+            light->spot_cos = 0.866f;
+            light->spot_inner_cos = 0.94f;
+        } else {
+            light->direction[0] = light->direction[1] = light->direction[2] = 0.0f;
+            light->spot_cos = light->spot_inner_cos = -2.0f;
+        }
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * Clustered forward lighting. The view frustum is cut into a grid of
+ * CLUSTER_X by CLUSTER_Y screen tiles and CLUSTER_Z exponential depth
+ * slices; each frame the CPU lists which lights touch each cluster, and
+ * the fragment shader only walks the list for its own cluster.
+ *
+ * These sizes are repeated in flag.f.glsl and must match it.
+ */
+#define MAX_LIGHTS              1024
+#define LIGHT_TEXELS            3
+#define CLUSTER_X               16
+#define CLUSTER_Y               9
+#define CLUSTER_Z               24
+#define CLUSTER_COUNT           (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define CLUSTER_NEAR            0.0625f
+#define CLUSTER_FAR             16.0f
+#define LIGHT_INDEX_WIDTH       1024
+#define LIGHT_INDEX_HEIGHT      64
+#define MAX_LIGHT_INDICES       (LIGHT_INDEX_WIDTH * LIGHT_INDEX_HEIGHT)
+
+/*
+ * A point light if spot_cos is less than -1, otherwise a spot light whose
+ * cone fades out between spot_inner_cos and spot_cos.
+ */
+struct light {
+    GLfloat position[3], radius;
+    GLfloat color[3], spot_cos;
+    GLfloat direction[3], spot_inner_cos;
+};
+
+struct light_clusters {
+    GLuint light_texture, cluster_texture, index_texture;
+    GLfloat *light_data, *cluster_data, *index_data;
+    unsigned short *cluster_counts;
+    int light_count, overflowed;
+
+    /* running total of texel data uploaded, for the caller to read and reset */
+    GLsizeiptr upload_bytes;
+};
+
+int light_clusters_supported(void);
+int make_light_clusters(struct light_clusters *out_clusters);
+void delete_light_clusters(struct light_clusters *clusters);
+
+void upload_lights(
+    struct light_clusters *clusters,
+    struct light const *lights, int count,
+    GLfloat const *mv_matrix
+);
+void update_light_clusters(struct light_clusters *clusters, GLfloat const *p_matrix);
+
+void animate_demo_lights(struct light *lights, int count, GLfloat time);
@@ -0,0 +1,500 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "memory.h"
+#include "file-util.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+#include "scene-file.h"
+
+/*
+ * Converts the procedural background and simple OBJ meshes into a scene
+ * file for --scene:
+ *
+ *   make-scene <output> [--procedural]
+ *       [[--offset <x> <y> <z>] [--translucent] --obj <file.obj> <texture.tga>]...
+ *
+ * --offset and --translucent apply to the --obj that follows them. The
+ * offset is baked into the vertices. OBJ support covers v, vt, vn and
+ * polygonal f lines, which are triangulated as fans; everything else,
+ * including materials, is ignored.
+ */
+
+#define MAX_SCENE_MESHES   4096
+#define MAX_SCENE_TEXTURES 256
+#define MAX_LINE           1024
+
+struct converted_mesh {
+    struct flag_vertex *vertices;
+    GLushort *elements;
+    GLsizei vertex_count, element_count;
+    GLuint texture, flags;
+};
+
+static struct {
+    struct converted_mesh meshes[MAX_SCENE_MESHES];
+    int mesh_count;
+    char textures[MAX_SCENE_TEXTURES][SCENE_TEXTURE_PATH_SIZE];
+    int texture_count;
+} g_scene;
+
+static int add_texture(const char *path, GLuint *out_index)
+{
+    int i;
+
+    if (strlen(path) >= SCENE_TEXTURE_PATH_SIZE) {
+        fprintf(stderr, "Texture path %s is too long\n", path);
+        return 0;
+    }
+    for (i = 0; i < g_scene.texture_count; ++i)
+        if (strcmp(g_scene.textures[i], path) == 0) {
+            *out_index = i;
+            return 1;
+        }
+    if (g_scene.texture_count == MAX_SCENE_TEXTURES) {
+        fprintf(stderr, "At most %d textures are supported\n", MAX_SCENE_TEXTURES);
+        return 0;
+    }
+    strcpy(g_scene.textures[g_scene.texture_count], path);
+    *out_index = g_scene.texture_count++;
+    return 1;
+}
+
+static struct converted_mesh *new_mesh(const char *texture, GLuint flags)
+{
+    struct converted_mesh *mesh;
+
+    if (g_scene.mesh_count == MAX_SCENE_MESHES) {
+        fprintf(stderr, "At most %d meshes are supported\n", MAX_SCENE_MESHES);
+        return NULL;
+    }
+    mesh = &g_scene.meshes[g_scene.mesh_count];
+    if (!add_texture(texture, &mesh->texture))
+        return NULL;
+    mesh->flags = flags;
+    mesh->vertices = NULL;
+    mesh->elements = NULL;
+    mesh->vertex_count = mesh->element_count = 0;
+    ++g_scene.mesh_count;
+    return mesh;
+}
+
+static int add_procedural_background(void)
+{
+    struct arena arena;
+    struct mesh_data data;
+    struct converted_mesh *mesh = new_mesh("background.tga", 0);
+    int ok;
+
+    if (!mesh)
+        return 0;
+
+    init_arena(&arena, 64*1024, MEMORY_MESH);
+    ok = generate_background_mesh(&data, &arena);
+    if (ok) {
+        mesh->vertices = (struct flag_vertex*) malloc(data.vertex_count * sizeof(struct flag_vertex));
+        mesh->elements = (GLushort*) malloc(data.element_count * sizeof(GLushort));
+        ok = mesh->vertices && mesh->elements;
+    }
+    if (ok) {
+        memcpy(mesh->vertices, data.vertices, data.vertex_count * sizeof(struct flag_vertex));
+        memcpy(mesh->elements, data.elements, data.element_count * sizeof(GLushort));
+        mesh->vertex_count = data.vertex_count;
+        mesh->element_count = data.element_count;
+    }
+    delete_arena(&arena);
+    return ok;
+}
+
+/* Growable array of floats for the v, vt and vn lists. */
+struct float_list {
+    GLfloat *values;
+    int count, capacity;
+};
+
+static int push_floats(struct float_list *list, GLfloat const *values, int n)
+{
+    if (list->count + n > list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 1024;
+        GLfloat *grown;
+        while (capacity < list->count + n)
+            capacity *= 2;
+        grown = (GLfloat*) realloc(list->values, capacity * sizeof(GLfloat));
+        if (!grown)
+            return 0;
+        list->values = grown;
+        list->capacity = capacity;
+    }
+    memcpy(list->values + list->count, values, n * sizeof(GLfloat));
+    list->count += n;
+    return 1;
+}
+
+/*
+ * OBJ corners that share position, texcoord and normal become one
+ * vertex, found through an open-addressed table of vertex indices.
+ */
+struct corner_table {
+    int *keys;      /* three per slot: position, texcoord, normal */
+    GLushort *vertices;
+    int capacity;
+};
+
+static unsigned hash_corner(int const *key)
+{
+    return (unsigned)key[0] * 73856093u ^ (unsigned)key[1] * 19349663u ^ (unsigned)key[2] * 83492791u;
+}
+
+/* obj indices are 1-based, negative ones count back from the end */
+static int resolve_index(int index, int count)
+{
+    if (index > 0)
+        return index - 1 < count ? index - 1 : -1;
+    if (index < 0)
+        return count + index >= 0 ? count + index : -1;
+    return -1;
+}
+
+static int add_corner(
+    struct converted_mesh *mesh, struct corner_table *table,
+    struct float_list const *positions,
+    struct float_list const *texcoords,
+    struct float_list const *normals,
+    int const *key, GLfloat const *offset,
+    GLushort *out_vertex
+) {
+    unsigned slot = hash_corner(key) & (table->capacity - 1);
+    struct flag_vertex *v;
+
+    while (table->keys[slot*3] != -2) {
+        if (memcmp(&table->keys[slot*3], key, 3*sizeof(int)) == 0) {
+            *out_vertex = table->vertices[slot];
+            return 1;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    if (mesh->vertex_count == 65536 || mesh->vertex_count * 2 >= table->capacity) {
+        fprintf(stderr, "OBJ mesh has too many distinct vertices\n");
+        return 0;
+    }
+
+    v = &mesh->vertices[mesh->vertex_count];
+    v->position[0] = positions->values[key[0]*3+0] + offset[0];
+    v->position[1] = positions->values[key[0]*3+1] + offset[1];
+    v->position[2] = positions->values[key[0]*3+2] + offset[2];
+    v->position[3] = 1.0f;
+    if (key[2] >= 0) {
+        v->normal[0] = normals->values[key[2]*3+0];
+        v->normal[1] = normals->values[key[2]*3+1];
+        v->normal[2] = normals->values[key[2]*3+2];
+    } else {
+        v->normal[0] = 0.0f;
+        v->normal[1] = 1.0f;
+        v->normal[2] = 0.0f;
+    }
+    v->normal[3] = 0.0f;
+    v->texcoord[0] = key[1] >= 0 ? texcoords->values[key[1]*2+0] : 0.0f;
+    v->texcoord[1] = key[1] >= 0 ? texcoords->values[key[1]*2+1] : 0.0f;
+    v->shininess = 0.0f;
+    v->specular[0] = v->specular[1] = v->specular[2] = v->specular[3] = 0;
+
+    memcpy(&table->keys[slot*3], key, 3*sizeof(int));
+    table->vertices[slot] = (GLushort)mesh->vertex_count;
+    *out_vertex = (GLushort)mesh->vertex_count++;
+    return 1;
+}
+
+static int parse_corner(
+    const char *token,
+    struct float_list const *positions,
+    struct float_list const *texcoords,
+    struct float_list const *normals,
+    int *out_key
+) {
+    int v = 0, vt = 0, vn = 0;
+
+    if (sscanf(token, "%d/%d/%d", &v, &vt, &vn) != 3
+        && sscanf(token, "%d//%d", &v, &vn) != 2
+        && sscanf(token, "%d/%d", &v, &vt) != 2
+        && sscanf(token, "%d", &v) != 1)
+        return 0;
+
+    out_key[0] = resolve_index(v, positions->count / 3);
+    out_key[1] = vt ? resolve_index(vt, texcoords->count / 2) : -1;
+    out_key[2] = vn ? resolve_index(vn, normals->count / 3) : -1;
+    return out_key[0] >= 0 && (vt == 0 || out_key[1] >= 0) && (vn == 0 || out_key[2] >= 0);
+}
+
+#define OBJ_TABLE_CAPACITY  (1 << 17)
+#define OBJ_MAX_ELEMENTS    (3 * 1024 * 1024)
+#define OBJ_MAX_POLYGON     64
+
+static int add_obj(const char *filename, const char *texture, GLfloat const *offset, GLuint flags)
+{
+    struct float_list positions = { NULL, 0, 0 }, texcoords = { NULL, 0, 0 }, normals = { NULL, 0, 0 };
+    struct corner_table table;
+    struct converted_mesh *mesh;
+    char line[MAX_LINE];
+    int i, line_number = 0, ok = 1;
+    FILE *f = fopen(filename, "r");
+
+    if (!f) {
+        fprintf(stderr, "Unable to open %s for reading\n", filename);
+        return 0;
+    }
+    mesh = new_mesh(texture, flags);
+    table.capacity = OBJ_TABLE_CAPACITY;
+    table.keys = (int*) malloc(table.capacity * 3 * sizeof(int));
+    table.vertices = (GLushort*) malloc(table.capacity * sizeof(GLushort));
+    if (mesh) {
+        mesh->vertices = (struct flag_vertex*) malloc(65536 * sizeof(struct flag_vertex));
+        mesh->elements = (GLushort*) malloc(OBJ_MAX_ELEMENTS * sizeof(GLushort));
+    }
+    if (!mesh || !table.keys || !table.vertices || !mesh->vertices || !mesh->elements) {
+        fprintf(stderr, "Unable to allocate space for %s\n", filename);
+        fclose(f);
+        free(table.keys);
+        free(table.vertices);
+        return 0;
+    }
+    for (i = 0; i < table.capacity * 3; ++i)
+        table.keys[i] = -2;
+
+    while (ok && fgets(line, sizeof(line), f)) {
+        GLfloat values[3];
+        ++line_number;
+
+        if (strncmp(line, "v ", 2) == 0) {
+            ok = sscanf(line + 2, "%f %f %f", &values[0], &values[1], &values[2]) == 3
+                && push_floats(&positions, values, 3);
+        } else if (strncmp(line, "vt ", 3) == 0) {
+            ok = sscanf(line + 3, "%f %f", &values[0], &values[1]) == 2
+                && push_floats(&texcoords, values, 2);
+        } else if (strncmp(line, "vn ", 3) == 0) {
+            ok = sscanf(line + 3, "%f %f %f", &values[0], &values[1], &values[2]) == 3
+                && push_floats(&normals, values, 3);
+        } else if (strncmp(line, "f ", 2) == 0) {
+            GLushort corners[OBJ_MAX_POLYGON];
+            int corner_count = 0;
+            char *token = strtok(line + 2, " \t\r\n");
+
+            /* a face with more corners than that fails rather than being cut short */
+            while (ok && token) {
+                int key[3];
+                ok = corner_count < OBJ_MAX_POLYGON
+                    && parse_corner(token, &positions, &texcoords, &normals, key)
+                    && add_corner(
+                        mesh, &table, &positions, &texcoords, &normals,
+                        key, offset, &corners[corner_count++]
+                    );
+                token = strtok(NULL, " \t\r\n");
+            }
+            if (ok && corner_count >= 3
+                && mesh->element_count + 3*(corner_count - 2) <= OBJ_MAX_ELEMENTS)
+                for (i = 2; i < corner_count; ++i) {
+                    mesh->elements[mesh->element_count++] = corners[0];
+                    mesh->elements[mesh->element_count++] = corners[i-1];
+                    mesh->elements[mesh->element_count++] = corners[i];
+                }
+            else if (ok)
+                ok = 0;
+        }
+        if (!ok)
+            fprintf(stderr, "%s:%d: unsupported or malformed line\n", filename, line_number);
+    }
+
+    fclose(f);
+    free(positions.values);
+    free(texcoords.values);
+    free(normals.values);
+    free(table.keys);
+    free(table.vertices);
+    return ok;
+}
+
+static GLuint align_offset(GLuint offset)
+{
+    return (offset + SCENE_FILE_ALIGNMENT - 1) & ~(GLuint)(SCENE_FILE_ALIGNMENT - 1);
+}
+
+static void mesh_bounds(struct converted_mesh const *mesh, GLfloat *lo, GLfloat *hi)
+{
+    GLsizei i;
+    int j;
+
+    for (i = 0; i < mesh->vertex_count; ++i)
+        for (j = 0; j < 3; ++j) {
+            GLfloat p = mesh->vertices[i].position[j];
+            if (p < lo[j]) lo[j] = p;
+            if (p > hi[j]) hi[j] = p;
+        }
+}
+
+static int write_padding(FILE *out, GLuint *offset, GLuint target)
+{
+    static const char zeros[SCENE_FILE_ALIGNMENT] = { 0 };
+    size_t n = target - *offset;
+
+    *offset = target;
+    return fwrite(zeros, 1, n, out) == n;
+}
+
+static int write_scene(const char *filename)
+{
+    struct scene_file_header header;
+    struct scene_file_mesh *meshes;
+    struct scene_file_instance *instances;
+    struct scene_file_texture *textures;
+    GLuint offset;
+    int i, j, ok = 1;
+    FILE *out;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC));
+    header.version = SCENE_FILE_VERSION;
+    header.vertex_size = sizeof(struct flag_vertex);
+    header.mesh_count = header.instance_count = g_scene.mesh_count;
+    header.texture_count = g_scene.texture_count;
+    header.meshes_offset = sizeof(header);
+    header.instances_offset
+        = header.meshes_offset + header.mesh_count * sizeof(struct scene_file_mesh);
+    header.textures_offset
+        = header.instances_offset + header.instance_count * sizeof(struct scene_file_instance);
+    for (j = 0; j < 3; ++j) {
+        header.bounds_lo[j] = 1e30f;
+        header.bounds_hi[j] = -1e30f;
+    }
+
+    meshes = (struct scene_file_mesh*) calloc(g_scene.mesh_count + 1, sizeof(struct scene_file_mesh));
+    instances = (struct scene_file_instance*) calloc(g_scene.mesh_count + 1, sizeof(struct scene_file_instance));
+    textures = (struct scene_file_texture*) calloc(g_scene.texture_count + 1, sizeof(struct scene_file_texture));
+    if (!meshes || !instances || !textures) {
+        fprintf(stderr, "Unable to allocate scene tables\n");
+        return 0;
+    }
+
+    offset = header.textures_offset + header.texture_count * sizeof(struct scene_file_texture);
+    for (i = 0; i < g_scene.mesh_count; ++i) {
+        struct converted_mesh const *mesh = &g_scene.meshes[i];
+        GLfloat lo[3] = { 1e30f, 1e30f, 1e30f }, hi[3] = { -1e30f, -1e30f, -1e30f };
+
+        offset = align_offset(offset);
+        meshes[i].vertex_offset = offset;
+        meshes[i].vertex_count = mesh->vertex_count;
+        offset += mesh->vertex_count * sizeof(struct flag_vertex);
+        offset = align_offset(offset);
+        meshes[i].element_offset = offset;
+        meshes[i].element_count = mesh->element_count;
+        offset += mesh->element_count * sizeof(GLushort);
+        meshes[i].texture = mesh->texture;
+
+        mesh_bounds(mesh, lo, hi);
+        instances[i].mesh = i;
+        instances[i].flags = mesh->flags;
+        for (j = 0; j < 3; ++j) {
+            instances[i].center[j] = 0.5f*(lo[j] + hi[j]);
+            if (lo[j] < header.bounds_lo[j]) header.bounds_lo[j] = lo[j];
+            if (hi[j] > header.bounds_hi[j]) header.bounds_hi[j] = hi[j];
+        }
+    }
+    for (i = 0; i < g_scene.texture_count; ++i)
+        strcpy(textures[i].path, g_scene.textures[i]);
+
+    out = fopen(filename, "wb");
+    if (!out) {
+        fprintf(stderr, "Unable to open %s for writing\n", filename);
+        return 0;
+    }
+    ok = fwrite(&header, sizeof(header), 1, out) == 1
+        && fwrite(meshes, sizeof(struct scene_file_mesh), header.mesh_count, out) == header.mesh_count
+        && fwrite(instances, sizeof(struct scene_file_instance), header.instance_count, out) == header.instance_count
+        && fwrite(textures, sizeof(struct scene_file_texture), header.texture_count, out) == header.texture_count;
+
+    offset = header.textures_offset + header.texture_count * sizeof(struct scene_file_texture);
+    for (i = 0; ok && i < g_scene.mesh_count; ++i) {
+        struct converted_mesh const *mesh = &g_scene.meshes[i];
+
+        ok = write_padding(out, &offset, meshes[i].vertex_offset)
+            && fwrite(mesh->vertices, sizeof(struct flag_vertex), mesh->vertex_count, out)
+                == (size_t)mesh->vertex_count;
+        offset += mesh->vertex_count * sizeof(struct flag_vertex);
+        ok = ok
+            && write_padding(out, &offset, meshes[i].element_offset)
+            && fwrite(mesh->elements, sizeof(GLushort), mesh->element_count, out)
+                == (size_t)mesh->element_count;
+        offset += mesh->element_count * sizeof(GLushort);
+    }
+
+    if (fclose(out) != 0)
+        ok = 0;
+    if (!ok)
+        fprintf(stderr, "Unable to write %s\n", filename);
+    else
+        printf("%s: %d meshes, %d textures, %u bytes\n",
+            filename, g_scene.mesh_count, g_scene.texture_count, offset);
+
+    free(meshes);
+    free(instances);
+    free(textures);
+    return ok;
+}
+
+static int parse_float(const char *arg, GLfloat *out)
+{
+    char trailing;
+    return sscanf(arg, "%f%c", out, &trailing) == 1;
+}
+
+int main(int argc, char *argv[])
+{
+    GLfloat offset[3] = { 0.0f, 0.0f, 0.0f };
+    GLuint flags = 0;
+    int i, ok = 1;
+
+    if (argc < 3) {
+        fprintf(stderr,
+            "usage: %s <output> [--procedural]\n"
+            "       [[--offset <x> <y> <z>] [--translucent] --obj <file.obj> <texture.tga>]...\n",
+            argv[0]
+        );
+        return 1;
+    }
+    init_memory(0);
+
+    for (i = 2; i < argc && ok; ++i) {
+        if (strcmp(argv[i], "--procedural") == 0) {
+            ok = add_procedural_background();
+        } else if (strcmp(argv[i], "--offset") == 0 && i + 3 < argc) {
+            ok = parse_float(argv[i+1], &offset[0])
+                && parse_float(argv[i+2], &offset[1])
+                && parse_float(argv[i+3], &offset[2]);
+            i += 3;
+        } else if (strcmp(argv[i], "--translucent") == 0) {
+            flags |= SCENE_INSTANCE_TRANSLUCENT;
+        } else if (strcmp(argv[i], "--obj") == 0 && i + 2 < argc) {
+            ok = add_obj(argv[i+1], argv[i+2], offset, flags);
+            offset[0] = offset[1] = offset[2] = 0.0f;
+            flags = 0;
+            i += 2;
+        } else {
+            fprintf(stderr, "unknown or incomplete option %s\n", argv[i]);
+            ok = 0;
+        }
+    }
+
+    if (ok && g_scene.mesh_count == 0) {
+        fprintf(stderr, "nothing to write\n");
+        ok = 0;
+    }
+    if (ok)
+        ok = write_scene(argv[1]);
+
+    for (i = 0; i < g_scene.mesh_count; ++i) {
+        free(g_scene.meshes[i].vertices);
+        free(g_scene.meshes[i].elements);
+    }
+    return !ok;
+}
@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "memory.h"
+#include "file-util.h"
+#include "tile-file.h"
+
+/*
+ * Splits flag artwork into a tile file for --virtual-texture:
+ *
+ *   make-tiles <artwork.tga> <output>
+ *
+ * Each level is a 2x2 box filter of the one before. The artwork can be
+ * any size up to MAX_LEVEL_TILES tiles on a side; edge tiles are padded
+ * by repeating the level's edge texels.
+ */
+
+static void halve_level(
+    GLubyte const *from, struct tile_file_level const *from_level,
+    GLubyte *to, struct tile_file_level const *to_level
+) {
+    GLuint x, y, channel;
+
+    for (y = 0; y < to_level->height; ++y) {
+        GLuint
+            y0 = 2*y < from_level->height ? 2*y : from_level->height - 1,
+            y1 = 2*y + 1 < from_level->height ? 2*y + 1 : from_level->height - 1;
+
+        for (x = 0; x < to_level->width; ++x) {
+            GLuint
+                x0 = 2*x < from_level->width ? 2*x : from_level->width - 1,
+                x1 = 2*x + 1 < from_level->width ? 2*x + 1 : from_level->width - 1;
+            GLubyte const
+                *t00 = from + ((size_t)y0 * from_level->width + x0) * 3,
+                *t01 = from + ((size_t)y0 * from_level->width + x1) * 3,
+                *t10 = from + ((size_t)y1 * from_level->width + x0) * 3,
+                *t11 = from + ((size_t)y1 * from_level->width + x1) * 3;
+            GLubyte *t = to + ((size_t)y * to_level->width + x) * 3;
+
+            for (channel = 0; channel < 3; ++channel)
+                t[channel] = (GLubyte)(
+                    (t00[channel] + t01[channel] + t10[channel] + t11[channel] + 2) / 4
+                );
+        }
+    }
+}
+
+static GLuint clamp_texel(int texel, GLuint size)
+{
+    return texel < 0 ? 0 : (GLuint)texel >= size ? size - 1 : (GLuint)texel;
+}
+
+static void cut_tile(
+    GLubyte const *pixels, struct tile_file_level const *level,
+    GLuint tile_x, GLuint tile_y, GLubyte *out_tile
+) {
+    int
+        left = (int)(tile_x * TILE_SIZE) - TILE_BORDER,
+        bottom = (int)(tile_y * TILE_SIZE) - TILE_BORDER,
+        x, y;
+
+    for (y = 0; y < TILE_TEXELS; ++y) {
+        GLubyte const *row
+            = pixels + (size_t)clamp_texel(bottom + y, level->height) * level->width * 3;
+
+        for (x = 0; x < TILE_TEXELS; ++x)
+            memcpy(
+                out_tile + (y * TILE_TEXELS + x) * 3,
+                row + clamp_texel(left + x, level->width) * 3,
+                3
+            );
+    }
+}
+
+static int write_tiles(
+    const char *filename, struct tile_file_header const *header,
+    GLubyte *const *level_pixels
+) {
+    static GLubyte padding[TILE_FILE_ALIGNMENT];
+    GLubyte tile[TILE_BYTES];
+    GLuint level, x, y;
+    FILE *out = fopen(filename, "wb");
+    int ok;
+
+    if (!out) {
+        fprintf(stderr, "Unable to open %s for writing\n", filename);
+        return 0;
+    }
+    ok = fwrite(header, sizeof(*header), 1, out) == 1
+        && fwrite(padding, 1, header->tiles_offset - sizeof(*header), out)
+            == header->tiles_offset - sizeof(*header);
+
+    for (level = 0; level < header->level_count && ok; ++level) {
+        struct tile_file_level const *l = &header->levels[level];
+
+        for (y = 0; y < l->tiles_y && ok; ++y)
+            for (x = 0; x < l->tiles_x && ok; ++x) {
+                cut_tile(level_pixels[level], l, x, y, tile);
+                ok = fwrite(tile, TILE_BYTES, 1, out) == 1;
+            }
+    }
+
+    if (fclose(out) != 0)
+        ok = 0;
+    if (!ok)
+        fprintf(stderr, "Unable to write %s\n", filename);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    struct tile_file_header header;
+    GLubyte *level_pixels[MAX_TILE_LEVELS];
+    int width, height, level_count, i, ok = 1;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <artwork.tga> <output>\n", argv[0]);
+        return 1;
+    }
+    init_memory(0);
+
+    level_pixels[0] = (GLubyte*) read_tga(scratch_arena(), argv[1], &width, &height);
+    if (!level_pixels[0])
+        return 1;
+
+    memset(&header, 0, sizeof(header));
+    level_count = tile_levels((GLuint)width, (GLuint)height, header.levels);
+    if (level_count == 0) {
+        fprintf(stderr, "%s is %dx%d; at most %dx%d is supported\n",
+            argv[1], width, height,
+            MAX_LEVEL_TILES*TILE_SIZE, MAX_LEVEL_TILES*TILE_SIZE);
+        return 1;
+    }
+    memcpy(header.magic, TILE_FILE_MAGIC, sizeof(TILE_FILE_MAGIC));
+    header.version = TILE_FILE_VERSION;
+    header.tile_size = TILE_SIZE;
+    header.tile_border = TILE_BORDER;
+    header.width = (GLuint)width;
+    header.height = (GLuint)height;
+    header.level_count = (GLuint)level_count;
+    header.tile_count = header.levels[level_count - 1].first_tile + 1;
+    header.tiles_offset
+        = (sizeof(header) + TILE_FILE_ALIGNMENT - 1) / TILE_FILE_ALIGNMENT * TILE_FILE_ALIGNMENT;
+
+    for (i = 1; i < level_count && ok; ++i) {
+        struct tile_file_level const *l = &header.levels[i];
+
+        level_pixels[i] = (GLubyte*) arena_alloc(
+            scratch_arena(), (size_t)l->width * l->height * 3
+        );
+        if (level_pixels[i])
+            halve_level(level_pixels[i - 1], &header.levels[i - 1], level_pixels[i], l);
+        else {
+            fprintf(stderr, "Unable to allocate level %d (%ux%u) of %s\n",
+                i, l->width, l->height, argv[1]);
+            ok = 0;
+        }
+    }
+
+    if (ok)
+        ok = write_tiles(argv[2], &header, level_pixels);
+    if (ok)
+        printf("wrote %dx%d as %u tiles in %d levels to %s (%.1f MiB)\n",
+            width, height, header.tile_count, level_count, argv[2],
+            ((double)header.tiles_offset + (double)header.tile_count * TILE_BYTES)
+                / (1024.0*1024.0));
+    return !ok;
+}
@@ -0,0 +1,266 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "thread-util.h"
+#include "memory.h"
+
+#define SCRATCH_CHUNK_SIZE  (1024*1024)
+#define ROUND_UP(n, align)  (((n) + (align) - 1) & ~(size_t)((align) - 1))
+
+static const char *const CATEGORY_NAMES[MEMORY_CATEGORY_COUNT] = {
+    "scratch", "mesh", "lights", "cloth", "crowd", "raster", "other"
+};
+
+static struct {
+    struct mutex mutex;
+    size_t budget, total;
+    size_t current[MEMORY_CATEGORY_COUNT], peak[MEMORY_CATEGORY_COUNT];
+    struct arena scratch;
+} g_memory;
+
+/*
+ * Stored just below each aligned pointer that memory_alloc returns. The
+ * aligned pointer is always at least MEMORY_ALIGNMENT bytes into the
+ * underlying allocation, which leaves room for it.
+ */
+struct allocation_header {
+    void *base;
+    size_t size;
+    enum memory_category category;
+};
+
+void init_memory(size_t budget)
+{
+    init_mutex(&g_memory.mutex);
+    g_memory.budget = budget;
+    init_arena(&g_memory.scratch, SCRATCH_CHUNK_SIZE, MEMORY_SCRATCH);
+}
+
+void *memory_alloc(size_t size, enum memory_category category)
+{
+    struct allocation_header *header;
+    char *base, *aligned;
+
+    lock_mutex(&g_memory.mutex);
+    if (g_memory.budget && g_memory.total + size > g_memory.budget) {
+        unlock_mutex(&g_memory.mutex);
+        fprintf(
+            stderr, "Memory budget exceeded allocating %lu bytes for %s\n",
+            (unsigned long)size, CATEGORY_NAMES[category]
+        );
+        return NULL;
+    }
+    g_memory.total += size;
+    g_memory.current[category] += size;
+    if (g_memory.current[category] > g_memory.peak[category])
+        g_memory.peak[category] = g_memory.current[category];
+    unlock_mutex(&g_memory.mutex);
+
+    base = (char*) malloc(size + 2*MEMORY_ALIGNMENT);
+    if (!base) {
+        fprintf(
+            stderr, "Unable to allocate %lu bytes for %s\n",
+            (unsigned long)size, CATEGORY_NAMES[category]
+        );
+        lock_mutex(&g_memory.mutex);
+        g_memory.total -= size;
+        g_memory.current[category] -= size;
+        unlock_mutex(&g_memory.mutex);
+        return NULL;
+    }
+
+    aligned = (char*)ROUND_UP((size_t)base + MEMORY_ALIGNMENT, MEMORY_ALIGNMENT);
+    header = (struct allocation_header*)(aligned - sizeof(struct allocation_header));
+    header->base = base;
+    header->size = size;
+    header->category = category;
+    return aligned;
+}
+
+void memory_free(void *pointer)
+{
+    struct allocation_header *header;
+
+    if (!pointer)
+        return;
+    header = (struct allocation_header*)((char*)pointer - sizeof(struct allocation_header));
+
+    lock_mutex(&g_memory.mutex);
+    g_memory.total -= header->size;
+    g_memory.current[header->category] -= header->size;
+    unlock_mutex(&g_memory.mutex);
+
+    free(header->base);
+}
+
+void report_memory(void)
+{
+    int i;
+
+    lock_mutex(&g_memory.mutex);
+    for (i = 0; i < MEMORY_CATEGORY_COUNT; ++i)
+        printf(
+            "%-8s %8.1f KiB current, %8.1f KiB peak\n",
+            CATEGORY_NAMES[i],
+            (double)g_memory.current[i] / 1024.0,
+            (double)g_memory.peak[i] / 1024.0
+        );
+    if (g_memory.budget)
+        printf(
+            "total    %8.1f KiB of %.1f KiB budget\n",
+            (double)g_memory.total / 1024.0, (double)g_memory.budget / 1024.0
+        );
+    else
+        printf("total    %8.1f KiB\n", (double)g_memory.total / 1024.0);
+    unlock_mutex(&g_memory.mutex);
+}
+
+struct arena_chunk {
+    struct arena_chunk *prev;
+    size_t size, used;
+};
+
+#define CHUNK_HEADER_SIZE ROUND_UP(sizeof(struct arena_chunk), MEMORY_ALIGNMENT)
+
+void init_arena(struct arena *out_arena, size_t chunk_size, enum memory_category category)
+{
+    out_arena->chunk = out_arena->spare = NULL;
+    out_arena->chunk_size = chunk_size;
+    out_arena->category = category;
+}
+
+void delete_arena(struct arena *arena)
+{
+    struct arena_mark empty = { NULL, 0 };
+
+    release_arena(arena, empty);
+    memory_free(arena->spare);
+    arena->spare = NULL;
+}
+
+/*
+ * Requests larger than the chunk size get a chunk of their own. One
+ * ordinary chunk is kept back when released, so that repeatedly loading
+ * and releasing does not go back to the system allocator every time.
+ */
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk = arena->chunk;
+    void *pointer;
+
+    size = ROUND_UP(size, ARENA_ALIGNMENT);
+    if (!chunk || chunk->used + size > chunk->size) {
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+
+        if (arena->spare && arena->spare->size >= chunk_size) {
+            chunk = arena->spare;
+            arena->spare = NULL;
+        } else {
+            chunk = (struct arena_chunk*) memory_alloc(
+                CHUNK_HEADER_SIZE + chunk_size, arena->category
+            );
+            if (!chunk)
+                return NULL;
+            chunk->size = chunk_size;
+        }
+        chunk->prev = arena->chunk;
+        chunk->used = 0;
+        arena->chunk = chunk;
+    }
+
+    pointer = (char*)chunk + CHUNK_HEADER_SIZE + chunk->used;
+    chunk->used += size;
+    return pointer;
+}
+
+struct arena_mark get_arena_mark(struct arena const *arena)
+{
+    struct arena_mark mark;
+    mark.chunk = arena->chunk;
+    mark.used = arena->chunk ? arena->chunk->used : 0;
+    return mark;
+}
+
+void release_arena(struct arena *arena, struct arena_mark mark)
+{
+    while (arena->chunk != mark.chunk) {
+        struct arena_chunk *chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+
+        if (!arena->spare && chunk->size == arena->chunk_size)
+            arena->spare = chunk;
+        else
+            memory_free(chunk);
+    }
+    if (arena->chunk)
+        arena->chunk->used = mark.used;
+}
+
+struct arena *scratch_arena(void)
+{
+    return &g_memory.scratch;
+}
+
+void init_memory_pool(
+    struct memory_pool *out_pool,
+    size_t block_size, int blocks_per_chunk,
+    enum memory_category category
+) {
+    if (block_size < sizeof(void*))
+        block_size = sizeof(void*);
+    out_pool->block_size = ROUND_UP(block_size, MEMORY_ALIGNMENT);
+    out_pool->blocks_per_chunk = blocks_per_chunk > 0 ? blocks_per_chunk : 1;
+    out_pool->category = category;
+    out_pool->chunks = out_pool->free_blocks = NULL;
+}
+
+void delete_memory_pool(struct memory_pool *pool)
+{
+    while (pool->chunks) {
+        void *chunk = pool->chunks;
+        pool->chunks = *(void**)chunk;
+        memory_free(chunk);
+    }
+    pool->free_blocks = NULL;
+}
+
+/*
+ * The first MEMORY_ALIGNMENT bytes of each chunk link it into the list
+ * of chunks, and each free block holds the pointer to the next.
+ */
+void *pool_alloc(struct memory_pool *pool)
+{
+    void *block;
+
+    if (!pool->free_blocks) {
+        char *chunk = (char*) memory_alloc(
+            MEMORY_ALIGNMENT + pool->block_size * pool->blocks_per_chunk,
+            pool->category
+        );
+        int i;
+
+        if (!chunk)
+            return NULL;
+        *(void**)chunk = pool->chunks;
+        pool->chunks = chunk;
+
+        for (i = pool->blocks_per_chunk - 1; i >= 0; --i) {
+            void *new_block = chunk + MEMORY_ALIGNMENT + pool->block_size * i;
+            *(void**)new_block = pool->free_blocks;
+            pool->free_blocks = new_block;
+        }
+    }
+
+    block = pool->free_blocks;
+    pool->free_blocks = *(void**)block;
+    return block;
+}
+
+void pool_free(struct memory_pool *pool, void *block)
+{
+    if (!block)
+        return;
+    *(void**)block = pool->free_blocks;
+    pool->free_blocks = block;
+}
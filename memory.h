@@ -0,0 +1,83 @@
+#define MEMORY_ALIGNMENT    64
+#define ARENA_ALIGNMENT     16
+
+/*
+ * Every tracked allocation is charged to a category, so that the current
+ * and peak usage of each can be reported and held to a budget.
+ */
+enum memory_category {
+    MEMORY_SCRATCH,
+    MEMORY_MESH,
+    MEMORY_LIGHTS,
+    MEMORY_CLOTH,
+    MEMORY_CROWD,
+    MEMORY_RASTER,
+    MEMORY_OTHER,
+    MEMORY_CATEGORY_COUNT
+};
+
+/*
+ * A budget of 0 means no limit. Must be called before any other memory
+ * function, and before any threads are started.
+ */
+void init_memory(size_t budget);
+
+/*
+ * Returns MEMORY_ALIGNMENT-aligned memory, or NULL with a message if the
+ * allocation fails or would exceed the budget. Safe to call from any
+ * thread.
+ */
+void *memory_alloc(size_t size, enum memory_category category);
+void memory_free(void *pointer);
+void report_memory(void);
+
+/*
+ * Bump allocator for short-lived buffers. Everything allocated after a
+ * mark is freed at once by releasing back to it; nothing is freed
+ * individually.
+ */
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunk, *spare;
+    size_t chunk_size;
+    enum memory_category category;
+};
+
+struct arena_mark {
+    struct arena_chunk *chunk;
+    size_t used;
+};
+
+void init_arena(struct arena *out_arena, size_t chunk_size, enum memory_category category);
+void delete_arena(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+struct arena_mark get_arena_mark(struct arena const *arena);
+void release_arena(struct arena *arena, struct arena_mark mark);
+
+/*
+ * Transient arena for loading and generating assets. Only for use from
+ * the GL thread; callers take a mark and release back to it when done.
+ */
+struct arena *scratch_arena(void);
+
+/*
+ * Fixed-size blocks, each MEMORY_ALIGNMENT-aligned so that SIMD code can
+ * use aligned loads, carved out of larger chunks and recycled through a
+ * free list. Not thread-safe.
+ */
+struct memory_pool {
+    size_t block_size;
+    int blocks_per_chunk;
+    enum memory_category category;
+    void *chunks, *free_blocks;
+};
+
+void init_memory_pool(
+    struct memory_pool *out_pool,
+    size_t block_size, int blocks_per_chunk,
+    enum memory_category category
+);
+void delete_memory_pool(struct memory_pool *pool);
+void *pool_alloc(struct memory_pool *pool);
+void pool_free(struct memory_pool *pool, void *block);
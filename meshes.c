@@ -8,18 +8,88 @@
 #include <stddef.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include "geometry-heap.h"
+#include "memory.h"
+#include "gpu-resources.h"
 #include "meshes.h"
+#include "embedded-assets.h"
 #include "vec-util.h"
+#include "gl-capture.h"
 
+static int heap_alloc_mesh(
+    struct flag_mesh *out_mesh, struct geometry_heap *heap,
+    struct flag_vertex const *vertex_data, GLsizei vertex_count,
+    GLushort const *element_data, GLsizei element_count,
+    GLenum hint
+) {
+    struct geometry_arena *vertices = hint == GL_STATIC_DRAW
+        ? &heap->static_vertices : &heap->dynamic_vertices;
+    GLsizei
+        base_vertex = geometry_alloc(vertices, vertex_count),
+        first_element;
+
+    if (base_vertex == GEOMETRY_ALLOC_FAILED)
+        return 0;
+    first_element = geometry_alloc(&heap->elements, element_count);
+    if (first_element == GEOMETRY_ALLOC_FAILED) {
+        geometry_free(vertices, base_vertex, vertex_count);
+        return 0;
+    }
+
+    out_mesh->vertex_buffer = vertices->buffer;
+    out_mesh->element_buffer = heap->elements.buffer;
+    out_mesh->vertex_arena = vertices;
+    out_mesh->element_arena = &heap->elements;
+    out_mesh->base_vertex = base_vertex;
+    out_mesh->first_element = first_element;
+
+    glBindBuffer(GL_ARRAY_BUFFER, vertices->buffer);
+    glBufferSubData(
+        GL_ARRAY_BUFFER,
+        (GLintptr)base_vertex * sizeof(struct flag_vertex),
+        vertex_count * sizeof(struct flag_vertex),
+        vertex_data
+    );
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, heap->elements.buffer);
+    glBufferSubData(
+        GL_ELEMENT_ARRAY_BUFFER,
+        (GLintptr)first_element * sizeof(GLushort),
+        element_count * sizeof(GLushort),
+        element_data
+    );
+    return 1;
+}
+
+/*
+ * heap may be null, and a mesh that does not fit in the heap falls back
+ * to buffers of its own; either way it draws the same through draw_mesh.
+ */
 void init_mesh(
-    struct flag_mesh *out_mesh,
+    struct flag_mesh *out_mesh, struct geometry_heap *heap,
     struct flag_vertex const *vertex_data, GLsizei vertex_count,
     GLushort const *element_data, GLsizei element_count,
     GLenum hint
 ) {
+    out_mesh->vertex_count = vertex_count;
+    out_mesh->element_count = element_count;
+    out_mesh->deformed_buffer = 0;
+
+    if (heap && heap_alloc_mesh(
+            out_mesh, heap,
+            vertex_data, vertex_count,
+            element_data, element_count,
+            hint
+        ))
+        return;
+
+    out_mesh->base_vertex = 0;
+    out_mesh->first_element = 0;
+    out_mesh->vertex_arena = out_mesh->element_arena = NULL;
+
     glGenBuffers(1, &out_mesh->vertex_buffer);
     glGenBuffers(1, &out_mesh->element_buffer);
-    out_mesh->element_count = element_count;
 
     glBindBuffer(GL_ARRAY_BUFFER, out_mesh->vertex_buffer);
     glBufferData(
@@ -36,59 +106,84 @@ void init_mesh(
         element_data,
         GL_STATIC_DRAW
     );
+    track_gpu_resource(
+        GPU_BUFFER, out_mesh->vertex_buffer, vertex_count * sizeof(struct flag_vertex), "meshes"
+    );
+    track_gpu_resource(
+        GPU_BUFFER, out_mesh->element_buffer, element_count * sizeof(GLushort), "meshes"
+    );
 }
 
-static void calculate_flag_vertex(
-    struct flag_vertex *v,
-    GLfloat s, GLfloat t, GLfloat time
-) {
-    GLfloat
-        sgrad[3] = {
-            1.0f + 0.5f*(0.0625f+0.03125f*sinf((GLfloat)M_PI*time))*t*(t - 1.0f),
-            0.0f,
-            0.125f*(
-                sinf(1.5f*(GLfloat)M_PI*(time + s)) 
-                + s*cosf(1.5f*(GLfloat)M_PI*(time + s))*(1.5f*(GLfloat)M_PI)
-            )
-        },
-        tgrad[3] = {
-            -(0.0625f+0.03125f*sinf((GLfloat)M_PI*time))*(1.0f - s)*(2.0f*t - 1.0f),
-            0.75f,
-            0.0f
-        };
-
-    v->position[0] = s - (0.0625f+0.03125f*sinf((GLfloat)M_PI*time))*(1.0f - 0.5f*s)*t*(t-1.0f);
-    v->position[1] = 0.75f*t - 0.375f;
-    v->position[2] = 0.125f*(s*sinf(1.5f*(GLfloat)M_PI*(time + s)));
-    v->position[3] = 0.0f;
-
-    vec_cross(v->normal, tgrad, sgrad);
-    vec_normalize(v->normal);
-    v->normal[3] = 0.0f;
+void delete_mesh(struct flag_mesh *mesh)
+{
+    if (mesh->vertex_arena) {
+        geometry_free(mesh->vertex_arena, mesh->base_vertex, mesh->vertex_count);
+        geometry_free(mesh->element_arena, mesh->first_element, mesh->element_count);
+    } else {
+        glDeleteBuffers(1, &mesh->vertex_buffer);
+        glDeleteBuffers(1, &mesh->element_buffer);
+        untrack_gpu_resource(GPU_BUFFER, mesh->vertex_buffer);
+        untrack_gpu_resource(GPU_BUFFER, mesh->element_buffer);
+    }
+    mesh->vertex_buffer = mesh->element_buffer = 0;
+    mesh->vertex_arena = mesh->element_arena = NULL;
+}
+
+/*
+ * Draw with the mesh's buffers bound and attribute pointers set up
+ * relative to the start of its vertex buffer.
+ */
+void draw_mesh(struct flag_mesh const *mesh)
+{
+    void *first = (void*)((GLintptr)mesh->first_element * sizeof(GLushort));
+
+    if (mesh->base_vertex != 0)
+        glDrawElementsBaseVertex(
+            GL_TRIANGLES, mesh->element_count, GL_UNSIGNED_SHORT, first, mesh->base_vertex
+        );
+    else
+        glDrawElements(GL_TRIANGLES, mesh->element_count, GL_UNSIGNED_SHORT, first);
 }
 
-#define FLAG_X_RES 100
-#define FLAG_Y_RES 75
 #define FLAG_S_STEP (1.0f/((GLfloat)(FLAG_X_RES - 1)))
 #define FLAG_T_STEP (1.0f/((GLfloat)(FLAG_Y_RES - 1)))
 #define FLAG_VERTEX_COUNT (FLAG_X_RES * FLAG_Y_RES)
 
-struct flag_vertex *init_flag_mesh(struct flag_mesh *out_mesh)
+/*
+ * Flag vertex arrays are rewritten every frame and outlive any load, so
+ * they come from an aligned pool rather than the scratch arena.
+ */
+static struct memory_pool flag_vertex_pool;
+
+/*
+ * Generation only fills in memory from the arena and never touches GL,
+ * so it can run on a worker thread while the GL thread does other work.
+ */
+int generate_flag_mesh(struct mesh_data *out_data, struct arena *arena)
 {
-    struct flag_vertex *vertex_data
-        = (struct flag_vertex*) malloc(FLAG_VERTEX_COUNT * sizeof(struct flag_vertex));
     GLsizei element_count = 6 * (FLAG_X_RES - 1) * (FLAG_Y_RES - 1);
+    struct flag_vertex *vertex_data
+        = (struct flag_vertex*) arena_alloc(arena, FLAG_VERTEX_COUNT * sizeof(struct flag_vertex));
     GLushort *element_data
-        = (GLushort*) malloc(element_count * sizeof(GLushort));
+        = (GLushort*) arena_alloc(arena, element_count * sizeof(GLushort));
     GLsizei s, t, i;
     GLushort index;
 
+    if (!vertex_data || !element_data)
+        return 0;
+
     for (t = 0, i = 0; t < FLAG_Y_RES; ++t)
         for (s = 0; s < FLAG_X_RES; ++s, ++i) {
             GLfloat ss = FLAG_S_STEP * s, tt = FLAG_T_STEP * t;
 
-            calculate_flag_vertex(&vertex_data[i], ss, tt, 0.0f);
-
+            vertex_data[i].position[0] = FLAG_WIDTH * ss;
+            vertex_data[i].position[1] = FLAG_HEIGHT * (tt - 0.5f);
+            vertex_data[i].position[2] = 0.0f;
+            vertex_data[i].position[3] = 0.0f;
+            vertex_data[i].normal[0]   = 0.0f;
+            vertex_data[i].normal[1]   = 0.0f;
+            vertex_data[i].normal[2]   = -1.0f;
+            vertex_data[i].normal[3]   = 0.0f;
             vertex_data[i].texcoord[0] = ss;
             vertex_data[i].texcoord[1] = tt;
             vertex_data[i].shininess   = 0.0f;
@@ -108,14 +203,40 @@ struct flag_vertex *init_flag_mesh(struct flag_mesh *out_mesh)
             element_data[i++] = index+FLAG_X_RES  ;
         }
 
+    out_data->vertices = vertex_data;
+    out_data->elements = element_data;
+    out_data->vertex_count = FLAG_VERTEX_COUNT;
+    out_data->element_count = element_count;
+    return 1;
+}
+
+/*
+ * Returns the array that update_flag_mesh animates, a copy of the
+ * generated vertices.
+ */
+struct flag_vertex *init_flag_mesh(
+    struct flag_mesh *out_mesh, struct geometry_heap *heap,
+    struct mesh_data const *data
+) {
+    struct flag_vertex *vertex_data;
+
+    if (flag_vertex_pool.block_size == 0)
+        init_memory_pool(
+            &flag_vertex_pool,
+            FLAG_VERTEX_COUNT * sizeof(struct flag_vertex), 1,
+            MEMORY_MESH
+        );
+    vertex_data = (struct flag_vertex*) pool_alloc(&flag_vertex_pool);
+    if (!vertex_data)
+        return NULL;
+    memcpy(vertex_data, data->vertices, FLAG_VERTEX_COUNT * sizeof(struct flag_vertex));
+
     init_mesh(
-        out_mesh,
+        out_mesh, heap,
         vertex_data, FLAG_VERTEX_COUNT,
-        element_data, element_count,
+        data->elements, data->element_count,
         GL_STREAM_DRAW
     );
-
-    free((void*)element_data);
     return vertex_data;
 }
 
@@ -129,18 +250,21 @@ struct flag_vertex *init_flag_mesh(struct flag_mesh *out_mesh)
 #define FLAGPOLE_TRUCK_BOTTOM_RADIUS  0.015f
 #define FLAGPOLE_SHAFT_RADIUS         0.010f
 #define FLAGPOLE_SHININESS            4.0f
+#define WALL_HEIGHT                   3.0f
+
+static const GLfloat
+    GROUND_LO[3] = { -0.875f, FLAGPOLE_SHAFT_BOTTOM, -2.45f },
+    GROUND_HI[3] = {  1.875f, FLAGPOLE_SHAFT_BOTTOM,  0.20f };
 
-void init_background_mesh(struct flag_mesh *out_mesh)
+int generate_background_mesh(struct mesh_data *out_data, struct arena *arena)
 {
     static const GLsizei FLAGPOLE_RES = 16, FLAGPOLE_SLICE = 6;
     GLfloat FLAGPOLE_AXIS_XZ[2] = { -FLAGPOLE_SHAFT_RADIUS, 0.0f };
     static const GLubyte FLAGPOLE_SPECULAR[4] = { 255, 255, 192, 0 };
 
     GLfloat
-        GROUND_LO[3] = { -0.875f, FLAGPOLE_SHAFT_BOTTOM, -2.45f },
-        GROUND_HI[3] = {  1.875f, FLAGPOLE_SHAFT_BOTTOM,  0.20f },
-        WALL_LO[3] = { GROUND_LO[0], FLAGPOLE_SHAFT_BOTTOM, GROUND_HI[2] },
-        WALL_HI[3] = { GROUND_HI[0], FLAGPOLE_SHAFT_BOTTOM + 3.0f, GROUND_HI[2] };
+        WALL_LO[3] = { GROUND_LO[0], GROUND_LO[1], GROUND_HI[2] },
+        WALL_HI[3] = { GROUND_HI[0], GROUND_LO[1] + WALL_HEIGHT, GROUND_HI[2] };
 
     static GLfloat
         TEX_FLAGPOLE_LO[2] = { 0.0f,    0.0f },
@@ -186,10 +310,13 @@ void init_background_mesh(struct flag_mesh *out_mesh)
             + ground_element_count;
 
     struct flag_vertex *vertex_data
-        = (struct flag_vertex*) malloc(vertex_count * sizeof(struct flag_vertex));
+        = (struct flag_vertex*) arena_alloc(arena, vertex_count * sizeof(struct flag_vertex));
 
     GLushort *element_data
-        = (GLushort*) malloc(element_count * sizeof(GLushort));
+        = (GLushort*) arena_alloc(arena, element_count * sizeof(GLushort));
+
+    if (!vertex_data || !element_data)
+        return 0;
 
     vertex_data[0].position[0] = GROUND_LO[0];
     vertex_data[0].position[1] = GROUND_LO[1];
@@ -561,36 +688,73 @@ void init_background_mesh(struct flag_mesh *out_mesh)
     element_data[element_i++] = vertex_i;
     element_data[element_i++] = 9 + 5;
 
+    out_data->vertices = vertex_data;
+    out_data->elements = element_data;
+    out_data->vertex_count = vertex_count;
+    out_data->element_count = element_count;
+    return 1;
+}
+
+/*
+ * Uses the baked copy of the background when the executable embeds one,
+ * and only falls back to generating it otherwise.
+ */
+int load_background_mesh(struct mesh_data *out_data, struct arena *arena)
+{
+    struct embedded_asset const
+        *vertices = find_embedded_asset(BACKGROUND_VERTICES_ASSET),
+        *elements = find_embedded_asset(BACKGROUND_ELEMENTS_ASSET);
+
+    if (!vertices || !elements)
+        return generate_background_mesh(out_data, arena);
+
+    out_data->vertices = (struct flag_vertex*)vertices->data;
+    out_data->elements = (GLushort*)elements->data;
+    out_data->vertex_count = (GLsizei)(vertices->size / sizeof(struct flag_vertex));
+    out_data->element_count = (GLsizei)(elements->size / sizeof(GLushort));
+    return 1;
+}
+
+void init_background_mesh(
+    struct flag_mesh *out_mesh, struct geometry_heap *heap,
+    struct mesh_data const *data
+) {
     init_mesh(
-        out_mesh,
-        vertex_data, vertex_count,
-        element_data, element_count,
+        out_mesh, heap,
+        data->vertices, data->vertex_count,
+        data->elements, data->element_count,
         GL_STATIC_DRAW
     );
+}
 
-    free(element_data);
-    free(vertex_data);
+/*
+ * The ground and wall enclose the flagpole and the flag's whole range of
+ * motion, so their extent bounds the entire scene.
+ */
+void background_mesh_bounds(GLfloat *out_lo, GLfloat *out_hi)
+{
+    out_lo[0] = GROUND_LO[0]; out_lo[1] = GROUND_LO[1];               out_lo[2] = GROUND_LO[2];
+    out_hi[0] = GROUND_HI[0]; out_hi[1] = GROUND_LO[1] + WALL_HEIGHT; out_hi[2] = GROUND_HI[2];
 }
 
 void update_flag_mesh(
     struct flag_mesh const *mesh,
-    struct flag_vertex *vertex_data,
-    GLfloat time
+    struct flag_vertex const *vertex_data
 ) {
-    GLsizei s, t, i;
-    for (t = 0, i = 0; t < FLAG_Y_RES; ++t)
-        for (s = 0; s < FLAG_X_RES; ++s, ++i) {
-            GLfloat ss = FLAG_S_STEP * s, tt = FLAG_T_STEP * t;
-
-            calculate_flag_vertex(&vertex_data[i], ss, tt, time);
-        }
-
     glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        FLAG_VERTEX_COUNT * sizeof(struct flag_vertex),
-        vertex_data,
-        GL_STREAM_DRAW
-    );
+    if (mesh->vertex_arena)
+        glBufferSubData(
+            GL_ARRAY_BUFFER,
+            (GLintptr)mesh->base_vertex * sizeof(struct flag_vertex),
+            FLAG_VERTEX_COUNT * sizeof(struct flag_vertex),
+            vertex_data
+        );
+    else
+        glBufferData(
+            GL_ARRAY_BUFFER,
+            FLAG_VERTEX_COUNT * sizeof(struct flag_vertex),
+            vertex_data,
+            GL_STREAM_DRAW
+        );
 }
 
@@ -1,10 +1,32 @@
 
+/*
+ * A mesh either owns its buffers, or has its vertices and elements
+ * sub-allocated from the arenas of a geometry heap, in which case
+ * base_vertex and first_element locate it within the shared buffers.
+ *
+ * If deformed_buffer is nonzero, the mesh's positions and normals are
+ * read from it as struct deformed_vertex instead of from vertex_buffer.
+ * It is written on the GPU, and is only used with a mesh that owns its
+ * buffers.
+ */
 struct flag_mesh {
-    GLuint vertex_buffer, element_buffer;
-    GLsizei element_count;
+    GLuint vertex_buffer, element_buffer, deformed_buffer;
+    GLsizei vertex_count, element_count;
+    GLint base_vertex;
+    GLsizei first_element;
+    struct geometry_arena *vertex_arena, *element_arena;
     GLuint texture;
 };
 
+/*
+ * The flag is a grid of FLAG_X_RES by FLAG_Y_RES vertices, generated
+ * flat and then moved by the cloth simulation.
+ */
+#define FLAG_X_RES  100
+#define FLAG_Y_RES  75
+#define FLAG_WIDTH  1.0f
+#define FLAG_HEIGHT 0.75f
+
 struct flag_vertex {
     GLfloat position[4];
     GLfloat normal[4];
@@ -13,16 +35,39 @@ struct flag_vertex {
     GLubyte specular[4];
 };
 
+struct deformed_vertex {
+    GLfloat position[4];
+    GLfloat normal[4];
+};
+
+/* Generated geometry, ready to upload with init_mesh. */
+struct mesh_data {
+    struct flag_vertex *vertices;
+    GLushort *elements;
+    GLsizei vertex_count, element_count;
+};
+
 void init_mesh(
-    struct flag_mesh *out_mesh,
+    struct flag_mesh *out_mesh, struct geometry_heap *heap,
     struct flag_vertex const *vertex_data, GLsizei vertex_count,
     GLushort const *element_data, GLsizei element_count,
     GLenum hint
 );
-struct flag_vertex *init_flag_mesh(struct flag_mesh *out_mesh);
-void init_background_mesh(struct flag_mesh *out_mesh);
+void delete_mesh(struct flag_mesh *mesh);
+void draw_mesh(struct flag_mesh const *mesh);
+int generate_flag_mesh(struct mesh_data *out_data, struct arena *arena);
+int generate_background_mesh(struct mesh_data *out_data, struct arena *arena);
+int load_background_mesh(struct mesh_data *out_data, struct arena *arena);
+struct flag_vertex *init_flag_mesh(
+    struct flag_mesh *out_mesh, struct geometry_heap *heap,
+    struct mesh_data const *data
+);
+void init_background_mesh(
+    struct flag_mesh *out_mesh, struct geometry_heap *heap,
+    struct mesh_data const *data
+);
+void background_mesh_bounds(GLfloat *out_lo, GLfloat *out_hi);
 void update_flag_mesh(
     struct flag_mesh const *mesh,
-    struct flag_vertex *vertex_data,
-    GLfloat time
+    struct flag_vertex const *vertex_data
 );
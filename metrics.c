@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "thread-util.h"
+#include "metrics.h"
+
+/* upper bounds of all but the last bucket, in seconds */
+static const double BUCKET_BOUNDS[METRICS_BUCKETS - 1] = {
+    0.001, 0.002, 0.004, 0.008, 0.0125, 0.0167, 0.025, 0.05, 0.1
+};
+
+static struct {
+    struct thread thread;
+    struct mutex mutex;
+    int listen_fd, wake_fds[2];
+
+    /*
+     * guarded by mutex; the render thread is the only writer, so it alone
+     * may read running without the lock
+     */
+    int running;
+
+    /* owned by the render thread */
+    struct metrics local;
+
+    /* written only by the render thread; sequence is odd while it writes */
+    unsigned volatile sequence;
+    struct metrics published;
+} g_metrics;
+
+static void add_sample(struct metrics_histogram *histogram, double seconds)
+{
+    int i;
+
+    for (i = 0; i < METRICS_BUCKETS - 1 && seconds > BUCKET_BOUNDS[i]; ++i)
+        ;
+    ++histogram->buckets[i];
+    ++histogram->count;
+    histogram->sum += seconds;
+}
+
+static void publish(void)
+{
+    ++g_metrics.sequence;
+    memory_fence();
+    g_metrics.published = g_metrics.local;
+    memory_fence();
+    ++g_metrics.sequence;
+}
+
+int metrics_server_running(void)
+{
+    return g_metrics.running;
+}
+
+void record_frame_metrics(struct frame_metrics const *frame)
+{
+    if (!g_metrics.running)
+        return;
+    ++g_metrics.local.frames;
+    g_metrics.local.draw_calls += (unsigned long)frame->draw_calls;
+    g_metrics.local.upload_bytes += frame->upload_bytes;
+    add_sample(&g_metrics.local.frame_seconds, frame->frame_seconds);
+    add_sample(&g_metrics.local.update_seconds, frame->update_seconds);
+    publish();
+}
+
+void record_gpu_seconds(double seconds)
+{
+    if (g_metrics.running)
+        add_sample(&g_metrics.local.gpu_seconds, seconds);
+}
+
+void record_shader_reload(void)
+{
+    if (g_metrics.running)
+        ++g_metrics.local.shader_reloads;
+}
+
+void record_gpu_memory(double texture_bytes, double total_bytes, int objects)
+{
+    if (!g_metrics.running)
+        return;
+    g_metrics.local.texture_bytes = texture_bytes;
+    g_metrics.local.gpu_bytes = total_bytes;
+    g_metrics.local.gpu_objects = (unsigned long)objects;
+}
+
+#ifdef _WIN32
+
+int start_metrics_server(const char *address)
+{
+    fprintf(stderr, "The metrics server is not supported on this platform\n");
+    return 0;
+}
+
+void stop_metrics_server(void) { }
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "socket-util.h"
+
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL 0
+#endif
+
+#define METRICS_RESPONSE_SIZE   16384
+#define METRICS_REQUEST_SIZE    4096
+#define METRICS_TIMEOUT_SECONDS 1
+
+struct text {
+    char *data;
+    size_t size, used;
+};
+
+static void append(struct text *text, const char *format, ...)
+{
+    va_list args;
+    int written;
+
+    va_start(args, format);
+    written = vsnprintf(text->data + text->used, text->size - text->used, format, args);
+    va_end(args);
+    if (written > 0)
+        text->used += (size_t)written < text->size - text->used
+            ? (size_t)written : text->size - text->used - 1;
+}
+
+static void append_metric(
+    struct text *text, const char *name, const char *type, const char *help, double value
+) {
+    append(text, "# HELP flag_%s %s\n# TYPE flag_%s %s\nflag_%s %.17g\n",
+        name, help, name, type, name, value);
+}
+
+static void append_histogram(
+    struct text *text, const char *name, const char *help,
+    struct metrics_histogram const *histogram
+) {
+    unsigned long total = 0;
+    int i;
+
+    append(text, "# HELP flag_%s %s\n# TYPE flag_%s histogram\n", name, help, name);
+    for (i = 0; i < METRICS_BUCKETS; ++i) {
+        total += histogram->buckets[i];
+        if (i < METRICS_BUCKETS - 1)
+            append(text, "flag_%s_bucket{le=\"%g\"} %lu\n", name, BUCKET_BOUNDS[i], total);
+        else
+            append(text, "flag_%s_bucket{le=\"+Inf\"} %lu\n", name, total);
+    }
+    append(text, "flag_%s_sum %.17g\nflag_%s_count %lu\n", name, histogram->sum, name, histogram->count);
+}
+
+/*
+ * Copies the published metrics, trying again if the render thread
+ * published a frame partway through. Publishing is a single struct copy,
+ * so a retry is rare and short.
+ */
+static void read_published(struct metrics *out_metrics)
+{
+    for (;;) {
+        unsigned before = g_metrics.sequence;
+
+        memory_fence();
+        if (before & 1)
+            continue;
+        *out_metrics = g_metrics.published;
+        memory_fence();
+        if (g_metrics.sequence == before)
+            return;
+    }
+}
+
+static void format_metrics(struct text *text)
+{
+    struct metrics metrics;
+
+    read_published(&metrics);
+    append_metric(text, "frames_total", "counter",
+        "Frames presented.", (double)metrics.frames);
+    append_histogram(text, "frame_seconds",
+        "CPU time from the start of a frame until it was presented.", &metrics.frame_seconds);
+    append_histogram(text, "update_seconds",
+        "CPU time animating the flag and crowd, including their vertex uploads.",
+        &metrics.update_seconds);
+    append_histogram(text, "gpu_seconds",
+        "GPU time drawing each window, from timer queries.", &metrics.gpu_seconds);
+    append_metric(text, "upload_bytes_total", "counter",
+        "Bytes of vertex, instance and light data uploaded to the GPU.", metrics.upload_bytes);
+    append_metric(text, "draw_calls_total", "counter",
+        "Draw calls issued.", (double)metrics.draw_calls);
+    append_metric(text, "shader_reloads_total", "counter",
+        "Successful shader reloads.", (double)metrics.shader_reloads);
+    append_metric(text, "texture_memory_bytes", "gauge",
+        "Estimated memory held by textures.", metrics.texture_bytes);
+    append_metric(text, "gpu_memory_bytes", "gauge",
+        "Estimated memory held by all GL objects.", metrics.gpu_bytes);
+    append_metric(text, "gpu_objects", "gauge",
+        "Live GL objects.", (double)metrics.gpu_objects);
+}
+
+static int send_all(int fd, char const *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t wrote = send(fd, data, size, MSG_NOSIGNAL);
+        if (wrote < 0 && errno == EINTR)
+            continue;
+        if (wrote <= 0)
+            return 0;
+        data += wrote;
+        size -= (size_t)wrote;
+    }
+    return 1;
+}
+
+/*
+ * Every request gets the metrics, whatever its path. Clients are served
+ * one at a time with a timeout, which is plenty for a scraper.
+ */
+static void serve_client(int fd, char *request, struct text *body)
+{
+    struct timeval timeout = { METRICS_TIMEOUT_SECONDS, 0 };
+    char header[128];
+    size_t received = 0;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+    {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+
+    while (received < METRICS_REQUEST_SIZE - 1) {
+        ssize_t got = recv(fd, request + received, METRICS_REQUEST_SIZE - 1 - received, 0);
+        if (got <= 0)
+            return;
+        received += (size_t)got;
+        request[received] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+
+    body->used = 0;
+    body->data[0] = '\0';
+    format_metrics(body);
+    snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %lu\r\n"
+        "Connection: close\r\n\r\n",
+        (unsigned long)body->used);
+    if (send_all(fd, header, strlen(header)))
+        send_all(fd, body->data, body->used);
+}
+
+static int server_running(void)
+{
+    int running;
+
+    lock_mutex(&g_metrics.mutex);
+    running = g_metrics.running;
+    unlock_mutex(&g_metrics.mutex);
+    return running;
+}
+
+static void serve(void *data)
+{
+    struct text body;
+    char *request = malloc(METRICS_REQUEST_SIZE);
+
+    body.size = METRICS_RESPONSE_SIZE;
+    body.used = 0;
+    body.data = malloc(body.size);
+    if (!request || !body.data) {
+        fprintf(stderr, "Unable to allocate metrics buffers\n");
+        free(request);
+        free(body.data);
+        return;
+    }
+
+    while (server_running()) {
+        struct pollfd fds[2];
+
+        fds[0].fd = g_metrics.wake_fds[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = g_metrics.listen_fd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+            break;
+        if (fds[1].revents & POLLIN) {
+            int fd = accept(g_metrics.listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                serve_client(fd, request, &body);
+                close(fd);
+            }
+        }
+    }
+    free(request);
+    free(body.data);
+}
+
+/* Must be called before the first frame is recorded. */
+int start_metrics_server(const char *address)
+{
+    memset(&g_metrics, 0, sizeof(g_metrics));
+
+    g_metrics.listen_fd = open_listen_socket(address);
+    if (g_metrics.listen_fd < 0)
+        return 0;
+
+    if (pipe(g_metrics.wake_fds) < 0) {
+        perror("pipe");
+        close(g_metrics.listen_fd);
+        return 0;
+    }
+
+    init_mutex(&g_metrics.mutex);
+    g_metrics.running = 1;
+    if (!start_thread(&g_metrics.thread, &serve, NULL)) {
+        g_metrics.running = 0;
+        destroy_mutex(&g_metrics.mutex);
+        close(g_metrics.listen_fd);
+        close(g_metrics.wake_fds[0]);
+        close(g_metrics.wake_fds[1]);
+        return 0;
+    }
+    printf("serving metrics on %s\n", address);
+    return 1;
+}
+
+void stop_metrics_server(void)
+{
+    if (!g_metrics.running)
+        return;
+    lock_mutex(&g_metrics.mutex);
+    g_metrics.running = 0;
+    unlock_mutex(&g_metrics.mutex);
+    if (write(g_metrics.wake_fds[1], "", 1) < 0)
+        perror("write");
+    join_thread(&g_metrics.thread);
+
+    close(g_metrics.listen_fd);
+    close(g_metrics.wake_fds[0]);
+    close(g_metrics.wake_fds[1]);
+    destroy_mutex(&g_metrics.mutex);
+}
+
+#endif
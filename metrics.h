@@ -0,0 +1,46 @@
+#define METRICS_BUCKETS 10
+
+/*
+ * Counts of seconds falling at or under each of METRICS_BUCKETS upper
+ * bounds, the last of which is infinite; cumulative when reported.
+ */
+struct metrics_histogram {
+    double sum;
+    unsigned long count;
+    unsigned long buckets[METRICS_BUCKETS];
+};
+
+/*
+ * Everything reported to a scrape. The render thread owns one copy and
+ * publishes it once a frame.
+ */
+struct metrics {
+    unsigned long frames, draw_calls, shader_reloads, gpu_objects;
+    double upload_bytes, texture_bytes, gpu_bytes;
+    struct metrics_histogram frame_seconds, update_seconds, gpu_seconds;
+};
+
+/* One frame's measurements from the render thread. */
+struct frame_metrics {
+    double frame_seconds, update_seconds, upload_bytes;
+    int draw_calls;
+};
+
+/*
+ * Serves the metrics over HTTP in the Prometheus text format, for any
+ * path, on a unix socket path or [host]:port as for --stream.
+ */
+int start_metrics_server(const char *address);
+void stop_metrics_server(void);
+int metrics_server_running(void);
+
+/*
+ * Render thread only. These never block or take a lock: the server
+ * thread copies the published metrics under a sequence count and retries
+ * if a frame was published while it copied. gpu time and GPU memory are
+ * published with the next frame.
+ */
+void record_frame_metrics(struct frame_metrics const *frame);
+void record_gpu_seconds(double seconds);
+void record_shader_reload(void);
+void record_gpu_memory(double texture_bytes, double total_bytes, int objects);
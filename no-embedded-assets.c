@@ -0,0 +1,5 @@
+#include <stddef.h>
+#include "embedded-assets.h"
+
+const struct embedded_asset *const embedded_assets = NULL;
+const int embedded_asset_count = 0;
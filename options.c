@@ -0,0 +1,334 @@
+#include <GL/glew.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "gl-util.h"
+#include "antialias.h"
+#include "options.h"
+
+void default_options(struct flag_options *out_options)
+{
+    out_options->resolution_scale = 1.0f;
+    out_options->auto_resolution = 0;
+    out_options->target_frame_ms = 1000.0f/30.0f;
+    out_options->fps_cap = -1.0f;
+    out_options->vsync = 1;
+    out_options->wall_size[0] = out_options->wall_size[1] = 1;
+    out_options->wall_viewports = 0;
+    out_options->export_path = NULL;
+    out_options->export_start = 0.0f;
+    out_options->export_fps = 30.0f;
+    out_options->export_frames = 0;
+    out_options->export_jobs = 1;
+    out_options->export_size[0] = 640;
+    out_options->export_size[1] = 480;
+    out_options->stream_address = NULL;
+    out_options->metrics_address = NULL;
+    out_options->capture_path = NULL;
+    out_options->capture_frames = 300;
+    out_options->scene_path = NULL;
+    out_options->virtual_texture_path = NULL;
+    out_options->light_count = 0;
+    out_options->shadow_size = 1024;
+    out_options->cpu_vertices = 0;
+    out_options->software = 0;
+    out_options->crowd_size = 0;
+    out_options->turbulence = 0.5f;
+    out_options->antialias = ANTIALIAS_OFF;
+    out_options->msaa_samples = DEFAULT_MSAA_SAMPLES;
+    out_options->worker_threads = 0;
+    out_options->memory_budget = 0;
+    out_options->gpu_budget = 0;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+        "usage: %s [GLUT options] [options]\n"
+        "  --scale <factor>      render at <factor> times the window resolution\n"
+        "  --auto-scale          adjust the resolution scale to meet the target frame time\n"
+        "  --target-ms <ms>      target frame time for --auto-scale (default 33.3)\n"
+        "  --fps <rate>          cap the frame rate; 0 for no cap (default 60 without vsync)\n"
+        "  --no-vsync            do not synchronize buffer swaps to the display refresh\n"
+        "  --wall <cols>x<rows>  split the view across a grid of windows\n"
+        "  --wall-viewports      draw the --wall grid as viewports of a single window\n"
+        "  --export <path>       render frames offline instead of opening a window; <path>\n"
+        "                        is a printf pattern for numbered tga images such as\n"
+        "                        frame%%04d.tga, or a .y4m file (- for a y4m stream on stdout)\n"
+        "  --export-start <s>    animation time of the first exported frame (default 0)\n"
+        "  --export-frames <n>   number of frames to export; required with --export\n"
+        "  --export-fps <rate>   exported frame rate (default 30)\n"
+        "  --export-size <w>x<h> exported frame size (default 640x480)\n"
+        "  --export-jobs <n>     number of worker processes to split the export across\n"
+        "  --stream <address>    serve raw frames on a unix socket path or [host]:port\n"
+        "  --metrics <address>   serve Prometheus metrics over HTTP on a unix socket path\n"
+        "                        or [host]:port\n"
+        "  --capture <path>      record every GL call from startup to <path> for\n"
+        "                        replay-capture\n"
+        "  --capture-frames <n>  number of frames to capture (default 300)\n"
+        "  --scene <path>        draw a scene file from make-scene instead of the background\n"
+        "  --virtual-texture <path>\n"
+        "                        draw the flag from a tile file from make-tiles, loading\n"
+        "                        only the tiles in view\n"
+        "  --lights <n>          add n animated point and spot lights\n"
+        "  --shadow-size <n>     shadow map resolution; 0 disables shadows (default 1024)\n"
+        "  --cpu-vertices        write the flag's vertices on the CPU even if the GPU can\n"
+        "  --software            rasterize the flag and background on the CPU and only\n"
+        "                        use GL to present them\n"
+        "  --crowd <n>           surround the flag with n more on stands, in place of the\n"
+        "                        background\n"
+        "  --turbulence <n>      strength of the gusts a drifting wind field adds to the\n"
+        "                        steady wind; 0 for a uniform wind (default 0.5)\n"
+        "  --aa <mode>           anti-aliasing: off, fxaa or msaa (default off); f cycles\n"
+        "                        through them while running\n"
+        "  --msaa-samples <n>    samples a pixel for --aa msaa (default 4)\n"
+        "  --threads <n>         worker threads for scene recording, cloth simulation and\n"
+        "                        crowd updates (default one per processor)\n"
+        "  --memory-budget <MiB> fail allocations beyond this much tracked memory\n"
+        "  --gpu-budget <MiB>    reduce textures, shadows and render targets to keep GL\n"
+        "                        objects within this much memory\n",
+        program
+    );
+}
+
+static int option_size(char **argv, int argc, int *i, int *out_size)
+{
+    char trailing;
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "%s requires an argument\n", argv[*i]);
+        return 0;
+    }
+    if (sscanf(argv[*i + 1], "%dx%d%c", &out_size[0], &out_size[1], &trailing) != 2
+        || out_size[0] < 1 || out_size[1] < 1) {
+        fprintf(stderr, "%s: invalid size %s\n", argv[*i], argv[*i + 1]);
+        return 0;
+    }
+    ++*i;
+    return 1;
+}
+
+static int option_int(char **argv, int argc, int *i, int *out_value)
+{
+    char *end;
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "%s requires an argument\n", argv[*i]);
+        return 0;
+    }
+    *out_value = (int)strtol(argv[*i + 1], &end, 10);
+    if (*end != '\0') {
+        fprintf(stderr, "%s: invalid integer %s\n", argv[*i], argv[*i + 1]);
+        return 0;
+    }
+    ++*i;
+    return 1;
+}
+
+static int option_float(char **argv, int argc, int *i, GLfloat *out_value)
+{
+    char *end;
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "%s requires an argument\n", argv[*i]);
+        return 0;
+    }
+    *out_value = (GLfloat)strtod(argv[*i + 1], &end);
+    if (*end != '\0') {
+        fprintf(stderr, "%s: invalid number %s\n", argv[*i], argv[*i + 1]);
+        return 0;
+    }
+    ++*i;
+    return 1;
+}
+
+/*
+ * Consume the options we understand from argv, leaving everything else
+ * (such as -display or -geometry) in place for glutInit.
+ */
+int parse_options(int *argc, char **argv, struct flag_options *out_options)
+{
+    int i, out_i;
+
+    for (i = 1, out_i = 1; i < *argc; ++i) {
+        if (strcmp(argv[i], "--scale") == 0) {
+            if (!option_float(argv, *argc, &i, &out_options->resolution_scale))
+                return 0;
+            if (out_options->resolution_scale <= 0.0f) {
+                fprintf(stderr, "--scale must be positive\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--auto-scale") == 0) {
+            out_options->auto_resolution = 1;
+        } else if (strcmp(argv[i], "--target-ms") == 0) {
+            if (!option_float(argv, *argc, &i, &out_options->target_frame_ms))
+                return 0;
+            if (out_options->target_frame_ms <= 0.0f) {
+                fprintf(stderr, "--target-ms must be positive\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--fps") == 0) {
+            if (!option_float(argv, *argc, &i, &out_options->fps_cap))
+                return 0;
+            if (out_options->fps_cap < 0.0f) {
+                fprintf(stderr, "--fps must not be negative\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--no-vsync") == 0) {
+            out_options->vsync = 0;
+        } else if (strcmp(argv[i], "--wall") == 0) {
+            if (!option_size(argv, *argc, &i, out_options->wall_size))
+                return 0;
+        } else if (strcmp(argv[i], "--wall-viewports") == 0) {
+            out_options->wall_viewports = 1;
+        } else if (strcmp(argv[i], "--export") == 0) {
+            if (i + 1 >= *argc) {
+                fprintf(stderr, "--export requires an argument\n");
+                return 0;
+            }
+            out_options->export_path = argv[++i];
+        } else if (strcmp(argv[i], "--export-start") == 0) {
+            if (!option_float(argv, *argc, &i, &out_options->export_start))
+                return 0;
+        } else if (strcmp(argv[i], "--export-frames") == 0) {
+            if (!option_int(argv, *argc, &i, &out_options->export_frames))
+                return 0;
+            if (out_options->export_frames < 1) {
+                fprintf(stderr, "--export-frames must be at least 1\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--export-fps") == 0) {
+            if (!option_float(argv, *argc, &i, &out_options->export_fps))
+                return 0;
+            if (out_options->export_fps <= 0.0f) {
+                fprintf(stderr, "--export-fps must be positive\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--export-size") == 0) {
+            if (!option_size(argv, *argc, &i, out_options->export_size))
+                return 0;
+        } else if (strcmp(argv[i], "--export-jobs") == 0) {
+            if (!option_int(argv, *argc, &i, &out_options->export_jobs))
+                return 0;
+            if (out_options->export_jobs < 1) {
+                fprintf(stderr, "--export-jobs must be at least 1\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            if (i + 1 >= *argc) {
+                fprintf(stderr, "--stream requires an argument\n");
+                return 0;
+            }
+            out_options->stream_address = argv[++i];
+        } else if (strcmp(argv[i], "--metrics") == 0) {
+            if (i + 1 >= *argc) {
+                fprintf(stderr, "--metrics requires an argument\n");
+                return 0;
+            }
+            out_options->metrics_address = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0) {
+            if (i + 1 >= *argc) {
+                fprintf(stderr, "--capture requires an argument\n");
+                return 0;
+            }
+            out_options->capture_path = argv[++i];
+        } else if (strcmp(argv[i], "--capture-frames") == 0) {
+            if (!option_int(argv, *argc, &i, &out_options->capture_frames))
+                return 0;
+            if (out_options->capture_frames < 1) {
+                fprintf(stderr, "--capture-frames must be at least 1\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--scene") == 0) {
+            if (i + 1 >= *argc) {
+                fprintf(stderr, "--scene requires an argument\n");
+                return 0;
+            }
+            out_options->scene_path = argv[++i];
+        } else if (strcmp(argv[i], "--virtual-texture") == 0) {
+            if (i + 1 >= *argc) {
+                fprintf(stderr, "--virtual-texture requires an argument\n");
+                return 0;
+            }
+            out_options->virtual_texture_path = argv[++i];
+        } else if (strcmp(argv[i], "--lights") == 0) {
+            if (!option_int(argv, *argc, &i, &out_options->light_count))
+                return 0;
+            if (out_options->light_count < 0)
+                out_options->light_count = 0;
+        } else if (strcmp(argv[i], "--shadow-size") == 0) {
+            if (!option_int(argv, *argc, &i, &out_options->shadow_size))
+                return 0;
+            if (out_options->shadow_size < 0) {
+                fprintf(stderr, "--shadow-size must not be negative\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--cpu-vertices") == 0) {
+            out_options->cpu_vertices = 1;
+        } else if (strcmp(argv[i], "--software") == 0) {
+            out_options->software = 1;
+        } else if (strcmp(argv[i], "--crowd") == 0) {
+            if (!option_int(argv, *argc, &i, &out_options->crowd_size))
+                return 0;
+            if (out_options->crowd_size < 0)
+                out_options->crowd_size = 0;
+        } else if (strcmp(argv[i], "--turbulence") == 0) {
+            if (!option_float(argv, *argc, &i, &out_options->turbulence))
+                return 0;
+            if (out_options->turbulence < 0.0f) {
+                fprintf(stderr, "--turbulence must not be negative\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--aa") == 0) {
+            if (i + 1 >= *argc) {
+                fprintf(stderr, "--aa requires an argument\n");
+                return 0;
+            }
+            out_options->antialias = parse_antialias_mode(argv[++i]);
+            if (out_options->antialias == ANTIALIAS_MODE_COUNT) {
+                fprintf(stderr, "--aa: unknown mode %s\n", argv[i]);
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--msaa-samples") == 0) {
+            if (!option_int(argv, *argc, &i, &out_options->msaa_samples))
+                return 0;
+            if (out_options->msaa_samples < 2) {
+                fprintf(stderr, "--msaa-samples must be at least 2\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            if (!option_int(argv, *argc, &i, &out_options->worker_threads))
+                return 0;
+            if (out_options->worker_threads < 1) {
+                fprintf(stderr, "--threads must be at least 1\n");
+                return 0;
+            }
+        } else if (strcmp(argv[i], "--memory-budget") == 0) {
+            int megabytes;
+            if (!option_int(argv, *argc, &i, &megabytes))
+                return 0;
+            if (megabytes < 1) {
+                fprintf(stderr, "--memory-budget must be at least 1\n");
+                return 0;
+            }
+            out_options->memory_budget = (size_t)megabytes * 1024 * 1024;
+        } else if (strcmp(argv[i], "--gpu-budget") == 0) {
+            int megabytes;
+            if (!option_int(argv, *argc, &i, &megabytes))
+                return 0;
+            if (megabytes < 1) {
+                fprintf(stderr, "--gpu-budget must be at least 1\n");
+                return 0;
+            }
+            out_options->gpu_budget = (size_t)megabytes * 1024 * 1024;
+        } else if (strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            usage(argv[0]);
+            return 0;
+        } else
+            argv[out_i++] = argv[i];
+    }
+    argv[out_i] = NULL;
+    *argc = out_i;
+    return 1;
+}
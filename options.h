@@ -0,0 +1,39 @@
+struct flag_options {
+    GLfloat resolution_scale;
+    int auto_resolution;
+    GLfloat target_frame_ms;
+
+    GLfloat fps_cap;
+    int vsync;
+
+    int wall_size[2];
+    int wall_viewports;
+
+    const char *export_path;
+    GLfloat export_start, export_fps;
+    int export_frames, export_jobs;
+    int export_size[2];
+
+    const char *stream_address;
+    const char *metrics_address;
+    const char *capture_path;
+    int capture_frames;
+    const char *scene_path;
+    const char *virtual_texture_path;
+
+    int light_count;
+    int shadow_size;
+    int cpu_vertices, software;
+    int crowd_size;
+    GLfloat turbulence;
+
+    int antialias;      /* an enum antialias_mode */
+    int msaa_samples;
+
+    int worker_threads;
+
+    size_t memory_budget, gpu_budget;
+};
+
+void default_options(struct flag_options *out_options);
+int parse_options(int *argc, char **argv, struct flag_options *out_options);
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stdio.h>
+#include "gpu-resources.h"
+#include "readback.h"
+#include "gl-capture.h"
+
+/*
+ * Without pixel buffer objects we fall back to reading synchronously into
+ * client memory, which is correct but stalls until the frame is drawn.
+ */
+static int pixel_buffers_supported(void)
+{
+    return GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object;
+}
+
+int make_readback_ring(struct readback_ring *out_ring, int depth, GLsizei width, GLsizei height)
+{
+    GLsizeiptr bytes = (GLsizeiptr)width * height * 4;
+    int i;
+
+    if (depth < 1) depth = 1;
+    if (depth > MAX_READBACK_DEPTH) depth = MAX_READBACK_DEPTH;
+
+    out_ring->depth = depth;
+    out_ring->head = out_ring->count = 0;
+    out_ring->size[0] = width;
+    out_ring->size[1] = height;
+    out_ring->fallback_pixels = NULL;
+
+    if (!pixel_buffers_supported()) {
+        out_ring->depth = 1;
+        out_ring->fallback_pixels = malloc(bytes);
+        return out_ring->fallback_pixels != NULL;
+    }
+
+    glGenBuffers(depth, out_ring->buffers);
+    for (i = 0; i < depth; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, out_ring->buffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+        track_gpu_resource(GPU_BUFFER, out_ring->buffers[i], (size_t)bytes, "readback");
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return 1;
+}
+
+void delete_readback_ring(struct readback_ring *ring)
+{
+    int i;
+
+    if (ring->fallback_pixels)
+        free(ring->fallback_pixels);
+    else {
+        glDeleteBuffers(ring->depth, ring->buffers);
+        for (i = 0; i < ring->depth; ++i)
+            untrack_gpu_resource(GPU_BUFFER, ring->buffers[i]);
+    }
+    ring->fallback_pixels = NULL;
+    ring->depth = ring->count = 0;
+}
+
+static void readback_pop(struct readback_ring *ring, readback_consumer consumer, void *data)
+{
+    int tail = (ring->head + ring->depth - ring->count) % ring->depth;
+    void *pixels;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ring->buffers[tail]);
+    pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    if (pixels) {
+        consumer(
+            pixels, ring->frame_sizes[tail][0], ring->frame_sizes[tail][1],
+            ring->frames[tail], data
+        );
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else
+        fprintf(stderr, "Unable to map readback buffer for frame %d\n", ring->frames[tail]);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    --ring->count;
+}
+
+/*
+ * Read the current read framebuffer into the ring as the given frame
+ * number. If the ring is full, the oldest frame is handed to the consumer
+ * first to make room.
+ */
+void readback_push(
+    struct readback_ring *ring, int frame,
+    readback_consumer consumer, void *data
+) {
+    readback_push_region(ring, frame, ring->size[0], ring->size[1], consumer, data);
+}
+
+/*
+ * Like readback_push, but reads only the lower-left width by height
+ * corner, which must fit within the ring's size. The consumer is given
+ * the size each frame was read at.
+ */
+void readback_push_region(
+    struct readback_ring *ring, int frame, GLsizei width, GLsizei height,
+    readback_consumer consumer, void *data
+) {
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    if (ring->fallback_pixels) {
+        glReadPixels(
+            0, 0, width, height,
+            GL_BGRA, GL_UNSIGNED_BYTE, ring->fallback_pixels
+        );
+        consumer(ring->fallback_pixels, width, height, frame, data);
+        return;
+    }
+
+    if (ring->count == ring->depth)
+        readback_pop(ring, consumer, data);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, ring->buffers[ring->head]);
+    glReadPixels(
+        0, 0, width, height,
+        GL_BGRA, GL_UNSIGNED_BYTE, (void*)0
+    );
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    ring->frames[ring->head] = frame;
+    ring->frame_sizes[ring->head][0] = width;
+    ring->frame_sizes[ring->head][1] = height;
+    ring->head = (ring->head + 1) % ring->depth;
+    ++ring->count;
+}
+
+void readback_flush(struct readback_ring *ring, readback_consumer consumer, void *data)
+{
+    while (ring->count > 0)
+        readback_pop(ring, consumer, data);
+}
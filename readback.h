@@ -0,0 +1,33 @@
+#define MAX_READBACK_DEPTH 4
+
+/*
+ * Ring of pixel buffer objects for reading frames back without stalling:
+ * each pushed frame is copied into the next buffer asynchronously, and
+ * handed to the consumer only once it has gone around the ring, by which
+ * time the GPU has long finished with it. Pixels are 32-bit BGRA with the
+ * bottom row first, as glReadPixels returns them.
+ */
+struct readback_ring {
+    GLuint buffers[MAX_READBACK_DEPTH];
+    int frames[MAX_READBACK_DEPTH];
+    GLsizei frame_sizes[MAX_READBACK_DEPTH][2];
+    int depth, head, count;
+    GLsizei size[2];
+    void *fallback_pixels;
+};
+
+typedef void (*readback_consumer)(
+    void const *pixels, GLsizei width, GLsizei height, int frame, void *data
+);
+
+int make_readback_ring(struct readback_ring *out_ring, int depth, GLsizei width, GLsizei height);
+void delete_readback_ring(struct readback_ring *ring);
+void readback_push(
+    struct readback_ring *ring, int frame,
+    readback_consumer consumer, void *data
+);
+void readback_push_region(
+    struct readback_ring *ring, int frame, GLsizei width, GLsizei height,
+    readback_consumer consumer, void *data
+);
+void readback_flush(struct readback_ring *ring, readback_consumer consumer, void *data);
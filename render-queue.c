@@ -0,0 +1,374 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <string.h>
+#include <stdio.h>
+#include "memory.h"
+#include "gpu-resources.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+#include "thread-util.h"
+#include "job-pool.h"
+#include "render-queue.h"
+#include "gl-capture.h"
+
+#define MIN_ITEMS_PER_LIST      64
+#define LISTS_PER_WORKER        2
+#define INITIAL_LIST_CAPACITY   64
+
+#define KEY_DEPTH_BITS          24
+#define KEY_DEPTH_MAX           ((1u << KEY_DEPTH_BITS) - 1)
+#define KEY_PROGRAM_MASK        0x3ffu
+#define KEY_TEXTURE_MASK        0x3fffu
+#define KEY_BUFFER_MASK         0xffu
+
+/*
+ * Must be called after glewInit, since it picks the submission path the
+ * queue will use.
+ */
+void init_render_queue(struct render_queue *out_queue)
+{
+    memset(out_queue, 0, sizeof(*out_queue));
+    out_queue->base_vertex = base_vertex_supported();
+    out_queue->indirect = out_queue->base_vertex && multi_draw_indirect_supported();
+    if (out_queue->indirect) {
+        glGenBuffers(1, &out_queue->indirect_buffer);
+        track_gpu_resource(GPU_BUFFER, out_queue->indirect_buffer, 0, "render queue");
+    }
+}
+
+void delete_render_queue(struct render_queue *queue)
+{
+    int i;
+    for (i = 0; i < MAX_COMMAND_LISTS; ++i)
+        free(queue->lists[i].items);
+    free(queue->items);
+    free(queue->scratch);
+    free(queue->batches);
+    free(queue->element_counts);
+    free(queue->element_offsets);
+    free(queue->base_vertices);
+    free(queue->commands);
+    if (queue->indirect_buffer) {
+        glDeleteBuffers(1, &queue->indirect_buffer);
+        untrack_gpu_resource(GPU_BUFFER, queue->indirect_buffer);
+    }
+    memset(queue, 0, sizeof(*queue));
+}
+
+/*
+ * Names are truncated to fit their fields. A collision only costs a
+ * missed batch or a redundant bind, never a wrong draw, since replay
+ * compares the full names.
+ */
+GLuint64 draw_item_key(
+    int translucent, GLuint program, GLuint texture, GLuint buffer,
+    GLfloat depth, GLfloat far_depth
+) {
+    GLfloat normalized = depth / far_depth;
+    GLuint64 quantized, state;
+
+    if (normalized < 0.0f) normalized = 0.0f;
+    if (normalized > 1.0f) normalized = 1.0f;
+    quantized = (GLuint64)(normalized * (GLfloat)KEY_DEPTH_MAX);
+    state = ((GLuint64)(program & KEY_PROGRAM_MASK) << 22)
+        | ((GLuint64)(texture & KEY_TEXTURE_MASK) << 8)
+        | (GLuint64)(buffer & KEY_BUFFER_MASK);
+
+    if (translucent)
+        return ((GLuint64)1 << 63)
+            | ((GLuint64)(KEY_DEPTH_MAX - quantized) << 39)
+            | (state << 7);
+    return (state << 31) | (quantized << 7);
+}
+
+void push_draw_item(
+    struct command_list *list, GLuint64 key,
+    struct flag_mesh const *mesh, GLuint program, GLuint texture
+) {
+    struct draw_item *item;
+
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : INITIAL_LIST_CAPACITY;
+        struct draw_item *items
+            = (struct draw_item*) realloc(list->items, capacity * sizeof(struct draw_item));
+        if (!items) {
+            fprintf(stderr, "Unable to grow command list, dropping draw\n");
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+
+    item = &list->items[list->count++];
+    item->key = key;
+    item->mesh = mesh;
+    item->program = program;
+    item->texture = texture;
+}
+
+struct record_job {
+    struct render_queue *queue;
+    record_func record;
+    void *data;
+    int scene_item_count;
+};
+
+static void record_list(int job, int worker, void *data)
+{
+    struct record_job *record = (struct record_job*)data;
+    int
+        list_count = record->queue->list_count,
+        first = (int)((long)record->scene_item_count * job / list_count),
+        last  = (int)((long)record->scene_item_count * (job + 1) / list_count);
+
+    record->record(&record->queue->lists[job], first, last - first, record->data);
+}
+
+/*
+ * Least significant digit first, a byte at a time. Each pass is stable,
+ * so items with equal keys stay in recording order. Passes where every
+ * key has the same digit are skipped, which covers the unused low bits
+ * and any state that does not vary across the frame.
+ */
+static void sort_items(struct render_queue *queue)
+{
+    struct draw_item *from = queue->items, *to = queue->scratch, *swap;
+    int count = queue->count, shift, i;
+
+    if (count < 2)
+        return;
+
+    for (shift = 0; shift < 64; shift += 8) {
+        int offsets[256], total = 0;
+
+        memset(offsets, 0, sizeof(offsets));
+        for (i = 0; i < count; ++i)
+            ++offsets[(from[i].key >> shift) & 0xff];
+        if (offsets[(from[0].key >> shift) & 0xff] == count)
+            continue;
+
+        for (i = 0; i < 256; ++i) {
+            int digit_count = offsets[i];
+            offsets[i] = total;
+            total += digit_count;
+        }
+        for (i = 0; i < count; ++i)
+            to[offsets[(from[i].key >> shift) & 0xff]++] = from[i];
+
+        swap = from; from = to; to = swap;
+    }
+
+    queue->items = from;
+    queue->scratch = to;
+}
+
+static int grow_array(void **array, int count, size_t element_size)
+{
+    void *grown = realloc(*array, count * element_size);
+    if (!grown)
+        return 0;
+    *array = grown;
+    return 1;
+}
+
+static int reserve_items(struct render_queue *queue, int count)
+{
+    if (count <= queue->capacity)
+        return 1;
+
+    if (!grow_array((void**)&queue->items, count, sizeof(struct draw_item))
+        || !grow_array((void**)&queue->scratch, count, sizeof(struct draw_item))
+        || !grow_array((void**)&queue->batches, count, sizeof(struct draw_batch))
+        || !grow_array((void**)&queue->element_counts, count, sizeof(GLsizei))
+        || !grow_array((void**)&queue->element_offsets, count, sizeof(void const*))
+        || !grow_array((void**)&queue->base_vertices, count, sizeof(GLint))
+        || !grow_array(
+            (void**)&queue->commands, count,
+            sizeof(struct draw_elements_indirect_command)
+        ))
+        return 0;
+    queue->capacity = count;
+    return 1;
+}
+
+static int same_batch(struct draw_item const *a, struct draw_item const *b)
+{
+    return a->program == b->program
+        && a->texture == b->texture
+        && a->mesh->vertex_buffer == b->mesh->vertex_buffer
+        && a->mesh->element_buffer == b->mesh->element_buffer;
+}
+
+/*
+ * Split the sorted items into batches and fill in the per-item draw
+ * parameters in both the multi-draw and the indirect command layouts.
+ */
+static void build_batches(struct render_queue *queue)
+{
+    int i;
+
+    queue->batch_count = 0;
+    for (i = 0; i < queue->count; ++i) {
+        struct flag_mesh const *mesh = queue->items[i].mesh;
+        struct draw_elements_indirect_command *command = &queue->commands[i];
+
+        queue->element_counts[i] = mesh->element_count;
+        queue->element_offsets[i]
+            = (void const*)((GLintptr)mesh->first_element * sizeof(GLushort));
+        queue->base_vertices[i] = mesh->base_vertex;
+
+        command->count = (GLuint)mesh->element_count;
+        command->instance_count = 1;
+        command->first_index = (GLuint)mesh->first_element;
+        command->base_vertex = mesh->base_vertex;
+        command->base_instance = 0;
+
+        if (i > 0 && same_batch(&queue->items[i-1], &queue->items[i]))
+            ++queue->batches[queue->batch_count - 1].count;
+        else {
+            queue->batches[queue->batch_count].first = i;
+            queue->batches[queue->batch_count].count = 1;
+            ++queue->batch_count;
+        }
+    }
+
+    if (queue->indirect && queue->count > 0) {
+        GLsizeiptr bytes
+            = (GLsizeiptr)queue->count * sizeof(struct draw_elements_indirect_command);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, queue->indirect_buffer);
+        if (queue->count > queue->indirect_capacity) {
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, bytes, queue->commands, GL_DYNAMIC_DRAW);
+            resize_gpu_resource(GPU_BUFFER, queue->indirect_buffer, (size_t)bytes);
+            queue->indirect_capacity = queue->count;
+        } else
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, bytes, queue->commands);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+}
+
+/*
+ * The scene is cut into contiguous ranges, one command list each, and
+ * the lists are recorded in parallel on the job pool, then concatenated
+ * in range order and sorted. Small scenes are recorded on the calling
+ * thread, since waking the workers would cost more than it saves.
+ */
+void record_render_queue(
+    struct render_queue *queue, struct job_pool *pool,
+    int scene_item_count, record_func record, void *data
+) {
+    struct record_job job;
+    int list_count = scene_item_count / MIN_ITEMS_PER_LIST, total, i;
+    int max_lists = pool ? pool->worker_count * LISTS_PER_WORKER : 1;
+
+    if (max_lists > MAX_COMMAND_LISTS) max_lists = MAX_COMMAND_LISTS;
+    if (list_count > max_lists) list_count = max_lists;
+    if (list_count < 1) list_count = 1;
+
+    queue->list_count = list_count;
+    for (i = 0; i < list_count; ++i)
+        queue->lists[i].count = 0;
+
+    job.queue = queue;
+    job.record = record;
+    job.data = data;
+    job.scene_item_count = scene_item_count;
+    if (pool && list_count > 1)
+        run_jobs(pool, list_count, &record_list, &job);
+    else
+        for (i = 0; i < list_count; ++i)
+            record_list(i, 0, &job);
+
+    for (i = 0, total = 0; i < list_count; ++i)
+        total += queue->lists[i].count;
+    if (!reserve_items(queue, total)) {
+        fprintf(stderr, "Unable to allocate render queue of %d items\n", total);
+        queue->count = 0;
+        return;
+    }
+
+    for (i = 0, queue->count = 0; i < list_count; ++i) {
+        memcpy(
+            queue->items + queue->count,
+            queue->lists[i].items,
+            queue->lists[i].count * sizeof(struct draw_item)
+        );
+        queue->count += queue->lists[i].count;
+    }
+    sort_items(queue);
+    build_batches(queue);
+}
+
+static void draw_batch(struct render_queue const *queue, struct draw_batch const *batch)
+{
+    int first = batch->first;
+
+    if (batch->count == 1)
+        draw_mesh(queue->items[first].mesh);
+    else if (queue->indirect)
+        glMultiDrawElementsIndirect(
+            GL_TRIANGLES, GL_UNSIGNED_SHORT,
+            (void*)((GLintptr)first * sizeof(struct draw_elements_indirect_command)),
+            batch->count, 0
+        );
+    else if (queue->base_vertex)
+        glMultiDrawElementsBaseVertex(
+            GL_TRIANGLES,
+            queue->element_counts + first, GL_UNSIGNED_SHORT,
+            queue->element_offsets + first,
+            batch->count,
+            queue->base_vertices + first
+        );
+    else
+        glMultiDrawElements(
+            GL_TRIANGLES,
+            queue->element_counts + first, GL_UNSIGNED_SHORT,
+            queue->element_offsets + first,
+            batch->count
+        );
+}
+
+/*
+ * Sorting puts items that share state next to each other, so replay only
+ * has to compare each batch against the previous one to skip redundant
+ * binds. Meshes in the same heap buffers share their attribute setup.
+ */
+void replay_render_queue(struct render_queue *queue, bind_mesh_func bind_mesh, void *data)
+{
+    GLuint program = 0, texture = 0, vertex_buffer = 0, element_buffer = 0;
+    int i;
+
+    memset(&queue->stats, 0, sizeof(queue->stats));
+    if (queue->indirect)
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, queue->indirect_buffer);
+
+    for (i = 0; i < queue->batch_count; ++i) {
+        struct draw_batch const *batch = &queue->batches[i];
+        struct draw_item const *item = &queue->items[batch->first];
+
+        if (item->program != program) {
+            glUseProgram(item->program);
+            program = item->program;
+            ++queue->stats.program_changes;
+        }
+        if (item->texture != texture) {
+            glBindTexture(GL_TEXTURE_2D, item->texture);
+            texture = item->texture;
+            ++queue->stats.texture_changes;
+        }
+        if (item->mesh->vertex_buffer != vertex_buffer
+            || item->mesh->element_buffer != element_buffer) {
+            bind_mesh(item->mesh, data);
+            vertex_buffer = item->mesh->vertex_buffer;
+            element_buffer = item->mesh->element_buffer;
+            ++queue->stats.mesh_changes;
+        }
+
+        draw_batch(queue, batch);
+        queue->stats.draws += batch->count;
+        ++queue->stats.draw_calls;
+    }
+
+    if (queue->indirect)
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
@@ -0,0 +1,99 @@
+#define MAX_COMMAND_LISTS 64
+
+/*
+ * Draw items are recorded off the GL thread and sorted by key before
+ * being replayed. Opaque items sort by program, then texture, then
+ * vertex buffer, then front to back; translucent items come after every
+ * opaque item and sort back to front:
+ *
+ *   opaque       0 | program:10 | texture:14 | buffer:8 | depth:24 | 0:7
+ *   translucent  1 | ~depth:24  | program:10 | texture:14 | buffer:8 | 0:7
+ *
+ * Consecutive items that share all of their state form a batch, which is
+ * submitted with a single multi-draw call.
+ */
+struct draw_item {
+    GLuint64 key;
+    struct flag_mesh const *mesh;
+    GLuint program, texture;
+};
+
+struct command_list {
+    struct draw_item *items;
+    int count, capacity;
+};
+
+struct draw_batch {
+    int first, count;
+};
+
+/* Layout defined by ARB_draw_indirect. */
+struct draw_elements_indirect_command {
+    GLuint count, instance_count, first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+};
+
+struct render_queue_stats {
+    int draws, draw_calls, program_changes, texture_changes, mesh_changes;
+};
+
+struct render_queue {
+    struct command_list lists[MAX_COMMAND_LISTS];
+    int list_count;
+
+    struct draw_item *items, *scratch;
+    int count, capacity;
+
+    struct draw_batch *batches;
+    int batch_count;
+
+    /* per item, in sorted order, for the multi-draw calls */
+    GLsizei *element_counts;
+    void const **element_offsets;
+    GLint *base_vertices;
+    struct draw_elements_indirect_command *commands;
+
+    int base_vertex, indirect;
+    GLuint indirect_buffer;
+    GLsizei indirect_capacity;
+
+    struct render_queue_stats stats;
+};
+
+/*
+ * Records draw items for scene items [first, first + count) into list.
+ * Called concurrently from several threads, each with its own list, so
+ * it must not touch GL or shared mutable state.
+ */
+typedef void (*record_func)(struct command_list *list, int first, int count, void *data);
+
+/*
+ * Sets up attribute pointers and the element buffer for a mesh before
+ * the first draw from its buffers; meshes sharing heap buffers share one
+ * call.
+ */
+typedef void (*bind_mesh_func)(struct flag_mesh const *mesh, void *data);
+
+void init_render_queue(struct render_queue *out_queue);
+void delete_render_queue(struct render_queue *queue);
+
+GLuint64 draw_item_key(
+    int translucent, GLuint program, GLuint texture, GLuint buffer,
+    GLfloat depth, GLfloat far_depth
+);
+void push_draw_item(
+    struct command_list *list, GLuint64 key,
+    struct flag_mesh const *mesh, GLuint program, GLuint texture
+);
+
+/*
+ * Must be called on the GL thread, since the indirect commands are
+ * uploaded once the queue is sorted; only the record callbacks run on
+ * the pool.
+ */
+void record_render_queue(
+    struct render_queue *queue, struct job_pool *pool,
+    int scene_item_count, record_func record, void *data
+);
+void replay_render_queue(struct render_queue *queue, bind_mesh_func bind_mesh, void *data);
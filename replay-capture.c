@@ -0,0 +1,1099 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#ifdef __APPLE__
+#  include <GLUT/glut.h>
+#else
+#  include <GL/glut.h>
+#endif
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "memory.h"
+#include "file-util.h"
+#include "frame-clock.h"
+#define GL_CAPTURE_DIRECT
+#include "gl-capture.h"
+
+/*
+ * Plays back a capture from flag --capture in a hidden window, timing
+ * every call:
+ *
+ *   replay-capture <capture> [--skip <frames>] [--finish] [--frames]
+ *
+ * --skip leaves the first frames out of the timings; by default only
+ * the first, which also holds all of the loading. --finish waits for the
+ * GPU after every call, so that each call is charged for the work it
+ * causes rather than only for handing it to the driver. --frames prints
+ * each frame's time as well as the totals.
+ *
+ * Without --finish, each frame still ends with a glFinish, timed on its
+ * own line, so that frame times include the GPU.
+ */
+
+#define MAX_REPLAY_NAMES     65536
+#define MAX_REPLAY_PROGRAMS  1024
+#define MAX_REPLAY_LOCATIONS 256
+
+enum name_kind {
+    BUFFER_NAMES,
+    TEXTURE_NAMES,
+    VERTEX_ARRAY_NAMES,
+    SHADER_NAMES,       /* and programs, which share their names */
+    FRAMEBUFFER_NAMES,
+    RENDERBUFFER_NAMES,
+    QUERY_NAMES,
+    NAME_KINDS
+};
+
+static const char *const OP_NAMES[CAPTURE_OP_COUNT] = {
+    "glFinish at frame end",
+    "glEnable", "glDisable", "glViewport", "glClearColor", "glClear",
+    "glPolygonOffset", "glPixelStorei", "glMemoryBarrier",
+    "glGenBuffers", "glDeleteBuffers", "glBindBuffer", "glBindBufferBase",
+    "glBufferData", "glBufferSubData", "glMapBuffer", "glUnmapBuffer",
+    "glGenTextures", "glDeleteTextures", "glActiveTexture", "glBindTexture",
+    "glTexParameteri", "glTexImage2D", "glTexSubImage2D", "glTexImage3D",
+    "glGenVertexArrays", "glDeleteVertexArrays", "glBindVertexArray",
+    "glVertexAttribPointer", "glEnableVertexAttribArray",
+    "glDisableVertexAttribArray", "glVertexAttribDivisor",
+    "glCreateShader", "glShaderSource", "glCompileShader", "glDeleteShader",
+    "glCreateProgram", "glAttachShader", "glDetachShader",
+    "glTransformFeedbackVaryings", "glLinkProgram", "glDeleteProgram",
+    "glUseProgram", "glGetAttribLocation", "glGetUniformLocation",
+    "glUniform1i", "glUniform1f", "glUniform2i", "glUniform4f", "glUniformMatrix4fv",
+    "glGenFramebuffers", "glDeleteFramebuffers", "glBindFramebuffer",
+    "glFramebufferTexture2D", "glGenRenderbuffers", "glDeleteRenderbuffers",
+    "glBindRenderbuffer", "glRenderbufferStorage", "glRenderbufferStorageMultisample",
+    "glFramebufferRenderbuffer",
+    "glDrawBuffer", "glReadBuffer", "glBlitFramebuffer", "glReadPixels",
+    "glGenQueries", "glDeleteQueries", "glBeginQuery", "glEndQuery",
+    "glDrawArrays", "glDrawElements", "glDrawElementsBaseVertex",
+    "glDrawElementsInstanced", "glMultiDrawElements",
+    "glMultiDrawElementsBaseVertex", "glMultiDrawElementsIndirect",
+    "glBeginTransformFeedback", "glEndTransformFeedback", "glDispatchCompute"
+};
+
+struct op_stats {
+    unsigned long calls;
+    double seconds, bytes;
+};
+
+static struct {
+    unsigned char const *at, *end;
+    int truncated;
+
+    GLuint names[NAME_KINDS][MAX_REPLAY_NAMES];
+    GLint uniform_locations[MAX_REPLAY_PROGRAMS][MAX_REPLAY_LOCATIONS];
+    GLuint program;     /* as recorded */
+
+    void *read_pixels;
+    size_t read_pixels_size;
+
+    int skip, finish, print_frames, frame;
+    double call_start, frame_start;
+    struct op_stats ops[CAPTURE_OP_COUNT];
+    double frame_sum, frame_min, frame_max;
+    int timed_frames;
+} g_replay;
+
+static void const *next_bytes(size_t size)
+{
+    void const *bytes = g_replay.at;
+
+    if ((size_t)(g_replay.end - g_replay.at) < size) {
+        g_replay.truncated = 1;
+        g_replay.at = g_replay.end;
+        return NULL;
+    }
+    g_replay.at += size;
+    return bytes;
+}
+
+static GLuint next_word(void)
+{
+    GLuint word = 0;
+    void const *bytes = next_bytes(sizeof(word));
+    if (bytes)
+        memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+static GLint next_int(void)
+{
+    return (GLint)next_word();
+}
+
+static GLfloat next_float(void)
+{
+    GLfloat value = 0.0f;
+    void const *bytes = next_bytes(sizeof(value));
+    if (bytes)
+        memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static GLsizeiptr next_size(void)
+{
+    GLint64 value = 0;
+    void const *bytes = next_bytes(sizeof(value));
+    if (bytes)
+        memcpy(&value, bytes, sizeof(value));
+    return (GLsizeiptr)value;
+}
+
+static void const *next_pointer(void)
+{
+    return (void const*)(GLintptr)next_size();
+}
+
+/* Blobs are word-aligned within the file, which is mapped page-aligned. */
+static void const *next_blob(size_t *out_size)
+{
+    size_t size = next_word();
+    void const *blob = next_bytes(size);
+
+    next_bytes((sizeof(GLuint) - size % sizeof(GLuint)) % sizeof(GLuint));
+    *out_size = blob ? size : 0;
+    return blob;
+}
+
+static GLuint map_name(enum name_kind kind, GLuint recorded)
+{
+    if (recorded >= MAX_REPLAY_NAMES) {
+        fprintf(stderr, "Recorded GL name %u is beyond the replayer's limit\n", recorded);
+        return 0;
+    }
+    return g_replay.names[kind][recorded];
+}
+
+static void set_name(enum name_kind kind, GLuint recorded, GLuint name)
+{
+    if (recorded < MAX_REPLAY_NAMES)
+        g_replay.names[kind][recorded] = name;
+}
+
+static GLint map_uniform(GLint recorded)
+{
+    if (recorded < 0 || recorded >= MAX_REPLAY_LOCATIONS
+        || g_replay.program >= MAX_REPLAY_PROGRAMS)
+        return recorded;
+    return g_replay.uniform_locations[g_replay.program][recorded];
+}
+
+static void begin_call(void)
+{
+    g_replay.call_start = clock_seconds();
+}
+
+static void end_call(enum gl_capture_op op, double bytes)
+{
+    struct op_stats *stats = &g_replay.ops[op];
+
+    if (g_replay.finish)
+        glFinish();
+    if (g_replay.frame < g_replay.skip)
+        return;
+    ++stats->calls;
+    stats->seconds += clock_seconds() - g_replay.call_start;
+    stats->bytes += bytes;
+}
+
+static void gen_names(enum gl_capture_op op, enum name_kind kind, PFNGLGENBUFFERSPROC gen)
+{
+    size_t size, i;
+    GLuint const *recorded = (GLuint const*)next_blob(&size);
+    GLuint name;
+
+    begin_call();
+    for (i = 0; i < size / sizeof(GLuint); ++i) {
+        gen(1, &name);
+        set_name(kind, recorded[i], name);
+    }
+    end_call(op, 0.0);
+}
+
+static void delete_names(enum gl_capture_op op, enum name_kind kind, PFNGLDELETEBUFFERSPROC del)
+{
+    size_t size, i;
+    GLuint const *recorded = (GLuint const*)next_blob(&size);
+    GLuint name;
+
+    begin_call();
+    for (i = 0; i < size / sizeof(GLuint); ++i) {
+        name = map_name(kind, recorded[i]);
+        del(1, &name);
+        set_name(kind, recorded[i], 0);
+    }
+    end_call(op, 0.0);
+}
+
+/* As recorded by put_pixels in gl-capture.c. */
+static void const *next_pixels(size_t *out_size)
+{
+    GLuint kind = next_word();
+
+    *out_size = 0;
+    if (kind == 1)
+        return next_pointer();
+    if (kind == 2)
+        return next_blob(out_size);
+    return NULL;
+}
+
+/* Returns memory to be freed, or NULL. */
+static void const **next_offsets(GLsizei *out_count)
+{
+    size_t size, i;
+    unsigned char const *offsets = (unsigned char const*)next_blob(&size);
+    void const **pointers;
+    GLint64 offset;
+
+    *out_count = (GLsizei)(size / sizeof(GLint64));
+    pointers = (void const**)malloc((*out_count + 1) * sizeof(void const*));
+    for (i = 0; pointers && i < (size_t)*out_count; ++i) {
+        memcpy(&offset, offsets + i * sizeof(GLint64), sizeof(offset));
+        pointers[i] = (void const*)(GLintptr)offset;
+    }
+    return pointers;
+}
+
+static void *read_pixels_memory(size_t size)
+{
+    if (size > g_replay.read_pixels_size) {
+        free(g_replay.read_pixels);
+        g_replay.read_pixels = malloc(size);
+        g_replay.read_pixels_size = g_replay.read_pixels ? size : 0;
+    }
+    return g_replay.read_pixels;
+}
+
+/*
+ * Checked as each call comes up, so that a capture from a machine with a
+ * newer GL stops with a message rather than a crash.
+ */
+static int function_missing(enum gl_capture_op op)
+{
+    switch (op) {
+    case CAPTURE_MEMORY_BARRIER:
+    case CAPTURE_DISPATCH_COMPUTE:
+        return !glDispatchCompute || !glMemoryBarrier;
+    case CAPTURE_BIND_BUFFER_BASE:
+        return !glBindBufferBase;
+    case CAPTURE_TEX_IMAGE_3D:
+        return !glTexImage3D;
+    case CAPTURE_GEN_VERTEX_ARRAYS:
+    case CAPTURE_DELETE_VERTEX_ARRAYS:
+    case CAPTURE_BIND_VERTEX_ARRAY:
+        return !glBindVertexArray;
+    case CAPTURE_VERTEX_ATTRIB_DIVISOR:
+        return !glVertexAttribDivisor;
+    case CAPTURE_TRANSFORM_FEEDBACK_VARYINGS:
+    case CAPTURE_BEGIN_TRANSFORM_FEEDBACK:
+    case CAPTURE_END_TRANSFORM_FEEDBACK:
+        return !glBeginTransformFeedback;
+    case CAPTURE_GEN_FRAMEBUFFERS:
+    case CAPTURE_DELETE_FRAMEBUFFERS:
+    case CAPTURE_BIND_FRAMEBUFFER:
+    case CAPTURE_FRAMEBUFFER_TEXTURE_2D:
+    case CAPTURE_GEN_RENDERBUFFERS:
+    case CAPTURE_DELETE_RENDERBUFFERS:
+    case CAPTURE_BIND_RENDERBUFFER:
+    case CAPTURE_RENDERBUFFER_STORAGE:
+    case CAPTURE_FRAMEBUFFER_RENDERBUFFER:
+        return !glBindFramebuffer;
+    case CAPTURE_BLIT_FRAMEBUFFER:
+        return !glBlitFramebuffer;
+    case CAPTURE_RENDERBUFFER_STORAGE_MULTISAMPLE:
+        return !glRenderbufferStorageMultisample;
+    case CAPTURE_GEN_QUERIES:
+    case CAPTURE_DELETE_QUERIES:
+    case CAPTURE_BEGIN_QUERY:
+    case CAPTURE_END_QUERY:
+        return !glBeginQuery;
+    case CAPTURE_DRAW_ELEMENTS_BASE_VERTEX:
+    case CAPTURE_MULTI_DRAW_ELEMENTS_BASE_VERTEX:
+        return !glDrawElementsBaseVertex || !glMultiDrawElementsBaseVertex;
+    case CAPTURE_DRAW_ELEMENTS_INSTANCED:
+        return !glDrawElementsInstanced;
+    case CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT:
+        return !glMultiDrawElementsIndirect;
+    default:
+        return 0;
+    }
+}
+
+static void end_frame(void)
+{
+    double now;
+
+    begin_call();
+    glFinish();
+    end_call(CAPTURE_END_FRAME, 0.0);
+
+    now = clock_seconds();
+    if (g_replay.frame >= g_replay.skip) {
+        double seconds = now - g_replay.frame_start;
+
+        if (g_replay.print_frames)
+            printf("frame %d: %.3f ms\n", g_replay.frame, 1000.0 * seconds);
+        if (g_replay.timed_frames == 0 || seconds < g_replay.frame_min)
+            g_replay.frame_min = seconds;
+        if (g_replay.timed_frames == 0 || seconds > g_replay.frame_max)
+            g_replay.frame_max = seconds;
+        g_replay.frame_sum += seconds;
+        ++g_replay.timed_frames;
+    }
+    ++g_replay.frame;
+    g_replay.frame_start = clock_seconds();
+}
+
+/* Returns 0 if the call cannot be replayed. */
+static int replay_call(enum gl_capture_op op)
+{
+    size_t size;
+
+    switch (op) {
+    case CAPTURE_END_FRAME:
+        end_frame();
+        return 1;
+
+    case CAPTURE_ENABLE: {
+        GLenum cap = next_word();
+        begin_call();
+        glEnable(cap);
+        break;
+    }
+    case CAPTURE_DISABLE: {
+        GLenum cap = next_word();
+        begin_call();
+        glDisable(cap);
+        break;
+    }
+    case CAPTURE_VIEWPORT: {
+        GLint x = next_int(), y = next_int();
+        GLsizei w = next_int(), h = next_int();
+        begin_call();
+        glViewport(x, y, w, h);
+        break;
+    }
+    case CAPTURE_CLEAR_COLOR: {
+        GLfloat r = next_float(), g = next_float(), b = next_float(), a = next_float();
+        begin_call();
+        glClearColor(r, g, b, a);
+        break;
+    }
+    case CAPTURE_CLEAR: {
+        GLbitfield mask = next_word();
+        begin_call();
+        glClear(mask);
+        break;
+    }
+    case CAPTURE_POLYGON_OFFSET: {
+        GLfloat factor = next_float(), units = next_float();
+        begin_call();
+        glPolygonOffset(factor, units);
+        break;
+    }
+    case CAPTURE_PIXEL_STOREI: {
+        GLenum pname = next_word();
+        GLint param = next_int();
+        begin_call();
+        glPixelStorei(pname, param);
+        break;
+    }
+    case CAPTURE_MEMORY_BARRIER: {
+        GLbitfield barriers = next_word();
+        begin_call();
+        glMemoryBarrier(barriers);
+        break;
+    }
+
+    case CAPTURE_GEN_BUFFERS:
+        gen_names(op, BUFFER_NAMES, glGenBuffers);
+        return 1;
+    case CAPTURE_DELETE_BUFFERS:
+        delete_names(op, BUFFER_NAMES, glDeleteBuffers);
+        return 1;
+    case CAPTURE_BIND_BUFFER: {
+        GLenum target = next_word();
+        GLuint buffer = map_name(BUFFER_NAMES, next_word());
+        begin_call();
+        glBindBuffer(target, buffer);
+        break;
+    }
+    case CAPTURE_BIND_BUFFER_BASE: {
+        GLenum target = next_word();
+        GLuint index = next_word();
+        GLuint buffer = map_name(BUFFER_NAMES, next_word());
+        begin_call();
+        glBindBufferBase(target, index, buffer);
+        break;
+    }
+    case CAPTURE_BUFFER_DATA: {
+        GLenum target = next_word();
+        GLsizeiptr bytes = next_size();
+        GLenum usage = next_word();
+        void const *data = next_word() ? next_blob(&size) : NULL;
+        begin_call();
+        glBufferData(target, bytes, data, usage);
+        end_call(op, data ? (double)bytes : 0.0);
+        return 1;
+    }
+    case CAPTURE_BUFFER_SUB_DATA: {
+        GLenum target = next_word();
+        GLintptr offset = next_size();
+        void const *data = next_blob(&size);
+        begin_call();
+        glBufferSubData(target, offset, (GLsizeiptr)size, data);
+        end_call(op, (double)size);
+        return 1;
+    }
+    case CAPTURE_MAP_BUFFER: {
+        GLenum target = next_word(), access = next_word();
+        begin_call();
+        glMapBuffer(target, access);
+        break;
+    }
+    case CAPTURE_UNMAP_BUFFER: {
+        GLenum target = next_word();
+        begin_call();
+        glUnmapBuffer(target);
+        break;
+    }
+
+    case CAPTURE_GEN_TEXTURES:
+        gen_names(op, TEXTURE_NAMES, glGenTextures);
+        return 1;
+    case CAPTURE_DELETE_TEXTURES:
+        delete_names(op, TEXTURE_NAMES, glDeleteTextures);
+        return 1;
+    case CAPTURE_ACTIVE_TEXTURE: {
+        GLenum unit = next_word();
+        begin_call();
+        glActiveTexture(unit);
+        break;
+    }
+    case CAPTURE_BIND_TEXTURE: {
+        GLenum target = next_word();
+        GLuint texture = map_name(TEXTURE_NAMES, next_word());
+        begin_call();
+        glBindTexture(target, texture);
+        break;
+    }
+    case CAPTURE_TEX_PARAMETERI: {
+        GLenum target = next_word(), pname = next_word();
+        GLint param = next_int();
+        begin_call();
+        glTexParameteri(target, pname, param);
+        break;
+    }
+    case CAPTURE_TEX_IMAGE_2D: {
+        GLenum target = next_word();
+        GLint level = next_int(), internal_format = next_int();
+        GLsizei w = next_int(), h = next_int();
+        GLint border = next_int();
+        GLenum format = next_word(), type = next_word();
+        void const *pixels = next_pixels(&size);
+        begin_call();
+        glTexImage2D(target, level, internal_format, w, h, border, format, type, pixels);
+        end_call(op, (double)size);
+        return 1;
+    }
+    case CAPTURE_TEX_SUB_IMAGE_2D: {
+        GLenum target = next_word();
+        GLint level = next_int(), x = next_int(), y = next_int();
+        GLsizei w = next_int(), h = next_int();
+        GLenum format = next_word(), type = next_word();
+        void const *pixels = next_pixels(&size);
+        begin_call();
+        glTexSubImage2D(target, level, x, y, w, h, format, type, pixels);
+        end_call(op, (double)size);
+        return 1;
+    }
+    case CAPTURE_TEX_IMAGE_3D: {
+        GLenum target = next_word();
+        GLint level = next_int(), internal_format = next_int();
+        GLsizei w = next_int(), h = next_int(), d = next_int();
+        GLint border = next_int();
+        GLenum format = next_word(), type = next_word();
+        void const *pixels = next_pixels(&size);
+        begin_call();
+        glTexImage3D(target, level, internal_format, w, h, d, border, format, type, pixels);
+        end_call(op, (double)size);
+        return 1;
+    }
+
+    case CAPTURE_GEN_VERTEX_ARRAYS:
+        gen_names(op, VERTEX_ARRAY_NAMES, glGenVertexArrays);
+        return 1;
+    case CAPTURE_DELETE_VERTEX_ARRAYS:
+        delete_names(op, VERTEX_ARRAY_NAMES, glDeleteVertexArrays);
+        return 1;
+    case CAPTURE_BIND_VERTEX_ARRAY: {
+        GLuint array = map_name(VERTEX_ARRAY_NAMES, next_word());
+        begin_call();
+        glBindVertexArray(array);
+        break;
+    }
+    case CAPTURE_VERTEX_ATTRIB_POINTER: {
+        GLuint index = next_word();
+        GLint components = next_int();
+        GLenum type = next_word();
+        GLboolean normalized = (GLboolean)next_word();
+        GLsizei stride = next_int();
+        void const *offset = next_pointer();
+        begin_call();
+        glVertexAttribPointer(index, components, type, normalized, stride, offset);
+        break;
+    }
+    case CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY: {
+        GLuint index = next_word();
+        begin_call();
+        glEnableVertexAttribArray(index);
+        break;
+    }
+    case CAPTURE_DISABLE_VERTEX_ATTRIB_ARRAY: {
+        GLuint index = next_word();
+        begin_call();
+        glDisableVertexAttribArray(index);
+        break;
+    }
+    case CAPTURE_VERTEX_ATTRIB_DIVISOR: {
+        GLuint index = next_word(), divisor = next_word();
+        begin_call();
+        glVertexAttribDivisor(index, divisor);
+        break;
+    }
+
+    case CAPTURE_CREATE_SHADER: {
+        GLenum type = next_word();
+        GLuint recorded = next_word();
+        begin_call();
+        set_name(SHADER_NAMES, recorded, glCreateShader(type));
+        break;
+    }
+    case CAPTURE_SHADER_SOURCE: {
+        GLuint shader = map_name(SHADER_NAMES, next_word());
+        GLsizei count = next_int(), i;
+        GLchar const **strings = (GLchar const**)malloc((count + 1) * sizeof(GLchar const*));
+        GLint *lengths = (GLint*)malloc((count + 1) * sizeof(GLint));
+
+        for (i = 0; strings && lengths && i < count; ++i) {
+            strings[i] = (GLchar const*)next_blob(&size);
+            lengths[i] = (GLint)size;
+        }
+        begin_call();
+        if (strings && lengths)
+            glShaderSource(shader, count, strings, lengths);
+        end_call(op, 0.0);
+        free(strings);
+        free(lengths);
+        return 1;
+    }
+    case CAPTURE_COMPILE_SHADER: {
+        GLuint shader = map_name(SHADER_NAMES, next_word());
+        begin_call();
+        glCompileShader(shader);
+        break;
+    }
+    case CAPTURE_DELETE_SHADER: {
+        GLuint recorded = next_word();
+        begin_call();
+        glDeleteShader(map_name(SHADER_NAMES, recorded));
+        set_name(SHADER_NAMES, recorded, 0);
+        break;
+    }
+    case CAPTURE_CREATE_PROGRAM: {
+        GLuint recorded = next_word();
+        begin_call();
+        set_name(SHADER_NAMES, recorded, glCreateProgram());
+        break;
+    }
+    case CAPTURE_ATTACH_SHADER: {
+        GLuint program = map_name(SHADER_NAMES, next_word());
+        GLuint shader = map_name(SHADER_NAMES, next_word());
+        begin_call();
+        glAttachShader(program, shader);
+        break;
+    }
+    case CAPTURE_DETACH_SHADER: {
+        GLuint program = map_name(SHADER_NAMES, next_word());
+        GLuint shader = map_name(SHADER_NAMES, next_word());
+        begin_call();
+        glDetachShader(program, shader);
+        break;
+    }
+    case CAPTURE_TRANSFORM_FEEDBACK_VARYINGS: {
+        GLuint program = map_name(SHADER_NAMES, next_word());
+        GLsizei count = next_int(), i;
+        GLchar const **varyings = (GLchar const**)malloc((count + 1) * sizeof(GLchar const*));
+        GLenum mode;
+
+        for (i = 0; varyings && i < count; ++i)
+            varyings[i] = (GLchar const*)next_blob(&size);
+        mode = next_word();
+        begin_call();
+        if (varyings)
+            glTransformFeedbackVaryings(program, count, varyings, mode);
+        end_call(op, 0.0);
+        free(varyings);
+        return 1;
+    }
+    case CAPTURE_LINK_PROGRAM: {
+        GLuint program = map_name(SHADER_NAMES, next_word());
+        begin_call();
+        glLinkProgram(program);
+        break;
+    }
+    case CAPTURE_DELETE_PROGRAM: {
+        GLuint recorded = next_word();
+        begin_call();
+        glDeleteProgram(map_name(SHADER_NAMES, recorded));
+        set_name(SHADER_NAMES, recorded, 0);
+        break;
+    }
+    case CAPTURE_USE_PROGRAM: {
+        g_replay.program = next_word();
+        begin_call();
+        glUseProgram(map_name(SHADER_NAMES, g_replay.program));
+        break;
+    }
+    /*
+     * Attribute locations are passed around as plain numbers, so where
+     * this GL picks another one the recorded one is bound instead.
+     */
+    case CAPTURE_GET_ATTRIB_LOCATION: {
+        GLuint program = map_name(SHADER_NAMES, next_word());
+        GLchar const *name = (GLchar const*)next_blob(&size);
+        GLint recorded = next_int(), location;
+        if (!name)
+            return 0;
+        begin_call();
+        location = glGetAttribLocation(program, name);
+        if (location != recorded && recorded >= 0) {
+            glBindAttribLocation(program, (GLuint)recorded, name);
+            glLinkProgram(program);
+        }
+        break;
+    }
+    case CAPTURE_GET_UNIFORM_LOCATION: {
+        GLuint recorded_program = next_word();
+        GLuint program = map_name(SHADER_NAMES, recorded_program);
+        GLchar const *name = (GLchar const*)next_blob(&size);
+        GLint recorded = next_int(), location;
+        if (!name)
+            return 0;
+        begin_call();
+        location = glGetUniformLocation(program, name);
+        if (recorded >= 0 && recorded < MAX_REPLAY_LOCATIONS
+            && recorded_program < MAX_REPLAY_PROGRAMS)
+            g_replay.uniform_locations[recorded_program][recorded] = location;
+        break;
+    }
+    case CAPTURE_UNIFORM_1I: {
+        GLint location = map_uniform(next_int()), x = next_int();
+        begin_call();
+        glUniform1i(location, x);
+        break;
+    }
+    case CAPTURE_UNIFORM_1F: {
+        GLint location = map_uniform(next_int());
+        GLfloat x = next_float();
+        begin_call();
+        glUniform1f(location, x);
+        break;
+    }
+    case CAPTURE_UNIFORM_2I: {
+        GLint location = map_uniform(next_int()), x = next_int(), y = next_int();
+        begin_call();
+        glUniform2i(location, x, y);
+        break;
+    }
+    case CAPTURE_UNIFORM_4F: {
+        GLint location = map_uniform(next_int());
+        GLfloat x = next_float(), y = next_float(), z = next_float(), w = next_float();
+        begin_call();
+        glUniform4f(location, x, y, z, w);
+        break;
+    }
+    case CAPTURE_UNIFORM_MATRIX_4FV: {
+        GLint location = map_uniform(next_int());
+        GLboolean transpose = (GLboolean)next_word();
+        GLfloat const *value = (GLfloat const*)next_blob(&size);
+        begin_call();
+        glUniformMatrix4fv(
+            location, (GLsizei)(size / (16 * sizeof(GLfloat))), transpose, value
+        );
+        break;
+    }
+
+    case CAPTURE_GEN_FRAMEBUFFERS:
+        gen_names(op, FRAMEBUFFER_NAMES, glGenFramebuffers);
+        return 1;
+    case CAPTURE_DELETE_FRAMEBUFFERS:
+        delete_names(op, FRAMEBUFFER_NAMES, glDeleteFramebuffers);
+        return 1;
+    case CAPTURE_BIND_FRAMEBUFFER: {
+        GLenum target = next_word();
+        GLuint framebuffer = map_name(FRAMEBUFFER_NAMES, next_word());
+        begin_call();
+        glBindFramebuffer(target, framebuffer);
+        break;
+    }
+    case CAPTURE_FRAMEBUFFER_TEXTURE_2D: {
+        GLenum target = next_word(), attachment = next_word(), texture_target = next_word();
+        GLuint texture = map_name(TEXTURE_NAMES, next_word());
+        GLint level = next_int();
+        begin_call();
+        glFramebufferTexture2D(target, attachment, texture_target, texture, level);
+        break;
+    }
+    case CAPTURE_GEN_RENDERBUFFERS:
+        gen_names(op, RENDERBUFFER_NAMES, glGenRenderbuffers);
+        return 1;
+    case CAPTURE_DELETE_RENDERBUFFERS:
+        delete_names(op, RENDERBUFFER_NAMES, glDeleteRenderbuffers);
+        return 1;
+    case CAPTURE_BIND_RENDERBUFFER: {
+        GLenum target = next_word();
+        GLuint renderbuffer = map_name(RENDERBUFFER_NAMES, next_word());
+        begin_call();
+        glBindRenderbuffer(target, renderbuffer);
+        break;
+    }
+    case CAPTURE_RENDERBUFFER_STORAGE: {
+        GLenum target = next_word(), internal_format = next_word();
+        GLsizei w = next_int(), h = next_int();
+        begin_call();
+        glRenderbufferStorage(target, internal_format, w, h);
+        break;
+    }
+    case CAPTURE_RENDERBUFFER_STORAGE_MULTISAMPLE: {
+        GLenum target = next_word();
+        GLsizei samples = next_int();
+        GLenum internal_format = next_word();
+        GLsizei w = next_int(), h = next_int();
+        begin_call();
+        glRenderbufferStorageMultisample(target, samples, internal_format, w, h);
+        break;
+    }
+    case CAPTURE_FRAMEBUFFER_RENDERBUFFER: {
+        GLenum target = next_word(), attachment = next_word(), rb_target = next_word();
+        GLuint renderbuffer = map_name(RENDERBUFFER_NAMES, next_word());
+        begin_call();
+        glFramebufferRenderbuffer(target, attachment, rb_target, renderbuffer);
+        break;
+    }
+    case CAPTURE_DRAW_BUFFER: {
+        GLenum buffer = next_word();
+        begin_call();
+        glDrawBuffer(buffer);
+        break;
+    }
+    case CAPTURE_READ_BUFFER: {
+        GLenum buffer = next_word();
+        begin_call();
+        glReadBuffer(buffer);
+        break;
+    }
+    case CAPTURE_BLIT_FRAMEBUFFER: {
+        GLint coords[8];
+        GLbitfield mask;
+        GLenum filter;
+        int i;
+
+        for (i = 0; i < 8; ++i)
+            coords[i] = next_int();
+        mask = next_word();
+        filter = next_word();
+        begin_call();
+        glBlitFramebuffer(
+            coords[0], coords[1], coords[2], coords[3],
+            coords[4], coords[5], coords[6], coords[7],
+            mask, filter
+        );
+        break;
+    }
+    case CAPTURE_READ_PIXELS: {
+        GLint x = next_int(), y = next_int();
+        GLsizei w = next_int(), h = next_int();
+        GLenum format = next_word(), type = next_word();
+        int into_buffer = next_word() != 0;
+        GLsizeiptr value = next_size();
+        void *pixels = into_buffer
+            ? (void*)(GLintptr)value : read_pixels_memory((size_t)value);
+        begin_call();
+        if (pixels || into_buffer)
+            glReadPixels(x, y, w, h, format, type, pixels);
+        break;
+    }
+
+    case CAPTURE_GEN_QUERIES:
+        gen_names(op, QUERY_NAMES, glGenQueries);
+        return 1;
+    case CAPTURE_DELETE_QUERIES:
+        delete_names(op, QUERY_NAMES, glDeleteQueries);
+        return 1;
+    case CAPTURE_BEGIN_QUERY: {
+        GLenum target = next_word();
+        GLuint query = map_name(QUERY_NAMES, next_word());
+        begin_call();
+        glBeginQuery(target, query);
+        break;
+    }
+    case CAPTURE_END_QUERY: {
+        GLenum target = next_word();
+        begin_call();
+        glEndQuery(target);
+        break;
+    }
+
+    case CAPTURE_DRAW_ARRAYS: {
+        GLenum mode = next_word();
+        GLint first = next_int();
+        GLsizei count = next_int();
+        begin_call();
+        glDrawArrays(mode, first, count);
+        break;
+    }
+    case CAPTURE_DRAW_ELEMENTS: {
+        GLenum mode = next_word();
+        GLsizei count = next_int();
+        GLenum type = next_word();
+        void const *offset = next_pointer();
+        begin_call();
+        glDrawElements(mode, count, type, offset);
+        break;
+    }
+    case CAPTURE_DRAW_ELEMENTS_BASE_VERTEX: {
+        GLenum mode = next_word();
+        GLsizei count = next_int();
+        GLenum type = next_word();
+        void const *offset = next_pointer();
+        GLint base_vertex = next_int();
+        begin_call();
+        glDrawElementsBaseVertex(mode, count, type, offset, base_vertex);
+        break;
+    }
+    case CAPTURE_DRAW_ELEMENTS_INSTANCED: {
+        GLenum mode = next_word();
+        GLsizei count = next_int();
+        GLenum type = next_word();
+        void const *offset = next_pointer();
+        GLsizei instances = next_int();
+        begin_call();
+        glDrawElementsInstanced(mode, count, type, offset, instances);
+        break;
+    }
+    case CAPTURE_MULTI_DRAW_ELEMENTS:
+    case CAPTURE_MULTI_DRAW_ELEMENTS_BASE_VERTEX: {
+        GLenum mode = next_word(), type = next_word();
+        GLsizei const *counts = (GLsizei const*)next_blob(&size);
+        GLsizei draw_count;
+        void const **offsets = next_offsets(&draw_count);
+        GLint const *base_vertices = op == CAPTURE_MULTI_DRAW_ELEMENTS_BASE_VERTEX
+            ? (GLint const*)next_blob(&size) : NULL;
+
+        if (!offsets)
+            return 0;
+        begin_call();
+        if (base_vertices)
+            glMultiDrawElementsBaseVertex(
+                mode, counts, type, offsets, draw_count, base_vertices
+            );
+        else
+            glMultiDrawElements(mode, counts, type, offsets, draw_count);
+        end_call(op, 0.0);
+        free(offsets);
+        return 1;
+    }
+    case CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT: {
+        GLenum mode = next_word(), type = next_word();
+        void const *offset = next_pointer();
+        GLsizei draw_count = next_int(), stride = next_int();
+        begin_call();
+        glMultiDrawElementsIndirect(mode, type, offset, draw_count, stride);
+        break;
+    }
+    case CAPTURE_BEGIN_TRANSFORM_FEEDBACK: {
+        GLenum mode = next_word();
+        begin_call();
+        glBeginTransformFeedback(mode);
+        break;
+    }
+    case CAPTURE_END_TRANSFORM_FEEDBACK:
+        begin_call();
+        glEndTransformFeedback();
+        break;
+    case CAPTURE_DISPATCH_COMPUTE: {
+        GLuint x = next_word(), y = next_word(), z = next_word();
+        begin_call();
+        glDispatchCompute(x, y, z);
+        break;
+    }
+
+    default:
+        fprintf(stderr, "Unknown call %u in capture\n", (unsigned)op);
+        return 0;
+    }
+    end_call(op, 0.0);
+    return 1;
+}
+
+static int compare_ops(void const *a, void const *b)
+{
+    double sa = g_replay.ops[*(int const*)a].seconds, sb = g_replay.ops[*(int const*)b].seconds;
+    return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+static void report(void)
+{
+    int order[CAPTURE_OP_COUNT], i;
+    double frames = g_replay.timed_frames > 0 ? (double)g_replay.timed_frames : 1.0;
+
+    if (g_replay.timed_frames > 0)
+        printf(
+            "replayed %d frames (%d more skipped): %.3f ms/frame (min %.3f, max %.3f)%s\n",
+            g_replay.timed_frames, g_replay.frame - g_replay.timed_frames,
+            1000.0 * g_replay.frame_sum / frames,
+            1000.0 * g_replay.frame_min, 1000.0 * g_replay.frame_max,
+            g_replay.finish ? ", finishing every call" : ""
+        );
+    else
+        printf("replayed %d frames, none of them timed\n", g_replay.frame);
+
+    for (i = 0; i < CAPTURE_OP_COUNT; ++i)
+        order[i] = i;
+    qsort(order, CAPTURE_OP_COUNT, sizeof(order[0]), &compare_ops);
+
+    /* the last column is data read from client memory */
+    printf("%-30s %9s %10s %10s %9s %10s\n",
+        "call", "calls", "total ms", "ms/frame", "us/call", "KiB/frame");
+    for (i = 0; i < CAPTURE_OP_COUNT; ++i) {
+        struct op_stats const *stats = &g_replay.ops[order[i]];
+        if (stats->calls == 0)
+            continue;
+        printf("%-30s %9lu %10.3f %10.4f %9.2f %10.1f\n",
+            OP_NAMES[order[i]], stats->calls,
+            1000.0 * stats->seconds,
+            1000.0 * stats->seconds / frames,
+            1.0e6 * stats->seconds / (double)stats->calls,
+            stats->bytes / frames / 1024.0
+        );
+    }
+}
+
+static int replay(struct mapped_file const *file)
+{
+    struct gl_capture_header const *header = (struct gl_capture_header const*)file->data;
+    int p, l;
+
+    for (p = 0; p < MAX_REPLAY_PROGRAMS; ++p)
+        for (l = 0; l < MAX_REPLAY_LOCATIONS; ++l)
+            g_replay.uniform_locations[p][l] = l;
+
+    g_replay.at = (unsigned char const*)file->data + sizeof(*header);
+    g_replay.end = (unsigned char const*)file->data + file->size;
+    g_replay.frame_start = clock_seconds();
+
+    while (g_replay.at < g_replay.end) {
+        enum gl_capture_op op = (enum gl_capture_op)next_word();
+
+        if ((unsigned)op < CAPTURE_OP_COUNT && function_missing(op)) {
+            fprintf(stderr, "This GL lacks %s, which the capture uses\n", OP_NAMES[op]);
+            return 0;
+        }
+        if (!replay_call(op) || g_replay.truncated)
+            break;
+    }
+    if (g_replay.truncated || g_replay.at < g_replay.end)
+        fprintf(stderr, "Capture is cut short or damaged after %lu bytes\n",
+            (unsigned long)(g_replay.at - (unsigned char const*)file->data));
+    if (header->frame_count != 0 && (GLuint)g_replay.frame != header->frame_count)
+        fprintf(stderr, "Capture holds %d of its %u frames\n",
+            g_replay.frame, header->frame_count);
+
+    report();
+    return 1;
+}
+
+static int open_capture(struct mapped_file *out_file, const char *filename)
+{
+    struct gl_capture_header const *header;
+
+    if (!map_file(out_file, filename))
+        return 0;
+    header = (struct gl_capture_header const*)out_file->data;
+    if (out_file->size < sizeof(*header)
+        || memcmp(header->magic, GL_CAPTURE_MAGIC, sizeof(GL_CAPTURE_MAGIC)) != 0) {
+        fprintf(stderr, "%s is not a GL capture\n", filename);
+        unmap_file(out_file);
+        return 0;
+    }
+    if (header->version != GL_CAPTURE_VERSION) {
+        fprintf(stderr, "%s is capture version %u; expected version %u\n",
+            filename, header->version, GL_CAPTURE_VERSION);
+        unmap_file(out_file);
+        return 0;
+    }
+    return 1;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+        "usage: %s <capture> [--skip <frames>] [--finish] [--frames]\n"
+        "  --skip <frames>  leave the first frames out of the timings (default 1)\n"
+        "  --finish         wait for the GPU after every call\n"
+        "  --frames         print every frame's time\n",
+        program
+    );
+}
+
+int main(int argc, char *argv[])
+{
+    struct mapped_file file;
+    struct gl_capture_header const *header;
+    const char *path = NULL;
+    int i, ok;
+
+    g_replay.skip = 1;
+    glutInit(&argc, argv);
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--skip") == 0 && i + 1 < argc)
+            g_replay.skip = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--finish") == 0)
+            g_replay.finish = 1;
+        else if (strcmp(argv[i], "--frames") == 0)
+            g_replay.print_frames = 1;
+        else if (argv[i][0] != '-' && !path)
+            path = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    init_memory(0);
+    if (!open_capture(&file, path))
+        return 1;
+    header = (struct gl_capture_header const*)file.data;
+
+    glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
+    glutInitWindowSize(header->width, header->height);
+    glutCreateWindow("Capture replay");
+    glutHideWindow();
+    glewInit();
+
+    printf("replaying %s at %dx%d on %s\n",
+        path, (int)header->width, (int)header->height, (const char*)glGetString(GL_RENDERER));
+    ok = replay(&file);
+
+    free(g_replay.read_pixels);
+    unmap_file(&file);
+    return !ok;
+}
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "memory.h"
+#include "file-util.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+#include "scene-file.h"
+
+static int in_file(
+    struct mapped_file const *file,
+    GLuint offset, GLuint count, size_t element_size, size_t alignment
+) {
+    if (offset % alignment != 0 || offset > file->size)
+        return 0;
+    return count <= (file->size - offset) / element_size;
+}
+
+/*
+ * Element indices are the one thing GL does not bounds-check for us, so
+ * they are checked here; this is a single pass over data that is about
+ * to be read for the upload anyway.
+ */
+static int check_mesh(struct scene_file const *scene, struct scene_file_mesh const *mesh)
+{
+    GLushort const *elements;
+    GLuint i;
+
+    if (!in_file(
+            &scene->file, mesh->vertex_offset, mesh->vertex_count,
+            sizeof(struct flag_vertex), SCENE_FILE_ALIGNMENT
+        )
+        || !in_file(
+            &scene->file, mesh->element_offset, mesh->element_count,
+            sizeof(GLushort), SCENE_FILE_ALIGNMENT
+        )
+        || mesh->texture >= scene->header->texture_count)
+        return 0;
+
+    elements = scene_mesh_elements(scene, mesh);
+    for (i = 0; i < mesh->element_count; ++i)
+        if (elements[i] >= mesh->vertex_count)
+            return 0;
+    return 1;
+}
+
+static int check_scene(struct scene_file *scene, const char *filename)
+{
+    struct scene_file_header const *header
+        = (struct scene_file_header const*)scene->file.data;
+    GLuint i;
+
+    if (scene->file.size < sizeof(struct scene_file_header)
+        || memcmp(header->magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC)) != 0) {
+        fprintf(stderr, "%s is not a scene file\n", filename);
+        return 0;
+    }
+    if (header->version != SCENE_FILE_VERSION
+        || header->vertex_size != sizeof(struct flag_vertex)) {
+        fprintf(stderr,
+            "%s is scene version %u with %u-byte vertices; expected version %u with %u\n",
+            filename, header->version, header->vertex_size,
+            SCENE_FILE_VERSION, (unsigned)sizeof(struct flag_vertex)
+        );
+        return 0;
+    }
+    if (!in_file(
+            &scene->file, header->meshes_offset, header->mesh_count,
+            sizeof(struct scene_file_mesh), sizeof(GLuint)
+        )
+        || !in_file(
+            &scene->file, header->instances_offset, header->instance_count,
+            sizeof(struct scene_file_instance), sizeof(GLuint)
+        )
+        || !in_file(
+            &scene->file, header->textures_offset, header->texture_count,
+            sizeof(struct scene_file_texture), 1
+        )) {
+        fprintf(stderr, "%s has truncated tables\n", filename);
+        return 0;
+    }
+
+    scene->header = header;
+    scene->meshes = (struct scene_file_mesh const*)
+        ((char const*)header + header->meshes_offset);
+    scene->instances = (struct scene_file_instance const*)
+        ((char const*)header + header->instances_offset);
+    scene->textures = (struct scene_file_texture const*)
+        ((char const*)header + header->textures_offset);
+
+    for (i = 0; i < header->texture_count; ++i)
+        if (memchr(scene->textures[i].path, '\0', SCENE_TEXTURE_PATH_SIZE) == NULL) {
+            fprintf(stderr, "%s has an unterminated texture path\n", filename);
+            return 0;
+        }
+    for (i = 0; i < header->mesh_count; ++i)
+        if (!check_mesh(scene, &scene->meshes[i])) {
+            fprintf(stderr, "%s has a corrupt mesh %u\n", filename, i);
+            return 0;
+        }
+    for (i = 0; i < header->instance_count; ++i)
+        if (scene->instances[i].mesh >= header->mesh_count) {
+            fprintf(stderr, "%s has an instance of a missing mesh\n", filename);
+            return 0;
+        }
+    return 1;
+}
+
+int open_scene_file(struct scene_file *out_scene, const char *filename)
+{
+    if (!map_file(&out_scene->file, filename))
+        return 0;
+    if (!check_scene(out_scene, filename)) {
+        unmap_file(&out_scene->file);
+        return 0;
+    }
+    return 1;
+}
+
+void close_scene_file(struct scene_file *scene)
+{
+    unmap_file(&scene->file);
+    scene->header = NULL;
+    scene->meshes = NULL;
+    scene->instances = NULL;
+    scene->textures = NULL;
+}
+
+struct flag_vertex const *scene_mesh_vertices(
+    struct scene_file const *scene, struct scene_file_mesh const *mesh
+) {
+    return (struct flag_vertex const*)
+        ((char const*)scene->file.data + mesh->vertex_offset);
+}
+
+GLushort const *scene_mesh_elements(
+    struct scene_file const *scene, struct scene_file_mesh const *mesh
+) {
+    return (GLushort const*)
+        ((char const*)scene->file.data + mesh->element_offset);
+}
@@ -0,0 +1,70 @@
+#define SCENE_FILE_MAGIC        "FLAGSCN"
+#define SCENE_FILE_VERSION      1
+#define SCENE_FILE_ALIGNMENT    64
+#define SCENE_TEXTURE_PATH_SIZE 60
+
+#define SCENE_INSTANCE_TRANSLUCENT 1
+
+/*
+ * Binary scene layout, in native byte order, written by make-scene:
+ *
+ *   header
+ *   meshes[mesh_count]
+ *   instances[instance_count]
+ *   textures[texture_count]
+ *   vertex and element data, each block SCENE_FILE_ALIGNMENT-aligned
+ *
+ * Offsets are in bytes from the start of the file. Vertex data is in
+ * struct flag_vertex layout and element data is GLushort, so a mapped
+ * file is handed to GL as it is. vertex_size guards against a file from
+ * a build with a different vertex layout.
+ *
+ * Meshes are in world space, since the renderer has no per-object
+ * transforms; an instance says which mesh is drawn, whether it is
+ * translucent and where its center is for depth sorting.
+ */
+struct scene_file_header {
+    char magic[8];
+    GLuint version, vertex_size;
+    GLuint mesh_count, instance_count, texture_count;
+    GLuint meshes_offset, instances_offset, textures_offset;
+    GLfloat bounds_lo[3], bounds_hi[3];
+};
+
+struct scene_file_mesh {
+    GLuint vertex_offset, vertex_count;
+    GLuint element_offset, element_count;
+    GLuint texture;
+};
+
+struct scene_file_instance {
+    GLuint mesh, flags;
+    GLfloat center[3];
+};
+
+struct scene_file_texture {
+    char path[SCENE_TEXTURE_PATH_SIZE];
+};
+
+struct scene_file {
+    struct mapped_file file;
+    struct scene_file_header const *header;
+    struct scene_file_mesh const *meshes;
+    struct scene_file_instance const *instances;
+    struct scene_file_texture const *textures;
+};
+
+/*
+ * Maps the file and checks that every table and data block lies within
+ * it and that every element index is in range for its mesh. Vertex data
+ * is not read.
+ */
+int open_scene_file(struct scene_file *out_scene, const char *filename);
+void close_scene_file(struct scene_file *scene);
+
+struct flag_vertex const *scene_mesh_vertices(
+    struct scene_file const *scene, struct scene_file_mesh const *mesh
+);
+GLushort const *scene_mesh_elements(
+    struct scene_file const *scene, struct scene_file_mesh const *mesh
+);
@@ -0,0 +1,10 @@
+#version 110
+
+uniform mat4 light_matrix;
+
+attribute vec3 position;
+
+void main()
+{
+    gl_Position = light_matrix * vec4(position, 1.0);
+}
@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdio.h>
+#include "gl-util.h"
+#include "memory.h"
+#include "gpu-resources.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+#include "vec-util.h"
+#include "shadows.h"
+#include "gl-capture.h"
+
+#define SHADOW_OFFSET_FACTOR 2.0f
+#define SHADOW_OFFSET_UNITS  4.0f
+
+/*
+ * Depth textures and comparison sampling are core since OpenGL 1.4; the
+ * framebuffer objects to render into them and blit between them are not.
+ */
+int shadow_maps_supported(void)
+{
+    return render_targets_supported();
+}
+
+static int make_depth_target(GLuint *out_texture, GLuint *out_framebuffer, GLsizei size)
+{
+    GLenum status;
+
+    glGenTextures(1, out_texture);
+    glBindTexture(GL_TEXTURE_2D, *out_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0,
+        GL_DEPTH_COMPONENT24,
+        size, size, 0,
+        GL_DEPTH_COMPONENT, GL_UNSIGNED_INT,
+        NULL
+    );
+    track_gpu_resource(GPU_TEXTURE, *out_texture, (size_t)size * size * 4, "shadow map");
+
+    glGenFramebuffers(1, out_framebuffer);
+    track_gpu_resource(GPU_FRAMEBUFFER, *out_framebuffer, 0, "shadow map");
+    glBindFramebuffer(GL_FRAMEBUFFER, *out_framebuffer);
+    glFramebufferTexture2D(
+        GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_TEXTURE_2D, *out_texture, 0
+    );
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Shadow map %dx%d incomplete: 0x%04x\n", size, size, status);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Project the corners of the bounding box onto the light's basis to find
+ * the tightest orthographic frustum around it. Texture space is clip
+ * space scaled and biased into [0, 1].
+ */
+static void update_light_matrices(
+    struct shadow_map *map,
+    GLfloat const *light_direction,
+    GLfloat const *bounds_lo, GLfloat const *bounds_hi
+) {
+    GLfloat
+        forward[3] = { light_direction[0], light_direction[1], light_direction[2] },
+        up[3] = { 0.0f, 0.0f, 1.0f },
+        right[3],
+        lo[3] = {  HUGE_VALF,  HUGE_VALF,  HUGE_VALF },
+        hi[3] = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF },
+        *axes[3] = { right, up, forward };
+    int corner, axis;
+
+    vec_normalize(forward);
+    if (fabsf(forward[2]) > 0.99f) {
+        up[1] = 1.0f;
+        up[2] = 0.0f;
+    }
+    vec_cross(right, forward, up);
+    vec_normalize(right);
+    vec_cross(up, right, forward);
+
+    for (corner = 0; corner < 8; ++corner) {
+        GLfloat p[3] = {
+            corner & 1 ? bounds_hi[0] : bounds_lo[0],
+            corner & 2 ? bounds_hi[1] : bounds_lo[1],
+            corner & 4 ? bounds_hi[2] : bounds_lo[2]
+        };
+        for (axis = 0; axis < 3; ++axis) {
+            GLfloat d = axes[axis][0]*p[0] + axes[axis][1]*p[1] + axes[axis][2]*p[2];
+            lo[axis] = fminf(lo[axis], d);
+            hi[axis] = fmaxf(hi[axis], d);
+        }
+    }
+
+    for (axis = 0; axis < 3; ++axis) {
+        GLfloat scale = 2.0f/(hi[axis] - lo[axis]);
+
+        map->light_matrix[ 0 + axis] = scale*axes[axis][0];
+        map->light_matrix[ 4 + axis] = scale*axes[axis][1];
+        map->light_matrix[ 8 + axis] = scale*axes[axis][2];
+        map->light_matrix[12 + axis] = -scale*lo[axis] - 1.0f;
+
+        map->matrix[ 0 + axis] = 0.5f*map->light_matrix[ 0 + axis];
+        map->matrix[ 4 + axis] = 0.5f*map->light_matrix[ 4 + axis];
+        map->matrix[ 8 + axis] = 0.5f*map->light_matrix[ 8 + axis];
+        map->matrix[12 + axis] = 0.5f*map->light_matrix[12 + axis] + 0.5f;
+    }
+    map->light_matrix[3] = map->light_matrix[7] = map->light_matrix[11] = 0.0f;
+    map->matrix[3] = map->matrix[7] = map->matrix[11] = 0.0f;
+    map->light_matrix[15] = map->matrix[15] = 1.0f;
+}
+
+static int make_shadow_program(struct shadow_map *map)
+{
+    map->program.vertex_shader = make_shader(GL_VERTEX_SHADER, "shadow.v.glsl");
+    if (map->program.vertex_shader == 0)
+        return 0;
+    map->program.fragment_shader = make_shader(GL_FRAGMENT_SHADER, "shadow.f.glsl");
+    if (map->program.fragment_shader == 0)
+        return 0;
+
+    map->program.program
+        = make_program(map->program.vertex_shader, map->program.fragment_shader);
+    if (map->program.program == 0)
+        return 0;
+
+    map->program.light_matrix
+        = glGetUniformLocation(map->program.program, "light_matrix");
+    map->program.position
+        = glGetAttribLocation(map->program.program, "position");
+    return 1;
+}
+
+int make_shadow_map(
+    struct shadow_map *out_map, GLsizei size,
+    GLfloat const *light_direction,
+    GLfloat const *bounds_lo, GLfloat const *bounds_hi
+) {
+    out_map->static_depth = out_map->depth = 0;
+    out_map->static_framebuffer = out_map->framebuffer = 0;
+    out_map->size = 0;
+    out_map->static_valid = 0;
+    update_light_matrices(out_map, light_direction, bounds_lo, bounds_hi);
+
+    if (!make_shadow_program(out_map))
+        return 0;
+    if (!make_depth_target(&out_map->static_depth, &out_map->static_framebuffer, size)
+        || !make_depth_target(&out_map->depth, &out_map->framebuffer, size)) {
+        delete_shadow_map(out_map);
+        return 0;
+    }
+    out_map->size = size;
+    return 1;
+}
+
+void delete_shadow_map(struct shadow_map *map)
+{
+    glDeleteFramebuffers(1, &map->static_framebuffer);
+    glDeleteFramebuffers(1, &map->framebuffer);
+    glDeleteTextures(1, &map->static_depth);
+    glDeleteTextures(1, &map->depth);
+    glDetachShader(map->program.program, map->program.vertex_shader);
+    glDetachShader(map->program.program, map->program.fragment_shader);
+    glDeleteProgram(map->program.program);
+    glDeleteShader(map->program.vertex_shader);
+    glDeleteShader(map->program.fragment_shader);
+    untrack_gpu_resource(GPU_FRAMEBUFFER, map->static_framebuffer);
+    untrack_gpu_resource(GPU_FRAMEBUFFER, map->framebuffer);
+    untrack_gpu_resource(GPU_TEXTURE, map->static_depth);
+    untrack_gpu_resource(GPU_TEXTURE, map->depth);
+    untrack_gpu_resource(GPU_PROGRAM, map->program.program);
+    untrack_gpu_resource(GPU_SHADER, map->program.vertex_shader);
+    untrack_gpu_resource(GPU_SHADER, map->program.fragment_shader);
+    map->size = 0;
+    map->static_valid = 0;
+}
+
+static void render_shadow_caster(struct shadow_map const *map, struct flag_mesh const *mesh)
+{
+    if (mesh->deformed_buffer) {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->deformed_buffer);
+        glVertexAttribPointer(
+            map->program.position,
+            3, GL_FLOAT, GL_FALSE, sizeof(struct deformed_vertex),
+            (void*)offsetof(struct deformed_vertex, position)
+        );
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
+        glVertexAttribPointer(
+            map->program.position,
+            3, GL_FLOAT, GL_FALSE, sizeof(struct flag_vertex),
+            (void*)offsetof(struct flag_vertex, position)
+        );
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->element_buffer);
+    draw_mesh(mesh);
+}
+
+/*
+ * Both sides of the flag cast shadows, so culling is off for the pass.
+ * The cached static depth is copied with a blit rather than redrawn.
+ */
+void update_shadow_map(
+    struct shadow_map *map,
+    struct flag_mesh const *static_meshes, int static_mesh_count,
+    struct flag_mesh const *dynamic_mesh
+) {
+    int i;
+
+    glUseProgram(map->program.program);
+    glUniformMatrix4fv(map->program.light_matrix, 1, GL_FALSE, map->light_matrix);
+    glEnableVertexAttribArray(map->program.position);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(SHADOW_OFFSET_FACTOR, SHADOW_OFFSET_UNITS);
+    glViewport(0, 0, map->size, map->size);
+
+    if (!map->static_valid) {
+        glBindFramebuffer(GL_FRAMEBUFFER, map->static_framebuffer);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        for (i = 0; i < static_mesh_count; ++i)
+            render_shadow_caster(map, &static_meshes[i]);
+        map->static_valid = 1;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, map->static_framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, map->framebuffer);
+    glBlitFramebuffer(
+        0, 0, map->size, map->size,
+        0, 0, map->size, map->size,
+        GL_DEPTH_BUFFER_BIT, GL_NEAREST
+    );
+
+    glBindFramebuffer(GL_FRAMEBUFFER, map->framebuffer);
+    render_shadow_caster(map, dynamic_mesh);
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_CULL_FACE);
+    glDisableVertexAttribArray(map->program.position);
+}
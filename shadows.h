@@ -0,0 +1,44 @@
+/*
+ * Shadow map for the scene's single directional light. The static
+ * background never moves relative to the light, so its depth is rendered
+ * once into a cached map; each frame that cache is copied into the map
+ * that is sampled, and only the animated meshes are drawn over it.
+ */
+struct shadow_map {
+    GLuint static_depth, static_framebuffer;
+    GLuint depth, framebuffer;
+    GLsizei size;
+    int static_valid;
+
+    GLfloat light_matrix[16];   /* model space to light clip space */
+    GLfloat matrix[16];         /* model space to shadow map texture space */
+
+    struct {
+        GLuint vertex_shader, fragment_shader, program;
+        GLint light_matrix, position;
+    } program;
+};
+
+int shadow_maps_supported(void);
+
+/*
+ * light_direction is the direction the light travels in, and bounds_lo
+ * and bounds_hi are the corners of a box around everything that casts or
+ * receives shadows; the light's orthographic frustum is fitted to it.
+ */
+int make_shadow_map(
+    struct shadow_map *out_map, GLsizei size,
+    GLfloat const *light_direction,
+    GLfloat const *bounds_lo, GLfloat const *bounds_hi
+);
+void delete_shadow_map(struct shadow_map *map);
+
+/*
+ * Leaves the shadow map's framebuffer bound; the caller rebinds its own
+ * framebuffer and viewport afterward.
+ */
+void update_shadow_map(
+    struct shadow_map *map,
+    struct flag_mesh const *static_meshes, int static_mesh_count,
+    struct flag_mesh const *dynamic_mesh
+);
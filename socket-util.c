@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "socket-util.h"
+
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+int open_listen_socket(const char *address)
+{
+    /* anything with a slash is a path, even if it also has a colon */
+    const char *colon = strchr(address, '/') ? NULL : strrchr(address, ':');
+    int fd;
+
+    if (colon) {
+        struct sockaddr_in addr;
+        int reuse = 1;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((unsigned short)atoi(colon + 1));
+        if (colon == address)
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        else {
+            char host[64];
+            size_t length = (size_t)(colon - address);
+            if (length >= sizeof(host))
+                length = sizeof(host) - 1;
+            memcpy(host, address, length);
+            host[length] = '\0';
+            if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+                fprintf(stderr, "Invalid address %s\n", address);
+                return -1;
+            }
+        }
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror(address);
+            close(fd);
+            return -1;
+        }
+    } else {
+        struct sockaddr_un addr;
+
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path %s is too long\n", address);
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("socket");
+            return -1;
+        }
+        unlink(address);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            perror(address);
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, 8) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+#endif
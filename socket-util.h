@@ -0,0 +1,7 @@
+/*
+ * Returns a nonblocking socket listening on address, or -1 with a
+ * message. address is a unix socket path, or [host]:port for TCP,
+ * listening on the loopback interface if no host is given. An address
+ * containing '/' is always a path. Not available on Windows.
+ */
+int open_listen_socket(const char *address);
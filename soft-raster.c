@@ -0,0 +1,942 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "thread-util.h"
+#include "job-pool.h"
+#include "memory.h"
+#include "frame-clock.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+#include "soft-raster.h"
+#include "gl-capture.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define SOFT_SSE
+#endif
+
+#define VERTICES_PER_JOB        4096
+#define TRIANGLES_PER_JOB       1024
+#define INITIAL_BIN_CAPACITY    64
+#define TILE_PIXELS             (SOFT_TILE_SIZE*SOFT_TILE_SIZE)
+/* texel indices are computed in floats, which hold integers exactly to 2^24 */
+#define MAX_SOFT_TEXELS         (1 << 24)
+
+/* must match flag.f.glsl */
+#define LIGHT_DIFFUSE   0.8f
+#define LIGHT_AMBIENT   0.2f
+#define LIGHT_SPECULAR  1.0f
+
+/*
+ * What flag.v.glsl passes to flag.f.glsl: the eye-space position and
+ * normal, the texcoord, shininess and specular color.
+ */
+enum {
+    ATTR_POSITION   = 0,
+    ATTR_NORMAL     = 3,
+    ATTR_TEXCOORD   = 6,
+    ATTR_SHININESS  = 8,
+    ATTR_SPECULAR   = 9,
+    ATTR_COUNT      = 13
+};
+
+/* depth and 1/w are interpolated linearly in screen space, attributes as a/w */
+enum {
+    PLANE_DEPTH     = 0,
+    PLANE_INV_W     = 1,
+    PLANE_ATTRS     = 2,
+    PLANE_COUNT     = PLANE_ATTRS + ATTR_COUNT
+};
+
+struct soft_vertex {
+    GLfloat clip[4];
+    GLfloat attrs[ATTR_COUNT];
+};
+
+/*
+ * Each plane and edge function is a*x + b*y + c at a pixel center. A
+ * pixel is inside where all three edges are greater than their bias,
+ * which is just below zero for top and left edges so that pixels on an
+ * edge shared by two triangles are drawn once.
+ */
+struct soft_triangle {
+    GLfloat edges[3][3], biases[3];
+    GLfloat planes[PLANE_COUNT][3];
+    int bounds[4];      /* x_min, y_min, x_max, y_max, inclusive */
+    int mesh;
+};
+
+struct soft_bin {
+    int *triangles;
+    int count, capacity;
+};
+
+struct tile_buffer {
+    GLuint color[TILE_PIXELS];
+    GLfloat depth[TILE_PIXELS];
+};
+
+int make_soft_texture(struct soft_texture *out_texture, void const *bgr_pixels, int width, int height)
+{
+    unsigned char const *bgr = (unsigned char const*)bgr_pixels;
+    int i;
+
+    if ((size_t)width * height > MAX_SOFT_TEXELS) {
+        fprintf(stderr, "%dx%d is too large for a software texture\n", width, height);
+        return 0;
+    }
+    out_texture->texels = (GLubyte*) memory_alloc((size_t)width * height * 4, MEMORY_RASTER);
+    if (!out_texture->texels)
+        return 0;
+    out_texture->width = width;
+    out_texture->height = height;
+    for (i = 0; i < width * height; ++i) {
+        out_texture->texels[i*4 + 0] = bgr[i*3 + 2];
+        out_texture->texels[i*4 + 1] = bgr[i*3 + 1];
+        out_texture->texels[i*4 + 2] = bgr[i*3 + 0];
+        out_texture->texels[i*4 + 3] = 255;
+    }
+    return 1;
+}
+
+void delete_soft_texture(struct soft_texture *texture)
+{
+    memory_free(texture->texels);
+    texture->texels = NULL;
+}
+
+int make_soft_raster(struct soft_raster *out_raster, int worker_count)
+{
+    memset(out_raster, 0, sizeof(struct soft_raster));
+    out_raster->worker_count = worker_count;
+    out_raster->tile_buffers = memory_alloc(
+        (size_t)worker_count * sizeof(struct tile_buffer), MEMORY_RASTER
+    );
+    return out_raster->tile_buffers != NULL;
+}
+
+static void delete_bins(struct soft_raster *raster)
+{
+    int i;
+
+    for (i = 0; i < raster->bin_capacity; ++i)
+        memory_free(raster->bins[i].triangles);
+    memory_free(raster->bins);
+    raster->bins = NULL;
+    raster->bin_capacity = 0;
+}
+
+void delete_soft_raster(struct soft_raster *raster)
+{
+    delete_bins(raster);
+    memory_free(raster->pixels);
+    memory_free(raster->vertices);
+    memory_free(raster->triangles);
+    memory_free(raster->tile_buffers);
+    memset(raster, 0, sizeof(struct soft_raster));
+}
+
+/*
+ * Everything a frame needs is allocated up front and kept for the next,
+ * so that the jobs only allocate when a bin outgrows its array.
+ */
+static int reserve_frame(
+    struct soft_raster *raster, GLsizei width, GLsizei height,
+    int vertex_count, int triangle_count
+) {
+    int tiles_x = (width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE,
+        tiles_y = (height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE,
+        i;
+
+    if (width != raster->width || height != raster->height) {
+        memory_free(raster->pixels);
+        raster->pixels = (GLuint*) memory_alloc((size_t)width * height * sizeof(GLuint), MEMORY_RASTER);
+        if (!raster->pixels) {
+            raster->width = raster->height = 0;
+            return 0;
+        }
+        raster->width = width;
+        raster->height = height;
+    }
+
+    if (tiles_x * tiles_y * MAX_SOFT_SETUP_JOBS > raster->bin_capacity) {
+        int bin_count = tiles_x * tiles_y * MAX_SOFT_SETUP_JOBS;
+
+        delete_bins(raster);
+        raster->bins = (struct soft_bin*) memory_alloc(
+            (size_t)bin_count * sizeof(struct soft_bin), MEMORY_RASTER
+        );
+        if (!raster->bins)
+            return 0;
+        for (i = 0; i < bin_count; ++i) {
+            raster->bins[i].triangles = NULL;
+            raster->bins[i].count = raster->bins[i].capacity = 0;
+        }
+        raster->bin_capacity = bin_count;
+    }
+    raster->tiles_x = tiles_x;
+    raster->tiles_y = tiles_y;
+
+    if (vertex_count > raster->vertex_capacity) {
+        memory_free(raster->vertices);
+        raster->vertex_capacity = 0;
+        raster->vertices = (struct soft_vertex*) memory_alloc(
+            (size_t)vertex_count * sizeof(struct soft_vertex), MEMORY_RASTER
+        );
+        if (!raster->vertices)
+            return 0;
+        raster->vertex_capacity = vertex_count;
+    }
+
+    /* clipping against the near plane can make two triangles of one */
+    if (2 * triangle_count > raster->triangle_capacity) {
+        memory_free(raster->triangles);
+        raster->triangle_capacity = 0;
+        raster->triangles = (struct soft_triangle*) memory_alloc(
+            (size_t)2 * triangle_count * sizeof(struct soft_triangle), MEMORY_RASTER
+        );
+        if (!raster->triangles)
+            return 0;
+        raster->triangle_capacity = 2 * triangle_count;
+    }
+    return 1;
+}
+
+static void transform_vertex(
+    struct soft_raster const *raster,
+    struct flag_vertex const *vertex, struct soft_vertex *out
+) {
+    GLfloat const *mv = raster->mv_matrix, *p = raster->p_matrix;
+    GLfloat eye[3];
+    int i;
+
+    for (i = 0; i < 3; ++i) {
+        eye[i] = mv[i]*vertex->position[0] + mv[4 + i]*vertex->position[1]
+            + mv[8 + i]*vertex->position[2] + mv[12 + i];
+        out->attrs[ATTR_NORMAL + i] = mv[i]*vertex->normal[0]
+            + mv[4 + i]*vertex->normal[1] + mv[8 + i]*vertex->normal[2];
+        out->attrs[ATTR_POSITION + i] = eye[i];
+    }
+    for (i = 0; i < 4; ++i)
+        out->clip[i] = p[i]*eye[0] + p[4 + i]*eye[1] + p[8 + i]*eye[2] + p[12 + i];
+
+    out->attrs[ATTR_TEXCOORD + 0] = vertex->texcoord[0];
+    out->attrs[ATTR_TEXCOORD + 1] = vertex->texcoord[1];
+    out->attrs[ATTR_SHININESS] = vertex->shininess;
+    for (i = 0; i < 4; ++i)
+        out->attrs[ATTR_SPECULAR + i] = (GLfloat)vertex->specular[i] * (1.0f/255.0f);
+}
+
+static void transform_job(int job, int worker, void *data)
+{
+    struct soft_raster *raster = (struct soft_raster*)data;
+    int first = job * VERTICES_PER_JOB,
+        end = first + VERTICES_PER_JOB,
+        i, mesh = 0;
+
+    if (end > raster->vertex_offsets[raster->mesh_count])
+        end = raster->vertex_offsets[raster->mesh_count];
+    for (i = first; i < end; ++i) {
+        while (i >= raster->vertex_offsets[mesh + 1])
+            ++mesh;
+        transform_vertex(
+            raster,
+            &raster->meshes[mesh].vertices[i - raster->vertex_offsets[mesh]],
+            &raster->vertices[i]
+        );
+    }
+}
+
+static int push_bin(struct soft_raster *raster, struct soft_bin *bin, int triangle)
+{
+    if (bin->count == bin->capacity) {
+        int capacity = bin->capacity ? bin->capacity * 2 : INITIAL_BIN_CAPACITY;
+        int *triangles = (int*) memory_alloc((size_t)capacity * sizeof(int), MEMORY_RASTER);
+
+        if (!triangles) {
+            raster->failed = 1;
+            return 0;
+        }
+        if (bin->count)
+            memcpy(triangles, bin->triangles, (size_t)bin->count * sizeof(int));
+        memory_free(bin->triangles);
+        bin->triangles = triangles;
+        bin->capacity = capacity;
+    }
+    bin->triangles[bin->count++] = triangle;
+    return 1;
+}
+
+static void set_plane(
+    GLfloat *plane, GLfloat const *x, GLfloat const *y, GLfloat inv_area,
+    GLfloat f0, GLfloat f1, GLfloat f2
+) {
+    plane[0] = ((f1 - f0)*(y[2] - y[0]) - (f2 - f0)*(y[1] - y[0])) * inv_area;
+    plane[1] = ((f2 - f0)*(x[1] - x[0]) - (f1 - f0)*(x[2] - x[0])) * inv_area;
+    plane[2] = f0 - plane[0]*x[0] - plane[1]*y[0];
+}
+
+/*
+ * Takes a triangle already clipped to the near plane to the screen, and
+ * bins it if it faces the camera and covers any pixel centers. Returns
+ * 1 if it was kept.
+ */
+static int setup_triangle(
+    struct soft_raster *raster, int job, int slot, int mesh,
+    struct soft_vertex const *const *vertices
+) {
+    struct soft_triangle *triangle = &raster->triangles[slot];
+    GLfloat x[3], y[3], z[3], inv_w[3], area, inv_area, lo, hi;
+    int i, j, tile_x, tile_y, tile_count = raster->tiles_x * raster->tiles_y;
+    int *bounds = triangle->bounds;
+
+    for (i = 0; i < 3; ++i) {
+        GLfloat const *clip = vertices[i]->clip;
+        inv_w[i] = 1.0f / clip[3];
+        x[i] = (clip[0]*inv_w[i]*0.5f + 0.5f) * (GLfloat)raster->width;
+        y[i] = (clip[1]*inv_w[i]*0.5f + 0.5f) * (GLfloat)raster->height;
+        z[i] = clip[2]*inv_w[i]*0.5f + 0.5f;
+    }
+
+    /* counterclockwise is front-facing; this also drops degenerate triangles */
+    area = (x[1] - x[0])*(y[2] - y[0]) - (x[2] - x[0])*(y[1] - y[0]);
+    if (!(area > 0.0f))
+        return 0;
+
+    /* the pixels whose centers fall within the bounding box */
+    lo = fmaxf(fminf(fminf(x[0], x[1]), x[2]) - 0.5f, 0.0f);
+    hi = fminf(fmaxf(fmaxf(x[0], x[1]), x[2]) - 0.5f, (GLfloat)(raster->width - 1));
+    bounds[0] = (int)ceilf(lo);
+    bounds[2] = (int)floorf(hi);
+    lo = fmaxf(fminf(fminf(y[0], y[1]), y[2]) - 0.5f, 0.0f);
+    hi = fminf(fmaxf(fmaxf(y[0], y[1]), y[2]) - 0.5f, (GLfloat)(raster->height - 1));
+    bounds[1] = (int)ceilf(lo);
+    bounds[3] = (int)floorf(hi);
+    if (bounds[0] > bounds[2] || bounds[1] > bounds[3])
+        return 0;
+
+    for (i = 0; i < 3; ++i) {
+        int next = i == 2 ? 0 : i + 1;
+        GLfloat ex = x[next] - x[i], ey = y[next] - y[i];
+
+        triangle->edges[i][0] = -ey;
+        triangle->edges[i][1] = ex;
+        triangle->edges[i][2] = ey*x[i] - ex*y[i];
+        triangle->biases[i] = ey < 0.0f || (ey == 0.0f && ex < 0.0f) ? -FLT_MIN : 0.0f;
+    }
+
+    inv_area = 1.0f / area;
+    set_plane(triangle->planes[PLANE_DEPTH], x, y, inv_area, z[0], z[1], z[2]);
+    set_plane(triangle->planes[PLANE_INV_W], x, y, inv_area, inv_w[0], inv_w[1], inv_w[2]);
+    for (i = 0; i < ATTR_COUNT; ++i)
+        set_plane(
+            triangle->planes[PLANE_ATTRS + i], x, y, inv_area,
+            vertices[0]->attrs[i] * inv_w[0],
+            vertices[1]->attrs[i] * inv_w[1],
+            vertices[2]->attrs[i] * inv_w[2]
+        );
+    triangle->mesh = mesh;
+
+    for (tile_y = bounds[1] / SOFT_TILE_SIZE; tile_y <= bounds[3] / SOFT_TILE_SIZE; ++tile_y)
+        for (tile_x = bounds[0] / SOFT_TILE_SIZE; tile_x <= bounds[2] / SOFT_TILE_SIZE; ++tile_x) {
+            j = tile_y * raster->tiles_x + tile_x;
+            if (!push_bin(raster, &raster->bins[job * tile_count + j], slot))
+                return 1;
+        }
+    return 1;
+}
+
+static void lerp_vertex(
+    struct soft_vertex const *a, struct soft_vertex const *b, GLfloat t,
+    struct soft_vertex *out
+) {
+    int i;
+
+    for (i = 0; i < 4; ++i)
+        out->clip[i] = a->clip[i] + (b->clip[i] - a->clip[i])*t;
+    for (i = 0; i < ATTR_COUNT; ++i)
+        out->attrs[i] = a->attrs[i] + (b->attrs[i] - a->attrs[i])*t;
+}
+
+/*
+ * Clips to z >= -w, leaving 0, 3 or 4 vertices. Nothing in front of the
+ * near plane can be behind the eye, so no other plane is needed: the
+ * rest are handled by the bounding box and the depth test.
+ */
+static int clip_near(struct soft_vertex const *const *in, struct soft_vertex *out)
+{
+    int i, count = 0;
+
+    for (i = 0; i < 3; ++i) {
+        struct soft_vertex const *a = in[i], *b = in[i == 2 ? 0 : i + 1];
+        GLfloat
+            da = a->clip[2] + a->clip[3],
+            db = b->clip[2] + b->clip[3];
+
+        if (da >= 0.0f)
+            out[count++] = *a;
+        if ((da >= 0.0f) != (db >= 0.0f))
+            lerp_vertex(a, b, da / (da - db), &out[count++]);
+    }
+    return count;
+}
+
+/*
+ * Each setup job takes a contiguous run of triangles and bins them into
+ * its own row of bins, so that the tiles can replay every row in job
+ * order and draw triangles in the order they were submitted.
+ */
+static void setup_job(int job, int worker, void *data)
+{
+    struct soft_raster *raster = (struct soft_raster*)data;
+    int tile_count = raster->tiles_x * raster->tiles_y,
+        total = raster->triangle_offsets[raster->mesh_count],
+        per_job = (total + raster->setup_jobs - 1) / raster->setup_jobs,
+        first = job * per_job,
+        end = first + per_job < total ? first + per_job : total,
+        i, t, mesh = 0, kept = 0;
+
+    for (i = 0; i < tile_count; ++i)
+        raster->bins[job * tile_count + i].count = 0;
+
+    for (t = first; t < end; ++t) {
+        struct soft_vertex const *vertices[3];
+        GLushort const *elements;
+        GLfloat w_sign;
+
+        while (t >= raster->triangle_offsets[mesh + 1])
+            ++mesh;
+        elements = &raster->meshes[mesh].elements[(t - raster->triangle_offsets[mesh]) * 3];
+        for (i = 0; i < 3; ++i)
+            vertices[i] = &raster->vertices[raster->vertex_offsets[mesh] + elements[i]];
+
+        w_sign = fminf(
+            fminf(vertices[0]->clip[2] + vertices[0]->clip[3],
+                  vertices[1]->clip[2] + vertices[1]->clip[3]),
+            vertices[2]->clip[2] + vertices[2]->clip[3]
+        );
+        if (w_sign >= 0.0f) {
+            kept += setup_triangle(raster, job, 2*t, mesh, vertices);
+        } else {
+            struct soft_vertex clipped[4];
+            struct soft_vertex const *fan[3];
+            int count = clip_near(vertices, clipped);
+
+            if (count >= 3) {
+                fan[0] = &clipped[0]; fan[1] = &clipped[1]; fan[2] = &clipped[2];
+                kept += setup_triangle(raster, job, 2*t, mesh, fan);
+            }
+            if (count == 4) {
+                fan[1] = &clipped[2]; fan[2] = &clipped[3];
+                kept += setup_triangle(raster, job, 2*t + 1, mesh, fan);
+            }
+        }
+    }
+    raster->job_triangles[job] = kept;
+}
+
+/*
+ * pow(-dot(reflect(L, N), eye), shininess), skipped where the specular
+ * color is black, which is everywhere but the flagpole. A negative base
+ * is undefined in GLSL; drivers give 0 after the max, and so does this.
+ */
+static GLfloat specular_factor(
+    GLfloat const *eye_light, GLfloat const *normal, GLfloat n_dot_l,
+    GLfloat const *eye, GLfloat shininess
+) {
+    GLfloat r[3], r_dot_e;
+    int i;
+
+    for (i = 0; i < 3; ++i)
+        r[i] = eye_light[i] - 2.0f*n_dot_l*normal[i];
+    r_dot_e = -(r[0]*eye[0] + r[1]*eye[1] + r[2]*eye[2]);
+    return r_dot_e > 0.0f ? powf(r_dot_e, shininess) * LIGHT_SPECULAR : 0.0f;
+}
+
+#ifdef SOFT_SSE
+static __m128 plane_at(GLfloat const *plane, __m128 px, __m128 py)
+{
+    return _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), px), _mm_mul_ps(_mm_set1_ps(plane[1]), py)),
+        _mm_set1_ps(plane[2])
+    );
+}
+
+static __m128 inverse_length(__m128 x, __m128 y, __m128 z)
+{
+    return _mm_div_ps(
+        _mm_set1_ps(1.0f),
+        _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)))
+    );
+}
+
+/* floor, for values no less than -1 */
+static __m128 floor_from_minus_one(__m128 x)
+{
+    __m128 one = _mm_set1_ps(1.0f);
+    return _mm_sub_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_add_ps(x, one))), one);
+}
+
+static __m128 texel_channel(GLuint const *texels, int channel)
+{
+    __m128i packed = _mm_loadu_si128((__m128i const*)texels);
+    return _mm_cvtepi32_ps(_mm_and_si128(
+        _mm_srl_epi32(packed, _mm_cvtsi32_si128(8*channel)),
+        _mm_set1_epi32(0xff)
+    ));
+}
+
+/*
+ * GL_LINEAR with GL_CLAMP_TO_EDGE at four texcoords at once. SSE2 has
+ * no gather, so only the fetches go lane by lane. Lanes outside the triangle can hold
+ * anything, NaN included; max and min turn that into an edge texel.
+ */
+static void sample_texture4(struct soft_texture const *texture, __m128 s, __m128 t, __m128 *out)
+{
+    __m128
+        zero = _mm_setzero_ps(),
+        one = _mm_set1_ps(1.0f),
+        half = _mm_set1_ps(0.5f),
+        width = _mm_set1_ps((GLfloat)texture->width),
+        height = _mm_set1_ps((GLfloat)texture->height),
+        max_x = _mm_set1_ps((GLfloat)(texture->width - 1)),
+        max_y = _mm_set1_ps((GLfloat)(texture->height - 1)),
+        u, v, x0, y0, x1, y1, fu, fv, row0, row1;
+    GLint indices[4][4];
+    GLuint texels[4][4];
+    int corner, lane, c;
+
+    u = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(s, width), half), _mm_set1_ps(-1.0f)), width);
+    v = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(t, height), half), _mm_set1_ps(-1.0f)), height);
+    x0 = floor_from_minus_one(u);
+    y0 = floor_from_minus_one(v);
+    fu = _mm_sub_ps(u, x0);
+    fv = _mm_sub_ps(v, y0);
+    x1 = _mm_min_ps(_mm_max_ps(_mm_add_ps(x0, one), zero), max_x);
+    y1 = _mm_min_ps(_mm_max_ps(_mm_add_ps(y0, one), zero), max_y);
+    x0 = _mm_min_ps(_mm_max_ps(x0, zero), max_x);
+    y0 = _mm_min_ps(_mm_max_ps(y0, zero), max_y);
+
+    /* exact in floats since make_soft_texture keeps textures to MAX_SOFT_TEXELS */
+    row0 = _mm_mul_ps(y0, width);
+    row1 = _mm_mul_ps(y1, width);
+    _mm_storeu_si128((__m128i*)indices[0], _mm_cvttps_epi32(_mm_add_ps(row0, x0)));
+    _mm_storeu_si128((__m128i*)indices[1], _mm_cvttps_epi32(_mm_add_ps(row0, x1)));
+    _mm_storeu_si128((__m128i*)indices[2], _mm_cvttps_epi32(_mm_add_ps(row1, x0)));
+    _mm_storeu_si128((__m128i*)indices[3], _mm_cvttps_epi32(_mm_add_ps(row1, x1)));
+    for (corner = 0; corner < 4; ++corner)
+        for (lane = 0; lane < 4; ++lane)
+            memcpy(
+                &texels[corner][lane],
+                &texture->texels[indices[corner][lane] * 4],
+                sizeof(GLuint)
+            );
+
+    for (c = 0; c < 4; ++c) {
+        __m128
+            t00 = texel_channel(texels[0], c), t10 = texel_channel(texels[1], c),
+            t01 = texel_channel(texels[2], c), t11 = texel_channel(texels[3], c),
+            bottom = _mm_add_ps(t00, _mm_mul_ps(_mm_sub_ps(t10, t00), fu)),
+            top = _mm_add_ps(t01, _mm_mul_ps(_mm_sub_ps(t11, t01), fu));
+        out[c] = _mm_mul_ps(
+            _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(top, bottom), fv)),
+            _mm_set1_ps(1.0f/255.0f)
+        );
+    }
+}
+
+/* to GL_UNSIGNED_INT_8_8_8_8_REV, clamped; NaN becomes 0 */
+static __m128i pack_colors(__m128 const *rgba)
+{
+    __m128i packed = _mm_setzero_si128();
+    int c;
+
+    for (c = 0; c < 4; ++c) {
+        __m128 clamped = _mm_min_ps(_mm_max_ps(rgba[c], _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        __m128i byte = _mm_cvttps_epi32(
+            _mm_add_ps(_mm_mul_ps(clamped, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f))
+        );
+        packed = _mm_or_si128(packed, _mm_sll_epi32(byte, _mm_cvtsi32_si128(8*c)));
+    }
+    return packed;
+}
+
+/*
+ * Four pixels of a row at once, in the tile's aligned groups of four.
+ * Only the specular term goes lane by lane, and only where there is a
+ * specular color.
+ */
+static void raster_triangle(
+    struct soft_raster const *raster, struct soft_triangle const *triangle,
+    struct tile_buffer *buffer, int tile_x0, int tile_y0
+) {
+    struct soft_texture const *texture = raster->meshes[triangle->mesh].texture;
+    int x_min = triangle->bounds[0] > tile_x0 ? triangle->bounds[0] : tile_x0,
+        y_min = triangle->bounds[1] > tile_y0 ? triangle->bounds[1] : tile_y0,
+        x_max = triangle->bounds[2] < tile_x0 + SOFT_TILE_SIZE - 1
+            ? triangle->bounds[2] : tile_x0 + SOFT_TILE_SIZE - 1,
+        y_max = triangle->bounds[3] < tile_y0 + SOFT_TILE_SIZE - 1
+            ? triangle->bounds[3] : tile_y0 + SOFT_TILE_SIZE - 1,
+        x_start = tile_x0 + ((x_min - tile_x0) & ~3),
+        x, y, i, lane;
+    __m128
+        lane_offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f),
+        left = _mm_set1_ps((GLfloat)x_min),
+        right = _mm_set1_ps((GLfloat)x_max + 1.0f),
+        zero = _mm_setzero_ps(),
+        one = _mm_set1_ps(1.0f),
+        light[3];
+
+    for (i = 0; i < 3; ++i)
+        light[i] = _mm_set1_ps(raster->eye_light[i]);
+
+    for (y = y_min; y <= y_max; ++y) {
+        __m128 py = _mm_set1_ps((GLfloat)y + 0.5f);
+        int row = (y - tile_y0) * SOFT_TILE_SIZE - tile_x0;
+
+        for (x = x_start; x <= x_max; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps((GLfloat)x), lane_offsets);
+            __m128 mask = _mm_and_ps(_mm_cmpgt_ps(px, left), _mm_cmplt_ps(px, right));
+            __m128 z, old_z, w, attrs[ATTR_COUNT], n_len, e_len, n_dot_l, diffuse;
+            __m128 specular, any_specular, tex[4], rgba[4];
+            __m128i covered, old_color;
+            int bits, specular_bits;
+
+            for (i = 0; i < 3; ++i)
+                mask = _mm_and_ps(mask, _mm_cmpgt_ps(
+                    plane_at(triangle->edges[i], px, py), _mm_set1_ps(triangle->biases[i])
+                ));
+            if (!_mm_movemask_ps(mask))
+                continue;
+
+            z = plane_at(triangle->planes[PLANE_DEPTH], px, py);
+            old_z = _mm_load_ps(&buffer->depth[row + x]);
+            mask = _mm_and_ps(mask, _mm_cmplt_ps(z, old_z));
+            bits = _mm_movemask_ps(mask);
+            if (!bits)
+                continue;
+            _mm_store_ps(
+                &buffer->depth[row + x],
+                _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, old_z))
+            );
+
+            w = _mm_div_ps(one, plane_at(triangle->planes[PLANE_INV_W], px, py));
+            for (i = 0; i < ATTR_COUNT; ++i)
+                attrs[i] = _mm_mul_ps(plane_at(triangle->planes[PLANE_ATTRS + i], px, py), w);
+
+            n_len = inverse_length(attrs[ATTR_NORMAL], attrs[ATTR_NORMAL + 1], attrs[ATTR_NORMAL + 2]);
+            e_len = inverse_length(attrs[ATTR_POSITION], attrs[ATTR_POSITION + 1], attrs[ATTR_POSITION + 2]);
+            for (i = 0; i < 3; ++i) {
+                attrs[ATTR_NORMAL + i] = _mm_mul_ps(attrs[ATTR_NORMAL + i], n_len);
+                attrs[ATTR_POSITION + i] = _mm_mul_ps(attrs[ATTR_POSITION + i], e_len);
+            }
+            n_dot_l = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(attrs[ATTR_NORMAL], light[0]),
+                           _mm_mul_ps(attrs[ATTR_NORMAL + 1], light[1])),
+                _mm_mul_ps(attrs[ATTR_NORMAL + 2], light[2])
+            );
+            diffuse = _mm_add_ps(
+                _mm_mul_ps(_mm_max_ps(_mm_sub_ps(zero, n_dot_l), zero), _mm_set1_ps(LIGHT_DIFFUSE)),
+                _mm_set1_ps(LIGHT_AMBIENT)
+            );
+
+            specular = zero;
+            any_specular = _mm_max_ps(
+                _mm_max_ps(attrs[ATTR_SPECULAR], attrs[ATTR_SPECULAR + 1]),
+                _mm_max_ps(attrs[ATTR_SPECULAR + 2], attrs[ATTR_SPECULAR + 3])
+            );
+            specular_bits = bits & _mm_movemask_ps(_mm_cmpgt_ps(any_specular, zero));
+            if (specular_bits) {
+                GLfloat lanes[8][4], factors[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+                for (i = 0; i < 3; ++i) {
+                    _mm_storeu_ps(lanes[i], attrs[ATTR_NORMAL + i]);
+                    _mm_storeu_ps(lanes[3 + i], attrs[ATTR_POSITION + i]);
+                }
+                _mm_storeu_ps(lanes[6], attrs[ATTR_SHININESS]);
+                _mm_storeu_ps(lanes[7], n_dot_l);
+                for (lane = 0; lane < 4; ++lane) {
+                    GLfloat normal[3], eye[3];
+
+                    if (!(specular_bits & (1 << lane)))
+                        continue;
+                    for (i = 0; i < 3; ++i) {
+                        normal[i] = lanes[i][lane];
+                        eye[i] = lanes[3 + i][lane];
+                    }
+                    factors[lane] = specular_factor(
+                        raster->eye_light, normal, lanes[7][lane], eye, lanes[6][lane]
+                    );
+                }
+                specular = _mm_loadu_ps(factors);
+            }
+
+            if (texture)
+                sample_texture4(texture, attrs[ATTR_TEXCOORD], attrs[ATTR_TEXCOORD + 1], tex);
+            else
+                tex[0] = tex[1] = tex[2] = tex[3] = one;
+            for (i = 0; i < 3; ++i)
+                rgba[i] = _mm_add_ps(
+                    _mm_mul_ps(specular, attrs[ATTR_SPECULAR + i]),
+                    _mm_mul_ps(diffuse, tex[i])
+                );
+            rgba[3] = _mm_add_ps(_mm_mul_ps(specular, attrs[ATTR_SPECULAR + 3]), tex[3]);
+
+            covered = _mm_castps_si128(mask);
+            old_color = _mm_load_si128((__m128i const*)&buffer->color[row + x]);
+            _mm_store_si128(
+                (__m128i*)&buffer->color[row + x],
+                _mm_or_si128(
+                    _mm_and_si128(covered, pack_colors(rgba)),
+                    _mm_andnot_si128(covered, old_color)
+                )
+            );
+        }
+    }
+}
+#else
+/* GL_LINEAR with GL_CLAMP_TO_EDGE; a mesh without a texture is white */
+static void sample_texture(struct soft_texture const *texture, GLfloat s, GLfloat t, GLfloat *out)
+{
+    GLfloat u, v, fu, fv;
+    int x0, y0, x1, y1, c;
+    GLubyte const *t00, *t10, *t01, *t11;
+
+    if (!texture) {
+        out[0] = out[1] = out[2] = out[3] = 1.0f;
+        return;
+    }
+
+    u = s * (GLfloat)texture->width - 0.5f;
+    v = t * (GLfloat)texture->height - 0.5f;
+    u = fminf(fmaxf(u, -1.0f), (GLfloat)texture->width);
+    v = fminf(fmaxf(v, -1.0f), (GLfloat)texture->height);
+    x0 = (int)floorf(u);
+    y0 = (int)floorf(v);
+    fu = u - (GLfloat)x0;
+    fv = v - (GLfloat)y0;
+    x1 = x0 + 1 < texture->width ? x0 + 1 : texture->width - 1;
+    y1 = y0 + 1 < texture->height ? y0 + 1 : texture->height - 1;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x0 > texture->width - 1) x0 = texture->width - 1;
+    if (y0 > texture->height - 1) y0 = texture->height - 1;
+
+    t00 = &texture->texels[(y0*texture->width + x0)*4];
+    t10 = &texture->texels[(y0*texture->width + x1)*4];
+    t01 = &texture->texels[(y1*texture->width + x0)*4];
+    t11 = &texture->texels[(y1*texture->width + x1)*4];
+    for (c = 0; c < 4; ++c) {
+        GLfloat
+            bottom = (GLfloat)t00[c] + ((GLfloat)t10[c] - (GLfloat)t00[c])*fu,
+            top    = (GLfloat)t01[c] + ((GLfloat)t11[c] - (GLfloat)t01[c])*fu;
+        out[c] = (bottom + (top - bottom)*fv) * (1.0f/255.0f);
+    }
+}
+
+static GLuint pack_color(GLfloat const *rgba)
+{
+    GLuint packed = 0;
+    int c;
+
+    for (c = 3; c >= 0; --c)
+        packed = (packed << 8) | (GLuint)(fminf(fmaxf(rgba[c], 0.0f), 1.0f)*255.0f + 0.5f);
+    return packed;
+}
+
+/* attrs is each attribute already divided through by 1/w */
+static GLuint shade_pixel(
+    struct soft_raster const *raster, struct soft_texture const *texture,
+    GLfloat const *attrs
+) {
+    GLfloat normal[3], eye[3], tex[4], rgba[4];
+    GLfloat n_len, e_len, n_dot_l, diffuse, specular;
+    GLfloat const *light = raster->eye_light, *spec = &attrs[ATTR_SPECULAR];
+    int i;
+
+    n_len = 1.0f / sqrtf(attrs[ATTR_NORMAL]*attrs[ATTR_NORMAL]
+        + attrs[ATTR_NORMAL + 1]*attrs[ATTR_NORMAL + 1]
+        + attrs[ATTR_NORMAL + 2]*attrs[ATTR_NORMAL + 2]);
+    e_len = 1.0f / sqrtf(attrs[ATTR_POSITION]*attrs[ATTR_POSITION]
+        + attrs[ATTR_POSITION + 1]*attrs[ATTR_POSITION + 1]
+        + attrs[ATTR_POSITION + 2]*attrs[ATTR_POSITION + 2]);
+    for (i = 0; i < 3; ++i) {
+        normal[i] = attrs[ATTR_NORMAL + i] * n_len;
+        eye[i] = attrs[ATTR_POSITION + i] * e_len;
+    }
+
+    n_dot_l = normal[0]*light[0] + normal[1]*light[1] + normal[2]*light[2];
+    diffuse = fmaxf(-n_dot_l, 0.0f) * LIGHT_DIFFUSE + LIGHT_AMBIENT;
+    specular = spec[0] > 0.0f || spec[1] > 0.0f || spec[2] > 0.0f || spec[3] > 0.0f
+        ? specular_factor(light, normal, n_dot_l, eye, attrs[ATTR_SHININESS])
+        : 0.0f;
+
+    sample_texture(texture, attrs[ATTR_TEXCOORD], attrs[ATTR_TEXCOORD + 1], tex);
+    for (i = 0; i < 3; ++i)
+        rgba[i] = specular*spec[i] + diffuse*tex[i];
+    rgba[3] = specular*spec[3] + tex[3];
+    return pack_color(rgba);
+}
+
+static void raster_triangle(
+    struct soft_raster const *raster, struct soft_triangle const *triangle,
+    struct tile_buffer *buffer, int tile_x0, int tile_y0
+) {
+    struct soft_texture const *texture = raster->meshes[triangle->mesh].texture;
+    int x_min = triangle->bounds[0] > tile_x0 ? triangle->bounds[0] : tile_x0,
+        y_min = triangle->bounds[1] > tile_y0 ? triangle->bounds[1] : tile_y0,
+        x_max = triangle->bounds[2] < tile_x0 + SOFT_TILE_SIZE - 1
+            ? triangle->bounds[2] : tile_x0 + SOFT_TILE_SIZE - 1,
+        y_max = triangle->bounds[3] < tile_y0 + SOFT_TILE_SIZE - 1
+            ? triangle->bounds[3] : tile_y0 + SOFT_TILE_SIZE - 1,
+        x, y, i;
+
+    for (y = y_min; y <= y_max; ++y) {
+        GLfloat py = (GLfloat)y + 0.5f;
+        int row = (y - tile_y0) * SOFT_TILE_SIZE - tile_x0;
+
+        for (x = x_min; x <= x_max; ++x) {
+            GLfloat px = (GLfloat)x + 0.5f, z, w, attrs[ATTR_COUNT];
+            GLfloat const *plane;
+
+            for (i = 0; i < 3; ++i) {
+                GLfloat const *edge = triangle->edges[i];
+                if (!(edge[0]*px + edge[1]*py + edge[2] > triangle->biases[i]))
+                    break;
+            }
+            if (i < 3)
+                continue;
+
+            plane = triangle->planes[PLANE_DEPTH];
+            z = plane[0]*px + plane[1]*py + plane[2];
+            if (!(z < buffer->depth[row + x]))
+                continue;
+            buffer->depth[row + x] = z;
+
+            plane = triangle->planes[PLANE_INV_W];
+            w = 1.0f / (plane[0]*px + plane[1]*py + plane[2]);
+            for (i = 0; i < ATTR_COUNT; ++i) {
+                plane = triangle->planes[PLANE_ATTRS + i];
+                attrs[i] = (plane[0]*px + plane[1]*py + plane[2]) * w;
+            }
+            buffer->color[row + x] = shade_pixel(raster, texture, attrs);
+        }
+    }
+}
+#endif
+
+static void raster_job(int tile, int worker, void *data)
+{
+    struct soft_raster *raster = (struct soft_raster*)data;
+    struct tile_buffer *buffer = (struct tile_buffer*)raster->tile_buffers + worker;
+    int tile_count = raster->tiles_x * raster->tiles_y,
+        tile_x0 = (tile % raster->tiles_x) * SOFT_TILE_SIZE,
+        tile_y0 = (tile / raster->tiles_x) * SOFT_TILE_SIZE,
+        width = raster->width - tile_x0 < SOFT_TILE_SIZE ? raster->width - tile_x0 : SOFT_TILE_SIZE,
+        height = raster->height - tile_y0 < SOFT_TILE_SIZE ? raster->height - tile_y0 : SOFT_TILE_SIZE,
+        i, j, y;
+
+    /* opaque black, as glClearColor(0, 0, 0, 1) */
+    for (i = 0; i < TILE_PIXELS; ++i) {
+        buffer->color[i] = 0xff000000u;
+        buffer->depth[i] = 1.0f;
+    }
+
+    for (i = 0; i < raster->setup_jobs; ++i) {
+        struct soft_bin const *bin = &raster->bins[i * tile_count + tile];
+        for (j = 0; j < bin->count; ++j)
+            raster_triangle(raster, &raster->triangles[bin->triangles[j]], buffer, tile_x0, tile_y0);
+    }
+
+    for (y = 0; y < height; ++y)
+        memcpy(
+            &raster->pixels[(tile_y0 + y) * raster->width + tile_x0],
+            &buffer->color[y * SOFT_TILE_SIZE],
+            (size_t)width * sizeof(GLuint)
+        );
+}
+
+int draw_soft_frame(
+    struct soft_raster *raster, struct job_pool *pool,
+    GLsizei width, GLsizei height,
+    struct soft_mesh const *meshes, int mesh_count,
+    GLfloat const *p_matrix, GLfloat const *mv_matrix,
+    GLfloat const *light_direction
+) {
+    double start = clock_seconds(), setup_start, raster_start;
+    int i, triangle_count, tile_count;
+
+    if (mesh_count > MAX_SOFT_MESHES)
+        mesh_count = MAX_SOFT_MESHES;
+    raster->meshes = meshes;
+    raster->mesh_count = mesh_count;
+    raster->vertex_offsets[0] = raster->triangle_offsets[0] = 0;
+    for (i = 0; i < mesh_count; ++i) {
+        raster->vertex_offsets[i + 1] = raster->vertex_offsets[i] + meshes[i].vertex_count;
+        raster->triangle_offsets[i + 1] = raster->triangle_offsets[i] + meshes[i].element_count / 3;
+    }
+    triangle_count = raster->triangle_offsets[mesh_count];
+
+    if (pool->worker_count > raster->worker_count) {
+        fprintf(stderr, "Software rasterizer made for %d workers, not %d\n",
+            raster->worker_count, pool->worker_count);
+        return 0;
+    }
+    if (!reserve_frame(raster, width, height, raster->vertex_offsets[mesh_count], triangle_count))
+        return 0;
+    tile_count = raster->tiles_x * raster->tiles_y;
+
+    memcpy(raster->p_matrix, p_matrix, sizeof(raster->p_matrix));
+    memcpy(raster->mv_matrix, mv_matrix, sizeof(raster->mv_matrix));
+    for (i = 0; i < 3; ++i)
+        raster->eye_light[i] = mv_matrix[i]*light_direction[0]
+            + mv_matrix[4 + i]*light_direction[1] + mv_matrix[8 + i]*light_direction[2];
+    raster->failed = 0;
+
+    run_jobs(
+        pool, (raster->vertex_offsets[mesh_count] + VERTICES_PER_JOB - 1) / VERTICES_PER_JOB,
+        &transform_job, raster
+    );
+
+    setup_start = clock_seconds();
+    raster->setup_jobs = (triangle_count + TRIANGLES_PER_JOB - 1) / TRIANGLES_PER_JOB;
+    if (raster->setup_jobs < 1)
+        raster->setup_jobs = 1;
+    if (raster->setup_jobs > MAX_SOFT_SETUP_JOBS)
+        raster->setup_jobs = MAX_SOFT_SETUP_JOBS;
+    run_jobs(pool, raster->setup_jobs, &setup_job, raster);
+
+    raster_start = clock_seconds();
+    run_jobs(pool, tile_count, &raster_job, raster);
+
+    raster->stats.transform_seconds += setup_start - start;
+    raster->stats.setup_seconds += raster_start - setup_start;
+    raster->stats.raster_seconds += clock_seconds() - raster_start;
+    for (i = 0; i < raster->setup_jobs; ++i)
+        raster->stats.triangles += raster->job_triangles[i];
+    for (i = 0; i < raster->setup_jobs * tile_count; ++i)
+        raster->stats.binned += raster->bins[i].count;
+    ++raster->stats.frames;
+
+    if (raster->failed) {
+        fprintf(stderr, "Software rasterizer ran out of memory binning triangles\n");
+        return 0;
+    }
+    return 1;
+}
+
+void upload_soft_frame(struct soft_raster const *raster, GLuint texture)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0,
+        0, 0, raster->width, raster->height,
+        GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
+        raster->pixels
+    );
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
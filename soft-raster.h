@@ -0,0 +1,82 @@
+/*
+ * A CPU rasterizer for the meshes the flag program draws, for machines
+ * where GL itself runs on the CPU. It lights them as flag.f.glsl does
+ * with the directional light, without shadows or clustered lights.
+ *
+ * A frame runs in three passes on the job pool: vertices are transformed,
+ * triangles are clipped, set up and binned to the screen tiles they
+ * touch, and each tile is then rasterized and shaded on its own. The
+ * result is one RGBA image, rows from the bottom, ready for a single
+ * texture upload.
+ */
+#define SOFT_TILE_SIZE          64
+#define MAX_SOFT_MESHES         8
+#define MAX_SOFT_SETUP_JOBS     64
+
+/* RGBA texels, rows from the bottom, sampled bilinearly with clamping. */
+struct soft_texture {
+    GLubyte *texels;
+    int width, height;
+};
+
+struct soft_mesh {
+    struct flag_vertex const *vertices;
+    GLushort const *elements;
+    GLsizei vertex_count, element_count;
+    struct soft_texture const *texture;
+};
+
+struct soft_vertex;
+struct soft_triangle;
+struct soft_bin;
+
+struct soft_raster {
+    GLsizei width, height;
+    int tiles_x, tiles_y;
+    GLuint *pixels;     /* packed as GL_UNSIGNED_INT_8_8_8_8_REV */
+
+    struct soft_vertex *vertices;
+    struct soft_triangle *triangles;
+    struct soft_bin *bins;
+    int vertex_capacity, triangle_capacity, bin_capacity;
+
+    /* a tile's color and depth for each worker */
+    void *tile_buffers;
+    int worker_count;
+
+    /* the frame being drawn */
+    struct soft_mesh const *meshes;
+    int mesh_count, setup_jobs, failed;
+    int vertex_offsets[MAX_SOFT_MESHES + 1], triangle_offsets[MAX_SOFT_MESHES + 1];
+    int job_triangles[MAX_SOFT_SETUP_JOBS];
+    GLfloat mv_matrix[16], p_matrix[16], eye_light[3];
+
+    /* summed over frames until the caller resets them */
+    struct {
+        double transform_seconds, setup_seconds, raster_seconds;
+        long triangles, binned;
+        int frames;
+    } stats;
+};
+
+int make_soft_texture(struct soft_texture *out_texture, void const *bgr_pixels, int width, int height);
+void delete_soft_texture(struct soft_texture *texture);
+
+int make_soft_raster(struct soft_raster *out_raster, int worker_count);
+void delete_soft_raster(struct soft_raster *raster);
+
+/*
+ * Draws the meshes into a width by height image, cleared to black. The
+ * light direction is in model space, as in flag.f.glsl. Returns 0 if
+ * there is not enough memory for the frame.
+ */
+int draw_soft_frame(
+    struct soft_raster *raster, struct job_pool *pool,
+    GLsizei width, GLsizei height,
+    struct soft_mesh const *meshes, int mesh_count,
+    GLfloat const *p_matrix, GLfloat const *mv_matrix,
+    GLfloat const *light_direction
+);
+
+/* Replaces the lower-left corner of the texture with the last frame. */
+void upload_soft_frame(struct soft_raster const *raster, GLuint texture);
@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stdio.h>
+#include <string.h>
+#include "stream-server.h"
+
+#ifdef _WIN32
+
+int start_stream_server(const char *address)
+{
+    fprintf(stderr, "Frame streaming is not supported on this platform\n");
+    return 0;
+}
+
+void stop_stream_server(void) { }
+int stream_server_wants_frames(void) { return 0; }
+void stream_frame(void const *pixels, GLsizei width, GLsizei height, int frame, void *data) { }
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "thread-util.h"
+#include "socket-util.h"
+
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL 0
+#endif
+
+#define MAX_STREAM_CLIENTS 32
+#define STREAM_HEADER_SIZE 24
+
+/*
+ * An encoded frame, shared by every client that is sending it and freed
+ * when the last one is done. Only the server thread touches refs.
+ */
+struct stream_packet {
+    int refs, frame;
+    size_t size;
+    unsigned char data[1];
+};
+
+struct stream_client {
+    int fd;
+    struct stream_packet *packet;
+    size_t sent;
+    int last_frame;
+};
+
+static struct {
+    struct thread thread;
+    struct mutex mutex;
+    int listen_fd, wake_fds[2];
+
+    /*
+     * guarded by mutex; the render thread fills pending and is the only
+     * writer of running, so it alone may read running without the lock
+     */
+    int running;
+    unsigned char *pending;
+    size_t pending_capacity;
+    GLsizei pending_size[2];
+    int pending_frame, has_pending, client_count, dropped_frames;
+
+    /* owned by the server thread */
+    unsigned char *raw;
+    size_t raw_capacity;
+    GLsizei raw_size[2];
+    struct stream_packet *latest;
+    struct stream_client clients[MAX_STREAM_CLIENTS];
+    int connected;
+} g_stream;
+
+static void release_packet(struct stream_packet *packet)
+{
+    if (packet && --packet->refs == 0)
+        free(packet);
+}
+
+static void put_be32(unsigned char *out, unsigned value)
+{
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+/*
+ * Pack the bottom-up BGRA readback into top-down RGB behind the header.
+ */
+static struct stream_packet *encode_packet(
+    unsigned char const *pixels, GLsizei width, GLsizei height, int frame
+) {
+    size_t payload = (size_t)width*height*3;
+    struct stream_packet *packet
+        = malloc(sizeof(struct stream_packet) + STREAM_HEADER_SIZE + payload);
+    unsigned char *out;
+    GLsizei x, y;
+
+    if (!packet)
+        return NULL;
+
+    packet->refs = 1;
+    packet->frame = frame;
+    packet->size = STREAM_HEADER_SIZE + payload;
+
+    put_be32(packet->data +  0, STREAM_MAGIC);
+    put_be32(packet->data +  4, (unsigned)width);
+    put_be32(packet->data +  8, (unsigned)height);
+    put_be32(packet->data + 12, (unsigned)frame);
+    put_be32(packet->data + 16, (unsigned)payload);
+    put_be32(packet->data + 20, STREAM_FORMAT_RGB24);
+
+    out = packet->data + STREAM_HEADER_SIZE;
+    for (y = height - 1; y >= 0; --y) {
+        unsigned char const *row = pixels + (size_t)y*width*4;
+        for (x = 0; x < width; ++x, out += 3) {
+            out[0] = row[x*4 + 2];
+            out[1] = row[x*4 + 1];
+            out[2] = row[x*4 + 0];
+        }
+    }
+    return packet;
+}
+
+static void close_client(struct stream_client *client)
+{
+    close(client->fd);
+    release_packet(client->packet);
+    *client = g_stream.clients[--g_stream.connected];
+
+    lock_mutex(&g_stream.mutex);
+    g_stream.client_count = g_stream.connected;
+    unlock_mutex(&g_stream.mutex);
+}
+
+/*
+ * A client that has finished its packet moves straight to the newest
+ * one, skipping any frames published while it was busy, so slow clients
+ * see a lower frame rate instead of growing latency.
+ */
+static void next_packet(struct stream_client *client)
+{
+    if (client->packet && client->sent < client->packet->size)
+        return;
+    release_packet(client->packet);
+    client->packet = NULL;
+    client->sent = 0;
+
+    if (g_stream.latest && g_stream.latest->frame != client->last_frame) {
+        client->packet = g_stream.latest;
+        client->last_frame = g_stream.latest->frame;
+        ++client->packet->refs;
+    }
+}
+
+static void take_pending_frame(void)
+{
+    int frame, has_pending;
+    unsigned char *swap;
+    size_t swap_capacity;
+
+    lock_mutex(&g_stream.mutex);
+    has_pending = g_stream.has_pending;
+    if (has_pending) {
+        swap = g_stream.raw;
+        swap_capacity = g_stream.raw_capacity;
+        g_stream.raw = g_stream.pending;
+        g_stream.raw_capacity = g_stream.pending_capacity;
+        g_stream.raw_size[0] = g_stream.pending_size[0];
+        g_stream.raw_size[1] = g_stream.pending_size[1];
+        g_stream.pending = swap;
+        g_stream.pending_capacity = swap_capacity;
+        g_stream.has_pending = 0;
+    }
+    frame = g_stream.pending_frame;
+    unlock_mutex(&g_stream.mutex);
+
+    if (has_pending) {
+        struct stream_packet *packet = encode_packet(
+            g_stream.raw, g_stream.raw_size[0], g_stream.raw_size[1], frame
+        );
+        if (packet) {
+            release_packet(g_stream.latest);
+            g_stream.latest = packet;
+        }
+    }
+}
+
+static void accept_client(void)
+{
+    int fd = accept(g_stream.listen_fd, NULL, NULL);
+    struct stream_client *client;
+
+    if (fd < 0)
+        return;
+    if (g_stream.connected == MAX_STREAM_CLIENTS) {
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+    {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+
+    client = &g_stream.clients[g_stream.connected++];
+    client->fd = fd;
+    client->packet = NULL;
+    client->sent = 0;
+    client->last_frame = -1;
+
+    lock_mutex(&g_stream.mutex);
+    g_stream.client_count = g_stream.connected;
+    unlock_mutex(&g_stream.mutex);
+}
+
+static int server_running(void)
+{
+    int running;
+
+    lock_mutex(&g_stream.mutex);
+    running = g_stream.running;
+    unlock_mutex(&g_stream.mutex);
+    return running;
+}
+
+static void serve(void *data)
+{
+    struct pollfd fds[2 + MAX_STREAM_CLIENTS];
+
+    while (server_running()) {
+        int i, n = g_stream.connected;
+
+        fds[0].fd = g_stream.wake_fds[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = g_stream.listen_fd;
+        fds[1].events = POLLIN;
+        for (i = 0; i < n; ++i) {
+            fds[2 + i].fd = g_stream.clients[i].fd;
+            fds[2 + i].events = g_stream.clients[i].packet ? POLLOUT : POLLIN;
+        }
+
+        if (poll(fds, 2 + n, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(g_stream.wake_fds[0], drain, sizeof(drain)) > 0)
+                ;
+            take_pending_frame();
+        }
+
+        /* walk backward since close_client moves the last client down */
+        for (i = n - 1; i >= 0; --i) {
+            struct stream_client *client = &g_stream.clients[i];
+            short revents = fds[2 + i].revents;
+
+            if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                close_client(client);
+                continue;
+            }
+            if (revents & POLLIN) {
+                char discard[256];
+                ssize_t got = recv(client->fd, discard, sizeof(discard), 0);
+                if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    close_client(client);
+                    continue;
+                }
+            }
+            if (revents & POLLOUT) {
+                ssize_t wrote = send(
+                    client->fd,
+                    client->packet->data + client->sent,
+                    client->packet->size - client->sent,
+                    MSG_NOSIGNAL
+                );
+                if (wrote < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    close_client(client);
+                    continue;
+                }
+                if (wrote > 0)
+                    client->sent += (size_t)wrote;
+            }
+            next_packet(client);
+        }
+
+        if (fds[1].revents & POLLIN)
+            accept_client();
+    }
+}
+
+/* address is as for open_listen_socket. */
+int start_stream_server(const char *address)
+{
+    memset(&g_stream, 0, sizeof(g_stream));
+
+    g_stream.listen_fd = open_listen_socket(address);
+    if (g_stream.listen_fd < 0)
+        return 0;
+
+    if (pipe(g_stream.wake_fds) < 0) {
+        perror("pipe");
+        close(g_stream.listen_fd);
+        return 0;
+    }
+    fcntl(g_stream.wake_fds[0], F_SETFL, fcntl(g_stream.wake_fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(g_stream.wake_fds[1], F_SETFL, fcntl(g_stream.wake_fds[1], F_GETFL) | O_NONBLOCK);
+
+    init_mutex(&g_stream.mutex);
+    g_stream.running = 1;
+    if (!start_thread(&g_stream.thread, &serve, NULL)) {
+        g_stream.running = 0;
+        destroy_mutex(&g_stream.mutex);
+        close(g_stream.listen_fd);
+        close(g_stream.wake_fds[0]);
+        close(g_stream.wake_fds[1]);
+        return 0;
+    }
+    printf("streaming frames on %s\n", address);
+    return 1;
+}
+
+void stop_stream_server(void)
+{
+    int i;
+
+    if (!g_stream.running)
+        return;
+    lock_mutex(&g_stream.mutex);
+    g_stream.running = 0;
+    unlock_mutex(&g_stream.mutex);
+    if (write(g_stream.wake_fds[1], "", 1) < 0)
+        perror("write");
+    join_thread(&g_stream.thread);
+
+    for (i = 0; i < g_stream.connected; ++i) {
+        close(g_stream.clients[i].fd);
+        release_packet(g_stream.clients[i].packet);
+    }
+    release_packet(g_stream.latest);
+    close(g_stream.listen_fd);
+    close(g_stream.wake_fds[0]);
+    close(g_stream.wake_fds[1]);
+    destroy_mutex(&g_stream.mutex);
+    free(g_stream.pending);
+    free(g_stream.raw);
+    printf("stream server stopped, %d stale frames dropped\n", g_stream.dropped_frames);
+}
+
+int stream_server_wants_frames(void)
+{
+    int count;
+
+    if (!g_stream.running)
+        return 0;
+    lock_mutex(&g_stream.mutex);
+    count = g_stream.client_count;
+    unlock_mutex(&g_stream.mutex);
+    return count > 0;
+}
+
+/*
+ * Readback consumer called on the render thread. It only copies the
+ * frame into the pending slot and wakes the server; if the server has
+ * not picked up the previous frame yet, that frame is simply replaced.
+ */
+void stream_frame(void const *pixels, GLsizei width, GLsizei height, int frame, void *data)
+{
+    size_t bytes = (size_t)width*height*4;
+
+    lock_mutex(&g_stream.mutex);
+    if (g_stream.pending_capacity < bytes) {
+        free(g_stream.pending);
+        g_stream.pending = malloc(bytes);
+        g_stream.pending_capacity = g_stream.pending ? bytes : 0;
+    }
+    if (g_stream.pending) {
+        if (g_stream.has_pending)
+            ++g_stream.dropped_frames;
+        memcpy(g_stream.pending, pixels, bytes);
+        g_stream.pending_size[0] = width;
+        g_stream.pending_size[1] = height;
+        g_stream.pending_frame = frame;
+        g_stream.has_pending = 1;
+    }
+    unlock_mutex(&g_stream.mutex);
+
+    if (write(g_stream.wake_fds[1], "", 1) < 0 && errno != EAGAIN)
+        perror("write");
+}
+
+#endif
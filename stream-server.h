@@ -0,0 +1,12 @@
+/*
+ * Each frame is sent to a client as a header of six big-endian 32-bit
+ * words: 'FLAG', width, height, frame number, payload size in bytes, and
+ * payload format (1 for 24-bit RGB, top row first); then the payload.
+ */
+#define STREAM_MAGIC 0x464c4147
+#define STREAM_FORMAT_RGB24 1
+
+int start_stream_server(const char *address);
+void stop_stream_server(void);
+int stream_server_wants_frames(void);
+void stream_frame(void const *pixels, GLsizei width, GLsizei height, int frame, void *data);
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+#include "thread-util.h"
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_trampoline(LPVOID param)
+{
+    struct thread *thread = (struct thread*)param;
+    thread->func(thread->data);
+    return 0;
+}
+
+int start_thread(struct thread *out_thread, thread_func func, void *data)
+{
+    out_thread->func = func;
+    out_thread->data = data;
+    out_thread->handle = CreateThread(NULL, 0, &thread_trampoline, out_thread, 0, NULL);
+    if (!out_thread->handle) {
+        fprintf(stderr, "Unable to start thread\n");
+        return 0;
+    }
+    return 1;
+}
+
+void join_thread(struct thread *thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+}
+
+void init_mutex(struct mutex *mutex)    { InitializeCriticalSection(&mutex->handle); }
+void destroy_mutex(struct mutex *mutex) { DeleteCriticalSection(&mutex->handle); }
+void lock_mutex(struct mutex *mutex)    { EnterCriticalSection(&mutex->handle); }
+void unlock_mutex(struct mutex *mutex)  { LeaveCriticalSection(&mutex->handle); }
+
+void init_condition(struct condition *condition)
+{
+    InitializeConditionVariable(&condition->handle);
+}
+
+void destroy_condition(struct condition *condition)
+{
+}
+
+void wait_condition(struct condition *condition, struct mutex *mutex)
+{
+    SleepConditionVariableCS(&condition->handle, &mutex->handle, INFINITE);
+}
+
+void signal_condition(struct condition *condition)
+{
+    WakeConditionVariable(&condition->handle);
+}
+
+void broadcast_condition(struct condition *condition)
+{
+    WakeAllConditionVariable(&condition->handle);
+}
+
+int processor_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+void memory_fence(void)
+{
+    MemoryBarrier();
+}
+
+#else
+
+static void *thread_trampoline(void *param)
+{
+    struct thread *thread = (struct thread*)param;
+    thread->func(thread->data);
+    return NULL;
+}
+
+/*
+ * The thread struct is passed to the new thread, so it must stay where
+ * it is until join_thread.
+ */
+int start_thread(struct thread *out_thread, thread_func func, void *data)
+{
+    out_thread->func = func;
+    out_thread->data = data;
+    if (pthread_create(&out_thread->handle, NULL, &thread_trampoline, out_thread) != 0) {
+        fprintf(stderr, "Unable to start thread\n");
+        return 0;
+    }
+    return 1;
+}
+
+void join_thread(struct thread *thread)
+{
+    pthread_join(thread->handle, NULL);
+}
+
+void init_mutex(struct mutex *mutex)    { pthread_mutex_init(&mutex->handle, NULL); }
+void destroy_mutex(struct mutex *mutex) { pthread_mutex_destroy(&mutex->handle); }
+void lock_mutex(struct mutex *mutex)    { pthread_mutex_lock(&mutex->handle); }
+void unlock_mutex(struct mutex *mutex)  { pthread_mutex_unlock(&mutex->handle); }
+
+void init_condition(struct condition *condition)
+{
+    pthread_cond_init(&condition->handle, NULL);
+}
+
+void destroy_condition(struct condition *condition)
+{
+    pthread_cond_destroy(&condition->handle);
+}
+
+void wait_condition(struct condition *condition, struct mutex *mutex)
+{
+    pthread_cond_wait(&condition->handle, &mutex->handle);
+}
+
+void signal_condition(struct condition *condition)
+{
+    pthread_cond_signal(&condition->handle);
+}
+
+void broadcast_condition(struct condition *condition)
+{
+    pthread_cond_broadcast(&condition->handle);
+}
+
+int processor_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+void memory_fence(void)
+{
+    __sync_synchronize();
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
+
+typedef void (*thread_func)(void *data);
+
+struct thread {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    thread_func func;
+    void *data;
+};
+
+struct mutex {
+#ifdef _WIN32
+    CRITICAL_SECTION handle;
+#else
+    pthread_mutex_t handle;
+#endif
+};
+
+struct condition {
+#ifdef _WIN32
+    CONDITION_VARIABLE handle;
+#else
+    pthread_cond_t handle;
+#endif
+};
+
+int start_thread(struct thread *out_thread, thread_func func, void *data);
+void join_thread(struct thread *thread);
+
+void init_mutex(struct mutex *mutex);
+void destroy_mutex(struct mutex *mutex);
+void lock_mutex(struct mutex *mutex);
+void unlock_mutex(struct mutex *mutex);
+
+void init_condition(struct condition *condition);
+void destroy_condition(struct condition *condition);
+void wait_condition(struct condition *condition, struct mutex *mutex);
+void signal_condition(struct condition *condition);
+void broadcast_condition(struct condition *condition);
+
+int processor_count(void);
+
+/*
+ * Full memory barrier, for lock-free handoffs between threads. It is a
+ * function call so that the compiler cannot move memory accesses across
+ * it either.
+ */
+void memory_fence(void);
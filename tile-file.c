@@ -0,0 +1,128 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "memory.h"
+#include "file-util.h"
+#include "tile-file.h"
+
+int tile_levels(GLuint width, GLuint height, struct tile_file_level *out_levels)
+{
+    GLuint first_tile = 0;
+    int level;
+
+    if (width == 0 || height == 0
+        || (width + TILE_SIZE - 1)/TILE_SIZE > MAX_LEVEL_TILES
+        || (height + TILE_SIZE - 1)/TILE_SIZE > MAX_LEVEL_TILES)
+        return 0;
+
+    for (level = 0; level < MAX_TILE_LEVELS; ++level) {
+        struct tile_file_level *l = &out_levels[level];
+
+        l->width = width >> level ? width >> level : 1;
+        l->height = height >> level ? height >> level : 1;
+        l->tiles_x = (l->width + TILE_SIZE - 1)/TILE_SIZE;
+        l->tiles_y = (l->height + TILE_SIZE - 1)/TILE_SIZE;
+        l->first_tile = first_tile;
+        first_tile += l->tiles_x * l->tiles_y;
+        if (l->tiles_x == 1 && l->tiles_y == 1)
+            return level + 1;
+    }
+    return 0;
+}
+
+static int check_tiles(struct tile_file *tiles, const char *filename)
+{
+    struct tile_file_header const *header
+        = (struct tile_file_header const*)tiles->file.data;
+    struct tile_file_level levels[MAX_TILE_LEVELS];
+    int level_count;
+
+    if (tiles->file.size < sizeof(struct tile_file_header)
+        || memcmp(header->magic, TILE_FILE_MAGIC, sizeof(TILE_FILE_MAGIC)) != 0) {
+        fprintf(stderr, "%s is not a tile file\n", filename);
+        return 0;
+    }
+    if (header->version != TILE_FILE_VERSION
+        || header->tile_size != TILE_SIZE || header->tile_border != TILE_BORDER) {
+        fprintf(stderr,
+            "%s is tile version %u with %u+%u texel tiles; expected version %u with %u+%u\n",
+            filename, header->version, header->tile_size, header->tile_border,
+            TILE_FILE_VERSION, TILE_SIZE, TILE_BORDER
+        );
+        return 0;
+    }
+
+    /* the levels follow from the size, so anything else is corrupt */
+    level_count = tile_levels(header->width, header->height, levels);
+    if (level_count == 0 || (GLuint)level_count != header->level_count
+        || memcmp(levels, header->levels, level_count * sizeof(struct tile_file_level)) != 0
+        || header->tile_count
+            != levels[level_count - 1].first_tile + 1) {
+        fprintf(stderr, "%s has a corrupt level table\n", filename);
+        return 0;
+    }
+    if (header->tiles_offset % TILE_FILE_ALIGNMENT != 0
+        || header->tiles_offset > tiles->file.size
+        || header->tile_count > (tiles->file.size - header->tiles_offset) / TILE_BYTES) {
+        fprintf(stderr, "%s has truncated tiles\n", filename);
+        return 0;
+    }
+
+    tiles->header = header;
+    return 1;
+}
+
+int open_tile_file(struct tile_file *out_tiles, const char *filename)
+{
+    if (!map_file(&out_tiles->file, filename))
+        return 0;
+    if (!check_tiles(out_tiles, filename)) {
+        unmap_file(&out_tiles->file);
+        return 0;
+    }
+    return 1;
+}
+
+void close_tile_file(struct tile_file *tiles)
+{
+    unmap_file(&tiles->file);
+    tiles->header = NULL;
+}
+
+GLubyte const *tile_texels(struct tile_file const *tiles, GLuint tile)
+{
+    return (GLubyte const*)tiles->file.data
+        + tiles->header->tiles_offset + (size_t)tile * TILE_BYTES;
+}
+
+void *read_tile_level(
+    struct tile_file const *tiles, struct arena *arena, int level,
+    int *out_width, int *out_height
+) {
+    struct tile_file_level const *l = &tiles->header->levels[level];
+    GLubyte *pixels = (GLubyte*) arena_alloc(arena, (size_t)l->width * l->height * 3);
+    GLuint x, y;
+
+    if (!pixels)
+        return NULL;
+    for (y = 0; y < l->height; ++y) {
+        GLuint tile_y = y / TILE_SIZE, row = y % TILE_SIZE + TILE_BORDER;
+
+        for (x = 0; x < l->width; x += TILE_SIZE) {
+            GLuint
+                tile = l->first_tile + tile_y * l->tiles_x + x / TILE_SIZE,
+                span = l->width - x < TILE_SIZE ? l->width - x : TILE_SIZE;
+
+            memcpy(
+                pixels + ((size_t)y * l->width + x) * 3,
+                tile_texels(tiles, tile) + (row * TILE_TEXELS + TILE_BORDER) * 3,
+                span * 3
+            );
+        }
+    }
+    *out_width = (int)l->width;
+    *out_height = (int)l->height;
+    return pixels;
+}
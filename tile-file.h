@@ -0,0 +1,68 @@
+#define TILE_FILE_MAGIC         "FLAGVT"
+#define TILE_FILE_VERSION       1
+#define TILE_FILE_ALIGNMENT     64
+#define MAX_TILE_LEVELS         16
+
+#define TILE_SIZE               128
+#define TILE_BORDER             1
+#define TILE_TEXELS             (TILE_SIZE + 2*TILE_BORDER)
+#define TILE_BYTES              (TILE_TEXELS*TILE_TEXELS*3)
+
+/* so that a tile's coordinates within its level fit in a byte */
+#define MAX_LEVEL_TILES         256
+
+/*
+ * Artwork split into tiles for virtual texturing, in native byte order,
+ * written by make-tiles:
+ *
+ *   header
+ *   tiles, TILE_FILE_ALIGNMENT-aligned
+ *
+ * Level 0 is the artwork and each level after it is half the size of the
+ * one before, rounded down, until one tile covers the whole level. A
+ * level's tiles are stored row by row from the bottom, and the levels one
+ * after another from level 0.
+ *
+ * A tile is TILE_SIZE texels square of its level with a TILE_BORDER of
+ * its neighbours' texels around it, clamped at the edges of the level, so
+ * that bilinear filtering within a tile matches filtering the level as a
+ * whole. Texels are BGR with the bottom row first, as read_tga returns
+ * them, so a tile goes to GL as it is.
+ */
+struct tile_file_level {
+    GLuint width, height;       /* in texels */
+    GLuint tiles_x, tiles_y;
+    GLuint first_tile;
+};
+
+struct tile_file_header {
+    char magic[8];
+    GLuint version, tile_size, tile_border;
+    GLuint width, height, level_count, tile_count;
+    GLuint tiles_offset;
+    struct tile_file_level levels[MAX_TILE_LEVELS];
+};
+
+struct tile_file {
+    struct mapped_file file;
+    struct tile_file_header const *header;
+};
+
+/* Every level's size from the artwork's; returns the number of levels. */
+int tile_levels(GLuint width, GLuint height, struct tile_file_level *out_levels);
+
+/* Maps the file and checks that every tile lies within it. */
+int open_tile_file(struct tile_file *out_tiles, const char *filename);
+void close_tile_file(struct tile_file *tiles);
+
+GLubyte const *tile_texels(struct tile_file const *tiles, GLuint tile);
+
+/*
+ * Copies a whole level out of its tiles into BGR pixels, bottom row
+ * first, allocated from the arena. Touches no GL, so it may run on any
+ * thread that owns the arena.
+ */
+void *read_tile_level(
+    struct tile_file const *tiles, struct arena *arena, int level,
+    int *out_width, int *out_height
+);
@@ -0,0 +1,739 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "memory.h"
+#include "file-util.h"
+#include "gl-util.h"
+#include "gpu-resources.h"
+#include "thread-util.h"
+#include "readback.h"
+#include "geometry-heap.h"
+#include "meshes.h"
+#include "tile-file.h"
+#include "virtual-texture.h"
+#include "gl-capture.h"
+
+/*
+ * Slots for twice the tiles it takes to cover the view at one texel a
+ * pixel, since the flag's tiles rarely line up with the screen, plus the
+ * coarser tiles kept as fallbacks.
+ */
+#define VT_VIEW_COVERAGE    2
+#define VT_SPARE_SLOTS      16
+
+/* slots a side, so that a slot's coordinates fit in a byte of an indirection entry */
+#define VT_MAX_CACHE_SLOTS  255
+
+int virtual_texture_supported(void)
+{
+    return render_targets_supported();
+}
+
+static struct tile_file_level const *vt_level(struct virtual_texture const *vt, int level)
+{
+    return &vt->tiles.header->levels[level];
+}
+
+int open_virtual_texture(struct virtual_texture *out_vt, const char *filename)
+{
+    memset(out_vt, 0, sizeof(struct virtual_texture));
+    if (!open_tile_file(&out_vt->tiles, filename))
+        return 0;
+    out_vt->level_count = (int)out_vt->tiles.header->level_count;
+    return 1;
+}
+
+/*
+ * Loaders take the oldest queued load, which is the coarsest, since
+ * requests are queued coarse to fine. Reading the tile out of the
+ * mapping is what faults it in from disk.
+ */
+static void run_loader(void *data)
+{
+    struct virtual_texture *vt = (struct virtual_texture*)data;
+
+    lock_mutex(&vt->mutex);
+    for (;;) {
+        struct vt_load *load = NULL;
+        int i;
+
+        for (i = 0; i < VT_MAX_LOADS; ++i)
+            if (vt->loads[i].state == VT_LOAD_QUEUED
+                && (!load || vt->loads[i].sequence < load->sequence))
+                load = &vt->loads[i];
+        if (!load) {
+            if (vt->quit)
+                break;
+            wait_condition(&vt->queued, &vt->mutex);
+            continue;
+        }
+
+        load->state = VT_LOAD_READING;
+        unlock_mutex(&vt->mutex);
+        memcpy(load->texels, tile_texels(&vt->tiles, load->tile), TILE_BYTES);
+        lock_mutex(&vt->mutex);
+        load->state = VT_LOAD_DONE;
+        signal_condition(&vt->finished);
+    }
+    unlock_mutex(&vt->mutex);
+}
+
+static int needed_slots(struct virtual_texture const *vt, GLsizei view_width, GLsizei view_height)
+{
+    size_t slots = (size_t)view_width * view_height * VT_VIEW_COVERAGE / (TILE_SIZE*TILE_SIZE)
+        + VT_SPARE_SLOTS + vt->level_count;
+
+    return slots < vt->tiles.header->tile_count ? (int)slots : (int)vt->tiles.header->tile_count;
+}
+
+static void copy_tile_to_slot(struct virtual_texture *vt, int slot, GLubyte const *texels)
+{
+    glBindTexture(GL_TEXTURE_2D, vt->cache_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0,
+        (slot % vt->slots_x) * TILE_TEXELS, (slot / vt->slots_x) * TILE_TEXELS,
+        TILE_TEXELS, TILE_TEXELS,
+        GL_BGR, GL_UNSIGNED_BYTE, texels
+    );
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+static void delete_cache(struct virtual_texture *vt)
+{
+    untrack_gpu_resource(GPU_TEXTURE, vt->cache_texture);
+    glDeleteTextures(1, &vt->cache_texture);
+    vt->cache_texture = 0;
+    memory_free(vt->slot_tiles);
+    vt->slot_tiles = NULL;
+    vt->slot_count = 0;
+}
+
+static size_t layout_cache(struct virtual_texture *vt, int slot_count)
+{
+    GLint max_size;
+
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    vt->slots_x = (int)ceil(sqrt((double)slot_count));
+    if (vt->slots_x > max_size / TILE_TEXELS)
+        vt->slots_x = max_size / TILE_TEXELS;
+    if (vt->slots_x > VT_MAX_CACHE_SLOTS)
+        vt->slots_x = VT_MAX_CACHE_SLOTS;
+    vt->slots_y = (slot_count + vt->slots_x - 1) / vt->slots_x;
+    if (vt->slots_y > vt->slots_x)
+        vt->slots_y = vt->slots_x;
+    vt->slot_count = vt->slots_x * vt->slots_y;
+    return (size_t)vt->slot_count * TILE_TEXELS * TILE_TEXELS * 4;
+}
+
+/*
+ * Every tile is dropped from the cache except the last level's, which
+ * goes into slot 0 for good, straight from the mapping. Over the GPU
+ * budget, the cache is halved until it fits or holds no more than a
+ * tile a level, which it gets regardless.
+ */
+static int make_cache(struct virtual_texture *vt, int slot_count)
+{
+    GLuint tile, last_tile = vt->tiles.header->tile_count - 1;
+    size_t bytes = layout_cache(vt, slot_count);
+    int slot;
+
+    while (vt->slot_count > vt->level_count + 1
+        && !reserve_gpu_memory(bytes, "virtual texture cache"))
+        bytes = layout_cache(vt, vt->slot_count / 2 > vt->level_count + 1
+            ? vt->slot_count / 2 : vt->level_count + 1);
+
+    for (tile = 0; tile < vt->tiles.header->tile_count; ++tile)
+        vt->tile_slots[tile] = -1;
+    vt->slot_tiles = (int*) memory_alloc(vt->slot_count * sizeof(int), MEMORY_OTHER);
+    if (!vt->slot_tiles) {
+        vt->slot_count = 0;
+        return 0;
+    }
+
+    glGenTextures(1, &vt->cache_texture);
+    glBindTexture(GL_TEXTURE_2D, vt->cache_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_RGB8,
+        vt->slots_x * TILE_TEXELS, vt->slots_y * TILE_TEXELS, 0,
+        GL_BGR, GL_UNSIGNED_BYTE, NULL
+    );
+    track_gpu_resource(GPU_TEXTURE, vt->cache_texture, bytes, "virtual texture cache");
+
+    for (slot = 0; slot < vt->slot_count; ++slot)
+        vt->slot_tiles[slot] = -1;
+
+    copy_tile_to_slot(vt, 0, tile_texels(&vt->tiles, last_tile));
+    vt->slot_tiles[0] = (int)last_tile;
+    vt->tile_slots[last_tile] = 0;
+    vt->indirection_dirty = 1;
+    return 1;
+}
+
+static int make_indirection(struct virtual_texture *vt)
+{
+    int level;
+    GLsizei rows = 0;
+
+    for (level = 0; level < vt->level_count; ++level) {
+        vt->level_rows[level] = rows;
+        rows += vt_level(vt, level)->tiles_y;
+    }
+    vt->indirection_size[0] = vt_level(vt, 0)->tiles_x;
+    vt->indirection_size[1] = rows;
+    vt->indirection = (GLubyte*) memory_alloc(
+        (size_t)vt->indirection_size[0] * rows * 4, MEMORY_OTHER
+    );
+    if (!vt->indirection)
+        return 0;
+    memset(vt->indirection, 0, (size_t)vt->indirection_size[0] * rows * 4);
+
+    glGenTextures(1, &vt->indirection_texture);
+    glBindTexture(GL_TEXTURE_2D, vt->indirection_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,     GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,     GL_CLAMP_TO_EDGE);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_RGBA8,
+        vt->indirection_size[0], vt->indirection_size[1], 0,
+        GL_RGBA, GL_UNSIGNED_BYTE, vt->indirection
+    );
+    track_gpu_resource(
+        GPU_TEXTURE, vt->indirection_texture,
+        (size_t)vt->indirection_size[0] * rows * 4, "virtual texture indirection"
+    );
+    return 1;
+}
+
+static int make_feedback_program(struct virtual_texture *vt)
+{
+    vt->feedback_program.vertex_shader
+        = make_shader(GL_VERTEX_SHADER, "vt-feedback.v.glsl");
+    if (vt->feedback_program.vertex_shader == 0)
+        return 0;
+    vt->feedback_program.fragment_shader
+        = make_shader(GL_FRAGMENT_SHADER, "vt-feedback.f.glsl");
+    if (vt->feedback_program.fragment_shader == 0)
+        return 0;
+
+    vt->feedback_program.program = make_program(
+        vt->feedback_program.vertex_shader, vt->feedback_program.fragment_shader
+    );
+    if (vt->feedback_program.program == 0)
+        return 0;
+
+    vt->feedback_program.p_matrix
+        = glGetUniformLocation(vt->feedback_program.program, "p_matrix");
+    vt->feedback_program.mv_matrix
+        = glGetUniformLocation(vt->feedback_program.program, "mv_matrix");
+    vt->feedback_program.position
+        = glGetAttribLocation(vt->feedback_program.program, "position");
+    vt->feedback_program.texcoord
+        = glGetAttribLocation(vt->feedback_program.program, "texcoord");
+    get_vt_uniforms(vt->feedback_program.program, &vt->feedback_program.uniforms);
+    return 1;
+}
+
+/*
+ * Like the scene target, the feedback target and its readback ring are
+ * only reallocated when they need to grow, so resolution scale changes
+ * keep the feedback in flight; smaller views draw into and read back the
+ * lower-left corner. The view size is recorded even if growing fails, so
+ * the failure is reported once instead of every frame.
+ */
+static int make_feedback_target(struct virtual_texture *vt, GLsizei view_width, GLsizei view_height)
+{
+    GLsizei
+        w = (view_width + VT_FEEDBACK_DIVISOR - 1) / VT_FEEDBACK_DIVISOR,
+        h = (view_height + VT_FEEDBACK_DIVISOR - 1) / VT_FEEDBACK_DIVISOR,
+        alloc_w, alloc_h;
+
+    vt->view_size[0] = view_width;
+    vt->view_size[1] = view_height;
+    vt->feedback_size[0] = w;
+    vt->feedback_size[1] = h;
+    if (vt->feedback_ring.depth > 0
+        && w <= vt->feedback_target.size[0] && h <= vt->feedback_target.size[1])
+        return 1;
+
+    alloc_w = w > vt->feedback_target.size[0] ? w : vt->feedback_target.size[0];
+    alloc_h = h > vt->feedback_target.size[1] ? h : vt->feedback_target.size[1];
+    if (vt->feedback_ring.depth > 0) {
+        delete_readback_ring(&vt->feedback_ring);
+        delete_render_target(&vt->feedback_target);
+    }
+    if (!make_render_target(&vt->feedback_target, alloc_w, alloc_h))
+        return 0;
+    if (!make_readback_ring(&vt->feedback_ring, VT_FEEDBACK_DEPTH, alloc_w, alloc_h)) {
+        vt->feedback_ring.depth = 0;
+        delete_render_target(&vt->feedback_target);
+        return 0;
+    }
+    return 1;
+}
+
+int make_virtual_texture(struct virtual_texture *vt, GLsizei view_width, GLsizei view_height)
+{
+    GLuint tile_count = vt->tiles.header->tile_count;
+    int i;
+
+    vt->tile_slots = (int*) memory_alloc(tile_count * sizeof(int), MEMORY_OTHER);
+    vt->tile_used = (unsigned*) memory_alloc(tile_count * sizeof(unsigned), MEMORY_OTHER);
+    vt->tile_loading = (unsigned char*) memory_alloc(tile_count, MEMORY_OTHER);
+    vt->requests = (GLuint*) memory_alloc(tile_count * sizeof(GLuint), MEMORY_OTHER);
+    if (!vt->tile_slots || !vt->tile_used || !vt->tile_loading || !vt->requests)
+        return 0;
+    memset(vt->tile_used, 0, tile_count * sizeof(unsigned));
+    memset(vt->tile_loading, 0, tile_count);
+    vt->frame = 1;
+
+    for (i = 0; i < VT_MAX_LOADS; ++i) {
+        vt->loads[i].state = VT_LOAD_FREE;
+        vt->loads[i].texels = (GLubyte*) memory_alloc(TILE_BYTES, MEMORY_OTHER);
+        if (!vt->loads[i].texels)
+            return 0;
+    }
+
+    if (!make_feedback_program(vt)
+        || !make_indirection(vt)
+        || !make_cache(vt, needed_slots(vt, view_width, view_height))
+        || !make_feedback_target(vt, view_width, view_height))
+        return 0;
+
+    init_mutex(&vt->mutex);
+    init_condition(&vt->queued);
+    init_condition(&vt->finished);
+    vt->quit = 0;
+    for (i = 0; i < VT_LOADER_THREADS; ++i)
+        if (!start_thread(&vt->loaders[i], &run_loader, vt))
+            return 0;
+
+    printf("virtual texture %ux%u in %d levels, %d of %u tiles cached (%.1f MiB)\n",
+        vt->tiles.header->width, vt->tiles.header->height, vt->level_count,
+        vt->slot_count, tile_count,
+        (double)virtual_texture_bytes(vt) / (1024.0*1024.0));
+    return 1;
+}
+
+void delete_virtual_texture(struct virtual_texture *vt)
+{
+    int i;
+
+    lock_mutex(&vt->mutex);
+    vt->quit = 1;
+    broadcast_condition(&vt->queued);
+    unlock_mutex(&vt->mutex);
+    for (i = 0; i < VT_LOADER_THREADS; ++i)
+        join_thread(&vt->loaders[i]);
+    destroy_condition(&vt->queued);
+    destroy_condition(&vt->finished);
+    destroy_mutex(&vt->mutex);
+
+    delete_readback_ring(&vt->feedback_ring);
+    delete_render_target(&vt->feedback_target);
+    delete_cache(vt);
+    untrack_gpu_resource(GPU_TEXTURE, vt->indirection_texture);
+    glDeleteTextures(1, &vt->indirection_texture);
+    untrack_gpu_resource(GPU_PROGRAM, vt->feedback_program.program);
+    untrack_gpu_resource(GPU_SHADER, vt->feedback_program.vertex_shader);
+    untrack_gpu_resource(GPU_SHADER, vt->feedback_program.fragment_shader);
+    glDeleteProgram(vt->feedback_program.program);
+    glDeleteShader(vt->feedback_program.vertex_shader);
+    glDeleteShader(vt->feedback_program.fragment_shader);
+
+    for (i = 0; i < VT_MAX_LOADS; ++i)
+        memory_free(vt->loads[i].texels);
+    memory_free(vt->indirection);
+    memory_free(vt->tile_slots);
+    memory_free(vt->tile_used);
+    memory_free(vt->tile_loading);
+    memory_free(vt->requests);
+    close_tile_file(&vt->tiles);
+}
+
+void get_vt_uniforms(GLuint program, struct vt_uniforms *out_uniforms)
+{
+    char name[32];
+    int level;
+
+    out_uniforms->size = glGetUniformLocation(program, "vt_size");
+    out_uniforms->scale = glGetUniformLocation(program, "vt_scale");
+    out_uniforms->cache = glGetUniformLocation(program, "vt_cache");
+    out_uniforms->indirection = glGetUniformLocation(program, "vt_indirection");
+    for (level = 0; level < MAX_TILE_LEVELS; ++level) {
+        snprintf(name, sizeof(name), "vt_levels[%d]", level);
+        out_uniforms->levels[level] = glGetUniformLocation(program, name);
+    }
+}
+
+void bind_virtual_texture(
+    struct virtual_texture const *vt, struct vt_uniforms const *uniforms, GLfloat lod_bias
+) {
+    int level;
+
+    glUniform4f(
+        uniforms->size,
+        (GLfloat)vt->tiles.header->width, (GLfloat)vt->tiles.header->height,
+        (GLfloat)vt->level_count, lod_bias
+    );
+    glUniform4f(
+        uniforms->scale,
+        1.0f/(GLfloat)vt->indirection_size[0], 1.0f/(GLfloat)vt->indirection_size[1],
+        1.0f/(GLfloat)(vt->slots_x * TILE_TEXELS), 1.0f/(GLfloat)(vt->slots_y * TILE_TEXELS)
+    );
+    for (level = 0; level < vt->level_count; ++level)
+        glUniform4f(
+            uniforms->levels[level],
+            (GLfloat)vt_level(vt, level)->width, (GLfloat)vt_level(vt, level)->height,
+            (GLfloat)vt->level_rows[level], 0.0f
+        );
+
+    glUniform1i(uniforms->cache, VT_CACHE_UNIT);
+    glUniform1i(uniforms->indirection, VT_INDIRECTION_UNIT);
+    glActiveTexture(GL_TEXTURE0 + VT_CACHE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, vt->cache_texture);
+    glActiveTexture(GL_TEXTURE0 + VT_INDIRECTION_UNIT);
+    glBindTexture(GL_TEXTURE_2D, vt->indirection_texture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+/*
+ * The least recently seen tile gives up its slot, unless it was seen in
+ * the latest feedback, in which case the cache is too small for the view
+ * and the new tile is dropped instead.
+ */
+static int find_slot(struct virtual_texture *vt)
+{
+    int slot, best = -1;
+    unsigned best_used = vt->frame;
+
+    for (slot = 1; slot < vt->slot_count; ++slot) {
+        int tile = vt->slot_tiles[slot];
+        unsigned used;
+
+        if (tile < 0)
+            return slot;
+        used = vt->tile_used[tile];
+        if (used + 1 < best_used) {
+            best = slot;
+            best_used = used + 1;
+        }
+    }
+    return best;
+}
+
+static void place_tile(struct virtual_texture *vt, GLuint tile, GLubyte const *texels)
+{
+    int slot = find_slot(vt);
+
+    if (slot < 0) {
+        ++vt->stats.dropped;
+        return;
+    }
+    if (vt->slot_tiles[slot] >= 0) {
+        vt->tile_slots[vt->slot_tiles[slot]] = -1;
+        ++vt->stats.evicted;
+    }
+    copy_tile_to_slot(vt, slot, texels);
+    vt->slot_tiles[slot] = (int)tile;
+    vt->tile_slots[tile] = slot;
+    vt->indirection_dirty = 1;
+    ++vt->stats.uploaded;
+}
+
+/* Returns the number of loads still queued or being read. */
+static int upload_loads(struct virtual_texture *vt, int max_uploads)
+{
+    int done[VT_MAX_LOADS], done_count = 0, pending = 0, i;
+
+    lock_mutex(&vt->mutex);
+    for (i = 0; i < VT_MAX_LOADS; ++i)
+        if (vt->loads[i].state == VT_LOAD_DONE && done_count < max_uploads)
+            done[done_count++] = i;
+        else if (vt->loads[i].state != VT_LOAD_FREE)
+            ++pending;
+    unlock_mutex(&vt->mutex);
+
+    for (i = 0; i < done_count; ++i) {
+        struct vt_load *load = &vt->loads[done[i]];
+
+        place_tile(vt, load->tile, load->texels);
+        vt->tile_loading[load->tile] = 0;
+    }
+
+    lock_mutex(&vt->mutex);
+    for (i = 0; i < done_count; ++i)
+        vt->loads[done[i]].state = VT_LOAD_FREE;
+    unlock_mutex(&vt->mutex);
+    return pending;
+}
+
+/*
+ * Queues requests from the front of the list for as long as there are
+ * free loads, and returns how many are left.
+ */
+static int queue_requests(struct virtual_texture *vt, int first)
+{
+    int i, queued = 0;
+
+    lock_mutex(&vt->mutex);
+    for (i = 0; i < VT_MAX_LOADS && first < vt->request_count; ++i) {
+        struct vt_load *load = &vt->loads[i];
+        GLuint tile;
+
+        if (load->state != VT_LOAD_FREE)
+            continue;
+        tile = vt->requests[first++];
+        if (vt->tile_slots[tile] >= 0 || vt->tile_loading[tile]) {
+            --i;
+            continue;
+        }
+        load->state = VT_LOAD_QUEUED;
+        load->tile = tile;
+        load->sequence = vt->load_sequence++;
+        vt->tile_loading[tile] = 1;
+        ++vt->stats.requested;
+        ++queued;
+    }
+    if (queued > 0)
+        broadcast_condition(&vt->queued);
+    unlock_mutex(&vt->mutex);
+    return vt->request_count - first;
+}
+
+/*
+ * Every tile up the levels from one that is seen is marked too, so that
+ * the fallbacks for what is on screen are kept and loaded first.
+ */
+static void see_tile(struct virtual_texture *vt, int level, GLuint x, GLuint y)
+{
+    for (; level < vt->level_count; ++level, x /= 2, y /= 2) {
+        struct tile_file_level const *l = vt_level(vt, level);
+        GLuint tile;
+
+        if (x >= l->tiles_x) x = l->tiles_x - 1;
+        if (y >= l->tiles_y) y = l->tiles_y - 1;
+        tile = l->first_tile + y * l->tiles_x + x;
+        if (vt->tile_used[tile] == vt->frame)
+            return;
+        vt->tile_used[tile] = vt->frame;
+        if (vt->tile_slots[tile] < 0 && !vt->tile_loading[tile])
+            vt->requests[vt->request_count++] = tile;
+    }
+}
+
+/* Tiles are numbered from level 0, so the coarsest come first. */
+static int compare_requests(void const *a, void const *b)
+{
+    GLuint ta = *(GLuint const*)a, tb = *(GLuint const*)b;
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+/*
+ * Feedback pixels are BGRA: level, tile y, tile x, and 0 where there is no flag.
+ * A flush can deliver several results in one update, and see_tile skips
+ * tiles an earlier one already stamped, so requests add up until the
+ * update is over rather than starting afresh with each result.
+ */
+static void read_feedback(
+    void const *pixels, GLsizei width, GLsizei height, int frame, void *data
+) {
+    struct virtual_texture *vt = (struct virtual_texture*)data;
+    GLubyte const *pixel = (GLubyte const*)pixels;
+    GLsizei i;
+
+    for (i = 0; i < width * height; ++i, pixel += 4)
+        if (pixel[3] != 0 && pixel[0] < vt->level_count)
+            see_tile(vt, pixel[0], pixel[2], pixel[1]);
+    qsort(vt->requests, vt->request_count, sizeof(GLuint), &compare_requests);
+}
+
+/*
+ * Each entry points at its own tile's slot if that is in the cache, or
+ * else at whatever its parent's entry points at. The last level is always
+ * in the cache, so every entry ends up pointing somewhere.
+ */
+static void update_indirection(struct virtual_texture *vt)
+{
+    int level;
+
+    for (level = vt->level_count - 1; level >= 0; --level) {
+        struct tile_file_level const *l = vt_level(vt, level);
+        GLuint x, y;
+
+        for (y = 0; y < l->tiles_y; ++y)
+            for (x = 0; x < l->tiles_x; ++x) {
+                GLubyte *entry = vt->indirection
+                    + ((size_t)(vt->level_rows[level] + y) * vt->indirection_size[0] + x) * 4;
+                int slot = vt->tile_slots[l->first_tile + y * l->tiles_x + x];
+
+                if (slot >= 0) {
+                    entry[0] = (GLubyte)(slot % vt->slots_x);
+                    entry[1] = (GLubyte)(slot / vt->slots_x);
+                    entry[2] = (GLubyte)level;
+                    entry[3] = 255;
+                } else {
+                    struct tile_file_level const *parent = vt_level(vt, level + 1);
+                    GLuint
+                        px = x/2 < parent->tiles_x ? x/2 : parent->tiles_x - 1,
+                        py = y/2 < parent->tiles_y ? y/2 : parent->tiles_y - 1;
+
+                    memcpy(
+                        entry,
+                        vt->indirection
+                            + ((size_t)(vt->level_rows[level + 1] + py) * vt->indirection_size[0] + px) * 4,
+                        4
+                    );
+                }
+            }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, vt->indirection_texture);
+    glTexSubImage2D(
+        GL_TEXTURE_2D, 0, 0, 0,
+        vt->indirection_size[0], vt->indirection_size[1],
+        GL_RGBA, GL_UNSIGNED_BYTE, vt->indirection
+    );
+    vt->indirection_dirty = 0;
+}
+
+/* Clearing to zero alpha marks pixels without any of the flag. */
+static void draw_feedback(
+    struct virtual_texture *vt, struct flag_mesh const *mesh,
+    GLfloat const *p_matrix, GLfloat const *mv_matrix
+) {
+    GLsizei *size = vt->feedback_size;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, vt->feedback_target.framebuffer);
+    glViewport(0, 0, size[0], size[1]);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    glUseProgram(vt->feedback_program.program);
+    glUniformMatrix4fv(vt->feedback_program.p_matrix, 1, GL_FALSE, p_matrix);
+    glUniformMatrix4fv(vt->feedback_program.mv_matrix, 1, GL_FALSE, mv_matrix);
+    bind_virtual_texture(
+        vt, &vt->feedback_program.uniforms,
+        (GLfloat)(log((double)size[0] / (double)vt->view_size[0]) / log(2.0))
+    );
+
+    if (mesh->deformed_buffer) {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->deformed_buffer);
+        glVertexAttribPointer(
+            vt->feedback_program.position,
+            3, GL_FLOAT, GL_FALSE, sizeof(struct deformed_vertex),
+            (void*)offsetof(struct deformed_vertex, position)
+        );
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
+        glVertexAttribPointer(
+            vt->feedback_program.position,
+            3, GL_FLOAT, GL_FALSE, sizeof(struct flag_vertex),
+            (void*)offsetof(struct flag_vertex, position)
+        );
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
+    glVertexAttribPointer(
+        vt->feedback_program.texcoord,
+        2, GL_FLOAT, GL_FALSE, sizeof(struct flag_vertex),
+        (void*)offsetof(struct flag_vertex, texcoord)
+    );
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->element_buffer);
+
+    glEnableVertexAttribArray(vt->feedback_program.position);
+    glEnableVertexAttribArray(vt->feedback_program.texcoord);
+    draw_mesh(mesh);
+    glDisableVertexAttribArray(vt->feedback_program.position);
+    glDisableVertexAttribArray(vt->feedback_program.texcoord);
+}
+
+static void grow_virtual_texture(struct virtual_texture *vt, GLsizei view_width, GLsizei view_height)
+{
+    int slots = needed_slots(vt, view_width, view_height);
+
+    if (slots > vt->slot_count) {
+        delete_cache(vt);
+        if (!make_cache(vt, slots))
+            fprintf(stderr, "Unable to grow the virtual texture cache to %d tiles\n", slots);
+    }
+    if (!make_feedback_target(vt, view_width, view_height))
+        fprintf(stderr, "Unable to resize the virtual texture feedback\n");
+}
+
+void update_virtual_texture(
+    struct virtual_texture *vt, struct flag_mesh const *mesh,
+    GLfloat const *p_matrix, GLfloat const *mv_matrix,
+    GLsizei view_width, GLsizei view_height, int wait
+) {
+    int first_request = 0;
+
+    ++vt->frame;
+    if (view_width != vt->view_size[0] || view_height != vt->view_size[1])
+        grow_virtual_texture(vt, view_width, view_height);
+
+    if (!wait)
+        upload_loads(vt, VT_MAX_UPLOADS);
+    if (vt->feedback_ring.depth > 0) {
+        draw_feedback(vt, mesh, p_matrix, mv_matrix);
+        readback_push_region(
+            &vt->feedback_ring, vt->feedback_frame++,
+            vt->feedback_size[0], vt->feedback_size[1], &read_feedback, vt
+        );
+        if (wait)
+            readback_flush(&vt->feedback_ring, &read_feedback, vt);
+        first_request = vt->request_count - queue_requests(vt, 0);
+    }
+
+    while (wait) {
+        int remaining = vt->request_count - first_request, pending;
+
+        lock_mutex(&vt->mutex);
+        for (;;) {
+            int i, busy = 0;
+            for (i = 0; i < VT_MAX_LOADS; ++i)
+                if (vt->loads[i].state == VT_LOAD_DONE)
+                    break;
+                else if (vt->loads[i].state != VT_LOAD_FREE)
+                    busy = 1;
+            if (i < VT_MAX_LOADS || !busy)
+                break;
+            wait_condition(&vt->finished, &vt->mutex);
+        }
+        unlock_mutex(&vt->mutex);
+
+        pending = upload_loads(vt, VT_MAX_LOADS);
+        if (remaining > 0)
+            first_request = vt->request_count - queue_requests(vt, first_request);
+        else if (pending == 0)
+            break;
+    }
+
+    if (vt->indirection_dirty)
+        update_indirection(vt);
+    vt->request_count = 0;
+}
+
+int virtual_texture_resident(struct virtual_texture const *vt)
+{
+    int slot, resident = 0;
+
+    for (slot = 0; slot < vt->slot_count; ++slot)
+        if (vt->slot_tiles[slot] >= 0)
+            ++resident;
+    return resident;
+}
+
+size_t virtual_texture_bytes(struct virtual_texture const *vt)
+{
+    return (size_t)vt->slots_x * vt->slots_y * TILE_TEXELS * TILE_TEXELS * 4
+        + (size_t)vt->indirection_size[0] * vt->indirection_size[1] * 4;
+}
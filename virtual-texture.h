@@ -0,0 +1,131 @@
+#define VT_LOADER_THREADS   2
+#define VT_MAX_LOADS        32      /* tiles being read at once */
+#define VT_MAX_UPLOADS      8       /* tiles copied into the cache a frame */
+#define VT_FEEDBACK_DIVISOR 8
+#define VT_FEEDBACK_DEPTH   2
+
+/* texture units, after the flag program's own */
+#define VT_CACHE_UNIT       5
+#define VT_INDIRECTION_UNIT 6
+
+enum vt_load_state {
+    VT_LOAD_FREE,
+    VT_LOAD_QUEUED,
+    VT_LOAD_READING,
+    VT_LOAD_DONE
+};
+
+struct vt_load {
+    enum vt_load_state state;
+    GLuint tile;
+    unsigned sequence;
+    GLubyte *texels;
+};
+
+/*
+ * Uniform locations in a program that samples or requests virtual
+ * texture tiles: level 0's size, the level count and a level of detail
+ * bias in size; each level's size and first indirection row in levels.
+ */
+struct vt_uniforms {
+    GLint size, scale, cache, indirection;
+    GLint levels[MAX_TILE_LEVELS];
+};
+
+/*
+ * Artwork far larger than a texture can be, drawn from a cache of the
+ * tiles that are on screen. Each frame the flag is drawn at a fraction
+ * of the view's size with a program that writes out the tile each pixel
+ * would sample; that image is read back a couple of frames later, and
+ * whatever tiles it names that are not in the cache are read from the
+ * tile file by loader threads and copied into it, replacing the tiles
+ * that have gone unused for longest.
+ *
+ * The cache is one texture of TILE_TEXELS-square slots, sized from the
+ * view rather than the artwork. An indirection texture holds an entry
+ * for every tile of every level, giving the slot of that tile or of the
+ * nearest coarser one in the cache, so a tile that has not arrived yet
+ * is drawn blurred rather than not at all. The last level, a single
+ * tile, is always in the cache.
+ */
+struct virtual_texture {
+    struct tile_file tiles;
+    int level_count;
+
+    GLuint cache_texture;
+    int slots_x, slots_y, slot_count;
+    int *slot_tiles;            /* per slot, its tile or -1 */
+
+    GLuint indirection_texture;
+    GLsizei indirection_size[2];
+    GLuint level_rows[MAX_TILE_LEVELS];
+    GLubyte *indirection;       /* RGBA: slot x, slot y, level, unused */
+    int indirection_dirty;
+
+    int *tile_slots;            /* per tile, its slot or -1 */
+    unsigned *tile_used;        /* per tile, the last frame it was seen */
+    unsigned char *tile_loading;
+    unsigned frame;
+
+    struct render_target feedback_target;
+    struct readback_ring feedback_ring;
+    GLsizei view_size[2], feedback_size[2];
+    int feedback_frame;
+    struct {
+        GLuint vertex_shader, fragment_shader, program;
+        GLint p_matrix, mv_matrix, position, texcoord;
+        struct vt_uniforms uniforms;
+    } feedback_program;
+    GLuint *requests;
+    int request_count;
+
+    struct thread loaders[VT_LOADER_THREADS];
+    struct mutex mutex;
+    struct condition queued, finished;
+    struct vt_load loads[VT_MAX_LOADS];
+    unsigned load_sequence;
+    int quit;
+
+    struct {
+        int requested, uploaded, evicted, dropped;
+    } stats;
+};
+
+int virtual_texture_supported(void);
+
+/* Maps the tile file, so that read_tile_level can be used before GL is. */
+int open_virtual_texture(struct virtual_texture *out_vt, const char *filename);
+
+/*
+ * Makes the feedback program, the indirection table and a cache for a
+ * view of view_width by view_height, and starts the loaders.
+ */
+int make_virtual_texture(struct virtual_texture *vt, GLsizei view_width, GLsizei view_height);
+void delete_virtual_texture(struct virtual_texture *vt);
+
+void get_vt_uniforms(GLuint program, struct vt_uniforms *out_uniforms);
+
+/*
+ * Sets a program's uniforms and binds the cache and indirection textures
+ * to their units, leaving unit 0 active. The program must be in use.
+ */
+void bind_virtual_texture(
+    struct virtual_texture const *vt, struct vt_uniforms const *uniforms, GLfloat lod_bias
+);
+
+/*
+ * Copies tiles the loaders have finished into the cache, draws the
+ * feedback image for the view and reads back an earlier one, queueing
+ * loads for any tiles it is missing. The cache grows if the view has.
+ * With wait set, the feedback is read back at once and this returns
+ * only when every tile the view needs is in the cache, as an export
+ * wants. Leaves the feedback framebuffer bound.
+ */
+void update_virtual_texture(
+    struct virtual_texture *vt, struct flag_mesh const *mesh,
+    GLfloat const *p_matrix, GLfloat const *mv_matrix,
+    GLsizei view_width, GLsizei view_height, int wait
+);
+
+int virtual_texture_resident(struct virtual_texture const *vt);
+size_t virtual_texture_bytes(struct virtual_texture const *vt);
@@ -0,0 +1,33 @@
+#version 110
+
+/* x, y: level 0's size; z: the level count; w: a level of detail bias */
+uniform vec4 vt_size;
+/* x, y: each level's size; z: its first row of the indirection table */
+uniform vec4 vt_levels[16];
+
+varying vec2 frag_texcoord;
+
+/* must match tile-file.h */
+const float TILE_SIZE = 128.0;
+
+/*
+ * Writes the level and tile the flag program would want at this pixel,
+ * for update_virtual_texture to read back. The bias accounts for this
+ * being drawn at a fraction of the view's size.
+ */
+void main()
+{
+    vec2 texels = frag_texcoord * vt_size.xy,
+         dx = dFdx(texels), dy = dFdy(texels);
+    float level = clamp(
+        floor(0.5*log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + vt_size.w + 0.5),
+        0.0, vt_size.z - 1.0
+    );
+    vec2 level_size = vt_levels[int(level)].xy,
+         tile = min(
+             floor(clamp(frag_texcoord, 0.0, 1.0) * level_size / TILE_SIZE),
+             ceil(level_size / TILE_SIZE) - 1.0
+         );
+
+    gl_FragColor = vec4(tile, level, 255.0) / 255.0;
+}
@@ -0,0 +1,14 @@
+#version 110
+
+uniform mat4 p_matrix, mv_matrix;
+
+attribute vec3 position;
+attribute vec2 texcoord;
+
+varying vec2 frag_texcoord;
+
+void main()
+{
+    gl_Position = p_matrix * mv_matrix * vec4(position, 1.0);
+    frag_texcoord = texcoord;
+}
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <GL/glew.h>
+#include <stddef.h>
+#include <math.h>
+#include "thread-util.h"
+#include "job-pool.h"
+#include "memory.h"
+#include "gpu-resources.h"
+#include "wind-field.h"
+#include "gl-capture.h"
+
+#define WIND_FIELD_OCTAVES  3
+#define WIND_FIELD_CELLS    2       /* of the coarsest octave, per period */
+#define WIND_FIELD_GAIN     2.0f
+
+#define TEXEL_MASK          (WIND_FIELD_SIZE - 1)
+
+/*
+ * Shifts texel coordinates by whole periods, less the half texel to the
+ * first texel center, so that truncating them floors them for positions
+ * up to that many periods below the origin.
+ */
+#define TEXEL_BIAS          (64.0f*WIND_FIELD_SIZE - 0.5f)
+
+/* A hash of a lattice point to a value from -1 to 1. */
+static GLfloat lattice_value(unsigned x, unsigned y, unsigned z, unsigned seed)
+{
+    unsigned h = x*0x8da6b343u ^ y*0xd8163841u ^ z*0xcb1ab31fu ^ seed*0x9e3779b9u;
+
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return (GLfloat)(h & 0xffffu) * (2.0f/65535.0f) - 1.0f;
+}
+
+static GLfloat fade(GLfloat t)
+{
+    return t*t*t*(t*(t*6.0f - 15.0f) + 10.0f);
+}
+
+static GLfloat lerp(GLfloat a, GLfloat b, GLfloat t)
+{
+    return a + (b - a)*t;
+}
+
+/*
+ * Value noise on a lattice of cells on a side, which wraps around at
+ * the edges of the volume, so that the sum of octaves tiles too.
+ */
+static GLfloat periodic_noise(int x, int y, int z, unsigned cells, unsigned seed)
+{
+    GLfloat
+        scale = (GLfloat)cells / (GLfloat)WIND_FIELD_SIZE,
+        u = ((GLfloat)x + 0.5f)*scale,
+        v = ((GLfloat)y + 0.5f)*scale,
+        w = ((GLfloat)z + 0.5f)*scale,
+        fu, fv, fw;
+    unsigned
+        x0 = (unsigned)u, y0 = (unsigned)v, z0 = (unsigned)w,
+        x1 = (x0 + 1) % cells, y1 = (y0 + 1) % cells, z1 = (z0 + 1) % cells;
+
+    fu = fade(u - (GLfloat)x0);
+    fv = fade(v - (GLfloat)y0);
+    fw = fade(w - (GLfloat)z0);
+    return lerp(
+        lerp(
+            lerp(lattice_value(x0, y0, z0, seed), lattice_value(x1, y0, z0, seed), fu),
+            lerp(lattice_value(x0, y1, z0, seed), lattice_value(x1, y1, z0, seed), fu),
+            fv
+        ),
+        lerp(
+            lerp(lattice_value(x0, y0, z1, seed), lattice_value(x1, y0, z1, seed), fu),
+            lerp(lattice_value(x0, y1, z1, seed), lattice_value(x1, y1, z1, seed), fu),
+            fv
+        ),
+        fw
+    );
+}
+
+static GLubyte encode_gust(GLfloat gust)
+{
+    GLfloat clamped = gust < -1.0f ? -1.0f : gust > 1.0f ? 1.0f : gust;
+    return (GLubyte)((clamped + 1.0f)*127.5f + 0.5f);
+}
+
+static void slice_job(int job, int worker, void *data)
+{
+    struct wind_field *field = (struct wind_field*)data;
+    GLubyte *texel = field->texels + (size_t)job * WIND_FIELD_SIZE * WIND_FIELD_SIZE * 4;
+    int x, y, axis, octave;
+
+    for (y = 0; y < WIND_FIELD_SIZE; ++y)
+        for (x = 0; x < WIND_FIELD_SIZE; ++x, texel += 4) {
+            for (axis = 0; axis < 3; ++axis) {
+                GLfloat sum = 0.0f, amplitude = 1.0f, total = 0.0f;
+                unsigned cells = WIND_FIELD_CELLS;
+
+                for (octave = 0; octave < WIND_FIELD_OCTAVES; ++octave) {
+                    sum += amplitude * periodic_noise(x, y, job, cells, octave*3 + axis);
+                    total += amplitude;
+                    amplitude *= 0.5f;
+                    cells *= 2;
+                }
+                texel[axis] = encode_gust(sum * (WIND_FIELD_GAIN/total));
+            }
+            texel[3] = 255;
+        }
+}
+
+int make_wind_field(
+    struct wind_field *out_field, struct job_pool *pool,
+    GLfloat const *drift, GLfloat strength
+) {
+    out_field->texels = (GLubyte*) memory_alloc(
+        (size_t)WIND_FIELD_SIZE * WIND_FIELD_SIZE * WIND_FIELD_SIZE * 4, MEMORY_CLOTH
+    );
+    if (!out_field->texels)
+        return 0;
+    out_field->drift[0] = drift[0];
+    out_field->drift[1] = drift[1];
+    out_field->drift[2] = drift[2];
+    out_field->strength = strength;
+    out_field->texture = 0;
+
+    run_jobs(pool, WIND_FIELD_SIZE, &slice_job, out_field);
+    return 1;
+}
+
+void make_wind_texture(struct wind_field *field)
+{
+    glGenTextures(1, &field->texture);
+    glBindTexture(GL_TEXTURE_3D, field->texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+    glTexImage3D(
+        GL_TEXTURE_3D, 0, GL_RGBA8,
+        WIND_FIELD_SIZE, WIND_FIELD_SIZE, WIND_FIELD_SIZE, 0,
+        GL_RGBA, GL_UNSIGNED_BYTE, field->texels
+    );
+    glBindTexture(GL_TEXTURE_3D, 0);
+    track_gpu_resource(
+        GPU_TEXTURE, field->texture,
+        (size_t)WIND_FIELD_SIZE * WIND_FIELD_SIZE * WIND_FIELD_SIZE * 4, "wind field"
+    );
+}
+
+void delete_wind_field(struct wind_field *field)
+{
+    if (field->texture) {
+        untrack_gpu_resource(GPU_TEXTURE, field->texture);
+        glDeleteTextures(1, &field->texture);
+        field->texture = 0;
+    }
+    memory_free(field->texels);
+    field->texels = NULL;
+}
+
+void wind_field_offset(struct wind_field const *field, double time, GLfloat *out_offset)
+{
+    int axis;
+
+    for (axis = 0; axis < 3; ++axis) {
+        double offset = fmod(-(double)field->drift[axis] * time, (double)WIND_FIELD_PERIOD);
+        out_offset[axis] = (GLfloat)(offset < 0.0 ? offset + WIND_FIELD_PERIOD : offset);
+    }
+}
+
+/*
+ * GL_LINEAR puts texel centers at half-texel coordinates, so a position
+ * lies between the texels on either side of it less half a texel.
+ */
+void sample_wind_field(
+    struct wind_field const *field, GLfloat const *offset,
+    GLfloat const *position, GLfloat *out_gust
+) {
+    GLfloat const texel_scale = (GLfloat)WIND_FIELD_SIZE / WIND_FIELD_PERIOD;
+    GLfloat
+        u = (position[0] + offset[0])*texel_scale + TEXEL_BIAS,
+        v = (position[1] + offset[1])*texel_scale + TEXEL_BIAS,
+        w = (position[2] + offset[2])*texel_scale + TEXEL_BIAS;
+    int iu = (int)u, iv = (int)v, iw = (int)w;
+    GLfloat fu = u - (GLfloat)iu, fv = v - (GLfloat)iv, fw = w - (GLfloat)iw;
+    int
+        x0 = iu & TEXEL_MASK, x1 = (x0 + 1) & TEXEL_MASK,
+        y0 = (iv & TEXEL_MASK) * WIND_FIELD_SIZE,
+        y1 = (y0 + WIND_FIELD_SIZE) & (TEXEL_MASK * WIND_FIELD_SIZE),
+        z0 = (iw & TEXEL_MASK) * WIND_FIELD_SIZE * WIND_FIELD_SIZE,
+        z1 = (z0 + WIND_FIELD_SIZE * WIND_FIELD_SIZE) & (TEXEL_MASK * WIND_FIELD_SIZE * WIND_FIELD_SIZE),
+        axis;
+    GLubyte const
+        *t000 = field->texels + 4*(z0 + y0 + x0), *t001 = field->texels + 4*(z0 + y0 + x1),
+        *t010 = field->texels + 4*(z0 + y1 + x0), *t011 = field->texels + 4*(z0 + y1 + x1),
+        *t100 = field->texels + 4*(z1 + y0 + x0), *t101 = field->texels + 4*(z1 + y0 + x1),
+        *t110 = field->texels + 4*(z1 + y1 + x0), *t111 = field->texels + 4*(z1 + y1 + x1);
+
+    for (axis = 0; axis < 3; ++axis) {
+        GLfloat
+            c00 = lerp((GLfloat)t000[axis], (GLfloat)t001[axis], fu),
+            c01 = lerp((GLfloat)t010[axis], (GLfloat)t011[axis], fu),
+            c10 = lerp((GLfloat)t100[axis], (GLfloat)t101[axis], fu),
+            c11 = lerp((GLfloat)t110[axis], (GLfloat)t111[axis], fu);
+        out_gust[axis] = lerp(lerp(c00, c01, fv), lerp(c10, c11, fv), fw) * (2.0f/255.0f) - 1.0f;
+    }
+}
@@ -0,0 +1,51 @@
+#define WIND_FIELD_SIZE     32
+#define WIND_FIELD_PERIOD   8.0f
+
+/*
+ * Turbulence for the steady wind to carry along: a volume of gusts,
+ * WIND_FIELD_SIZE texels on a side, that tiles every WIND_FIELD_PERIOD
+ * units of world space and drifts through the world at a fixed velocity.
+ * Every point of every flag reads its own gust from where it stands, so
+ * flags close together move alike and flags far apart do not, at one
+ * sample a vertex however many flags there are.
+ *
+ * Texels are RGBA8, holding the gust's x, y and z mapped from -1..1 to
+ * 0..255. The GL texture and the CPU sampler read the same texels, so
+ * the cloth and the crowd feel the same wind.
+ */
+struct wind_field {
+    GLubyte *texels;
+    GLfloat drift[3];
+    GLfloat strength;   /* gust speed as a fraction of the steady wind's */
+    GLuint texture;
+};
+
+/* Generates the volume on the pool, a slice of it to a job. */
+int make_wind_field(
+    struct wind_field *out_field, struct job_pool *pool,
+    GLfloat const *drift, GLfloat strength
+);
+
+/*
+ * A GL_TEXTURE_3D of the texels, repeating and linearly filtered, for
+ * shaders to sample. Only the GPU animation needs it.
+ */
+void make_wind_texture(struct wind_field *field);
+void delete_wind_field(struct wind_field *field);
+
+/*
+ * Where the volume has drifted to at time: a point's gust is found at
+ * its position plus the offset, each axis of which is kept between 0 and
+ * WIND_FIELD_PERIOD so that it stays precise however long the program
+ * runs.
+ */
+void wind_field_offset(struct wind_field const *field, double time, GLfloat *out_offset);
+
+/*
+ * Samples the gust at a position, filtered and wrapped the way the GL
+ * texture is, into -1..1 on each axis.
+ */
+void sample_wind_field(
+    struct wind_field const *field, GLfloat const *offset,
+    GLfloat const *position, GLfloat *out_gust
+);